@@ -0,0 +1,286 @@
+//
+// This code is public domain. Do whatever you want with it.
+//
+// This test program replays the responses of an IMAP server to a
+// CWIMAPStore instance one byte per read, to verify that responses
+// split anywhere, and literals in particular, are parsed like they
+// are when they come in one read. The store logs in, selects INBOX
+// and prefetches its two messages. The headers of both messages are
+// literals ending with their own line, the first one followed by ")"
+// alone and the second one by the rest of its FETCH response.
+//
+// It exits with 0 if the messages were parsed as expected, with 1
+// otherwise.
+//
+
+#import <Foundation/Foundation.h>
+
+#import <Pantomime/Pantomime.h>
+
+#define HEADER_FIELDS "BODY[HEADER.FIELDS (From To Cc Subject Date Message-ID References In-Reply-To)]"
+
+#define FIRST_HEADERS  "Subject: First\r\nFrom: alice@example.com\r\n\r\n"
+#define SECOND_HEADERS "Subject: Second\r\nFrom: bob@example.com\r\n\r\n"
+
+
+//
+// The responses of our server, keyed by the command they answer. "%@"
+// is replaced by the tag of the command.
+//
+static NSDictionary *responses(void)
+{
+  return [NSDictionary dictionaryWithObjectsAndKeys:
+			 @"* CAPABILITY IMAP4rev1\r\n%@ OK CAPABILITY completed\r\n", @"CAPABILITY",
+		       @"%@ OK LOGIN completed\r\n", @"LOGIN",
+		       @"* 2 EXISTS\r\n* 0 RECENT\r\n* OK [UIDVALIDITY 7] UIDs valid\r\n%@ OK [READ-WRITE] SELECT completed\r\n", @"SELECT",
+		       [NSString stringWithFormat: @"* 1 FETCH (UID 5 FLAGS (\\Seen) RFC822.SIZE 120 %s {%lu}\r\n%s)\r\n"
+				 @"* 2 FETCH (FLAGS () %s {%lu}\r\n%s UID 6 RFC822.SIZE 80)\r\n"
+				 @"%%@ OK FETCH completed\r\n",
+				 HEADER_FIELDS, (unsigned long)strlen(FIRST_HEADERS), FIRST_HEADERS,
+				 HEADER_FIELDS, (unsigned long)strlen(SECOND_HEADERS), SECOND_HEADERS], @"UID FETCH",
+		       nil];
+}
+
+
+//
+// A connection that answers the commands written to it with the responses
+// above and hands them out one byte at a time, only when it is told to.
+//
+@interface ReplayConnection : NSObject <CWConnection>
+{
+  @private
+    id<CWConnectionDelegate> _delegate;
+    NSMutableData *_input;
+    NSMutableData *_output;
+    NSUInteger _position;
+    NSUInteger _budget;
+}
+- (void) allowByte;
+- (BOOL) hasPendingBytes;
+@end
+
+@implementation ReplayConnection
+
+- (id) initWithName: (NSString *) theName
+               port: (unsigned short) thePort
+           delegate: (id<CWConnectionDelegate>) theDelegate
+         background: (BOOL) theBOOL
+{
+  return [self initWithName: theName  port: thePort  delegate: theDelegate  connectionTimeout: 60  readTimeout: 60  writeTimeout: 60  background: theBOOL];
+}
+
+- (id) initWithName: (NSString *) theName
+               port: (unsigned short) thePort
+           delegate: (id<CWConnectionDelegate>) theDelegate
+  connectionTimeout: (NSUInteger) theConnectionTimeout
+        readTimeout: (NSUInteger) theReadTimeout
+       writeTimeout: (NSUInteger) theWriteTimeout
+         background: (BOOL) theBOOL
+{
+  self = [super init];
+  if (self)
+    {
+      _delegate = theDelegate;
+      _input = [[NSMutableData alloc] initWithBytes: "* OK IMAP4rev1 ready\r\n"  length: 22];
+      _output = [[NSMutableData alloc] init];
+      _position = _budget = 0;
+    }
+  return self;
+}
+
+- (BOOL) isConnected
+{
+  return YES;
+}
+
+- (void) close
+{
+}
+
+- (void) allowByte
+{
+  _budget++;
+}
+
+- (BOOL) hasPendingBytes
+{
+  return (_position < [_input length]);
+}
+
+- (NSInteger) read: (uint8_t *) buf  length: (NSInteger) len
+{
+  if (!_budget || len < 1 || _position >= [_input length])
+    {
+      return 0;
+    }
+
+  _budget--;
+  buf[0] = ((const uint8_t *)[_input bytes])[_position++];
+
+  return 1;
+}
+
+//
+// Each complete command line gets its response, the ones we don't
+// know about are simply completed.
+//
+- (NSInteger) write: (uint8_t *) buf  length: (NSInteger) len
+{
+  NSString *aLine, *aResponse, *aKey;
+  NSArray *allWords;
+  const char *bytes, *p;
+  NSUInteger n;
+
+  [_output appendBytes: buf  length: len];
+
+  while ((bytes = [_output bytes]) && (p = memchr(bytes, '\n', [_output length])))
+    {
+      n = p - bytes + 1;
+      aLine = [[NSString alloc] initWithBytes: bytes  length: n  encoding: NSASCIIStringEncoding];
+      [_output replaceBytesInRange: NSMakeRange(0, n)  withBytes: NULL  length: 0];
+
+      allWords = [[aLine stringByTrimmingCharactersInSet: [NSCharacterSet whitespaceAndNewlineCharacterSet]] componentsSeparatedByString: @" "];
+
+      if ([allWords count] < 2)
+	{
+	  continue;
+	}
+
+      aKey = [allWords objectAtIndex: 1];
+
+      if ([aKey isEqualToString: @"UID"] && [allWords count] > 2)
+	{
+	  aKey = [NSString stringWithFormat: @"UID %@", [allWords objectAtIndex: 2]];
+	}
+
+      aResponse = [responses() objectForKey: aKey];
+
+      if (!aResponse)
+	{
+	  aResponse = @"%@ OK completed\r\n";
+	}
+
+      [_input appendData: [[NSString stringWithFormat: aResponse, [allWords objectAtIndex: 0]] dataUsingEncoding: NSASCIIStringEncoding]];
+    }
+
+  return len;
+}
+
+- (id<CWConnectionDelegate>) delegate
+{
+  return _delegate;
+}
+
+- (void) setDelegate: (id<CWConnectionDelegate>) theDelegate
+{
+  _delegate = theDelegate;
+}
+
+@end
+
+
+//
+// Our class interface.
+//
+@interface IMAPByteReplay : NSObject
+{
+  @private
+    CWIMAPStore *_store;
+    BOOL _done;
+}
+- (int) run;
+@end
+
+
+//
+// Our class implementation.
+//
+@implementation IMAPByteReplay
+
+- (int) run
+{
+  ReplayConnection *aConnection;
+  CWIMAPFolder *aFolder;
+  CWMessage *aMessage;
+  NSUInteger reads;
+
+  _store = [[CWIMAPStore alloc] initWithName: @"localhost"  port: 143];
+  [_store setConnectionClass: [ReplayConnection class]];
+  [_store setDelegate: self];
+  [_store connect];
+
+  aConnection = (ReplayConnection *)[_store connection];
+  [_store connectionReceivedOpenCompleted: aConnection];
+
+  // Each read event gets a single byte.
+  for (reads = 0; !_done && [aConnection hasPendingBytes]; reads++)
+    {
+      [aConnection allowByte];
+      [_store updateRead];
+    }
+
+  NSLog(@"%lu reads", (unsigned long)reads);
+
+  aFolder = (CWIMAPFolder *)[_store folderForName: @"INBOX"  select: NO];
+
+  if (!_done || [aFolder count] != 2)
+    {
+      NSLog(@"FAILED: the prefetch didn't complete with 2 messages.");
+      return 1;
+    }
+
+  aMessage = [[aFolder allMessages] objectAtIndex: 0];
+
+  if ([(CWIMAPMessage *)aMessage uid] != 5 || ![[aMessage subject] isEqualToString: @"First"] ||
+      ![[aMessage flags] contain: PantomimeSeen] || [aMessage size] != 120)
+    {
+      NSLog(@"FAILED: the first message is wrong (UID %lu, subject %@).", (unsigned long)[(CWIMAPMessage *)aMessage uid], [aMessage subject]);
+      return 1;
+    }
+
+  aMessage = [[aFolder allMessages] objectAtIndex: 1];
+
+  if ([(CWIMAPMessage *)aMessage uid] != 6 || ![[aMessage subject] isEqualToString: @"Second"] ||
+      [[aMessage flags] contain: PantomimeSeen] || [aMessage size] != 80)
+    {
+      NSLog(@"FAILED: the second message is wrong (UID %lu, subject %@).", (unsigned long)[(CWIMAPMessage *)aMessage uid], [aMessage subject]);
+      return 1;
+    }
+
+  NSLog(@"OK");
+  return 0;
+}
+
+- (void) serviceInitialized: (NSNotification *) theNotification
+{
+  [_store authenticate: @"user"  password: @"secret"  mechanism: nil];
+}
+
+- (void) authenticationCompleted: (NSNotification *) theNotification
+{
+  [_store folderForName: @"INBOX"];
+}
+
+- (void) folderOpenCompleted: (NSNotification *) theNotification
+{
+  [[[theNotification userInfo] objectForKey: @"Folder"] prefetch];
+}
+
+- (void) folderPrefetchCompleted: (NSNotification *) theNotification
+{
+  _done = YES;
+}
+
+@end
+
+
+//
+// Main entry point for the test program.
+//
+int main(int argc, const char *argv[], char *env[])
+{
+  @autoreleasepool
+    {
+      return [[[IMAPByteReplay alloc] init] run];
+    }
+}
@@ -0,0 +1,211 @@
+//
+// This code is public domain. Do whatever you want with it.
+//
+// This test program measures how long finding messages from their
+// UID takes in a large IMAP folder:
+//
+// a) for the cache, CWIMAPUIDIndex against the dictionary keyed by
+//    formatted UIDs that CWIMAPCacheManager used before, when the
+//    cache is loaded, looked up and expunged;
+//
+// b) for the folder, -indexOfMessageWithUID: of CWIMAPFolder against
+//    going through -allMessages, with all UIDs known and with the
+//    oldest half of the messages not prefetched yet.
+//
+// Usage: IMAPUIDBenchmark [number of messages]
+//
+
+#import <Foundation/Foundation.h>
+
+#import <Pantomime/Pantomime.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define DEFAULT_COUNT 300000
+#define FOLDER_LOOKUPS 1000
+
+
+//
+// This C function is used to obtain a monotonic time, in seconds.
+//
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+//
+// UIDs have gaps, like in a folder where messages were expunged.
+//
+static NSUInteger uid_at(NSUInteger theIndex)
+{
+  return 1 + theIndex*3;
+}
+
+
+//
+//
+//
+static void benchmark_cache(NSArray *allMessages)
+{
+  NSMutableDictionary *aDictionary;
+  CWIMAPUIDIndex *anIndex;
+  NSUInteger i, count, found;
+  double t, dictionary[3], index[3];
+
+  count = [allMessages count];
+
+  @autoreleasepool
+    {
+      t = now();
+      aDictionary = [[NSMutableDictionary alloc] initWithCapacity: count];
+
+      for (i = 0; i < count; i++)
+	{
+	  [aDictionary setObject: [allMessages objectAtIndex: i]  forKey: [NSString stringWithFormat: @"%lu", (unsigned long)uid_at(i)]];
+	}
+      dictionary[0] = now() - t;
+
+      t = now();
+      for (i = found = 0; i < count; i++)
+	{
+	  found += ([aDictionary objectForKey: [NSString stringWithFormat: @"%lu", (unsigned long)uid_at(i)]] != nil);
+	}
+      dictionary[1] = now() - t;
+
+      t = now();
+      for (i = 0; i < count; i += 2)
+	{
+	  [aDictionary removeObjectForKey: [NSString stringWithFormat: @"%lu", (unsigned long)uid_at(i)]];
+	}
+      dictionary[2] = now() - t;
+    }
+
+  @autoreleasepool
+    {
+      t = now();
+      anIndex = [[CWIMAPUIDIndex alloc] initWithCapacity: count];
+
+      for (i = 0; i < count; i++)
+	{
+	  [anIndex setObject: [allMessages objectAtIndex: i]  forUID: uid_at(i)];
+	}
+      index[0] = now() - t;
+
+      t = now();
+      for (i = found = 0; i < count; i++)
+	{
+	  found += ([anIndex objectForUID: uid_at(i)] != nil);
+	}
+      index[1] = now() - t;
+
+      t = now();
+      for (i = 0; i < count; i += 2)
+	{
+	  [anIndex removeObjectForUID: uid_at(i)];
+	}
+      index[2] = now() - t;
+    }
+
+  printf("Cache, %lu messages        NSDictionary  CWIMAPUIDIndex  speedup\n", (unsigned long)count);
+  printf("  load                      %9.3f s     %9.3f s   %6.1fx\n", dictionary[0], index[0], dictionary[0]/index[0]);
+  printf("  lookup of every UID       %9.3f s     %9.3f s   %6.1fx\n", dictionary[1], index[1], dictionary[1]/index[1]);
+  printf("  expunge of half of them   %9.3f s     %9.3f s   %6.1fx\n", dictionary[2], index[2], dictionary[2]/index[2]);
+}
+
+
+//
+//
+//
+static void benchmark_folder(CWIMAPFolder *theFolder, const char *theTitle)
+{
+  NSArray *allMessages;
+  NSUInteger i, j, n, count, uid, found;
+  double t, scan, bisection;
+
+  allMessages = [theFolder allMessages];
+  count = [allMessages count];
+
+  // We look for the newest messages, which are known in both cases.
+  t = now();
+  for (i = found = 0; i < FOLDER_LOOKUPS; i++)
+    {
+      uid = uid_at(count - 1 - (i * 7919) % (count/2));
+      n = [allMessages count];
+
+      for (j = 0; j < n; j++)
+	{
+	  if ([(CWIMAPMessage *)[allMessages objectAtIndex: j] uid] == uid)
+	    {
+	      found++;
+	      break;
+	    }
+	}
+    }
+  scan = now() - t;
+
+  t = now();
+  for (i = found = 0; i < FOLDER_LOOKUPS; i++)
+    {
+      uid = uid_at(count - 1 - (i * 7919) % (count/2));
+      found += ([theFolder indexOfMessageWithUID: uid] != NSNotFound);
+    }
+  bisection = now() - t;
+
+  printf("Folder, %s: %d lookups\n", theTitle, FOLDER_LOOKUPS);
+  printf("  scan %.3f s, -indexOfMessageWithUID: %.3f s, %.1fx (%lu found)\n", scan, bisection, scan/bisection, (unsigned long)found);
+}
+
+
+//
+// Main entry point for the test program.
+//
+int main(int argc, const char *argv[], char *env[])
+{
+  @autoreleasepool
+    {
+      NSMutableArray *allMessages;
+      CWIMAPFolder *aFolder;
+      CWIMAPMessage *aMessage;
+      NSUInteger i, count;
+
+      count = (argc > 1 ? (NSUInteger)strtoul(argv[1], NULL, 10) : DEFAULT_COUNT);
+
+      if (count < 2)
+	{
+	  fprintf(stderr, "Usage: %s [number of messages]\n", argv[0]);
+	  return 1;
+	}
+
+      allMessages = [NSMutableArray arrayWithCapacity: count];
+      aFolder = [[CWIMAPFolder alloc] initWithName: @"INBOX"];
+
+      for (i = 0; i < count; i++)
+	{
+	  aMessage = [[CWIMAPMessage alloc] init];
+	  [aMessage setUid: uid_at(i)];
+	  [aMessage setMessageNumber: i+1];
+	  [allMessages addObject: aMessage];
+	  [aFolder appendMessage: aMessage];
+	}
+
+      benchmark_cache(allMessages);
+      benchmark_folder(aFolder, "all UIDs known");
+
+      // Like while the newest messages are prefetched first.
+      for (i = 0; i < count/2; i++)
+	{
+	  [[allMessages objectAtIndex: i] setUid: 0];
+	}
+
+      benchmark_folder(aFolder, "oldest half not prefetched");
+    }
+
+  return 0;
+}
@@ -0,0 +1,125 @@
+/*
+**  CWCacheWriter.h
+**
+**  Copyright (c) 2001-2007
+**
+**  This library is free software; you can redistribute it and/or
+**  modify it under the terms of the GNU Lesser General Public
+**  License as published by the Free Software Foundation; either
+**  version 2.1 of the License, or (at your option) any later version.
+**
+**  This library is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+**  Lesser General Public License for more details.
+**
+**  You should have received a copy of the GNU Lesser General Public
+**  License along with this library; if not, write to the Free Software
+**  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef _Pantomime_H_CWCacheWriter
+#define _Pantomime_H_CWCacheWriter
+
+#import <Foundation/Foundation.h>
+
+/*!
+  @const CWCacheWriterBatchSize
+  @discussion The number of bytes a CWCacheWriter holds before
+              -isFull returns YES.
+*/
+#define CWCacheWriterBatchSize 65536
+
+/*!
+  @class CWCacheWriter
+  @discussion This class is used by the cache managers to append records
+              to their files. The records are serialized in memory, in
+	      network byte-order like the io.c functions write them,
+	      and written with a single call when the receiver is flushed.
+
+	      Nothing is written until -flush is invoked: the cache manager
+	      decides when a batch ends, usually when the receiver is full
+	      or when the cache is synchronized.
+*/
+@interface CWCacheWriter : NSObject
+
+/*!
+  @method initWithFileDescriptor: offset:
+  @discussion This method is used to initialize a writer appending
+              to the file <i>fd</i>, starting at <i>theOffset</i>.
+  @param fd The file descriptor, which isn't closed by the receiver.
+  @param theOffset The offset in the file of the first byte appended.
+  @result The instance.
+*/
+- (id) initWithFileDescriptor: (int) fd  offset: (unsigned long long) theOffset;
+
+/*!
+  @method offset
+  @discussion This method is used to obtain the offset in the file
+              where the bytes held by the receiver will be written.
+  @result The offset, which is the end of what was flushed.
+*/
+- (unsigned long long) offset;
+
+/*!
+  @method length
+  @discussion This method is used to obtain the number of bytes the
+              receiver holds.
+  @result The number of bytes not yet written.
+*/
+- (NSUInteger) length;
+
+/*!
+  @method isFull
+  @discussion This method is used to verify if the receiver holds at
+              least CWCacheWriterBatchSize bytes.
+  @result YES if it does, NO otherwise.
+*/
+- (BOOL) isFull;
+
+/*!
+  @method appendBytes: length:
+  @discussion This method is used to append <i>theLength</i> bytes.
+  @param theBytes The bytes.
+  @param theLength The number of bytes.
+*/
+- (void) appendBytes: (const void *) theBytes  length: (NSUInteger) theLength;
+
+/*!
+  @method appendUnsignedShort:
+  @discussion This method is used to append <i>theValue</i> in
+              network byte-order, like write_unsigned_short() does.
+  @param theValue The value.
+*/
+- (void) appendUnsignedShort: (unsigned short) theValue;
+
+/*!
+  @method appendUnsignedInt:
+  @discussion This method is used to append <i>theValue</i> in
+              network byte-order, like write_unsigned_int() does.
+  @param theValue The value.
+*/
+- (void) appendUnsignedInt: (unsigned int) theValue;
+
+/*!
+  @method appendString: length:
+  @discussion This method is used to append <i>theLength</i> bytes
+              preceded by their length, like write_string() does.
+  @param theBytes The bytes, which can be NULL if <i>theLength</i> is 0.
+  @param theLength The number of bytes, at most 65535.
+*/
+- (void) appendString: (const void *) theBytes  length: (unsigned short) theLength;
+
+/*!
+  @method flush
+  @discussion This method is used to write the bytes held by the
+              receiver at its offset in the file, which then moves
+	      past them. On failure, the bytes are kept and the file
+	      might hold part of them.
+  @result YES on success, NO otherwise.
+*/
+- (BOOL) flush;
+
+@end
+
+#endif // _Pantomime_H_CWCacheWriter
@@ -0,0 +1,160 @@
+/*
+**  CWCacheWriter.m
+**
+**  Copyright (c) 2001-2007
+**
+**  This library is free software; you can redistribute it and/or
+**  modify it under the terms of the GNU Lesser General Public
+**  License as published by the Free Software Foundation; either
+**  version 2.1 of the License, or (at your option) any later version.
+**
+**  This library is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+**  Lesser General Public License for more details.
+**
+**  You should have received a copy of the GNU Lesser General Public
+**  License along with this library; if not, write to the Free Software
+**  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#import "CWCacheWriter.h"
+
+#include "io.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+@implementation CWCacheWriter
+{
+  NSMutableData *_buffer;
+  unsigned long long _offset;
+  int _fd;
+}
+
+//
+//
+//
+- (id) initWithFileDescriptor: (int) fd  offset: (unsigned long long) theOffset
+{
+  self = [super init];
+  if (self)
+    {
+      _buffer = [[NSMutableData alloc] initWithCapacity: CWCacheWriterBatchSize];
+      _offset = theOffset;
+      _fd = fd;
+    }
+  return self;
+}
+
+
+//
+//
+//
+- (unsigned long long) offset
+{
+  return _offset;
+}
+
+
+//
+//
+//
+- (NSUInteger) length
+{
+  return [_buffer length];
+}
+
+
+//
+//
+//
+- (BOOL) isFull
+{
+  return ([_buffer length] >= CWCacheWriterBatchSize);
+}
+
+
+//
+//
+//
+- (void) appendBytes: (const void *) theBytes  length: (NSUInteger) theLength
+{
+  if (theLength)
+    {
+      [_buffer appendBytes: theBytes  length: theLength];
+    }
+}
+
+
+//
+//
+//
+- (void) appendUnsignedShort: (unsigned short) theValue
+{
+  unsigned char buf[2];
+
+  write_unsigned_short_memory(buf, theValue);
+  [_buffer appendBytes: buf  length: 2];
+}
+
+
+//
+//
+//
+- (void) appendUnsignedInt: (unsigned int) theValue
+{
+  unsigned char buf[4];
+
+  write_unsigned_int_memory(buf, theValue);
+  [_buffer appendBytes: buf  length: 4];
+}
+
+
+//
+//
+//
+- (void) appendString: (const void *) theBytes  length: (unsigned short) theLength
+{
+  [self appendUnsignedShort: (theBytes ? theLength : 0)];
+
+  if (theBytes)
+    {
+      [self appendBytes: theBytes  length: theLength];
+    }
+}
+
+
+//
+// We use pwrite() so that the file offset of the descriptor,
+// which the cache manager might rely on, is left alone.
+//
+- (BOOL) flush
+{
+  const unsigned char *bytes;
+  NSUInteger len, tot;
+  ssize_t n;
+
+  bytes = [_buffer bytes];
+  len = [_buffer length];
+
+  for (tot = 0; tot < len; tot += n)
+    {
+      if ((n = pwrite(_fd, bytes+tot, len-tot, (off_t)(_offset+tot))) < 0)
+	{
+	  if (errno != EINTR)
+	    {
+	      return NO;
+	    }
+
+	  n = 0;
+	}
+    }
+
+  _offset += len;
+  [_buffer setLength: 0];
+
+  return YES;
+}
+
+@end
@@ -22,6 +22,8 @@
 
 #import <Foundation/Foundation.h>
 
+#include <sys/uio.h>
+
 @protocol CWConnectionDelegate; 
 
 /*!
@@ -112,6 +114,19 @@
 - (NSInteger) write:(uint8_t*)buf length:(NSInteger)len;
 
 @optional
+/*!
+  @method writeVector: count:
+  @discussion This method is used to write the bytes described by the
+              <i>count</i> entries of <i>iov</i> to the socket, in order,
+	      with as few system calls as possible (ideally a single
+	      writev(2)). Like -write:length:, it might write less than
+	      what was asked for.
+  @param iov The bytes that we want to write to the socket.
+  @param count The number of entries in <i>iov</i>.
+  @result The number of bytes successfully written.
+*/
+- (NSInteger) writeVector:(const struct iovec*)iov count:(NSInteger)count;
+
 - (id<CWConnectionDelegate>)delegate;
 - (void)setDelegate:(id<CWConnectionDelegate>)inDelegate;
 
@@ -325,3 +325,76 @@ typedef NS_ENUM(NSInteger, PantomimeRecipientType)
   PantomimeResentBccRecipient = 6
 };
 
+
+
+/*!
+  @typedef PantomimeCachedHeader
+  @abstract Headers kept in the cache of a folder.
+  @discussion This enum lists the headers a cache manager stores
+              for each message. A message read from a cache decodes
+	      them only when they are first accessed, the values of
+	      this enum are combined to tell which ones are still
+	      pending. See CWMessage: -setCachedHeaders:.
+  @constant PantomimeCachedFrom The "From:" header.
+  @constant PantomimeCachedInReplyTo The "In-Reply-To:" header.
+  @constant PantomimeCachedMessageID The "Message-ID:" header.
+  @constant PantomimeCachedReferences The "References:" header.
+  @constant PantomimeCachedSubject The "Subject:" header.
+  @constant PantomimeCachedTo The "To:" header.
+  @constant PantomimeCachedCc The "Cc:" header.
+  @constant PantomimeCachedAllHeaders All the headers above.
+*/
+typedef NS_ENUM(NSUInteger, PantomimeCachedHeader)
+{
+  PantomimeCachedFrom = 1,
+  PantomimeCachedInReplyTo = 2,
+  PantomimeCachedMessageID = 4,
+  PantomimeCachedReferences = 8,
+  PantomimeCachedSubject = 16,
+  PantomimeCachedTo = 32,
+  PantomimeCachedCc = 64,
+  PantomimeCachedAllHeaders = 127
+};
+
+
+/*!
+  @typedef PantomimeSortKey
+  @abstract Keys for CWIMAPFolder: -sortByKey: reverse:
+  @discussion This enum lists the keys an IMAP server can sort
+              the messages of a folder on. See 3. Additional
+	      Commands of RFC 5256.
+  @constant PantomimeSortArrival The internal date of the messages.
+  @constant PantomimeSortCc The first "Cc:" address.
+  @constant PantomimeSortDate The "Date:" header value.
+  @constant PantomimeSortFrom The first "From:" address.
+  @constant PantomimeSortSize The size of the messages.
+  @constant PantomimeSortSubject The base subject of the messages.
+  @constant PantomimeSortTo The first "To:" address.
+*/
+typedef NS_ENUM(NSInteger, PantomimeSortKey)
+{
+  PantomimeSortArrival = 1,
+  PantomimeSortCc = 2,
+  PantomimeSortDate = 3,
+  PantomimeSortFrom = 4,
+  PantomimeSortSize = 5,
+  PantomimeSortSubject = 6,
+  PantomimeSortTo = 7
+};
+
+
+/*!
+  @typedef PantomimeThreadAlgorithm
+  @abstract Algorithms for CWIMAPFolder: -threadWithAlgorithm:
+  @discussion This enum lists the algorithms an IMAP server can
+              use to thread the messages of a folder. See 2.1.
+	      Threading Algorithm of RFC 5256.
+  @constant PantomimeThreadOrderedSubject Messages are grouped by base subject.
+  @constant PantomimeThreadReferences Messages are threaded from their
+                                      "References:" and "In-Reply-To:" headers.
+*/
+typedef NS_ENUM(NSInteger, PantomimeThreadAlgorithm)
+{
+  PantomimeThreadOrderedSubject = 1,
+  PantomimeThreadReferences = 2
+};
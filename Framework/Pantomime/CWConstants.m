@@ -43,12 +43,23 @@ NSString* PantomimeFolderSearchFailed = @"PantomimeFolderSearchFailed";
 // CWIMAPFolder notifications
 NSString* PantomimeMessagesCopyCompleted = @"PantomimeMessagesCopyCompleted";
 NSString* PantomimeMessagesCopyFailed = @"PantomimeMessagesCopyFailed";
+NSString* PantomimeMessagesMoveCompleted = @"PantomimeMessagesMoveCompleted";
+NSString* PantomimeMessagesMoveFailed = @"PantomimeMessagesMoveFailed";
 NSString* PantomimeMessageStoreCompleted = @"PantomimeMessageStoreCompleted";
 NSString* PantomimeMessageStoreFailed = @"PantomimeMessageStoreFailed";
+NSString* PantomimeFolderSortCompleted = @"PantomimeFolderSortCompleted";
+NSString* PantomimeFolderSortFailed = @"PantomimeFolderSortFailed";
+NSString* PantomimeFolderThreadCompleted = @"PantomimeFolderThreadCompleted";
+NSString* PantomimeFolderThreadFailed = @"PantomimeFolderThreadFailed";
+NSString* PantomimeFolderPrefetchWindowCompleted = @"PantomimeFolderPrefetchWindowCompleted";
 
 // CWIMAPFolder IDLE notifications
 NSString* PantomimeFolderNewMessageWhileIDLE = @"PantomimeFolderNewMessageWhileIDLE";
 
+// CWIMAPMessage notifications
+NSString* PantomimeBodyStructureFetchCompleted = @"PantomimeBodyStructureFetchCompleted";
+NSString* PantomimePartFetchCompleted = @"PantomimePartFetchCompleted";
+
 // CWIMAPStore notifications
 NSString* PantomimeFolderStatusCompleted = @"PantomimeFolderStatusCompleted";
 NSString* PantomimeFolderStatusFailed = @"PantomimeFolderStatusFailed";
@@ -520,6 +520,16 @@ extern NSString* PantomimeFolderSearchFailed;
 */
 - (NSArray *) allContainers;
 
+/*!
+  @method setAllContainers:
+  @discussion This method is used to set the root containers of the
+              receiver when its messages were threaded elsewhere, like
+	      by an IMAP server. Normally, you should not invoke this
+	      method directly.
+  @param theContainers The root CWContainer instances, nil to unthread.
+*/
+- (void) setAllContainers: (NSArray *) theContainers;
+
 /*!
   @method thread
   @discussion This method implements Jamie Zawinski's message threading algorithm.
@@ -130,6 +130,15 @@
 }
 
 
+//
+//
+//
+- (void) setAllContainers: (NSArray *) theContainers
+{
+  _allContainers = (theContainers ? [[NSMutableArray alloc] initWithArray: theContainers] : nil);
+}
+
+
 //
 //
 //
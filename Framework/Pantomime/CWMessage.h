@@ -492,6 +492,60 @@ extern NSString* PantomimeMessageExpunged;
   @param theHeaders The bytes to use.
 */
 - (void) setHeadersFromData: (NSData *) theHeaders record: (CWCacheRecord *) theRecord;
+
+/*!
+  @method setCachedHeaders:
+  @discussion This method is used by the cache managers to tell that the
+              headers <i>theHeaders</i> of the receiver are in its cache
+	      record and weren't decoded yet. Each of them is decoded,
+	      using -readCachedHeaders:, the first time it is accessed.
+	      Setting one of them directly discards its cached value.
+  @param theHeaders A combination of the values of the PantomimeCachedHeader enum.
+*/
+- (void) setCachedHeaders: (NSUInteger) theHeaders;
+
+/*!
+  @method cachedHeaders
+  @discussion This method is used to obtain the headers of the receiver
+              that are still to be decoded from its cache record.
+  @result A combination of the values of the PantomimeCachedHeader enum.
+*/
+- (NSUInteger) cachedHeaders;
+
+/*!
+  @method readCachedHeaders:
+  @discussion This method is invoked to decode the headers <i>theHeaders</i>
+              from the cache record of the receiver. Subclasses read
+	      from a cache must implement it, the default implementation
+	      does nothing. Both the To and Cc headers are always
+	      requested together since they fill the same recipients.
+  @param theHeaders A combination of the values of the PantomimeCachedHeader enum.
+*/
+- (void) readCachedHeaders: (NSUInteger) theHeaders;
+
+/*!
+  @method materializeCachedHeaders
+  @discussion This method is used to decode all the headers of the receiver
+              that are still in its cache record.
+*/
+- (void) materializeCachedHeaders;
+
+/*!
+  @method materializedMessageCount
+  @discussion This method is used to obtain the number of messages whose
+              cached headers were decoded, entirely or partly, since
+	      the last time the count was reset. It is meant to verify
+	      that only the messages being shown are decoded.
+  @result The count.
+*/
++ (NSUInteger) materializedMessageCount;
+
+/*!
+  @method resetMaterializedMessageCount
+  @discussion This method is used to set the count returned by
+              +materializedMessageCount back to 0.
+*/
++ (void) resetMaterializedMessageCount;
 @end
 
 
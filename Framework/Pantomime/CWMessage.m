@@ -40,15 +40,26 @@
 
 static NSInteger currentMessageVersion = 2;
 
+//
+// The number of messages whose cached headers were decoded, see
+// +materializedMessageCount.
+//
+static NSUInteger materializedMessageCount = 0;
+
 //
 // Private methods
 //
 @interface CWMessage ()
+{
+    NSUInteger _cachedHeaders;
+    BOOL _materialized;
+}
 
 @property NSMutableDictionary *properties;
 @property NSMutableArray *mutableRecipients;
 
 - (NSString *) _computeBaseSubject;
+- (void) _decodeCachedHeaders: (NSUInteger) theHeaders;
 - (void) _extractText:(NSMutableData *) theMutableData
 		 part:(id) thePart
 		quote:(BOOL *) theBOOL;
@@ -62,6 +73,8 @@ static NSInteger currentMessageVersion = 2;
 //
 @implementation CWMessage
 
+@synthesize references = _references;
+
 //
 //
 //
@@ -75,6 +88,8 @@ static NSInteger currentMessageVersion = 2;
         _flags = [[CWFlags alloc] init];
         _references = nil;
         _folder = nil;
+        _cachedHeaders = 0;
+        _materialized = NO;
         
         // By default, we want the subclass's rawSource method to be called so we set our
         // rawSource ivar to nil. If it's not nil (ONLY set in initWithData) it'll be returned,
@@ -152,6 +167,8 @@ static NSInteger currentMessageVersion = 2;
 //
 - (void) encodeWithCoder: (NSCoder *) theCoder
 {
+  [self materializeCachedHeaders];
+
   // Must also encode Part's superclass
   [super encodeWithCoder: theCoder];
 
@@ -226,6 +243,7 @@ static NSInteger currentMessageVersion = 2;
 //
 - (CWInternetAddress *) from
 {
+  [self _decodeCachedHeaders: PantomimeCachedFrom];
   return [_headers objectForKey: @"From"];
 }
 
@@ -237,6 +255,7 @@ static NSInteger currentMessageVersion = 2;
 {
   if (theInternetAddress)
     {
+      _cachedHeaders &= ~PantomimeCachedFrom;
       [_headers setObject: theInternetAddress  forKey: @"From"];
     }
 }
@@ -248,6 +267,7 @@ static NSInteger currentMessageVersion = 2;
 {
   NSString *aString;
 
+  [self _decodeCachedHeaders: PantomimeCachedMessageID];
   aString = [_headers objectForKey: @"Message-ID"];
   
   if (!aString)
@@ -267,6 +287,7 @@ static NSInteger currentMessageVersion = 2;
 {
   if (theMessageID)
     {
+      _cachedHeaders &= ~PantomimeCachedMessageID;
       [_headers setObject: theMessageID  forKey: @"Message-ID"];
     }
 }
@@ -277,6 +298,7 @@ static NSInteger currentMessageVersion = 2;
 //
 - (NSString *) inReplyTo
 {
+  [self _decodeCachedHeaders: PantomimeCachedInReplyTo];
   return [_headers objectForKey: @"In-Reply-To"];
 }
 
@@ -288,11 +310,32 @@ static NSInteger currentMessageVersion = 2;
 {
   if (theInReplyTo)
     {
+      _cachedHeaders &= ~PantomimeCachedInReplyTo;
       [_headers setObject: theInReplyTo  forKey: @"In-Reply-To"];
     }
 }
 
 
+//
+//
+//
+- (NSArray *) references
+{
+  [self _decodeCachedHeaders: PantomimeCachedReferences];
+  return _references;
+}
+
+
+//
+//
+//
+- (void) setReferences: (NSArray *) theReferences
+{
+  _cachedHeaders &= ~PantomimeCachedReferences;
+  _references = theReferences;
+}
+
+
 //
 //
 //
@@ -321,6 +364,7 @@ static NSInteger currentMessageVersion = 2;
 {
     if (theAddress)
     {
+        [self _decodeCachedHeaders: PantomimeCachedTo|PantomimeCachedCc];
         [_mutableRecipients addObject: theAddress];
     }
 }
@@ -333,6 +377,7 @@ static NSInteger currentMessageVersion = 2;
 {
     if (theAddress)
     {
+        [self _decodeCachedHeaders: PantomimeCachedTo|PantomimeCachedCc];
         [_mutableRecipients removeObject: theAddress];
     }
 }
@@ -343,6 +388,7 @@ static NSInteger currentMessageVersion = 2;
 //
 - (NSArray *) recipients
 {
+    [self _decodeCachedHeaders: PantomimeCachedTo|PantomimeCachedCc];
     return _mutableRecipients;
 }
 
@@ -352,6 +398,7 @@ static NSInteger currentMessageVersion = 2;
 //
 - (void) setRecipients: (NSArray *) theRecipients
 {
+    _cachedHeaders &= ~(PantomimeCachedTo|PantomimeCachedCc);
     [_mutableRecipients removeAllObjects];
     
     if (theRecipients)
@@ -366,6 +413,7 @@ static NSInteger currentMessageVersion = 2;
 //
 - (NSUInteger) recipientsCount
 {
+    [self _decodeCachedHeaders: PantomimeCachedTo|PantomimeCachedCc];
     return [_mutableRecipients count];
 }
 
@@ -375,6 +423,7 @@ static NSInteger currentMessageVersion = 2;
 //
 - (void) removeAllRecipients
 {
+    _cachedHeaders &= ~(PantomimeCachedTo|PantomimeCachedCc);
     [_mutableRecipients removeAllObjects];
 }
 
@@ -409,6 +458,7 @@ static NSInteger currentMessageVersion = 2;
 //
 - (NSString *) subject
 {
+    [self _decodeCachedHeaders: PantomimeCachedSubject];
     return [_headers objectForKey: @"Subject"];
 }
 
@@ -420,6 +470,7 @@ static NSInteger currentMessageVersion = 2;
 {
     if (theSubject)
     {
+        _cachedHeaders &= ~PantomimeCachedSubject;
         [_headers setObject: theSubject  forKey: @"Subject"];
         
         // We invalidate our previous base subject.
@@ -571,7 +622,7 @@ static NSInteger currentMessageVersion = 2;
     {
         NSEnumerator *anEnumerator;
         
-        anEnumerator = [_mutableRecipients objectEnumerator];
+        anEnumerator = [[self recipients] objectEnumerator];
         
         while ((anInternetAddress = [anEnumerator nextObject]))
         {
@@ -915,6 +966,7 @@ static NSInteger currentMessageVersion = 2;
 
   NSData *aData;
 
+  [self materializeCachedHeaders];
 
   // We get our locale in English
 #ifndef MACOSX
@@ -1039,6 +1091,8 @@ static NSInteger currentMessageVersion = 2;
     {
       NSString *aString;
       
+      [self materializeCachedHeaders];
+
       if ((aString = [_headers objectForKey: theName]))
 	{
 	  aString = [NSString stringWithFormat: @"%@ %@", aString, theValue];
@@ -1306,12 +1360,87 @@ static NSInteger currentMessageVersion = 2;
       return;
     }
 
-  // First of all, we remove all existing headers and recipients.
+  // First of all, we remove all existing headers and recipients,
+  // including those still in the cache.
+  _cachedHeaders = 0;
   [_headers removeAllObjects];
   [self removeAllRecipients];
   [self addHeadersFromData: theHeaders  record: theRecord];
 }
 
+
+//
+//
+//
+- (NSDictionary *) allHeaders
+{
+  [self materializeCachedHeaders];
+  return [super allHeaders];
+}
+
+
+//
+//
+//
+- (id) headerValueForName: (NSString *) theName
+{
+  [self materializeCachedHeaders];
+  return [super headerValueForName: theName];
+}
+
+
+//
+//
+//
+- (void) setCachedHeaders: (NSUInteger) theHeaders
+{
+  _cachedHeaders = (theHeaders & PantomimeCachedAllHeaders);
+}
+
+
+//
+//
+//
+- (NSUInteger) cachedHeaders
+{
+  return _cachedHeaders;
+}
+
+
+//
+// Subclasses decode the headers from their cache record.
+//
+- (void) readCachedHeaders: (NSUInteger) theHeaders
+{
+}
+
+
+//
+//
+//
+- (void) materializeCachedHeaders
+{
+  [self _decodeCachedHeaders: PantomimeCachedAllHeaders];
+}
+
+
+//
+//
+//
++ (NSUInteger) materializedMessageCount
+{
+  return materializedMessageCount;
+}
+
+
+//
+//
+//
++ (void) resetMaterializedMessageCount
+{
+  materializedMessageCount = 0;
+}
+
 - (NSInteger) compareAccordingToNumber: (CWMessage *) aMessage
 {
     NSInteger num;
@@ -1852,6 +1981,36 @@ static NSInteger currentMessageVersion = 2;
 }
 
 
+//
+// The headers are no longer pending once we start decoding them: the
+// parser sets them through the accessors, which must not decode again.
+// To and Cc both fill the recipients so they are decoded together.
+//
+- (void) _decodeCachedHeaders: (NSUInteger) theHeaders
+{
+  if (theHeaders & (PantomimeCachedTo|PantomimeCachedCc))
+    {
+      theHeaders |= (PantomimeCachedTo|PantomimeCachedCc);
+    }
+
+  theHeaders &= _cachedHeaders;
+
+  if (!theHeaders)
+    {
+      return;
+    }
+
+  if (!_materialized)
+    {
+      _materialized = YES;
+      materializedMessageCount++;
+    }
+
+  _cachedHeaders &= ~theHeaders;
+  [self readCachedHeaders: theHeaders];
+}
+
+
 //
 //
 //
@@ -34,6 +34,19 @@
 */
 @interface CWParser: NSObject
 
+/*!
+  @method parseCachedHeader: data: inMessage:
+  @discussion This method is used to parse the value of a header kept
+              in the cache of a folder, using the quick form of the
+	      parsing method of that header.
+  @param theHeader The header, one of the values of the PantomimeCachedHeader enum.
+  @param theData The value to parse.
+  @param theMessage The message in which to store the parsed value.
+*/
++ (void) parseCachedHeader: (PantomimeCachedHeader) theHeader
+                      data: (NSData *) theData
+                 inMessage: (CWMessage *) theMessage;
+
 /*!
   @method parseContentDescription: inPart:
   @discussion This method is used to parse a Content-Disposition header line.
@@ -120,6 +120,45 @@ NSInteger next_word(unsigned char *buf, NSUInteger start, NSUInteger len, unsign
 //
 @implementation CWParser
 
+//
+// The cache managers store the headers that are parsed here.
+//
++ (void) parseCachedHeader: (PantomimeCachedHeader) theHeader
+                      data: (NSData *) theData
+                 inMessage: (CWMessage *) theMessage
+{
+  switch (theHeader)
+    {
+    case PantomimeCachedFrom:
+      [self parseFrom: theData  inMessage: theMessage  quick: YES];
+      break;
+    case PantomimeCachedInReplyTo:
+      [self parseInReplyTo: theData  inMessage: theMessage  quick: YES];
+      break;
+    case PantomimeCachedMessageID:
+      [self parseMessageID: theData  inMessage: theMessage  quick: YES];
+      break;
+    case PantomimeCachedReferences:
+      [self parseReferences: theData  inMessage: theMessage  quick: YES];
+      break;
+    case PantomimeCachedSubject:
+      [self parseSubject: theData  inMessage: theMessage  quick: YES];
+      break;
+    case PantomimeCachedTo:
+      [self parseDestination: theData  forType: PantomimeToRecipient  inMessage: theMessage  quick: YES];
+      break;
+    case PantomimeCachedCc:
+      [self parseDestination: theData  forType: PantomimeCcRecipient  inMessage: theMessage  quick: YES];
+      break;
+    default:
+      break;
+    }
+}
+
+
+//
+//
+//
 + (void) parseContentDescription: (NSData *) theLine
                           inPart: (CWPart *) thePart
 {
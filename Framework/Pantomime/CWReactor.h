@@ -0,0 +1,139 @@
+/*
+**  CWReactor.h
+**
+**  Copyright (c) 2001-2007
+**
+**  This library is free software; you can redistribute it and/or
+**  modify it under the terms of the GNU Lesser General Public
+**  License as published by the Free Software Foundation; either
+**  version 2.1 of the License, or (at your option) any later version.
+**
+**  This library is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+**  Lesser General Public License for more details.
+**
+**  You should have received a copy of the GNU Lesser General Public
+**  License along with this library; if not, write to the Free Software
+**  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef _Pantomime_H_CWReactor
+#define _Pantomime_H_CWReactor
+
+#import <Foundation/Foundation.h>
+
+#ifdef __linux__
+
+@class CWService;
+@class CWSocketConnection;
+
+/*!
+  @class CWReactor
+  @discussion This class drives many CWService instances from a single
+              thread. All their connections, which are CWSocketConnection
+	      instances, share one epoll set and their network events are
+	      delivered to the services through the CWConnectionDelegate
+	      protocol, just like CWTCPConnection would do from a run loop.
+
+	      Connection, read and write timeouts as well as NOOP keepalives
+	      are tracked in a timer wheel with one second slots, so that
+	      the cost of managing them doesn't grow with the number of
+	      services.
+
+	      A service is dropped from the reactor once its connection
+	      is closed. It must be added again after a reconnection.
+*/
+@interface CWReactor : NSObject
+
+/*!
+  @method fd
+  @discussion This method is used to obtain the epoll file descriptor
+              of the receiver.
+  @result The file descriptor.
+*/
+- (int) fd;
+
+/*!
+  @method keepAliveInterval
+  @discussion This method is used to obtain the number of seconds
+              a connected service can stay idle before the receiver
+	      sends it a NOOP command.
+  @result The interval in seconds, 0 if keepalives are disabled.
+*/
+- (NSUInteger) keepAliveInterval;
+
+/*!
+  @method setKeepAliveInterval:
+  @discussion This method is used to set the number of seconds
+              a connected service can stay idle before the receiver
+	      sends it a NOOP command. Keepalives are disabled by default.
+  @param theInterval The interval in seconds, 0 to disable keepalives.
+*/
+- (void) setKeepAliveInterval: (NSUInteger) theInterval;
+
+/*!
+  @method addService:
+  @discussion This method is used to have the receiver drive
+              <i>theService</i>. If the service isn't connected yet,
+	      it is connected in background using a CWSocketConnection.
+	      Otherwise, its connection must be a CWSocketConnection.
+  @param theService The CWService instance to add.
+  @result YES on success, NO otherwise.
+*/
+- (BOOL) addService: (CWService *) theService;
+
+/*!
+  @method removeService:
+  @discussion This method is used to stop driving <i>theService</i>.
+              Its connection, if still open, goes back to waiting
+	      for events on its own.
+  @param theService The CWService instance to remove.
+*/
+- (void) removeService: (CWService *) theService;
+
+/*!
+  @method services
+  @discussion This method is used to obtain the services currently
+              driven by the receiver.
+  @result An array of CWService instances.
+*/
+- (NSArray *) services;
+
+/*!
+  @method runOnceWithTimeout:
+  @discussion This method is used to wait for at most <i>theTimeout</i>
+              seconds for network events, to dispatch them and to
+	      process the expired timers.
+  @param theTimeout The maximum number of seconds to wait.
+  @result The number of network events dispatched, -1 on error.
+*/
+- (NSInteger) runOnceWithTimeout: (NSTimeInterval) theTimeout;
+
+/*!
+  @method run
+  @discussion This method is used to dispatch events until -stop is
+              called or until the receiver has no service left.
+*/
+- (void) run;
+
+/*!
+  @method stop
+  @discussion This method is used to have -run return once the
+              events currently being dispatched are processed.
+*/
+- (void) stop;
+
+/*!
+  @method scheduleConnection:
+  @discussion This method is invoked by a CWSocketConnection instance
+              attached to the receiver when it arms one of its timeouts.
+  @param theConnection The CWSocketConnection instance.
+*/
+- (void) scheduleConnection: (CWSocketConnection *) theConnection;
+
+@end
+
+#endif // __linux__
+
+#endif // _Pantomime_H_CWReactor
@@ -0,0 +1,533 @@
+/*
+**  CWReactor.m
+**
+**  Copyright (c) 2001-2007
+**
+**  This library is free software; you can redistribute it and/or
+**  modify it under the terms of the GNU Lesser General Public
+**  License as published by the Free Software Foundation; either
+**  version 2.1 of the License, or (at your option) any later version.
+**
+**  This library is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+**  Lesser General Public License for more details.
+**
+**  You should have received a copy of the GNU Lesser General Public
+**  License along with this library; if not, write to the Free Software
+**  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#import "CWReactor.h"
+
+#ifdef __linux__
+
+#import "CWService.h"
+#import "CWSocketConnection.h"
+
+#include "io.h"
+
+#include <errno.h>
+#include <math.h>
+#include <sys/epoll.h>
+
+//
+// The timer wheel has WHEEL_SIZE slots of WHEEL_TICK seconds each.
+// Deadlines further away than the wheel can represent are put in
+// the last slot and simply re-evaluated when it expires.
+//
+#define WHEEL_SIZE 512
+#define WHEEL_TICK 1.0
+
+#define MAX_EVENTS 256
+
+//
+// Private class holding what the reactor knows about a service.
+// <i>tick</i> is the wheel tick the entry is scheduled for, 0 if
+// it isn't scheduled.
+//
+@interface CWReactorEntry : NSObject
+{
+  @public
+    CWService *service;
+    CWSocketConnection *connection;
+    NSTimeInterval lastActivity;
+    NSUInteger tick;
+}
+@end
+
+@implementation CWReactorEntry
+@end
+
+
+//
+// Private methods
+//
+@interface CWReactor ()
+
+- (void) _expireTimers: (NSTimeInterval) theTime;
+- (void) _removeEntry: (CWReactorEntry *) theEntry;
+- (void) _scheduleEntry: (CWReactorEntry *) theEntry;
+- (NSUInteger) _tickForTime: (NSTimeInterval) theTime;
+- (void) _unscheduleEntry: (CWReactorEntry *) theEntry;
+
+@end
+
+@implementation CWReactor
+{
+    NSMapTable *_entries;
+    NSMutableArray *_removed;
+    NSMutableArray *_wheel;
+    NSTimeInterval _origin;
+    NSUInteger _currentTick;
+    NSUInteger _scheduled;
+    NSUInteger _keepAliveInterval;
+    int _epfd;
+    BOOL _stopped;
+}
+
+//
+//
+//
+- (id) init
+{
+    self = [super init];
+    if (self)
+    {
+        NSUInteger i;
+
+        if ((_epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        {
+            return nil;
+        }
+
+        // Connections are compared by address, they are the key
+        // we get back from epoll_wait().
+        _entries = [NSMapTable mapTableWithKeyOptions: (NSPointerFunctionsStrongMemory|NSPointerFunctionsObjectPointerPersonality)
+                                         valueOptions: NSPointerFunctionsStrongMemory];
+        _removed = [[NSMutableArray alloc] init];
+        _wheel = [[NSMutableArray alloc] initWithCapacity: WHEEL_SIZE];
+
+        for (i = 0; i < WHEEL_SIZE; i++)
+        {
+            [_wheel addObject: [NSMutableArray array]];
+        }
+
+        _origin = monotonic_time();
+        _currentTick = _scheduled = _keepAliveInterval = 0;
+        _stopped = NO;
+    }
+    return self;
+}
+
+
+//
+//
+//
+- (void) dealloc
+{
+    NSEnumerator *theEnumerator;
+    CWReactorEntry *anEntry;
+
+    // We give the connections still attached to us their own epoll set back.
+    theEnumerator = [_entries objectEnumerator];
+
+    while ((anEntry = [theEnumerator nextObject]))
+    {
+        [anEntry->connection setReactor: nil];
+    }
+
+    safe_close(_epfd);
+}
+
+
+//
+//
+//
+- (int) fd
+{
+    return _epfd;
+}
+
+
+//
+//
+//
+- (NSUInteger) keepAliveInterval
+{
+    return _keepAliveInterval;
+}
+
+- (void) setKeepAliveInterval: (NSUInteger) theInterval
+{
+    NSEnumerator *theEnumerator;
+    CWReactorEntry *anEntry;
+
+    _keepAliveInterval = theInterval;
+
+    // Keepalives might now be due sooner than any scheduled deadline.
+    theEnumerator = [_entries objectEnumerator];
+
+    while ((anEntry = [theEnumerator nextObject]))
+    {
+        [self _scheduleEntry: anEntry];
+    }
+}
+
+
+//
+//
+//
+- (BOOL) addService: (CWService *) theService
+{
+    CWSocketConnection *aConnection;
+    CWReactorEntry *anEntry;
+
+    if (![theService connection])
+    {
+        [theService setConnectionClass: [CWSocketConnection class]];
+        [theService connectInBackgroundAndNotify];
+    }
+
+    aConnection = (CWSocketConnection *)[theService connection];
+
+    if (![aConnection isKindOfClass: [CWSocketConnection class]] ||
+        [_entries objectForKey: aConnection] ||
+        ![aConnection setReactor: self])
+    {
+        return NO;
+    }
+
+    anEntry = [[CWReactorEntry alloc] init];
+    anEntry->service = theService;
+    anEntry->connection = aConnection;
+    anEntry->lastActivity = monotonic_time();
+    anEntry->tick = 0;
+
+    [_entries setObject: anEntry  forKey: aConnection];
+    [self _scheduleEntry: anEntry];
+
+    return YES;
+}
+
+
+//
+//
+//
+- (void) removeService: (CWService *) theService
+{
+    NSEnumerator *theEnumerator;
+    CWReactorEntry *anEntry;
+
+    anEntry = [_entries objectForKey: [theService connection]];
+
+    // The service might have replaced its connection since it was added.
+    if (!anEntry)
+    {
+        theEnumerator = [_entries objectEnumerator];
+
+        while ((anEntry = [theEnumerator nextObject]))
+        {
+            if (anEntry->service == theService)
+            {
+                break;
+            }
+        }
+    }
+
+    if (anEntry)
+    {
+        [anEntry->connection setReactor: nil];
+        [self _removeEntry: anEntry];
+    }
+}
+
+
+//
+//
+//
+- (NSArray *) services
+{
+    NSMutableArray *aMutableArray;
+    NSEnumerator *theEnumerator;
+    CWReactorEntry *anEntry;
+
+    aMutableArray = [NSMutableArray arrayWithCapacity: [_entries count]];
+    theEnumerator = [_entries objectEnumerator];
+
+    while ((anEntry = [theEnumerator nextObject]))
+    {
+        [aMutableArray addObject: anEntry->service];
+    }
+
+    return aMutableArray;
+}
+
+
+//
+// We never sleep past the next tick of the wheel if some timer is
+// scheduled. Entries removed while dispatching are kept alive until
+// we are done with the events we got, as some of these might still
+// point to their connection.
+//
+- (NSInteger) runOnceWithTimeout: (NSTimeInterval) theTimeout
+{
+    struct epoll_event events[MAX_EVENTS];
+    CWSocketConnection *aConnection;
+    CWReactorEntry *anEntry;
+    NSTimeInterval now, next;
+    int i, n;
+
+    now = monotonic_time();
+
+    if (_scheduled)
+    {
+        next = _origin + (_currentTick+1) * WHEEL_TICK;
+
+        if (next - now < theTimeout)
+        {
+            theTimeout = next - now;
+        }
+    }
+
+    while (n = epoll_wait(_epfd, events, MAX_EVENTS, (theTimeout > 0 ? (int)ceil(theTimeout*1000) : 0)), n == -1 && errno == EINTR);
+
+    if (n < 0)
+    {
+        return -1;
+    }
+
+    now = monotonic_time();
+
+    for (i = 0; i < n; i++)
+    {
+        aConnection = (__bridge CWSocketConnection *)events[i].data.ptr;
+        anEntry = [_entries objectForKey: aConnection];
+
+        if (!anEntry)
+        {
+            continue;
+        }
+
+        anEntry->lastActivity = now;
+        [aConnection handleEvents: events[i].events];
+
+        if ([aConnection fd] < 0)
+        {
+            [self _removeEntry: anEntry];
+        }
+        else
+        {
+            [self _scheduleEntry: anEntry];
+        }
+    }
+
+    [self _expireTimers: monotonic_time()];
+    [_removed removeAllObjects];
+
+    return n;
+}
+
+
+//
+//
+//
+- (void) run
+{
+    _stopped = NO;
+
+    while (!_stopped && [_entries count])
+    {
+        if ([self runOnceWithTimeout: WHEEL_SIZE * WHEEL_TICK] < 0)
+        {
+            break;
+        }
+    }
+}
+
+
+//
+//
+//
+- (void) stop
+{
+    _stopped = YES;
+}
+
+
+//
+//
+//
+- (void) scheduleConnection: (CWSocketConnection *) theConnection
+{
+    CWReactorEntry *anEntry;
+
+    anEntry = [_entries objectForKey: theConnection];
+
+    if (anEntry)
+    {
+        [self _scheduleEntry: anEntry];
+    }
+}
+
+
+//
+// We visit every slot whose tick elapsed, at most once per slot.
+// Entries fired are first taken out of the wheel since firing them
+// might reschedule them, or others.
+//
+- (void) _expireTimers: (NSTimeInterval) theTime
+{
+    NSMutableArray *aSlot, *expired;
+    CWReactorEntry *anEntry;
+    NSUInteger t, now, count, i;
+
+    now = [self _tickForTime: theTime];
+
+    if (now <= _currentTick)
+    {
+        return;
+    }
+
+    t = (now - _currentTick > WHEEL_SIZE ? now - WHEEL_SIZE : _currentTick);
+    expired = [NSMutableArray array];
+
+    for (t = t+1; t <= now; t++)
+    {
+        aSlot = [_wheel objectAtIndex: (t % WHEEL_SIZE)];
+        count = [aSlot count];
+
+        for (i = count; i > 0; i--)
+        {
+            anEntry = [aSlot objectAtIndex: i-1];
+
+            if (anEntry->tick <= now)
+            {
+                [expired addObject: anEntry];
+                [aSlot removeObjectAtIndex: i-1];
+                anEntry->tick = 0;
+                _scheduled--;
+            }
+        }
+    }
+
+    _currentTick = now;
+
+    for (i = 0; i < [expired count]; i++)
+    {
+        anEntry = [expired objectAtIndex: i];
+
+        // It might have been removed by a previous entry's callbacks.
+        if ([_entries objectForKey: anEntry->connection] != anEntry)
+        {
+            continue;
+        }
+
+        [anEntry->connection checkDeadlines: theTime];
+
+        if ([anEntry->connection fd] < 0)
+        {
+            [self _removeEntry: anEntry];
+            continue;
+        }
+
+        if (_keepAliveInterval && [anEntry->service isConnected] &&
+            theTime - anEntry->lastActivity >= _keepAliveInterval)
+        {
+            anEntry->lastActivity = theTime;
+            [anEntry->service noop];
+        }
+
+        [self _scheduleEntry: anEntry];
+    }
+}
+
+
+//
+//
+//
+- (void) _removeEntry: (CWReactorEntry *) theEntry
+{
+    [self _unscheduleEntry: theEntry];
+    [_removed addObject: theEntry];
+    [_entries removeObjectForKey: theEntry->connection];
+}
+
+
+//
+// An entry is in at most one slot. It is only moved if its
+// new deadline is earlier than the one it is scheduled for:
+// a later deadline is discovered when the earlier one fires.
+//
+- (void) _scheduleEntry: (CWReactorEntry *) theEntry
+{
+    NSTimeInterval deadline;
+    NSUInteger tick;
+
+    deadline = [theEntry->connection nextDeadline];
+
+    if (_keepAliveInterval && [theEntry->service isConnected] &&
+        (!deadline || theEntry->lastActivity + _keepAliveInterval < deadline))
+    {
+        deadline = theEntry->lastActivity + _keepAliveInterval;
+    }
+
+    if (!deadline)
+    {
+        return;
+    }
+
+    // The slot's tick must have fully elapsed for the deadline to be reached.
+    tick = [self _tickForTime: deadline] + 1;
+
+    if (tick <= _currentTick)
+    {
+        tick = _currentTick + 1;
+    }
+    else if (tick - _currentTick >= WHEEL_SIZE)
+    {
+        tick = _currentTick + WHEEL_SIZE - 1;
+    }
+
+    if (theEntry->tick && theEntry->tick <= tick)
+    {
+        return;
+    }
+
+    [self _unscheduleEntry: theEntry];
+    [[_wheel objectAtIndex: (tick % WHEEL_SIZE)] addObject: theEntry];
+    theEntry->tick = tick;
+    _scheduled++;
+}
+
+
+//
+//
+//
+- (NSUInteger) _tickForTime: (NSTimeInterval) theTime
+{
+    if (theTime <= _origin)
+    {
+        return 0;
+    }
+
+    return (NSUInteger)((theTime - _origin) / WHEEL_TICK);
+}
+
+
+//
+//
+//
+- (void) _unscheduleEntry: (CWReactorEntry *) theEntry
+{
+    if (theEntry->tick)
+    {
+        [[_wheel objectAtIndex: (theEntry->tick % WHEEL_SIZE)] removeObjectIdenticalTo: theEntry];
+        theEntry->tick = 0;
+        _scheduled--;
+    }
+}
+
+@end
+
+#endif // __linux__
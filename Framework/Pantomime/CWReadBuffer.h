@@ -0,0 +1,88 @@
+/*
+**  CWReadBuffer.h
+**
+**  Copyright (c) 2001-2007
+**
+**  This library is free software; you can redistribute it and/or
+**  modify it under the terms of the GNU Lesser General Public
+**  License as published by the Free Software Foundation; either
+**  version 2.1 of the License, or (at your option) any later version.
+**
+**  This library is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+**  Lesser General Public License for more details.
+**
+**  You should have received a copy of the GNU Lesser General Public
+**  License along with this library; if not, write to the Free Software
+**  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#import <Foundation/Foundation.h>
+
+/*!
+  @class CWReadBuffer
+  @discussion This class holds the bytes read from the socket by a CWService
+              instance. IMAP, POP3 and SMTP servers responses are always
+	      ended by CRLF so the buffer hands out lines. Rather than moving
+	      the remaining bytes down each time a line is consumed, the
+	      buffer keeps a consume offset and only compacts itself once
+	      the consumed prefix gets big enough.
+*/
+@interface CWReadBuffer : NSObject
+
+/*!
+  @method appendBytes: length:
+  @discussion This method is used to append bytes read from the socket
+              to the buffer. This is the only method that can move
+	      the buffer bytes around so any pointer previously obtained
+	      with -nextLine: or -bytes is invalid after calling it.
+  @param theBytes The bytes to append.
+  @param theLength The number of bytes to append.
+*/
+- (void) appendBytes: (const void *) theBytes  length: (NSUInteger) theLength;
+
+/*!
+  @method bytes
+  @discussion This method is used to obtain the bytes that have not
+              been consumed yet.
+  @result A pointer to the first unconsumed byte.
+*/
+- (const char *) bytes;
+
+/*!
+  @method length
+  @discussion This method is used to obtain the number of bytes
+              that have not been consumed yet.
+  @result The number of unconsumed bytes.
+*/
+- (NSUInteger) length;
+
+/*!
+  @method nextLine:
+  @discussion This method is used to obtain the next CRLF terminated
+              line without copying it. The returned pointer points
+	      directly into the buffer and stays valid until the
+	      next call to -appendBytes:length: or -reset.
+  @param theLength The length of the line, without the CRLF.
+  @result A pointer to the first byte of the line, NULL if no
+          complete line is available.
+*/
+- (const char *) nextLine: (NSUInteger *) theLength;
+
+/*!
+  @method nextLineData
+  @discussion This method is used to obtain the next CRLF terminated line
+              as an independent NSData instance that can be kept
+	      around. Only the line itself is copied.
+  @result The line, without the CRLF, nil if no complete line is available.
+*/
+- (NSData *) nextLineData;
+
+/*!
+  @method reset
+  @discussion This method is used to discard all the bytes of the buffer.
+*/
+- (void) reset;
+
+@end
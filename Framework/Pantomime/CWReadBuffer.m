@@ -0,0 +1,162 @@
+/*
+**  CWReadBuffer.m
+**
+**  Copyright (c) 2001-2007
+**
+**  This library is free software; you can redistribute it and/or
+**  modify it under the terms of the GNU Lesser General Public
+**  License as published by the Free Software Foundation; either
+**  version 2.1 of the License, or (at your option) any later version.
+**
+**  This library is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+**  Lesser General Public License for more details.
+**
+**  You should have received a copy of the GNU Lesser General Public
+**  License along with this library; if not, write to the Free Software
+**  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#import "CWReadBuffer.h"
+
+#include <string.h>
+
+//
+// We only move the unconsumed bytes down once the consumed prefix
+// is at least that big AND bigger than what remains to be consumed.
+// That way, each byte is moved at most a constant number of times.
+//
+#define COMPACT_THRESHOLD 65536
+
+@implementation CWReadBuffer
+{
+    NSMutableData *_data;
+    NSUInteger _offset;
+    NSUInteger _scan;
+}
+
+//
+//
+//
+- (id) init
+{
+    self = [super init];
+    if (self)
+    {
+        _data = [[NSMutableData alloc] init];
+        _offset = _scan = 0;
+    }
+    return self;
+}
+
+
+//
+//
+//
+- (void) appendBytes: (const void *) theBytes  length: (NSUInteger) theLength
+{
+    NSUInteger len;
+
+    len = [_data length];
+
+    // Everything was consumed, we can start over for free.
+    if (_offset == len)
+    {
+        [_data setLength: 0];
+        _offset = _scan = 0;
+    }
+    else if (_offset >= COMPACT_THRESHOLD && _offset >= len-_offset)
+    {
+        char *bytes;
+
+        bytes = (char *)[_data mutableBytes];
+        memmove(bytes, bytes+_offset, len-_offset);
+        [_data setLength: len-_offset];
+        _scan -= _offset;
+        _offset = 0;
+    }
+
+    [_data appendBytes: theBytes  length: theLength];
+}
+
+
+//
+//
+//
+- (const char *) bytes
+{
+    return (const char *)[_data bytes] + _offset;
+}
+
+
+//
+//
+//
+- (NSUInteger) length
+{
+    return [_data length] - _offset;
+}
+
+
+//
+// We search for LF using memchr() and verify that it is preceded by CR.
+// We remember where we stopped searching so that a long line received
+// in many small reads is never scanned twice.
+//
+- (const char *) nextLine: (NSUInteger *) theLength
+{
+    const char *bytes, *start, *end, *lf;
+
+    bytes = (const char *)[_data bytes];
+    start = bytes + _offset;
+    end = bytes + [_data length];
+    lf = bytes + (_scan > _offset ? _scan : _offset);
+
+    while (lf < end && (lf = memchr(lf, '\n', end-lf)))
+    {
+        if (lf > start && *(lf-1) == '\r')
+        {
+            *theLength = lf-start-1;
+            _offset = _scan = lf-bytes+1;
+            return start;
+        }
+
+        lf++;
+    }
+
+    _scan = [_data length];
+
+    return NULL;
+}
+
+
+//
+//
+//
+- (NSData *) nextLineData
+{
+    const char *bytes;
+    NSUInteger len;
+
+    bytes = [self nextLine: &len];
+
+    if (!bytes)
+    {
+        return nil;
+    }
+
+    return [NSData dataWithBytes: bytes  length: len];
+}
+
+
+//
+//
+//
+- (void) reset
+{
+    [_data setLength: 0];
+    _offset = _scan = 0;
+}
+
+@end
@@ -290,7 +290,7 @@ static inline CWInternetAddress *next_recipient(NSMutableArray *theRecipients, B
     // We send the command to the POP3 server.
     if (nil != aQueueObject)
     {
-        [self writeData:[aQueueObject.arguments dataUsingEncoding: defaultCStringEncoding]];
+        [_wbuf appendData:[aQueueObject.arguments dataUsingEncoding: defaultCStringEncoding]];
         [self writeData:CRLF];
     }
 }
@@ -428,7 +428,7 @@ static inline CWInternetAddress *next_recipient(NSMutableArray *theRecipients, B
     
     [super updateRead];
     
-    while ((aData = split_lines(_rbuf)))
+    while ((aData = [_rbuf nextLineData]))
     {
         [_responsesFromServer addObject: aData];
         
@@ -662,7 +662,8 @@ static inline CWInternetAddress *next_recipient(NSMutableArray *theRecipients, B
 			length: 2];
 	}
  
-      [self writeData: aMutableData];
+      // The message is queued by reference along with its terminator.
+      [_wbuf appendData: aMutableData];
       [self writeData: [NSData dataWithBytes: "\r\n.\r\n"  length: 5]];
     }
   else if ([aData hasCPrefix: "250"])
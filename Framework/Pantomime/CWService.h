@@ -22,42 +22,10 @@
 
 
 #import "CWConnection.h"
+#import "CWReadBuffer.h"
+#import "CWWriteQueue.h"
 
 
-/*!
-  @function split_lines
-  @discussion This function is used to split lines from <i>theMutableData</i> and
-              return the first one found immediately (by removing it first
-              from <i>theMutableData</i>). IMAP, POP3 and SMTP servers reponses are 
-              always ended by CRLF.
-  @param theMutableData The data from which to split lines from.
-  @result A line as a NSData instance, nil if no line was splitted.
-*/
-static inline NSData *split_lines(NSMutableData *theMutableData)
-{
-    char *bytes, *end;
-    NSInteger i, count;
-    
-    end = bytes = (char *)[theMutableData mutableBytes];
-    count = [theMutableData length];
-    
-    for (i = 0; i < count; i++)
-    {
-        if (*end == '\n' && *(end-1) == '\r')
-        {
-            NSData *aData;
-            
-            aData = [NSData dataWithBytes: bytes  length: (i-1)];
-            memmove(bytes,end+1,count-i-1);
-            [theMutableData setLength: count-i-1];
-            return aData;
-        }
-        
-        end++;
-    }
-    return nil;
-}
-
 @class CWNSString;
 @class CWService;
 
@@ -251,8 +219,8 @@ extern NSString* PantomimeProtocolException;
     NSMutableArray *_capabilities;
     NSMutableArray *_runLoopModes;
     NSMutableArray *_queue;
-    NSMutableData *_wbuf;
-    NSMutableData *_rbuf;
+    CWWriteQueue *_wbuf;
+    CWReadBuffer *_rbuf;
     NSString *_mechanism;
     NSString *_username;
     NSString *_password;
@@ -267,6 +235,7 @@ extern NSString* PantomimeProtocolException;
     id _delegate;
     
     id<CWConnection> _connection;
+    Class _connectionClass;
     
   NSMutableArray *previous_queue;
   BOOL reconnecting;
@@ -340,6 +309,24 @@ extern NSString* PantomimeProtocolException;
 */
 - (id<CWConnection>) connection;
 
+/*!
+  @method connectionClass
+  @discussion This method is used to obtain the class used to create
+              the connection object of the service.
+  @result The class, CWTCPConnection by default.
+*/
+- (Class) connectionClass;
+
+/*!
+  @method setConnectionClass:
+  @discussion This method is used to set the class used to create the
+              connection object of the service, for example CWSocketConnection
+	      when running without a run loop. It must be called before
+	      -connect or -connectInBackgroundAndNotify.
+  @param theClass A class whose instances implement the CWConnection protocol.
+*/
+- (void) setConnectionClass: (Class) theClass;
+
 /*!
   @method username
   @discussion This method is used to get the username (if any) that will be
@@ -461,6 +448,8 @@ extern NSString* PantomimeProtocolException;
 /*!
   @method writeData:
   @discussion This method is used to buffer bytes to be written on the socket.
+              The bytes are queued by reference, not copied, so <i>theData</i>
+	      must not be modified afterward.
               You should never have to invoke this method directly.
   @param The bytes to buffer, as a NSData instance.
 */
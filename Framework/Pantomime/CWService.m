@@ -26,6 +26,8 @@
 #import "CWTCPConnection.h"
 #import "NSData+CWExtensions.h"
 
+#include <errno.h>
+
 //
 // It's important that the read buffer be bigger than the PMTU. Since almost all networks
 // permit 1500-byte packets and few permit more, the PMTU will generally be around 1500.
@@ -38,6 +40,10 @@
 // notified after a couple of writes that we can actually write data!
 #define WRITE_BLOCK_SIZE 1024
 
+// The maximum number of queued segments we hand out in a single
+// gather write. It's well below IOV_MAX on all platforms we support.
+#define WRITE_IOV_COUNT 64
+
 
 //
 // Default timeout used when waiting for something to complete.
@@ -59,9 +65,10 @@
         _capabilities = [[NSMutableArray alloc] init];
         _queue = [[NSMutableArray alloc] init];
         
-        _rbuf = [[NSMutableData alloc] init];
-        _wbuf = [[NSMutableData alloc] init];
+        _rbuf = [[CWReadBuffer alloc] init];
+        _wbuf = [[CWWriteQueue alloc] init];
         
+        _connectionClass = [CWTCPConnection class];
         _runLoopModes = [[NSMutableArray alloc] initWithObjects: NSDefaultRunLoopMode, nil];
         _connectionTimeout = _readTimeout = _writeTimeout = DEFAULT_TIMEOUT;
         
@@ -159,6 +166,21 @@
 }
 
 
+//
+//
+//
+- (Class) connectionClass
+{
+  return _connectionClass;
+}
+
+- (void) setConnectionClass: (Class) theClass
+{
+  NSAssert([theClass conformsToProtocol: @protocol(CWConnection)], @"Connection class must implement CWConnection");
+  _connectionClass = theClass;
+}
+
+
 //
 //
 //
@@ -269,10 +291,13 @@
 - (NSInteger) connect
 {
     NSAssert(nil == _connection, @"Connection already allocated");
-    _connection = [[CWTCPConnection alloc] initWithName:_name
-                                                   port:_port
-                                               delegate:self
-                                             background: NO];
+    _connection = [[_connectionClass alloc] initWithName:_name
+                                                    port:_port
+                                                delegate:self
+                                       connectionTimeout:_connectionTimeout
+                                             readTimeout:_readTimeout
+                                            writeTimeout:_writeTimeout
+                                              background:NO];
     
     if (!_connection)
     {
@@ -289,10 +314,13 @@
 - (void) connectInBackgroundAndNotify
 {
     NSAssert(nil == _connection, @"Connection already allocated");
-    _connection = [[CWTCPConnection alloc] initWithName:_name
-                                                   port:_port
-                                               delegate:self
-                                             background:YES];
+    _connection = [[_connectionClass alloc] initWithName:_name
+                                                    port:_port
+                                                delegate:self
+                                       connectionTimeout:_connectionTimeout
+                                             readTimeout:_readTimeout
+                                            writeTimeout:_writeTimeout
+                                              background:YES];
     
     if (!_connection)
     {
@@ -330,11 +358,11 @@
                             withObject: self
                             withObject: aData];
             
-            [_rbuf appendData: aData];
+            [_rbuf appendBytes: buf  length: count];
         }
         else
         {
-            [_rbuf appendBytes:buf length:count];
+            [_rbuf appendBytes: buf  length: count];
         }
     }
 }
@@ -345,19 +373,32 @@
 //
 - (void) updateWrite
 {
-    if ([_wbuf length] > 0)
+    struct iovec iov[WRITE_IOV_COUNT];
+    NSInteger count, n;
+    NSUInteger len;
+    
+    //
+    // We describe as much of the queued segments as we can and write
+    // them in one go. We loop until everything was written or until
+    // the connection stops accepting bytes.
+    //
+    while ((len = [_wbuf length]) > 0)
     {
-        uint8_t *bytes;
-        NSInteger count, len;
-        
-        bytes = (uint8_t *)[_wbuf mutableBytes];
-        len = [_wbuf length];
-        
 #ifdef MACOSX
-        count = [_connection write: bytes  length: len > WRITE_BLOCK_SIZE ? WRITE_BLOCK_SIZE : len];
+        n = [_wbuf getIOVec: iov  count: WRITE_IOV_COUNT  maxLength: WRITE_BLOCK_SIZE];
 #else
-        count = [_connection write: bytes  length: len];
+        n = [_wbuf getIOVec: iov  count: WRITE_IOV_COUNT  maxLength: len];
 #endif
+        
+        if ([_connection respondsToSelector: @selector(writeVector:count:)])
+        {
+            count = [_connection writeVector: iov  count: n];
+        }
+        else
+        {
+            count = [_connection write: iov[0].iov_base  length: iov[0].iov_len];
+        }
+        
         // If nothing was written of if an error occured, we return.
         if (count <= 0)
         {
@@ -368,26 +409,14 @@
         {
             [_delegate performSelector: @selector(service:sentData:)
                             withObject: self
-                            withObject: [_wbuf subdataToIndex: count]];
+                            withObject: [_wbuf subdataToLength: count]];
         }
         
         //NSLog(@"count = %d, len = %d", count, len);
         
-        // If we have been able to write everything...
-        if (count == len)
-        {
-            [_wbuf setLength: 0];
-        }
-        else
-        {
-            memmove(bytes, bytes+count, len-count);
-            [_wbuf setLength: len-count];
-            
-            // We enable the write callback under OS X.
-            // See the rationale in -writeData:
-            
-            [self updateWrite];
-        }
+        // We drop what was written. Nothing is moved around, the
+        // queue only advances in its first segment.
+        [_wbuf consumeLength: count];
     }
 }
 
@@ -532,18 +561,19 @@
                               [inError localizedDescription], NSLocalizedDescriptionKey,
                               nil];
     
-    switch ([inError code])
+    // CWTCPConnection reports timeouts using CFNetwork's error code
+    // while CWSocketConnection uses ETIMEDOUT.
+    if ([inError code] == kCFNetServiceErrorTimeout ||
+        ([[inError domain] isEqualToString: NSPOSIXErrorDomain] && [inError code] == ETIMEDOUT))
     {
-        case kCFNetServiceErrorTimeout:
-            POST_NOTIFICATION(PantomimeConnectionTimedOut, self, userInfo);
-            (void)PERFORM_SELECTOR_1(_delegate, @selector(connectionTimedOut:), PantomimeConnectionTimedOut);
-            break;
-    
-        default:
-            NSLog(@"Error %ld: %@", [inError code], [inError localizedDescription]);
-            POST_NOTIFICATION(PantomimeConnectionLost, self, userInfo);
-            (void)PERFORM_SELECTOR_1(_delegate, @selector(connectionLost:),  PantomimeConnectionLost);
-            break;
+        POST_NOTIFICATION(PantomimeConnectionTimedOut, self, userInfo);
+        (void)PERFORM_SELECTOR_1(_delegate, @selector(connectionTimedOut:), PantomimeConnectionTimedOut);
+    }
+    else
+    {
+        NSLog(@"Error %ld: %@", [inError code], [inError localizedDescription]);
+        POST_NOTIFICATION(PantomimeConnectionLost, self, userInfo);
+        (void)PERFORM_SELECTOR_1(_delegate, @selector(connectionLost:),  PantomimeConnectionLost);
     }
 }
 
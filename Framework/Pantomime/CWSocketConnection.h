@@ -0,0 +1,145 @@
+/*
+**  CWSocketConnection.h
+**
+**  Copyright (c) 2001-2007
+**
+**  This library is free software; you can redistribute it and/or
+**  modify it under the terms of the GNU Lesser General Public
+**  License as published by the Free Software Foundation; either
+**  version 2.1 of the License, or (at your option) any later version.
+**
+**  This library is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+**  Lesser General Public License for more details.
+**
+**  You should have received a copy of the GNU Lesser General Public
+**  License along with this library; if not, write to the Free Software
+**  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef _Pantomime_H_CWSocketConnection
+#define _Pantomime_H_CWSocketConnection
+
+#import "CWConnection.h"
+
+#ifdef __linux__
+
+#include <stdint.h>
+
+@class CWReactor;
+
+/*!
+  @class CWSocketConnection
+  @discussion This class, which implements the CWConnection protocol, offers
+              a TCP connection built directly on a non-blocking socket and
+	      epoll(7). Contrary to CWTCPConnection, it is not scheduled in
+	      any run loop, it enforces the connection, read and write timeouts
+	      it is initialized with, it disables Nagle's algorithm and it
+	      exposes its file descriptor. The addresses the host name
+	      resolves to are tried in turn, each one getting an equal
+	      share of what is left of the connection timeout.
+
+	      Events are only delivered to the delegate from
+	      -waitForEventsWithTimeout: or -handleEvents:, so whoever owns
+	      the connection must call one of them, unless the connection
+	      was handed to a CWReactor instance. A timeout is reported
+	      to the delegate as a NSPOSIXErrorDomain error with the
+	      ETIMEDOUT code.
+
+	      The read timeout is armed when bytes are written and disarmed
+	      as soon as bytes are read back, so an idle connection never
+	      times out. The write timeout is armed as long as the socket
+	      refuses to accept what we try to write.
+
+	      This class does not support TLS.
+*/
+@interface CWSocketConnection : NSObject <CWConnection>
+
+@property (weak) id<CWConnectionDelegate> delegate;
+
+/*!
+  @method fd
+  @discussion This method is used to obtain the file descriptor of
+              the underlying socket.
+  @result The file descriptor, -1 if the connection is closed.
+*/
+- (int) fd;
+
+/*!
+  @method waitForEventsWithTimeout:
+  @discussion This method is used to wait for network events on the
+              receiver for at most <i>theTimeout</i> seconds, and to
+	      dispatch them to the delegate. Expired timeouts are
+	      also reported from this method. It must not be used once
+	      the receiver was attached to a reactor.
+  @param theTimeout The maximum number of seconds to wait.
+  @result The number of events dispatched, -1 on error.
+*/
+- (NSInteger) waitForEventsWithTimeout: (NSTimeInterval) theTimeout;
+
+/*!
+  @method reactor
+  @discussion This method is used to obtain the reactor the receiver
+              was attached to.
+  @result The CWReactor instance, nil if none.
+*/
+- (CWReactor *) reactor;
+
+/*!
+  @method setReactor:
+  @discussion This method is used to move the receiver's socket from its
+              own epoll set to the one of <i>theReactor</i>, or back to
+	      a private set if <i>theReactor</i> is nil. The reactor is
+	      informed each time one of the receiver's timeouts is armed.
+	      You normally don't call this method directly, CWReactor does.
+  @param theReactor The CWReactor instance or nil.
+  @result YES on success, NO if the socket couldn't be moved.
+*/
+- (BOOL) setReactor: (CWReactor *) theReactor;
+
+/*!
+  @method handleEvents:
+  @discussion This method is used to dispatch the epoll events
+              <i>theEvents</i> received on the receiver's file
+	      descriptor to the delegate.
+  @param theEvents The EPOLLIN, EPOLLOUT, EPOLLERR or EPOLLHUP mask.
+*/
+- (void) handleEvents: (uint32_t) theEvents;
+
+/*!
+  @method nextDeadline
+  @discussion This method is used to obtain the earliest time, on the
+              CLOCK_MONOTONIC clock, at which one of the receiver's
+	      timeouts will expire.
+  @result The time in seconds, 0 if no timeout is armed.
+*/
+- (NSTimeInterval) nextDeadline;
+
+/*!
+  @method checkDeadlines:
+  @discussion This method is used to report a timeout to the delegate
+              if one of the receiver's timeouts expired at <i>theTime</i>.
+  @param theTime The current time on the CLOCK_MONOTONIC clock.
+*/
+- (void) checkDeadlines: (NSTimeInterval) theTime;
+
+/*!
+  @method startSSL
+  @discussion TLS is not supported by this class.
+  @result Always -1.
+*/
+- (NSInteger) startSSL;
+
+/*!
+  @method isSSL
+  @discussion TLS is not supported by this class.
+  @result Always NO.
+*/
+- (BOOL) isSSL;
+
+@end
+
+#endif // __linux__
+
+#endif // _Pantomime_H_CWSocketConnection
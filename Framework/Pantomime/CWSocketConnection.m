@@ -0,0 +1,773 @@
+/*
+**  CWSocketConnection.m
+**
+**  Copyright (c) 2001-2007
+**
+**  This library is free software; you can redistribute it and/or
+**  modify it under the terms of the GNU Lesser General Public
+**  License as published by the Free Software Foundation; either
+**  version 2.1 of the License, or (at your option) any later version.
+**
+**  This library is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+**  Lesser General Public License for more details.
+**
+**  You should have received a copy of the GNU Lesser General Public
+**  License along with this library; if not, write to the Free Software
+**  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#import "CWSocketConnection.h"
+
+#ifdef __linux__
+
+#import "CWReactor.h"
+
+#include "io.h"
+
+#include <errno.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+#define DEFAULT_TIMEOUT 60
+
+@interface CWSocketConnection ()
+
+- (BOOL) _connectNextAddress;
+- (BOOL) _finishConnect;
+- (void) _reportError: (int) theError;
+- (void) _updateInterest;
+
+@end
+
+@implementation CWSocketConnection
+{
+    __weak CWReactor *_reactor;
+
+    NSUInteger _connectionTimeout;
+    NSUInteger _readTimeout;
+    NSUInteger _writeTimeout;
+
+    struct addrinfo *_addresses;
+    struct addrinfo *_nextAddress;
+
+    NSTimeInterval _connectDeadline;
+    NSTimeInterval _attemptDeadline;
+    NSTimeInterval _readDeadline;
+    NSTimeInterval _writeDeadline;
+
+    uint32_t _interest;
+    int _error;
+    int _epfd;
+    int _fd;
+
+    BOOL _connecting;
+    BOOL _openPending;
+    BOOL _wantsWrite;
+}
+
+//
+//
+//
+- (id) initWithName:(NSString*)theName
+               port:(unsigned short)thePort
+           delegate:(id<CWConnectionDelegate>)inDelegate
+         background:(BOOL)theBOOL
+{
+    return [self initWithName:theName
+                         port:thePort
+                     delegate:inDelegate
+            connectionTimeout:DEFAULT_TIMEOUT
+                  readTimeout:DEFAULT_TIMEOUT
+                 writeTimeout:DEFAULT_TIMEOUT
+                   background:theBOOL];
+}
+
+
+//
+// If we are not connecting in background, this method blocks until
+// the connection is established or until the connection timeout
+// is exhausted, in which case nil is returned. The addresses the
+// name resolves to are tried in turn, see -_connectNextAddress.
+//
+- (id) initWithName:(NSString *)theName
+               port:(unsigned short)thePort
+           delegate:(id<CWConnectionDelegate>)inDelegate
+  connectionTimeout:(NSUInteger)theConnectionTimeout
+        readTimeout:(NSUInteger)theReadTimeout
+       writeTimeout:(NSUInteger)theWriteTimeout
+         background:(BOOL)theBOOL
+{
+    self = [super init];
+    if (self)
+    {
+        struct addrinfo hints, *res;
+        char port[8];
+
+        _fd = _epfd = -1;
+
+        if (theName == nil || thePort <= 0)
+        {
+            return nil;
+        }
+
+        self.delegate = inDelegate;
+
+        _connectionTimeout = (theConnectionTimeout > 0 ? theConnectionTimeout : DEFAULT_TIMEOUT);
+        _readTimeout = (theReadTimeout > 0 ? theReadTimeout : DEFAULT_TIMEOUT);
+        _writeTimeout = (theWriteTimeout > 0 ? theWriteTimeout : DEFAULT_TIMEOUT);
+
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        snprintf(port, sizeof(port), "%u", thePort);
+
+        if (getaddrinfo([theName UTF8String], port, &hints, &res) != 0)
+        {
+            return nil;
+        }
+
+        // We keep the addresses until we are connected to one of them.
+        _addresses = _nextAddress = res;
+
+        if ((_epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        {
+            [self close];
+            return nil;
+        }
+
+        _connecting = YES;
+        _connectDeadline = monotonic_time() + _connectionTimeout;
+
+        if (![self _connectNextAddress])
+        {
+            [self close];
+            return nil;
+        }
+
+        if (!theBOOL)
+        {
+            struct epoll_event ev;
+            NSTimeInterval remaining;
+            int n;
+
+            while (_connecting)
+            {
+                remaining = _attemptDeadline - monotonic_time();
+
+                if (remaining <= 0)
+                {
+                    if (![self _connectNextAddress])
+                    {
+                        [self close];
+                        return nil;
+                    }
+
+                    continue;
+                }
+
+                while (n = epoll_wait(_epfd, &ev, 1, (int)ceil(remaining*1000)), n == -1 && errno == EINTR);
+
+                if (n < 0 || (n > 0 && ![self _finishConnect] && ![self _connectNextAddress]))
+                {
+                    [self close];
+                    return nil;
+                }
+            }
+        }
+    }
+
+    return self;
+}
+
+
+//
+//
+//
+- (void) dealloc
+{
+    [self close];
+}
+
+
+//
+//
+//
+- (int) fd
+{
+    return _fd;
+}
+
+
+//
+//
+//
+- (BOOL) isConnected
+{
+    return (_fd >= 0 && !_connecting);
+}
+
+
+//
+//
+//
+- (BOOL) isSSL
+{
+    return NO;
+}
+
+
+//
+//
+//
+- (void) close
+{
+    if (_epfd >= 0)
+    {
+        // We don't own the epoll set of our reactor.
+        if (_reactor)
+        {
+            if (_fd >= 0)
+            {
+                epoll_ctl(_epfd, EPOLL_CTL_DEL, _fd, NULL);
+            }
+        }
+        else
+        {
+            safe_close(_epfd);
+        }
+
+        _epfd = -1;
+    }
+
+    if (_fd >= 0)
+    {
+        safe_close(_fd);
+        _fd = -1;
+    }
+
+    if (_addresses)
+    {
+        freeaddrinfo(_addresses);
+        _addresses = _nextAddress = NULL;
+    }
+
+    _connecting = _openPending = _wantsWrite = NO;
+    _connectDeadline = _attemptDeadline = _readDeadline = _writeDeadline = 0;
+}
+
+
+//
+// We return 0 if there's nothing to read. The end of the stream and
+// errors are reported to the delegate once it is done reading.
+//
+- (NSInteger) read:(uint8_t*)buf length:(NSInteger)len
+{
+    ssize_t count;
+
+    if (_fd < 0 || _connecting || _error)
+    {
+        return 0;
+    }
+
+    count = safe_recv(_fd, buf, len, 0);
+
+    if (count > 0)
+    {
+        _readDeadline = 0;
+        return count;
+    }
+
+    if (count == 0)
+    {
+        _error = ECONNRESET;
+    }
+    else if (errno != EAGAIN && errno != EWOULDBLOCK)
+    {
+        _error = errno;
+    }
+
+    return 0;
+}
+
+
+//
+//
+//
+- (NSInteger) write:(uint8_t*)buf length:(NSInteger)len
+{
+    struct iovec iov;
+
+    iov.iov_base = buf;
+    iov.iov_len = len;
+
+    return [self writeVector: &iov  count: 1];
+}
+
+
+//
+// We use sendmsg(2) rather than writev(2) so that a connection
+// reset by the peer doesn't raise SIGPIPE.
+//
+- (NSInteger) writeVector:(const struct iovec*)iov count:(NSInteger)count
+{
+    struct msghdr msg;
+    size_t total;
+    ssize_t value;
+    NSInteger i;
+    BOOL armed;
+
+    if (_fd < 0 || _connecting || _error)
+    {
+        return 0;
+    }
+
+    for (i = 0, total = 0; i < count; i++)
+    {
+        total += iov[i].iov_len;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec *)iov;
+    msg.msg_iovlen = count;
+
+    while (value = sendmsg(_fd, &msg, MSG_NOSIGNAL), value == -1 && errno == EINTR);
+
+    if (value < 0)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            _error = errno;
+            return -1;
+        }
+
+        value = 0;
+    }
+
+    armed = NO;
+
+    // We now expect the peer to answer within the read timeout.
+    if (value > 0 && !_readDeadline)
+    {
+        _readDeadline = monotonic_time() + _readTimeout;
+        armed = YES;
+    }
+
+    // If the socket didn't take everything, we ask to be notified
+    // once it can take more and we arm the write timeout. Any
+    // progress pushes that timeout back.
+    if ((size_t)value < total)
+    {
+        if (!_writeDeadline)
+        {
+            armed = YES;
+        }
+
+        if (value > 0 || !_writeDeadline)
+        {
+            _writeDeadline = monotonic_time() + _writeTimeout;
+        }
+
+        _wantsWrite = YES;
+    }
+    else
+    {
+        _writeDeadline = 0;
+    }
+
+    [self _updateInterest];
+
+    // Our reactor only checks our deadlines when it thinks one might
+    // have expired, so it must know about the ones we just armed.
+    if (armed)
+    {
+        [_reactor scheduleConnection: self];
+    }
+
+    return value;
+}
+
+
+//
+//
+//
+- (NSInteger) startSSL
+{
+    return -1;
+}
+
+
+//
+//
+//
+- (NSInteger) waitForEventsWithTimeout: (NSTimeInterval) theTimeout
+{
+    struct epoll_event ev;
+    NSTimeInterval now, deadline;
+    int n;
+
+    if (_epfd < 0 || _reactor)
+    {
+        return -1;
+    }
+
+    now = monotonic_time();
+    deadline = [self nextDeadline];
+
+    if (deadline && deadline - now < theTimeout)
+    {
+        theTimeout = deadline - now;
+    }
+
+    while (n = epoll_wait(_epfd, &ev, 1, (theTimeout > 0 ? (int)ceil(theTimeout*1000) : 0)), n == -1 && errno == EINTR);
+
+    if (n > 0)
+    {
+        [self handleEvents: ev.events];
+    }
+
+    [self checkDeadlines: monotonic_time()];
+
+    return n;
+}
+
+
+//
+//
+//
+- (CWReactor *) reactor
+{
+    return _reactor;
+}
+
+
+//
+// We register in the new epoll set before leaving the old one
+// so that a failure leaves the connection untouched.
+//
+- (BOOL) setReactor: (CWReactor *) theReactor
+{
+    struct epoll_event ev;
+    int epfd;
+
+    if (_fd < 0 || _epfd < 0 || theReactor == _reactor)
+    {
+        return NO;
+    }
+
+    if (theReactor)
+    {
+        epfd = [theReactor fd];
+    }
+    else if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    {
+        return NO;
+    }
+
+    ev.events = _interest;
+    ev.data.ptr = (__bridge void *)self;
+
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, _fd, &ev) < 0)
+    {
+        if (!theReactor)
+        {
+            safe_close(epfd);
+        }
+
+        return NO;
+    }
+
+    if (_reactor)
+    {
+        epoll_ctl(_epfd, EPOLL_CTL_DEL, _fd, NULL);
+    }
+    else
+    {
+        safe_close(_epfd);
+    }
+
+    _epfd = epfd;
+    _reactor = theReactor;
+
+    return YES;
+}
+
+
+//
+// The delegate might close the connection from any of its callbacks,
+// so we verify our file descriptor after each of them.
+//
+- (void) handleEvents: (uint32_t) theEvents
+{
+    id<CWConnectionDelegate> aDelegate;
+
+    if (_fd < 0)
+    {
+        return;
+    }
+
+    aDelegate = self.delegate;
+
+    if (_connecting)
+    {
+        if (!(theEvents & (EPOLLOUT|EPOLLERR|EPOLLHUP)))
+        {
+            return;
+        }
+
+        if (![self _finishConnect])
+        {
+            // We only give up once no address is left.
+            if (![self _connectNextAddress])
+            {
+                [self _reportError: _error];
+            }
+            return;
+        }
+    }
+
+    if (_openPending)
+    {
+        _openPending = NO;
+        [aDelegate connectionReceivedOpenCompleted: self];
+
+        if (_fd < 0) return;
+    }
+
+    if (theEvents & (EPOLLIN|EPOLLERR|EPOLLHUP))
+    {
+        [aDelegate connectionReceivedReadEvent: self];
+
+        if (_fd < 0) return;
+    }
+
+    if (!_error && (theEvents & EPOLLOUT))
+    {
+        _wantsWrite = NO;
+        [aDelegate connectionReceivedWriteEvent: self];
+
+        if (_fd < 0) return;
+    }
+
+    if (_error)
+    {
+        [self _reportError: _error];
+        return;
+    }
+
+    [self _updateInterest];
+}
+
+
+//
+//
+//
+- (NSTimeInterval) nextDeadline
+{
+    NSTimeInterval deadline;
+
+    deadline = _attemptDeadline;
+
+    if (_readDeadline && (!deadline || _readDeadline < deadline))
+    {
+        deadline = _readDeadline;
+    }
+
+    if (_writeDeadline && (!deadline || _writeDeadline < deadline))
+    {
+        deadline = _writeDeadline;
+    }
+
+    return deadline;
+}
+
+
+//
+//
+//
+- (void) checkDeadlines: (NSTimeInterval) theTime
+{
+    NSTimeInterval deadline;
+
+    if (_fd < 0)
+    {
+        return;
+    }
+
+    deadline = [self nextDeadline];
+
+    if (deadline && deadline <= theTime)
+    {
+        if (_connecting && [self _connectNextAddress])
+        {
+            return;
+        }
+
+        [self _reportError: ETIMEDOUT];
+    }
+}
+
+
+//
+// We drop the socket of the previous attempt, if any, and initiate a
+// connection to the next address we can. Each attempt gets an equal
+// share of what is left of the connection timeout, so that one
+// unreachable address doesn't exhaust it.
+//
+- (BOOL) _connectNextAddress
+{
+    struct epoll_event ev;
+    struct addrinfo *ai;
+    NSTimeInterval now;
+    NSUInteger count;
+    int value;
+
+    if (_fd >= 0)
+    {
+        epoll_ctl(_epfd, EPOLL_CTL_DEL, _fd, NULL);
+        safe_close(_fd);
+        _fd = -1;
+    }
+
+    now = monotonic_time();
+
+    while ((ai = _nextAddress) && now < _connectDeadline)
+    {
+        _nextAddress = ai->ai_next;
+        _fd = socket(ai->ai_family, ai->ai_socktype|SOCK_NONBLOCK|SOCK_CLOEXEC, ai->ai_protocol);
+
+        if (_fd < 0)
+        {
+            _error = errno;
+            continue;
+        }
+
+        // IMAP, POP3 and SMTP are all request/response protocols with
+        // small commands, we don't want them to be delayed.
+        value = 1;
+        setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value));
+
+        // We wait for the socket to be writable, which tells us
+        // that the connection has been established (or has failed).
+        _interest = EPOLLIN|EPOLLOUT;
+        ev.events = _interest;
+        ev.data.ptr = (__bridge void *)self;
+
+        if ((connect(_fd, ai->ai_addr, ai->ai_addrlen) == 0 || errno == EINPROGRESS) &&
+            epoll_ctl(_epfd, EPOLL_CTL_ADD, _fd, &ev) == 0)
+        {
+            for (count = 1, ai = _nextAddress; ai; ai = ai->ai_next)
+            {
+                count++;
+            }
+
+            _error = 0;
+            _attemptDeadline = now + (_connectDeadline - now) / count;
+            [_reactor scheduleConnection: self];
+
+            return YES;
+        }
+
+        _error = errno;
+        safe_close(_fd);
+        _fd = -1;
+    }
+
+    return NO;
+}
+
+
+//
+//
+//
+- (BOOL) _finishConnect
+{
+    socklen_t len;
+    int value;
+
+    value = 0;
+    len = sizeof(value);
+
+    if (getsockopt(_fd, SOL_SOCKET, SO_ERROR, &value, &len) < 0)
+    {
+        value = errno;
+    }
+
+    if (value)
+    {
+        _error = value;
+        return NO;
+    }
+
+    _connecting = NO;
+    _openPending = YES;
+    _connectDeadline = _attemptDeadline = 0;
+
+    freeaddrinfo(_addresses);
+    _addresses = _nextAddress = NULL;
+
+    return YES;
+}
+
+
+//
+// We close the connection before informing the delegate so
+// that we don't get notified about the same error again.
+//
+- (void) _reportError: (int) theError
+{
+    NSDictionary *userInfo;
+    NSError *anError;
+
+    userInfo = [NSDictionary dictionaryWithObject: [NSString stringWithUTF8String: strerror(theError)]
+                                           forKey: NSLocalizedDescriptionKey];
+    anError = [NSError errorWithDomain: NSPOSIXErrorDomain  code: theError  userInfo: userInfo];
+
+    [self close];
+    [self.delegate connection: self  receivedError: anError];
+}
+
+
+//
+// We always listen for incoming bytes but only for the socket being
+// writable while connecting, before the delegate was told about it,
+// or while some bytes are waiting to be written.
+//
+- (void) _updateInterest
+{
+    struct epoll_event ev;
+    uint32_t interest;
+
+    if (_fd < 0 || _epfd < 0)
+    {
+        return;
+    }
+
+    interest = EPOLLIN;
+
+    if (_connecting || _openPending || _wantsWrite)
+    {
+        interest |= EPOLLOUT;
+    }
+
+    if (interest != _interest)
+    {
+        _interest = interest;
+        ev.events = interest;
+        ev.data.ptr = (__bridge void *)self;
+        epoll_ctl(_epfd, EPOLL_CTL_MOD, _fd, &ev);
+    }
+}
+
+@end
+
+#endif // __linux__
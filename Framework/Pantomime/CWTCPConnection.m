@@ -232,6 +232,38 @@
 }
 
 
+//
+// NSOutputStream has no gather write so we hand over the
+// segments one after the other, until the stream stops
+// accepting bytes.
+//
+- (NSInteger)writeVector:(const struct iovec*)iov count:(NSInteger)count
+{
+    NSInteger i, len, total;
+    
+    total = 0;
+    
+    for (i = 0; i < count && [_outputStream hasSpaceAvailable]; i++)
+    {
+        len = [_outputStream write:(const uint8_t *)iov[i].iov_base maxLength:iov[i].iov_len];
+        
+        if (len <= 0)
+        {
+            return (total > 0 ? total : len);
+        }
+        
+        total += len;
+        
+        if (len < (NSInteger)iov[i].iov_len)
+        {
+            break;
+        }
+    }
+    
+    return total;
+}
+
+
 //
 // 0  -> success
 // -1 ->
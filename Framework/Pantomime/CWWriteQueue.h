@@ -0,0 +1,89 @@
+/*
+**  CWWriteQueue.h
+**
+**  Copyright (c) 2001-2007
+**
+**  This library is free software; you can redistribute it and/or
+**  modify it under the terms of the GNU Lesser General Public
+**  License as published by the Free Software Foundation; either
+**  version 2.1 of the License, or (at your option) any later version.
+**
+**  This library is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+**  Lesser General Public License for more details.
+**
+**  You should have received a copy of the GNU Lesser General Public
+**  License along with this library; if not, write to the Free Software
+**  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#import <Foundation/Foundation.h>
+
+#include <sys/uio.h>
+
+/*!
+  @class CWWriteQueue
+  @discussion This class holds the bytes a CWService instance still has to
+              write on the socket. Rather than appending every fragment into
+	      one contiguous buffer, it keeps the NSData instances it is given
+	      as segments and hands them out as an iovec array, suitable for
+	      a single writev(2) call. Written bytes are consumed by advancing
+	      an offset in the first segment - nothing is ever copied or
+	      moved around.
+*/
+@interface CWWriteQueue : NSObject
+
+/*!
+  @method appendData:
+  @discussion This method is used to queue <i>theData</i>. The instance is
+              retained, not copied, so it must not be modified once queued.
+  @param theData The bytes to queue.
+*/
+- (void) appendData: (NSData *) theData;
+
+/*!
+  @method length
+  @discussion This method is used to obtain the number of bytes that
+              have not been written yet.
+  @result The number of pending bytes.
+*/
+- (NSUInteger) length;
+
+/*!
+  @method getIOVec: count: maxLength:
+  @discussion This method is used to describe the pending bytes as an
+              iovec array, starting with the first unwritten byte.
+  @param theIOVec The array to fill.
+  @param theCount The number of entries available in <i>theIOVec</i>.
+  @param theMaxLength The maximum number of bytes to describe.
+  @result The number of entries filled.
+*/
+- (NSInteger) getIOVec: (struct iovec *) theIOVec
+                 count: (NSInteger) theCount
+             maxLength: (NSUInteger) theMaxLength;
+
+/*!
+  @method subdataToLength:
+  @discussion This method is used to obtain a copy of the first
+              <i>theLength</i> pending bytes.
+  @param theLength The number of bytes to copy.
+  @result The bytes, as a NSData instance.
+*/
+- (NSData *) subdataToLength: (NSUInteger) theLength;
+
+/*!
+  @method consumeLength:
+  @discussion This method is used to drop <i>theLength</i> bytes once
+              they have been written on the socket.
+  @param theLength The number of bytes that were written.
+*/
+- (void) consumeLength: (NSUInteger) theLength;
+
+/*!
+  @method reset
+  @discussion This method is used to discard all pending bytes.
+*/
+- (void) reset;
+
+@end
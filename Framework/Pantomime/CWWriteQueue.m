@@ -0,0 +1,186 @@
+/*
+**  CWWriteQueue.m
+**
+**  Copyright (c) 2001-2007
+**
+**  This library is free software; you can redistribute it and/or
+**  modify it under the terms of the GNU Lesser General Public
+**  License as published by the Free Software Foundation; either
+**  version 2.1 of the License, or (at your option) any later version.
+**
+**  This library is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+**  Lesser General Public License for more details.
+**
+**  You should have received a copy of the GNU Lesser General Public
+**  License along with this library; if not, write to the Free Software
+**  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#import "CWWriteQueue.h"
+
+@implementation CWWriteQueue
+{
+    NSMutableArray *_segments;
+    NSUInteger _head;
+    NSUInteger _offset;
+    NSUInteger _length;
+}
+
+//
+//
+//
+- (id) init
+{
+    self = [super init];
+    if (self)
+    {
+        _segments = [[NSMutableArray alloc] init];
+        _head = _offset = _length = 0;
+    }
+    return self;
+}
+
+
+//
+//
+//
+- (void) appendData: (NSData *) theData
+{
+    if (theData && [theData length])
+    {
+        [_segments addObject: theData];
+        _length += [theData length];
+    }
+}
+
+
+//
+//
+//
+- (NSUInteger) length
+{
+    return _length;
+}
+
+
+//
+//
+//
+- (NSInteger) getIOVec: (struct iovec *) theIOVec
+                 count: (NSInteger) theCount
+             maxLength: (NSUInteger) theMaxLength
+{
+    NSUInteger i, count, offset, len, total;
+    NSInteger n;
+    NSData *aData;
+
+    count = [_segments count];
+    offset = _offset;
+    total = 0;
+    n = 0;
+
+    for (i = _head; i < count && n < theCount && total < theMaxLength; i++)
+    {
+        aData = [_segments objectAtIndex: i];
+        len = [aData length] - offset;
+
+        if (len > theMaxLength - total)
+        {
+            len = theMaxLength - total;
+        }
+
+        theIOVec[n].iov_base = (char *)[aData bytes] + offset;
+        theIOVec[n].iov_len = len;
+        total += len;
+        offset = 0;
+        n++;
+    }
+
+    return n;
+}
+
+
+//
+//
+//
+- (NSData *) subdataToLength: (NSUInteger) theLength
+{
+    NSMutableData *aMutableData;
+    NSUInteger i, count, offset, len;
+    NSData *aData;
+
+    aMutableData = [NSMutableData dataWithCapacity: theLength];
+    count = [_segments count];
+    offset = _offset;
+
+    for (i = _head; i < count && theLength > 0; i++)
+    {
+        aData = [_segments objectAtIndex: i];
+        len = [aData length] - offset;
+
+        if (len > theLength)
+        {
+            len = theLength;
+        }
+
+        [aMutableData appendBytes: (char *)[aData bytes] + offset  length: len];
+        theLength -= len;
+        offset = 0;
+    }
+
+    return aMutableData;
+}
+
+
+//
+// Fully written segments are released as we go. We only shrink
+// the array itself once in a while so that dropping the head
+// segment doesn't shift the whole array each time.
+//
+- (void) consumeLength: (NSUInteger) theLength
+{
+    NSUInteger len;
+
+    _length -= theLength;
+
+    while (theLength > 0)
+    {
+        len = [[_segments objectAtIndex: _head] length] - _offset;
+
+        if (theLength < len)
+        {
+            _offset += theLength;
+            return;
+        }
+
+        [_segments replaceObjectAtIndex: _head  withObject: [NSNull null]];
+        theLength -= len;
+        _offset = 0;
+        _head++;
+    }
+
+    if (_head == [_segments count])
+    {
+        [_segments removeAllObjects];
+        _head = 0;
+    }
+    else if (_head >= 64 && _head >= [_segments count]/2)
+    {
+        [_segments removeObjectsInRange: NSMakeRange(0, _head)];
+        _head = 0;
+    }
+}
+
+
+//
+//
+//
+- (void) reset
+{
+    [_segments removeAllObjects];
+    _head = _offset = _length = 0;
+}
+
+@end
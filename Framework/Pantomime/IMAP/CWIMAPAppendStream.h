@@ -0,0 +1,125 @@
+/*
+**  CWIMAPAppendStream.h
+**
+**  Copyright (c) 2001-2007
+**
+**  This library is free software; you can redistribute it and/or
+**  modify it under the terms of the GNU Lesser General Public
+**  License as published by the Free Software Foundation; either
+**  version 2.1 of the License, or (at your option) any later version.
+**
+**  This library is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+**  Lesser General Public License for more details.
+**
+**  You should have received a copy of the GNU Lesser General Public
+**  License along with this library; if not, write to the Free Software
+**  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef _Pantomime_H_CWIMAPAppendStream
+#define _Pantomime_H_CWIMAPAppendStream
+
+#import <Foundation/Foundation.h>
+
+/*!
+  @class CWIMAPAppendStream
+  @discussion This class produces what follows the command line of an
+              APPEND command appending one or more messages, as allowed
+	      by the MULTIAPPEND extension (RFC 3502): their literals,
+	      each one but the first preceded by its flags and length.
+
+	      The sources of the messages are either NSData instances or
+	      paths of files, which are mapped one at a time, only once
+	      their literal is reached. Their line breaks are converted to
+	      CRLF and the mbox separator ("From ...") they might start
+	      with is skipped as the literals are produced, a chunk at a
+	      time, so that a message is never held in memory as a whole.
+
+	      Non-empty literals up to the limit given at initialization
+	      time are non-synchronizing ones (RFC 7888) and immediately
+	      follow what precedes them. The others wait for a continuation
+	      request.
+*/
+@interface CWIMAPAppendStream : NSObject
+
+/*!
+  @method initWithSources: flags: nonSynchronizingLimit:
+  @discussion This method is used to initialize a stream appending
+              the messages of <i>theSources</i>.
+  @param theSources The raw sources, as NSData instances, or the
+                    paths of files holding them, as NSString instances.
+		    A file that can't be read is sent as an empty message,
+		    callers are expected to check them beforehand.
+  @param theFlags The flags of each message, as the content of a IMAP
+                  flag list, for example "\Seen \Flagged".
+  @param theLimit The length up to which literals are non-synchronizing
+                  ones. 0 if the server doesn't support them, NSUIntegerMax
+		  if it accepts them whatever their length is.
+  @result The instance.
+*/
+- (id) initWithSources: (NSArray *) theSources
+                 flags: (NSArray *) theFlags
+ nonSynchronizingLimit: (NSUInteger) theLimit;
+
+/*!
+  @method count
+  @discussion This method is used to obtain the number of messages
+              appended by the receiver.
+  @result The number of messages.
+*/
+- (NSUInteger) count;
+
+/*!
+  @method arguments
+  @discussion This method is used to obtain the flags and the length
+              of the first message, as they end the command line of
+	      the APPEND command.
+  @result The arguments, for example "(\Seen) {1024+}".
+*/
+- (NSString *) arguments;
+
+/*!
+  @method nextData
+  @discussion This method is used to obtain the next bytes to send once
+              the command line was sent. The last ones end the command.
+  @result The bytes, nil if the receiver waits for a continuation
+          request or if it's complete.
+*/
+- (NSData *) nextData;
+
+/*!
+  @method isWaiting
+  @discussion This method is used to verify if the receiver waits for
+              a continuation request before sending the next literal.
+  @result YES if it does, NO otherwise.
+*/
+- (BOOL) isWaiting;
+
+/*!
+  @method resume
+  @discussion This method is used to tell the receiver the continuation
+              request it was waiting for was received.
+*/
+- (void) resume;
+
+/*!
+  @method isComplete
+  @discussion This method is used to verify if the receiver produced
+              everything up to the end of the command.
+  @result YES if it did, NO otherwise.
+*/
+- (BOOL) isComplete;
+
+/*!
+  @method rewind
+  @discussion This method is used to produce everything again, from
+              the first literal, when the command is sent again after
+	      the connection was lost.
+*/
+- (void) rewind;
+
+@end
+
+#endif // _Pantomime_H_CWIMAPAppendStream
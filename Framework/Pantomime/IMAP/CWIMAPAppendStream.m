@@ -0,0 +1,305 @@
+/*
+**  CWIMAPAppendStream.m
+**
+**  Copyright (c) 2001-2007
+**
+**  This library is free software; you can redistribute it and/or
+**  modify it under the terms of the GNU Lesser General Public
+**  License as published by the Free Software Foundation; either
+**  version 2.1 of the License, or (at your option) any later version.
+**
+**  This library is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+**  Lesser General Public License for more details.
+**
+**  You should have received a copy of the GNU Lesser General Public
+**  License along with this library; if not, write to the Free Software
+**  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#import "CWIMAPAppendStream.h"
+
+#include <string.h>
+
+//
+// The literals are produced in chunks of about that size.
+//
+#define CHUNK_SIZE 65536
+
+typedef enum {
+    AppendStateLiteral,
+    AppendStateWaiting,
+    AppendStateComplete
+} AppendState;
+
+//
+// This C function is used to obtain the offset of the first byte sent
+// from a source, past the mbox separator line it might start with.
+//
+static NSUInteger source_start(const char *theBytes, NSUInteger theLength)
+{
+    const char *p;
+
+    if (theLength >= 5 && strncmp(theBytes, "From ", 5) == 0 && (p = memchr(theBytes, '\n', theLength)))
+    {
+        return (p - theBytes) + 1;
+    }
+
+    return 0;
+}
+
+//
+// This C function is used to obtain the length of the literal of a
+// source, which has a CR added before each LF not preceded by one.
+//
+static NSUInteger literal_length(const char *theBytes, NSUInteger theLength)
+{
+    const char *begin, *end, *p;
+    NSUInteger len;
+
+    begin = theBytes + source_start(theBytes, theLength);
+    end = theBytes + theLength;
+    len = end - begin;
+
+    for (p = begin; p < end && (p = memchr(p, '\n', end - p)); p++)
+    {
+        if (p == begin || *(p-1) != '\r')
+        {
+            len++;
+        }
+    }
+
+    return len;
+}
+
+@interface CWIMAPAppendStream ()
+
+- (NSData *) _dataAtIndex: (NSUInteger) theIndex;
+- (BOOL) _isNonSynchronizing: (NSUInteger) theLength;
+
+@end
+
+@implementation CWIMAPAppendStream
+{
+    NSArray *_sources;
+    NSArray *_flags;
+    NSUInteger _limit;
+    NSUInteger _index;
+    NSUInteger _firstLength;
+    NSData *_data;
+    NSUInteger _start;
+    NSUInteger _position;
+    AppendState _state;
+}
+
+//
+// The first source is only read to obtain the length of its literal,
+// it is read again once the command line was sent.
+//
+- (id) initWithSources: (NSArray *) theSources
+                 flags: (NSArray *) theFlags
+ nonSynchronizingLimit: (NSUInteger) theLimit
+{
+    self = [super init];
+    if (self)
+    {
+        NSData *aData;
+
+        _sources = theSources;
+        _flags = theFlags;
+        _limit = theLimit;
+        _firstLength = 0;
+
+        if ([_sources count])
+        {
+            aData = [self _dataAtIndex: 0];
+            _firstLength = literal_length([aData bytes], [aData length]);
+        }
+
+        [self rewind];
+    }
+    return self;
+}
+
+
+//
+//
+//
+- (NSUInteger) count
+{
+    return [_sources count];
+}
+
+
+//
+//
+//
+- (NSString *) arguments
+{
+    return [NSString stringWithFormat: @"(%@) {%lu%@}", [_flags objectAtIndex: 0], (unsigned long)_firstLength,
+                     ([self _isNonSynchronizing: _firstLength] ? @"+" : @"")];
+}
+
+
+//
+// A chunk ends once it is large enough or with the literal. The next
+// message, if any, is then announced in the same chunk.
+//
+- (NSData *) nextData
+{
+    NSMutableData *aMutableData;
+    const char *bytes, *p;
+    NSUInteger len, n;
+
+    if (_state != AppendStateLiteral)
+    {
+        return nil;
+    }
+
+    if (!_data)
+    {
+        _data = [self _dataAtIndex: _index];
+        _start = _position = source_start([_data bytes], [_data length]);
+    }
+
+    aMutableData = [NSMutableData dataWithCapacity: CHUNK_SIZE+2];
+    bytes = [_data bytes];
+    len = [_data length];
+
+    while ([aMutableData length] < CHUNK_SIZE && _position < len)
+    {
+        n = MIN(len - _position, CHUNK_SIZE - [aMutableData length]);
+        p = memchr(bytes + _position, '\n', n);
+
+        if (!p)
+        {
+            [aMutableData appendBytes: bytes + _position  length: n];
+            _position += n;
+            continue;
+        }
+
+        [aMutableData appendBytes: bytes + _position  length: p - (bytes + _position)];
+
+        if (p == bytes + _start || *(p-1) != '\r')
+        {
+            [aMutableData appendBytes: "\r\n"  length: 2];
+        }
+        else
+        {
+            [aMutableData appendBytes: "\n"  length: 1];
+        }
+
+        _position = (p - bytes) + 1;
+    }
+
+    if (_position < len)
+    {
+        return aMutableData;
+    }
+
+    _data = nil;
+    _index++;
+
+    if (_index < [_sources count])
+    {
+        _data = [self _dataAtIndex: _index];
+        _start = _position = source_start([_data bytes], [_data length]);
+        len = literal_length([_data bytes], [_data length]);
+
+        [aMutableData appendData: [[NSString stringWithFormat: @" (%@) {%lu%@}\r\n", [_flags objectAtIndex: _index], (unsigned long)len,
+                                           ([self _isNonSynchronizing: len] ? @"+" : @"")] dataUsingEncoding: NSASCIIStringEncoding]];
+        _state = ([self _isNonSynchronizing: len] ? AppendStateLiteral : AppendStateWaiting);
+    }
+    else
+    {
+        [aMutableData appendBytes: "\r\n"  length: 2];
+        _state = AppendStateComplete;
+    }
+
+    return aMutableData;
+}
+
+
+//
+//
+//
+- (BOOL) isWaiting
+{
+    return (_state == AppendStateWaiting);
+}
+
+
+//
+//
+//
+- (void) resume
+{
+    if (_state == AppendStateWaiting)
+    {
+        _state = AppendStateLiteral;
+    }
+}
+
+
+//
+//
+//
+- (BOOL) isComplete
+{
+    return (_state == AppendStateComplete);
+}
+
+
+//
+//
+//
+- (void) rewind
+{
+    _index = 0;
+    _data = nil;
+    _start = _position = 0;
+
+    if (![_sources count])
+    {
+        _state = AppendStateComplete;
+    }
+    else
+    {
+        _state = ([self _isNonSynchronizing: _firstLength] ? AppendStateLiteral : AppendStateWaiting);
+    }
+}
+
+
+//
+// Files are mapped, their pages are read as the literal is
+// produced and can be dropped once it was sent.
+//
+- (NSData *) _dataAtIndex: (NSUInteger) theIndex
+{
+    NSData *aData;
+    id aSource;
+
+    aSource = [_sources objectAtIndex: theIndex];
+
+    if ([aSource isKindOfClass: [NSData class]])
+    {
+        return aSource;
+    }
+
+    aData = [NSData dataWithContentsOfFile: aSource  options: NSDataReadingMappedIfSafe  error: NULL];
+
+    return (aData ? aData : [NSData data]);
+}
+
+
+//
+// Without LITERAL+ or LITERAL-, the limit is 0 and even an
+// empty literal must wait for a continuation request.
+//
+- (BOOL) _isNonSynchronizing: (NSUInteger) theLength
+{
+    return (theLength && theLength <= _limit);
+}
+
+@end
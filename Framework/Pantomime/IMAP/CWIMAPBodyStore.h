@@ -0,0 +1,162 @@
+/*
+**  CWIMAPBodyStore.h
+**
+**  Copyright (c) 2001-2007
+**
+**  This library is free software; you can redistribute it and/or
+**  modify it under the terms of the GNU Lesser General Public
+**  License as published by the Free Software Foundation; either
+**  version 2.1 of the License, or (at your option) any later version.
+**
+**  This library is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+**  Lesser General Public License for more details.
+**
+**  You should have received a copy of the GNU Lesser General Public
+**  License along with this library; if not, write to the Free Software
+**  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef _Pantomime_H_CWIMAPBodyStore
+#define _Pantomime_H_CWIMAPBodyStore
+
+#import <Foundation/Foundation.h>
+
+@class CWIMAPMessage;
+
+/*!
+  @class CWIMAPBodyStore
+  @discussion This class keeps the raw sources of IMAP messages on disk
+              so that they don't have to be fetched again from the IMAP
+	      server once the folder is closed or the connection is lost.
+
+	      A source is found from the name of the folder of its message,
+	      the UIDVALIDITY of that folder and the message's UID. Sources
+	      are stored in a directory, in files named after the SHA-256
+	      digest of their content. Identical sources, like a message
+	      copied to another folder, are thus stored only once.
+
+	      The total size of the files is kept under a budget: when it
+	      is exceeded, the least recently used sources are removed.
+
+	      The association between messages and files, as well as the
+	      order in which the sources were used, is written in an index
+	      file by -synchronize. Files written since the last time the
+	      index was written are removed when the store is opened again.
+*/
+@interface CWIMAPBodyStore : NSObject
+
+/*!
+  @method initWithPath:
+  @discussion This method is used to open the store found in the directory
+              <i>thePath</i>, which is created if it doesn't exist.
+  @param thePath The full path of the directory.
+  @result The instance, nil if the directory can't be created.
+*/
+- (id) initWithPath: (NSString *) thePath;
+
+/*!
+  @method budget
+  @discussion This method is used to obtain the size the files of
+              the receiver can't exceed.
+  @result The size in bytes.
+*/
+- (unsigned long long) budget;
+
+/*!
+  @method setBudget:
+  @discussion This method is used to set the size the files of the
+              receiver can't exceed. The least recently used sources
+	      are removed right away if it is already exceeded. The
+	      default budget is 100 MB.
+  @param theBudget The size in bytes.
+*/
+- (void) setBudget: (unsigned long long) theBudget;
+
+/*!
+  @method size
+  @discussion This method is used to obtain the size of the files
+              of the receiver.
+  @result The size in bytes.
+*/
+- (unsigned long long) size;
+
+/*!
+  @method dataForUID: UIDValidity: folder:
+  @discussion This method is used to obtain the raw source of the message
+              whose UID is <i>theUID</i> in the folder <i>theFolder</i>
+	      having <i>theUIDValidity</i> as UIDVALIDITY. The source
+	      becomes the most recently used one.
+  @param theUID The UID of the message.
+  @param theUIDValidity The UIDVALIDITY of the folder.
+  @param theFolder The name of the folder.
+  @result The source, which maps its file when possible. nil if
+          the receiver doesn't have it.
+*/
+- (NSData *) dataForUID: (NSUInteger) theUID
+            UIDValidity: (NSUInteger) theUIDValidity
+                 folder: (NSString *) theFolder;
+
+/*!
+  @method setData: forUID: UIDValidity: folder:
+  @discussion This method is used to store <i>theData</i> as the raw source
+              of the message whose UID is <i>theUID</i> in the folder
+	      <i>theFolder</i> having <i>theUIDValidity</i> as UIDVALIDITY.
+	      Sources larger than the budget aren't stored.
+  @param theData The raw source.
+  @param theUID The UID of the message.
+  @param theUIDValidity The UIDVALIDITY of the folder.
+  @param theFolder The name of the folder.
+*/
+- (void) setData: (NSData *) theData
+          forUID: (NSUInteger) theUID
+     UIDValidity: (NSUInteger) theUIDValidity
+          folder: (NSString *) theFolder;
+
+/*!
+  @method removeDataForUID: UIDValidity: folder:
+  @discussion This method is used to remove the raw source of the message
+              whose UID is <i>theUID</i> in the folder <i>theFolder</i>
+	      having <i>theUIDValidity</i> as UIDVALIDITY. Its file is
+	      removed unless another message has the same source.
+  @param theUID The UID of the message.
+  @param theUIDValidity The UIDVALIDITY of the folder.
+  @param theFolder The name of the folder.
+*/
+- (void) removeDataForUID: (NSUInteger) theUID
+              UIDValidity: (NSUInteger) theUIDValidity
+                   folder: (NSString *) theFolder;
+
+/*!
+  @method dataForMessage:
+  @discussion This method invokes -dataForUID:UIDValidity:folder: with
+              the UID of <i>theMessage</i> and the UIDVALIDITY and name
+	      of its folder.
+  @param theMessage The message.
+  @result The source, nil if the receiver doesn't have it or if
+          <i>theMessage</i> has no folder.
+*/
+- (NSData *) dataForMessage: (CWIMAPMessage *) theMessage;
+
+/*!
+  @method setData: forMessage:
+  @discussion This method invokes -setData:forUID:UIDValidity:folder: with
+              the UID of <i>theMessage</i> and the UIDVALIDITY and name
+	      of its folder.
+  @param theData The raw source.
+  @param theMessage The message.
+*/
+- (void) setData: (NSData *) theData  forMessage: (CWIMAPMessage *) theMessage;
+
+/*!
+  @method synchronize
+  @discussion This method is used to write the index of the receiver.
+              The index is replaced atomically.
+  @result YES on success, NO otherwise.
+*/
+- (BOOL) synchronize;
+
+@end
+
+#endif // _Pantomime_H_CWIMAPBodyStore
@@ -0,0 +1,480 @@
+/*
+**  CWIMAPBodyStore.m
+**
+**  Copyright (c) 2001-2007
+**
+**  This library is free software; you can redistribute it and/or
+**  modify it under the terms of the GNU Lesser General Public
+**  License as published by the Free Software Foundation; either
+**  version 2.1 of the License, or (at your option) any later version.
+**
+**  This library is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+**  Lesser General Public License for more details.
+**
+**  You should have received a copy of the GNU Lesser General Public
+**  License along with this library; if not, write to the Free Software
+**  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#import "CWIMAPBodyStore.h"
+
+#import "CWIMAPFolder.h"
+#import "CWIMAPMessage.h"
+
+#import <CommonCrypto/CommonDigest.h>
+
+#define DEFAULT_BUDGET 104857600ULL
+#define INDEX_FILE @"index"
+#define INDEX_VERSION 1
+
+//
+// CC_SHA256_Update() takes a 32-bit length, larger
+// sources are digested in chunks of this size.
+//
+#define DIGEST_CHUNK 1073741824UL
+
+//
+// This C function is used to obtain the SHA-256 digest of
+// theData as a string of 64 hexadecimal digits.
+//
+static NSString *digest_string(NSData *theData)
+{
+  unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+  char buf[CC_SHA256_DIGEST_LENGTH*2+1];
+  const unsigned char *bytes;
+  NSUInteger len, n;
+  CC_SHA256_CTX c;
+  int i;
+
+  bytes = [theData bytes];
+  len = [theData length];
+
+  CC_SHA256_Init(&c);
+
+  while (len)
+    {
+      n = (len > DIGEST_CHUNK ? DIGEST_CHUNK : len);
+      CC_SHA256_Update(&c, bytes, (CC_LONG)n);
+      bytes += n;
+      len -= n;
+    }
+
+  CC_SHA256_Final(digest, &c);
+
+  for (i = 0; i < CC_SHA256_DIGEST_LENGTH; i++)
+    {
+      snprintf(buf+i*2, 3, "%02x", digest[i]);
+    }
+
+  return [NSString stringWithCString: buf  encoding: NSASCIIStringEncoding];
+}
+
+//
+// This C function is used to obtain the key of a source. UIDs are
+// only unique in a folder for a given UIDVALIDITY.
+//
+static inline NSString *source_key(NSUInteger theUID, NSUInteger theUIDValidity, NSString *theFolder)
+{
+  return [NSString stringWithFormat: @"%lu %lu %@", (unsigned long)theUIDValidity, (unsigned long)theUID, theFolder];
+}
+
+@interface CWIMAPBodyStore ()
+
+- (void) _evict;
+- (void) _removeDigest: (NSString *) theDigest;
+- (void) _removeKey: (NSString *) theKey;
+- (void) _touch: (NSString *) theDigest;
+
+@end
+
+@implementation CWIMAPBodyStore
+{
+  NSString *_path;
+
+  // The digest of the source of each key.
+  NSMutableDictionary *_keys;
+
+  // The keys having each digest as their source.
+  NSMutableDictionary *_sources;
+
+  // The size of each file.
+  NSMutableDictionary *_sizes;
+
+  // The digests, the least recently used first.
+  NSMutableOrderedSet *_order;
+
+  unsigned long long _budget;
+  unsigned long long _size;
+  BOOL _dirty;
+}
+
+//
+// Files the index doesn't know about were written after it was last
+// synchronized, or are left over from an atomic write. We remove them
+// along with the files no key refers to.
+//
+- (id) initWithPath: (NSString *) thePath
+{
+  self = [super init];
+  if (self)
+    {
+      NSDictionary *allKeys, *aDictionary;
+      NSArray *allDigests, *allSizes;
+      NSString *aDigest, *aKey;
+      NSEnumerator *theEnumerator;
+      NSFileManager *aFileManager;
+      NSUInteger i;
+
+      aFileManager = [NSFileManager defaultManager];
+
+      if (![aFileManager createDirectoryAtPath: thePath  withIntermediateDirectories: YES  attributes: nil  error: NULL])
+	{
+	  return nil;
+	}
+
+      _path = thePath;
+      _keys = [[NSMutableDictionary alloc] init];
+      _sources = [[NSMutableDictionary alloc] init];
+      _sizes = [[NSMutableDictionary alloc] init];
+      _order = [[NSMutableOrderedSet alloc] init];
+      _budget = DEFAULT_BUDGET;
+      _size = 0;
+      _dirty = NO;
+
+      aDictionary = [NSDictionary dictionaryWithContentsOfFile: [_path stringByAppendingPathComponent: INDEX_FILE]];
+
+      if ([[aDictionary objectForKey: @"Version"] intValue] == INDEX_VERSION)
+	{
+	  allDigests = [aDictionary objectForKey: @"Digests"];
+	  allSizes = [aDictionary objectForKey: @"Sizes"];
+	  allKeys = [aDictionary objectForKey: @"Keys"];
+
+	  for (i = 0; i < [allDigests count] && i < [allSizes count]; i++)
+	    {
+	      aDigest = [allDigests objectAtIndex: i];
+	      [_sizes setObject: [allSizes objectAtIndex: i]  forKey: aDigest];
+	      [_sources setObject: [NSMutableSet set]  forKey: aDigest];
+	      [_order addObject: aDigest];
+	      _size += [[allSizes objectAtIndex: i] unsignedLongLongValue];
+	    }
+
+	  theEnumerator = [allKeys keyEnumerator];
+
+	  while ((aKey = [theEnumerator nextObject]))
+	    {
+	      aDigest = [allKeys objectForKey: aKey];
+
+	      if ([_sources objectForKey: aDigest])
+		{
+		  [_keys setObject: aDigest  forKey: aKey];
+		  [[_sources objectForKey: aDigest] addObject: aKey];
+		}
+	    }
+	}
+
+      theEnumerator = [[aFileManager contentsOfDirectoryAtPath: _path  error: NULL] objectEnumerator];
+
+      while ((aDigest = [theEnumerator nextObject]))
+	{
+	  if (![aDigest isEqualToString: INDEX_FILE] && ![_sizes objectForKey: aDigest])
+	    {
+	      [aFileManager removeItemAtPath: [_path stringByAppendingPathComponent: aDigest]  error: NULL];
+	    }
+	}
+
+      for (i = [_order count]; i > 0; i--)
+	{
+	  aDigest = [_order objectAtIndex: i-1];
+
+	  if (![[_sources objectForKey: aDigest] count])
+	    {
+	      [self _removeDigest: aDigest];
+	    }
+	}
+    }
+  return self;
+}
+
+
+//
+//
+//
+- (void) dealloc
+{
+  [self synchronize];
+}
+
+
+//
+//
+//
+- (unsigned long long) budget
+{
+  return _budget;
+}
+
+- (void) setBudget: (unsigned long long) theBudget
+{
+  _budget = theBudget;
+  [self _evict];
+}
+
+
+//
+//
+//
+- (unsigned long long) size
+{
+  return _size;
+}
+
+
+//
+// The file might have been removed behind our back, we then
+// forget about it.
+//
+- (NSData *) dataForUID: (NSUInteger) theUID
+            UIDValidity: (NSUInteger) theUIDValidity
+                 folder: (NSString *) theFolder
+{
+  NSString *aDigest;
+  NSData *aData;
+
+  if (!theUID || !theFolder)
+    {
+      return nil;
+    }
+
+  aDigest = [_keys objectForKey: source_key(theUID, theUIDValidity, theFolder)];
+
+  if (!aDigest)
+    {
+      return nil;
+    }
+
+  aData = [NSData dataWithContentsOfFile: [_path stringByAppendingPathComponent: aDigest]
+		  options: NSDataReadingMappedIfSafe
+		  error: NULL];
+
+  if (!aData)
+    {
+      [self _removeDigest: aDigest];
+      return nil;
+    }
+
+  [self _touch: aDigest];
+
+  return aData;
+}
+
+
+//
+// The source of a message never changes, but it can be stored
+// again under a different digest if its file was removed.
+//
+- (void) setData: (NSData *) theData
+          forUID: (NSUInteger) theUID
+     UIDValidity: (NSUInteger) theUIDValidity
+          folder: (NSString *) theFolder
+{
+  NSString *aDigest, *aKey, *oldDigest;
+  unsigned long long len;
+
+  len = [theData length];
+
+  if (!theData || !theUID || !theFolder || len > _budget)
+    {
+      return;
+    }
+
+  aKey = source_key(theUID, theUIDValidity, theFolder);
+  aDigest = digest_string(theData);
+  oldDigest = [_keys objectForKey: aKey];
+
+  if ([oldDigest isEqualToString: aDigest])
+    {
+      [self _touch: aDigest];
+      return;
+    }
+
+  if (oldDigest)
+    {
+      [self _removeKey: aKey];
+    }
+
+  if (![_sizes objectForKey: aDigest])
+    {
+      if (![theData writeToFile: [_path stringByAppendingPathComponent: aDigest]  atomically: YES])
+	{
+	  return;
+	}
+
+      [_sizes setObject: [NSNumber numberWithUnsignedLongLong: len]  forKey: aDigest];
+      [_sources setObject: [NSMutableSet set]  forKey: aDigest];
+      _size += len;
+    }
+
+  [_keys setObject: aDigest  forKey: aKey];
+  [[_sources objectForKey: aDigest] addObject: aKey];
+  [self _touch: aDigest];
+  [self _evict];
+}
+
+
+//
+//
+//
+- (void) removeDataForUID: (NSUInteger) theUID
+              UIDValidity: (NSUInteger) theUIDValidity
+                   folder: (NSString *) theFolder
+{
+  if (theUID && theFolder)
+    {
+      [self _removeKey: source_key(theUID, theUIDValidity, theFolder)];
+    }
+}
+
+
+//
+//
+//
+- (NSData *) dataForMessage: (CWIMAPMessage *) theMessage
+{
+  CWIMAPFolder *aFolder;
+
+  aFolder = (CWIMAPFolder *)[theMessage folder];
+
+  return [self dataForUID: [theMessage uid]  UIDValidity: [aFolder uidValidity]  folder: [aFolder name]];
+}
+
+
+//
+//
+//
+- (void) setData: (NSData *) theData  forMessage: (CWIMAPMessage *) theMessage
+{
+  CWIMAPFolder *aFolder;
+
+  aFolder = (CWIMAPFolder *)[theMessage folder];
+
+  [self setData: theData  forUID: [theMessage uid]  UIDValidity: [aFolder uidValidity]  folder: [aFolder name]];
+}
+
+
+//
+// The digests and their sizes are written as two arrays, in
+// the order the sources were used.
+//
+- (BOOL) synchronize
+{
+  NSMutableArray *allSizes;
+  NSDictionary *aDictionary;
+  NSUInteger i;
+
+  if (!_dirty)
+    {
+      return YES;
+    }
+
+  allSizes = [NSMutableArray arrayWithCapacity: [_order count]];
+
+  for (i = 0; i < [_order count]; i++)
+    {
+      [allSizes addObject: [_sizes objectForKey: [_order objectAtIndex: i]]];
+    }
+
+  aDictionary = [NSDictionary dictionaryWithObjectsAndKeys:
+				[NSNumber numberWithInt: INDEX_VERSION], @"Version",
+			      [_order array], @"Digests",
+			      allSizes, @"Sizes",
+			      _keys, @"Keys",
+			      nil];
+
+  if (![aDictionary writeToFile: [_path stringByAppendingPathComponent: INDEX_FILE]  atomically: YES])
+    {
+      return NO;
+    }
+
+  _dirty = NO;
+
+  return YES;
+}
+
+
+//
+//
+//
+- (void) _evict
+{
+  while (_size > _budget && [_order count])
+    {
+      [self _removeDigest: [_order firstObject]];
+    }
+}
+
+
+//
+// The keys having this source are removed with it.
+//
+- (void) _removeDigest: (NSString *) theDigest
+{
+  NSEnumerator *theEnumerator;
+  NSString *aKey;
+
+  theEnumerator = [[_sources objectForKey: theDigest] objectEnumerator];
+
+  while ((aKey = [theEnumerator nextObject]))
+    {
+      [_keys removeObjectForKey: aKey];
+    }
+
+  [[NSFileManager defaultManager] removeItemAtPath: [_path stringByAppendingPathComponent: theDigest]  error: NULL];
+
+  _size -= [[_sizes objectForKey: theDigest] unsignedLongLongValue];
+  [_sources removeObjectForKey: theDigest];
+  [_sizes removeObjectForKey: theDigest];
+  [_order removeObject: theDigest];
+  _dirty = YES;
+}
+
+
+//
+// The file goes away with the last key having it as its source.
+//
+- (void) _removeKey: (NSString *) theKey
+{
+  NSMutableSet *allKeys;
+  NSString *aDigest;
+
+  aDigest = [_keys objectForKey: theKey];
+
+  if (!aDigest)
+    {
+      return;
+    }
+
+  allKeys = [_sources objectForKey: aDigest];
+  [allKeys removeObject: theKey];
+  [_keys removeObjectForKey: theKey];
+  _dirty = YES;
+
+  if (![allKeys count])
+    {
+      [self _removeDigest: aDigest];
+    }
+}
+
+
+//
+//
+//
+- (void) _touch: (NSString *) theDigest
+{
+  [_order removeObject: theDigest];
+  [_order addObject: theDigest];
+  _dirty = YES;
+}
+
+@end
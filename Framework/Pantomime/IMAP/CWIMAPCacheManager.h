@@ -30,6 +30,17 @@
   @class CWIMAPCacheManager
   @discussion This class provides trivial extensions to the
               CWCacheManager superclass for CWIMAPFolder instances.
+
+	      The cache is made of four files: the records of the messages,
+	      at -path, the headers they cache, their flags and the journal
+	      of removed messages, in files with the same name and the heap,
+	      flags and journal extensions added. The records of removed
+	      messages are dropped when the cache is compacted, which is
+	      done in the background once -synchronize finds they make
+	      most of it. A later -synchronize replaces the files.
+
+	      Records are normally written in the order of their UIDs.
+	      See -setAcceptsUnorderedRecords: otherwise.
 */
 @interface CWIMAPCacheManager: CWCacheManager
 
@@ -43,6 +54,31 @@
  */
 @property NSUInteger uidValidity;
 
+/*!
+ @method highestModSeq
+ @discussion This method is used to obtain the highest mod-sequence
+ (RFC4551) the receiver's cache is synchronized with. It
+ is 0 if unknown, for example if the server doesn't
+ support CONDSTORE, which forces a full resynchronization.
+ It only means something for the UID validity of the cache.
+ @result The highest mod-sequence.
+ */
+@property unsigned long long highestModSeq;
+
+/*!
+ @method acceptsUnorderedRecords
+ @discussion This method is used to verify if records can be written
+ in any order, like when the newest messages of a folder
+ are fetched first. Until it is set back to NO, records are
+ found through a table in memory and -synchronize only
+ writes them, the header of the cache is left alone. The
+ next -synchronize sorts them once it is set back to NO.
+ If the application stops before, the records written
+ meanwhile are dropped when the cache is opened again.
+ @result YES if records can be written in any order, NO otherwise.
+ */
+@property (nonatomic) BOOL acceptsUnorderedRecords;
+
 /*!
   @method messageWithUID:
   @discussion This method is used to obtain the CWIMAPMessage instance
@@ -53,6 +89,17 @@
 - (CWIMAPMessage *) messageWithUID: (NSUInteger) theUID;
 
 
+/*!
+  @method readHeaders: ofMessage:
+  @discussion This method is used to decode the cached headers
+              <i>theHeaders</i> of <i>theMessage</i> from its record.
+	      It is invoked by CWIMAPMessage: -readCachedHeaders:.
+	      Nothing is done if the message isn't cached.
+  @param theHeaders A combination of the values of the PantomimeCachedHeader enum.
+  @param theMessage The message.
+*/
+- (void) readHeaders: (NSUInteger) theHeaders  ofMessage: (CWIMAPMessage *) theMessage;
+
 /*!
   @method removeMessageWithUID:
   @discussion This method is used to remove the associated
@@ -61,14 +108,34 @@
 */
 - (void) removeMessageWithUID: (NSUInteger) theUID;
 
+/*!
+  @method updateFlagsOfMessage:
+  @discussion This method is used to record in the cache that the flags
+              of <i>theMessage</i> changed. The flags are written back by
+	      -synchronize, which only writes the flags recorded this way.
+	      Nothing is done if the message isn't cached.
+  @param theMessage The message whose flags changed.
+*/
+- (void) updateFlagsOfMessage: (CWIMAPMessage *) theMessage;
+
 /*!
   @method writeRecord:message:
   @discussion This method is used to write a cache record to disk.
+              Records are written in batches, see CWCacheWriter. A
+	      batch is written once it's large enough, when the records
+	      are read again or by -synchronize.
   @param theRecord The record to write.
   @param theMessage The message associated to the record <i>theRecord</i>.
 */
 - (void) writeRecord: (CWCacheRecord *) theRecord  message: (id) theMessage;
 
+/*!
+  @method expunge
+  @discussion This method is used to record in the journal of the cache
+              the messages removed with -removeMessageWithUID: since it
+	      was last invoked. Their records are kept until the cache
+	      is compacted.
+*/
 - (void) expunge;
 
 @end
@@ -20,6 +20,7 @@
 **  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 */
 
+
 #import "CWIMAPCacheManager.h"
 
 #include "io.h"
@@ -27,18 +28,348 @@
 #import "CWFlags.h"
 #import "CWFolder.h"
 #import "CWIMAPMessage.h"
+#import "CWIMAPUIDIndex.h"
 #import "CWParser.h"
 #import "CWCacheRecord.h"
+#import "CWCacheWriter.h"
+
+#include <dispatch/dispatch.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static unsigned short version = 3;
+
+//
+// Cache structure, since version 3:
+//
+// The cache file holds a header followed by a fixed-size record per
+// message, so any record can be found without reading the previous ones.
+// The cached headers are kept in a separate file, the string heap, which
+// is only appended to. Both files are read through mmap().
+//
+// Start   length Description
+//
+// 0       2      Cache version
+// 2       2      Record size
+// 4       4      Number of records
+// 8       4      UID validity
+// 12      4      Cache flags
+// 16      8      Highest mod-sequence
+// 24      8      Length of the string heap
+// 32             Beginning of the first record
+//
+// 0       4      Flags
+// 4       4      Date
+// 8       4      UID
+// 12      4      Size
+// 16      8      Position of the cached headers in the string heap
+// 24      14     Lengths of the From, In-Reply-To, Message-ID, References,
+//                Subject, To and Cc headers, which follow each other there
+//                in the order of the PantomimeCachedHeader values
+// 38      2      Unused
+//
+// The flags file, next to them, holds the UID and the flags of each
+// record, 4 bytes each, in the same order. The flags are read from it
+// and it stays mapped, so that changing the flags of a message only
+// dirties the page holding them. The flags in the records are those the
+// messages had when the records were written or last compacted,
+// they are used to rebuild the flags file if it's missing.
+//
+// Records are only appended, in batches: the headers of a batch are
+// written first, then the flags and the records, a single write each.
+// Those written after the header was last updated are recovered when
+// the cache is opened. Removed messages are
+// logged in the journal, which holds their UIDs, 4 bytes each, and their
+// records are kept until the cache is compacted. A compaction writes
+// the records, string heap and flags to new files, with the new
+// extension added, which replace the old ones once complete: the new
+// records first, then the others. A compaction interrupted before the
+// records were replaced is dropped, one interrupted after is completed.
+// The records are copied in the background, from a snapshot of the cache.
+// The records appended meanwhile and the flags are added by -synchronize,
+// which then replaces the old files. A compaction still running when the
+// cache is released is dropped, the next one starts when it is opened.
+//
+// Records can also be appended in any order, for example when the newest
+// messages of a folder are fetched first. The UNORDERED_RECORDS cache flag
+// is then set and the header isn't written again until a compaction sorted
+// them: the records written after it are dropped instead of recovered.
+//
+// Versions 1 and 2 had a 10 and 18 bytes long header (without the
+// highest mod-sequence for the former) followed by records prefixed
+// by their length, holding the headers. They are migrated when opened.
+//
+#define HEADER_SIZE 32L
+#define RECORD_SIZE 40L
+#define HEADER_SIZE_V1 10L
+#define HEADER_SIZE_V2 18L
+#define FIELD_COUNT 7
+#define FLAGS_ENTRY_SIZE 8L
+#define JOURNAL_ENTRY_SIZE 4L
+#define BUFFER_SIZE 65536
+#define UNORDERED_RECORDS 1
+
+//
+// A record, in the order the compaction sorts them.
+//
+struct record_entry
+{
+    NSUInteger uid;
+    NSUInteger index;
+};
+
+//
+// This C function is used by qsort() to order records by UID.
+//
+static int compare_record_entries(const void *a, const void *b)
+{
+    NSUInteger uid_a, uid_b;
+    
+    uid_a = ((const struct record_entry *)a)->uid;
+    uid_b = ((const struct record_entry *)b)->uid;
+    
+    return (uid_a < uid_b ? -1 : (uid_a > uid_b ? 1 : 0));
+}
+
+//
+// This C function is used to obtain the size of the pages
+// the flags file is mapped and written back with.
+//
+static size_t page_size(void)
+{
+    static size_t size = 0;
+    
+    if (!size)
+    {
+        size = (size_t)sysconf(_SC_PAGESIZE);
+    }
+    
+    return size;
+}
+
+//
+// This C function is used to map the first theLength bytes of the
+// file fd. It returns NULL on error or if there is nothing to map.
+//
+static unsigned char *map_file(int fd, size_t theLength, int theProtection)
+{
+    void *m;
+    
+    if (!theLength)
+    {
+        return NULL;
+    }
+    
+    m = mmap(NULL, theLength, theProtection, MAP_SHARED, fd, 0);
+    
+    return (m == MAP_FAILED ? NULL : (unsigned char *)m);
+}
+
+//
+// This C function is used to write a record in r.
+//
+static void write_record_memory(unsigned char *r, NSUInteger theFlags, NSUInteger theDate, NSUInteger theUID, NSUInteger theSize,
+                                unsigned long long theOffset, unsigned short *theLengths)
+{
+    NSUInteger i;
+    
+    memset(r, 0, RECORD_SIZE);
+    write_unsigned_int_memory(r, theFlags);
+    write_unsigned_int_memory(r+4, theDate);
+    write_unsigned_int_memory(r+8, theUID);
+    write_unsigned_int_memory(r+12, theSize);
+    write_unsigned_long_long_memory(r+16, theOffset);
+    
+    for (i = 0; i < FIELD_COUNT; i++)
+    {
+        write_unsigned_short_memory(r+24+i*2, theLengths[i]);
+    }
+}
+
+//
+// This C function is used to obtain the number of bytes the
+// headers of the record r use in the string heap.
+//
+static unsigned long long record_heap_length(unsigned char *r)
+{
+    unsigned long long len;
+    NSUInteger i;
+    
+    for (len = 0, i = 0; i < FIELD_COUNT; i++)
+    {
+        len += read_unsigned_short_memory(r+24+i*2);
+    }
+    
+    return len;
+}
+
+//
+// This C function is used to append theLength bytes to theBuffer,
+// writing its content to fd first if they don't fit.
+//
+static BOOL append_block(int fd, NSMutableData *theBuffer, const void *theBytes, NSUInteger theLength)
+{
+    if ([theBuffer length] + theLength > BUFFER_SIZE)
+    {
+        if (write_block(fd, [theBuffer bytes], [theBuffer length]) < 0)
+        {
+            return NO;
+        }
+        
+        [theBuffer setLength: 0];
+    }
+    
+    [theBuffer appendBytes: theBytes  length: theLength];
+    
+    return YES;
+}
+
+//
+// A compaction running in the background, see -_startCompaction.
+// The records and string heap of the snapshot are mapped until the
+// kept records are written, the flags of the snapshot are a copy.
+//
+struct compaction
+{
+    unsigned char *index;
+    size_t index_length;
+    unsigned char *heap;
+    unsigned long long heap_length;
+    unsigned char *flags;
+    NSUInteger count;
+    int fd, heap_fd, flags_fd;
+    int cancelled;
+    BOOL result;
+    NSUInteger *kept;
+    NSUInteger kept_count;
+    unsigned long long offset;
+};
 
+//
+// This C function is used to write the records of the snapshot of
+// theCompaction, except those of theUIDs, to its new records and their
+// headers to its new string heap. The index each kept record had is
+// recorded so that their flags can be written once it's done.
+//
+static void compact_records(struct compaction *theCompaction, NSIndexSet *theUIDs)
+{
+    unsigned char record[RECORD_SIZE], *r;
+    NSMutableData *records, *strings;
+    unsigned long long len;
+    NSUInteger i;
+    
+    records = [NSMutableData dataWithCapacity: BUFFER_SIZE];
+    strings = [NSMutableData dataWithCapacity: BUFFER_SIZE];
+    theCompaction->kept = (NSUInteger *)malloc(theCompaction->count*sizeof(NSUInteger));
+    theCompaction->result = (theCompaction->kept && lseek(theCompaction->fd, HEADER_SIZE, SEEK_SET) >= 0);
+    
+    for (i = 0; theCompaction->result && i < theCompaction->count; i++)
+    {
+        if (__atomic_load_n(&theCompaction->cancelled, __ATOMIC_RELAXED))
+        {
+            theCompaction->result = NO;
+            break;
+        }
+        
+        r = theCompaction->index + HEADER_SIZE + i*RECORD_SIZE;
+        
+        if ([theUIDs containsIndex: read_unsigned_int_memory(r+8)])
+        {
+            continue;
+        }
+        
+        memcpy(record, r, RECORD_SIZE);
+        memcpy(record, theCompaction->flags+i*FLAGS_ENTRY_SIZE+4, 4);
+        len = record_heap_length(r);
+        
+        // We don't keep headers we don't have.
+        if (len && read_unsigned_long_long_memory(r+16) + len <= theCompaction->heap_length)
+        {
+            theCompaction->result = append_block(theCompaction->heap_fd, strings, theCompaction->heap+read_unsigned_long_long_memory(r+16), len);
+            write_unsigned_long_long_memory(record+16, theCompaction->offset);
+            theCompaction->offset += len;
+        }
+        else
+        {
+            write_unsigned_long_long_memory(record+16, theCompaction->offset);
+            memset(record+24, 0, FIELD_COUNT*2);
+        }
+        
+        theCompaction->result = (theCompaction->result && append_block(theCompaction->fd, records, record, RECORD_SIZE));
+        theCompaction->kept[theCompaction->kept_count++] = i;
+    }
+    
+    theCompaction->result = (theCompaction->result &&
+                             write_block(theCompaction->heap_fd, [strings bytes], [strings length]) >= 0 &&
+                             write_block(theCompaction->fd, [records bytes], [records length]) >= 0);
+    
+    munmap(theCompaction->index, theCompaction->index_length);
+    if (theCompaction->heap) munmap(theCompaction->heap, theCompaction->heap_length);
+    theCompaction->index = theCompaction->heap = NULL;
+}
 
-static unsigned short version = 1;
+//
+// This C function is used to obtain the theLength bytes at *theBytes,
+// without copying them, and to advance *theBytes past them.
+//
+static inline NSData *next_field(unsigned char **theBytes, unsigned short theLength)
+{
+    NSData *aData;
+    
+    aData = [NSData dataWithBytesNoCopy: *theBytes  length: theLength  freeWhenDone: NO];
+    *theBytes += theLength;
+    
+    return aData;
+}
 
 @interface CWIMAPCacheManager ()
+{
+    unsigned char *_flags;
+    size_t _flagsLength;
+    unsigned char *_dirtyPages;
+    NSUInteger _dirtyPageCount;
+    unsigned char _header[HEADER_SIZE];
+    NSUInteger _sortedCount;
+    struct compaction *_compaction;
+    dispatch_group_t _compactionGroup;
+}
 
-@property NSMutableDictionary *messageTable;
+@property CWIMAPUIDIndex *messageTable;
 @property CWFolder *folder;
 @property NSUInteger count;
 @property NSInteger fd;
+@property NSInteger heapFd;
+@property unsigned long long heapLength;
+@property NSInteger flagsFd;
+@property NSInteger journalFd;
+@property unsigned long long journalLength;
+@property NSMutableIndexSet *removedUIDs;
+@property NSMutableIndexSet *expungedUIDs;
+@property CWCacheWriter *indexWriter;
+@property CWCacheWriter *heapWriter;
+@property CWCacheWriter *flagsWriter;
+@property CWIMAPUIDIndex *recordIndexes;
+@property NSIndexSet *compactedUIDs;
+
+- (void) _cancelCompaction;
+- (BOOL) _compact;
+- (void) _discardCompaction;
+- (BOOL) _finishCompaction;
+- (BOOL) _flushFlags;
+- (BOOL) _flushRecords;
+- (void) _getHeader: (unsigned char *) theBuffer;
+- (BOOL) _mapFlags;
+- (void) _migrateFromVersion: (unsigned short) theVersion;
+- (void) _readJournal;
+- (BOOL) _rebuildFlags;
+- (NSUInteger) _recordCount;
+- (NSUInteger) _recordIndexOfUID: (NSUInteger) theUID  hint: (NSUInteger) theIndex;
+- (void) _recoverCompaction;
+- (void) _recoverRecords;
+- (void) _startCompaction;
+- (void) _truncate;
+- (BOOL) _writeHeader;
 
 @end
 
@@ -50,25 +381,36 @@ static unsigned short version = 1;
     
     if (self)
     {
+        struct stat heap_stat, flags_stat;
+        unsigned char buf[HEADER_SIZE];
         NSDictionary *attributes;
         unsigned short int v;
         
-        _messageTable = [[NSMutableDictionary alloc] init];
+        _messageTable = [[CWIMAPUIDIndex alloc] init];
+        _removedUIDs = [[NSMutableIndexSet alloc] init];
+        _expungedUIDs = [[NSMutableIndexSet alloc] init];
         _count = _uidValidity = 0;
+        _highestModSeq = _heapLength = _journalLength = 0;
+        _flags = _dirtyPages = NULL;
+        _flagsLength = _dirtyPageCount = _sortedCount = 0;
+        memset(_header, 0, HEADER_SIZE);
+        _acceptsUnorderedRecords = NO;
+        _recordIndexes = nil;
+        _compaction = NULL;
         _folder = theFolder;
+        _fd = _heapFd = _flagsFd = _journalFd = -1;
         
+        [self _recoverCompaction];
         
-        if ((_fd = open([thePath UTF8String], O_RDWR|O_CREAT, S_IRUSR|S_IWUSR)) < 0) 
-        {
-            NSLog(@"CANNOT CREATE OR OPEN THE CACHE!)");
-            abort();
-        }
-        
-        if (lseek(_fd, 0L, SEEK_SET) < 0)
+        // Without its files, the folder is used without a cache.
+        if ((_fd = open([thePath UTF8String], O_RDWR|O_CREAT, S_IRUSR|S_IWUSR)) < 0 ||
+            (_heapFd = open([[thePath stringByAppendingPathExtension: @"heap"] UTF8String], O_RDWR|O_CREAT, S_IRUSR|S_IWUSR)) < 0 ||
+            (_flagsFd = open([[thePath stringByAppendingPathExtension: @"flags"] UTF8String], O_RDWR|O_CREAT, S_IRUSR|S_IWUSR)) < 0 ||
+            (_journalFd = open([[thePath stringByAppendingPathExtension: @"journal"] UTF8String], O_RDWR|O_CREAT, S_IRUSR|S_IWUSR)) < 0 ||
+            lseek(_fd, 0L, SEEK_SET) < 0)
         {
-            close(_fd);
-            NSLog(@"UNABLE TO LSEEK INITIAL");
-            abort();
+            NSLog(@"CANNOT CREATE OR OPEN THE CACHE!");
+            return nil;
         }
         
         attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:thePath error:NULL];
@@ -76,22 +418,80 @@ static unsigned short version = 1;
         // If the cache exists, lets parse it.
         if ([[attributes objectForKey: NSFileSize] integerValue])
         {
-            v = read_unsigned_short(_fd);
+            // A cache too short for its version is ignored like an old one.
+            if (read_unsigned_short(_fd, &v) < 0)
+            {
+                v = 0;
+            }
+            
+            if (v == 1 || v == 2)
+            {
+                [self _migrateFromVersion: v];
+                return self;
+            }
             
             // HACK: We IGNORE all the previous cache.
-            if (v != version)
+            if (v != version || read_block(_fd, buf, HEADER_SIZE-2) != HEADER_SIZE-2 || read_unsigned_short_memory(buf) != RECORD_SIZE)
             {
                 //NSLog(@"Ignoring the old cache format.");
-                ftruncate(_fd, 0);
+                [self _truncate];
                 [self synchronize];
                 return self;
             }
             
-            _count = read_unsigned_int(_fd);
-            _uidValidity = read_unsigned_int(_fd);
+            // The offsets are relative to the end of the version.
+            _count = read_unsigned_int_memory(buf+2);
+            _uidValidity = read_unsigned_int_memory(buf+6);
+            _highestModSeq = read_unsigned_long_long_memory(buf+14);
+            _heapLength = read_unsigned_long_long_memory(buf+22);
+            
+            // Records and headers are written before the header is, we
+            // never have fewer of them than it says unless the files were damaged.
+            if (fstat(_heapFd, &heap_stat) < 0 || _heapLength > (unsigned long long)heap_stat.st_size || _count > [self _recordCount])
+            {
+                [self _truncate];
+                [self synchronize];
+                return self;
+            }
+            
+            // We know what's on disk, -synchronize only writes the header if it changes.
+            write_unsigned_short_memory(_header, v);
+            memcpy(_header+2, buf, HEADER_SIZE-2);
+            
+            // Unordered records written after the header was are dropped.
+            if (read_unsigned_int_memory(buf+10) & UNORDERED_RECORDS)
+            {
+                ftruncate(_fd, HEADER_SIZE+_count*RECORD_SIZE);
+                ftruncate(_heapFd, _heapLength);
+                ftruncate(_flagsFd, _count*FLAGS_ENTRY_SIZE);
+            }
+            else
+            {
+                [self _recoverRecords];
+            }
+            
+            [self _readJournal];
+            
+            // Without the flags file, the flags of the records might be old
+            // ones. We forget the mod-sequence so that they get updated.
+            if (fstat(_flagsFd, &flags_stat) < 0 || (unsigned long long)flags_stat.st_size < _count*FLAGS_ENTRY_SIZE)
+            {
+                [self _rebuildFlags];
+                _highestModSeq = 0;
+            }
+            
+            [self _mapFlags];
+            
+            // A compaction we didn't complete before is done while the folder is open.
+            if ([_removedUIDs count]*2 > _count)
+            {
+                [self _startCompaction];
+            }
         }
         else
         {
+            // What's left of another cache doesn't belong to this one.
+            [self _truncate];
             [self synchronize];
         }
     }
@@ -104,108 +504,166 @@ static unsigned short version = 1;
 //
 - (void) dealloc
 {
+    // The records are recovered when the cache is opened again.
+    [self _cancelCompaction];
+    [self _flushRecords];
+    [self _flushFlags];
+    
+    if (_flags) munmap(_flags, _flagsLength);
+    free(_dirtyPages);
     
     if (_fd >= 0) close(_fd);
+    if (_heapFd >= 0) close(_heapFd);
+    if (_flagsFd >= 0) close(_flagsFd);
+    if (_journalFd >= 0) close(_journalFd);
     
 }
 
 //
-//
+// Only the records are read, through mmap(). The cached headers of
+// the messages are left in the string heap until they are accessed,
+// see -readHeaders:ofMessage:. The records of removed messages that
+// are still there are skipped.
 //
 - (void) initInRange: (NSRange) theRange
 {
     CWIMAPMessage *aMessage;
-    unsigned short int len, tot = 0;
     NSUInteger begin, end, i;
-    unsigned char *r, *s;
-    
-    if (lseek(_fd, 10L, SEEK_SET) < 0)
-    {
-        NSLog(@"lseek failed in initInRange:");
-        abort();
-    }
+    unsigned char *index, *r;
+    size_t index_length;
     
     begin = (NSNotFound != theRange.location) ? theRange.location : 0;
     end = (NSMaxRange(theRange) <= _count ? NSMaxRange(theRange) : _count);
     
     //NSLog(@"init from %d to %d, count = %d, size of char %d  UID validity = %d", begin, end, _count, sizeof(char), _uidValidity);
     
+    if (begin >= end)
+    {
+        return;
+    }
+    
+    // We size the index once instead of letting it grow while loading a large folder.
+    if ([_messageTable count] == 0)
+    {
+        _messageTable = [[CWIMAPUIDIndex alloc] initWithCapacity: end-begin];
+    }
+    
+    if (end*FLAGS_ENTRY_SIZE > _flagsLength && ![self _mapFlags])
+    {
+        return;
+    }
+    
+    index_length = HEADER_SIZE+end*RECORD_SIZE;
+    
+    if (!(index = map_file(_fd, index_length, PROT_READ)))
+    {
+        NSLog(@"mmap failed in initInRange:");
+        return;
+    }
+    
+    madvise(index, index_length, MADV_SEQUENTIAL);
+    
     @autoreleasepool
     {
-        s = (unsigned char *)malloc(65536);
-        
-        
-        // We MUST skip the last few bytes...
         for (i = begin; i < end ; i++)
         {
-            aMessage = [[CWIMAPMessage alloc] init];
-            aMessage.messageNumber = i + 1;
-            
-            // We parse the record length, date, flags, position in file and the size.
-            len = read_unsigned_int(_fd);
-            //NSLog(@"i = %d, len = %d", i, len);
+            r = index + HEADER_SIZE + i*RECORD_SIZE;
             
-            r = (unsigned char *)malloc(len-4);
+            if ([_removedUIDs containsIndex: read_unsigned_int_memory(r+8)])
+            {
+                continue;
+            }
             
-            if (read(_fd, r, len-4) < 0) { NSLog(@"read failed"); abort(); }
+            aMessage = [[CWIMAPMessage alloc] init];
+            aMessage.messageNumber = [_folder->allMessages count] + 1;
             
-            aMessage.flags.flags = read_unsigned_int_memory(r);  // FASTER and _RIGHT_ since we can't call -setFlags: on CWIMAPMessage
+            aMessage.flags.flags = read_unsigned_int_memory(_flags+i*FLAGS_ENTRY_SIZE+4);  // FASTER and _RIGHT_ since we can't call -setFlags: on CWIMAPMessage
             [aMessage setReceivedDate: [NSDate dateWithTimeIntervalSince1970: read_unsigned_int_memory(r+4)]];
             [aMessage setUid: read_unsigned_int_memory(r+8)];
             [aMessage setSize: read_unsigned_int_memory(r+12)];
-            tot = 16;
-            
-            read_string_memory(r+tot, s, &len);
-            [CWParser parseFrom: [NSData dataWithBytes: s  length: len]  inMessage: aMessage  quick: YES];
-            tot += len+2;
-            
-            read_string_memory(r+tot, s, &len);
-            [CWParser parseInReplyTo: [NSData dataWithBytes: s  length: len]  inMessage: aMessage  quick: YES];
-            tot += len+2;
-            
-            read_string_memory(r+tot, s, &len);
-            [CWParser parseMessageID: [NSData dataWithBytes: s  length: len]  inMessage: aMessage  quick: YES];
-            tot += len+2;
-            
-            read_string_memory(r+tot, s, &len);
-            [CWParser parseReferences: [NSData dataWithBytes: s  length: len]  inMessage: aMessage  quick: YES];
-            tot += len+2;
-            
-            read_string_memory(r+tot, s, &len);
-            [CWParser parseSubject:  [NSData dataWithBytes: s  length: len]  inMessage: aMessage  quick: YES];
-            tot += len+2;
-            
-            read_string_memory(r+tot, s, &len);
-            [CWParser parseDestination: [NSData dataWithBytes: s  length: len]
-                               forType: PantomimeToRecipient
-                             inMessage: aMessage
-                                 quick: YES];
-            tot += len+2;
-            
-            read_string_memory(r+tot, s, &len);
-            [CWParser parseDestination: [NSData dataWithBytes: s  length: len]
-                               forType: PantomimeCcRecipient
-                             inMessage: aMessage
-                                 quick: YES];
+            [aMessage setCacheManager: self];
+            [aMessage setCachedHeaders: PantomimeCachedAllHeaders];
             
             [_folder->allMessages addObject:aMessage];
-            [_messageTable setValue:aMessage forKey:[NSString stringWithFormat:@"%lu", (unsigned long)[aMessage uid]]];
+            [_messageTable setObject: aMessage  forUID: [aMessage uid]];
             //[self addObject: aMessage]; // MOVE TO CWFIMAPOLDER
             //[((CWFolder *)_folder)->allMessages replaceObjectAtIndex: i  withObject: aMessage];
-            
-            free(r);
         }
+    }
+    
+    munmap(index, index_length);
+}
+
+
+//
+// The record of the message is found like for its flags. Its
+// headers are read from the string heap and the requested ones
+// parsed, the parser copies what it keeps.
+//
+- (void) readHeaders: (NSUInteger) theHeaders  ofMessage: (CWIMAPMessage *) theMessage
+{
+    unsigned char record[RECORD_SIZE], *buf, *s;
+    unsigned long long offset, len;
+    NSUInteger i;
+    NSData *aData;
+    
+    i = [self _recordIndexOfUID: [theMessage uid]  hint: [theMessage messageNumber]-1];
+    
+    if (i == NSNotFound || pread(_fd, record, RECORD_SIZE, HEADER_SIZE+i*RECORD_SIZE) != RECORD_SIZE)
+    {
+        return;
+    }
+    
+    offset = read_unsigned_long_long_memory(record+16);
+    len = record_heap_length(record);
+    
+    // We don't trust headers we don't have.
+    if (!len || offset + len > _heapLength)
+    {
+        return;
+    }
+    
+    buf = (unsigned char *)malloc(len);
+    
+    if (pread(_heapFd, buf, len, offset) != (ssize_t)len)
+    {
+        NSLog(@"UNABLE TO READ THE CACHED HEADERS");
+        free(buf);
+        return;
+    }
+    
+    for (s = buf, i = 0; i < FIELD_COUNT; i++)
+    {
+        aData = next_field(&s, read_unsigned_short_memory(record+24+i*2));
         
-        free(s);
+        if (theHeaders & (1 << i))
+        {
+            [CWParser parseCachedHeader: (1 << i)  data: aData  inMessage: theMessage];
+        }
     }
+    
+    free(buf);
 }
 
+
 //
 //
 //
 - (void) removeMessageWithUID: (NSUInteger) theUID
 {
-    [_messageTable removeObjectForKey:[NSString stringWithFormat:@"%lu", (unsigned long)theUID]];
+    CWIMAPMessage *aMessage;
+    
+    aMessage = [_messageTable objectForUID: theUID];
+    
+    // Its record won't outlive the next compaction.
+    [aMessage materializeCachedHeaders];
+    [_messageTable removeObjectForUID: theUID];
+    
+    // Only messages having a record are logged in the journal by -expunge.
+    if ([self _recordIndexOfUID: theUID  hint: (aMessage ? [aMessage messageNumber]-1 : NSNotFound)] != NSNotFound)
+    {
+        [_expungedUIDs addIndex: theUID];
+    }
 }
 
 //
@@ -213,7 +671,7 @@ static unsigned short version = 1;
 //
 - (CWIMAPMessage *) messageWithUID: (NSUInteger) theUID
 {
-    return [_messageTable objectForKey:[NSString stringWithFormat:@"%lu", (unsigned long)theUID]];
+    return [_messageTable objectForUID: theUID];
 }
 
 //
@@ -223,163 +681,1186 @@ static unsigned short version = 1;
 {
   //NSLog(@"IMAPCacheManager - INVALIDATING the cache...");
   [super invalidate];
-  _uidValidity = 0;
+
+  // The records go away, the messages read from them keep their headers.
+  [_folder->allMessages makeObjectsPerformSelector: @selector(materializeCachedHeaders)];
+  [self _truncate];
   [self synchronize];
 }
 
 
 //
+// The records written so far stay where they are, those that follow
+// are found through _recordIndexes. The header tells they might not
+// be sorted before any is written.
 //
-//
-- (BOOL) synchronize
+- (void) setAcceptsUnorderedRecords: (BOOL) theBOOL
 {
-    NSUInteger len, flags;
-    NSInteger i;
-    
-    _count = [_folder->allMessages count];
-    
-    //NSLog(@"CWIMAPCacheManager: -synchronize with folder count = %d", _count);
-    
-    if (lseek(_fd, 0L, SEEK_SET) < 0)
+    if (theBOOL == _acceptsUnorderedRecords)
     {
-        NSLog(@"fseek failed");
-        abort();
+        return;
     }
     
-    // We write our cache version, count and UID validity.
-    write_unsigned_short(_fd, version);
-    write_unsigned_int(_fd, _count);
-    write_unsigned_int(_fd, _uidValidity);
-    
-    //NSLog(@"Synching flags");
-    for (i = 0; i < _count; i++)
+    if (theBOOL)
+    {
+        // The records it didn't copy would follow those written now, out of order.
+        [self _cancelCompaction];
+        [self synchronize];
+        
+        if (!_recordIndexes)
+        {
+            _recordIndexes = [[CWIMAPUIDIndex alloc] init];
+            _sortedCount = _count;
+        }
+        
+        _acceptsUnorderedRecords = YES;
+        
+        if ([self _writeHeader])
+        {
+            fsync(_fd);
+        }
+    }
+    else
     {
-        len = read_unsigned_int(_fd);
-        flags = ((CWMessage*)[_folder->allMessages objectAtIndex:i]).flags.flags;
-        write_unsigned_int(_fd, flags);
-        lseek(_fd, (len-8), SEEK_CUR);
+        _acceptsUnorderedRecords = NO;
     }
-    //NSLog(@"Done!");
-    
-    return (fsync(_fd) == 0);
 }
 
 
-//
-//
-//
-- (void) writeRecord: (CWCacheRecord *) theRecord  message: (id) theMessage
-{
-    NSUInteger len;
-    
-    if (lseek(_fd, 0L, SEEK_END) < 0)
-    {
-        NSLog(@"COULD NOT LSEEK TO END OF FILE");
-        abort();
-    }
-    
-    // We calculate the length of this record (including the
-    // first five fields, which is 20 bytes long and is added
-    // at the very end)
-    len = 0;
-    len += [theRecord.from length]+2;
-    len += [theRecord.in_reply_to length]+2;
-    len += [theRecord.message_id length]+2;
-    len += [theRecord.references length]+2;
-    len += [theRecord.subject length]+2;
-    len += [theRecord.to length]+2;
-    len += [theRecord.cc length]+22;
-    write_unsigned_int(_fd, len);
-    
-    // We write the flags, date, position and the size of the message.
-    write_unsigned_int(_fd, theRecord.flags);
-    write_unsigned_int(_fd, theRecord.date);
-    write_unsigned_int(_fd, theRecord.imap_uid);
-    write_unsigned_int(_fd, theRecord.size);
-    
-    // We write the read of our cached headers (From, In-Reply-To, Message-ID, References,
-    // Subject, To and Cc)
-    write_string(_fd, (unsigned char *)[theRecord.from bytes], [theRecord.from length]);
-    write_string(_fd, (unsigned char *)[theRecord.in_reply_to bytes], [theRecord.in_reply_to length]);
-    write_string(_fd, (unsigned char *)[theRecord.message_id bytes], [theRecord.message_id length]);
-    write_string(_fd, (unsigned char *)[theRecord.references bytes], [theRecord.references length]);
-    write_string(_fd, (unsigned char *)[theRecord.subject bytes], [theRecord.subject length]);
-    write_string(_fd, (unsigned char *)[theRecord.to bytes], [theRecord.to length]);
-    write_string(_fd, (unsigned char *)[theRecord.cc bytes], [theRecord.cc length]);
-    
-    [_messageTable setValue:theMessage forKey:[NSString stringWithFormat:@"%lu", (unsigned long)theRecord.imap_uid]];
-    
-    _count++;
-}
 
 
 //
+// The flags were written to the mapped flags file as they changed,
+// only the pages holding them are written back. The records, the
+// headers and the header are left alone unless some were added, or
+// removed ones make most of the cache, which is then compacted in the
+// background and replaced by a later call once that's done. Unordered
+// records are sorted by a compaction, here, until then the header
+// isn't written.
 //
-//
-- (void) expunge
+- (BOOL) synchronize
 {
-    NSDictionary *attributes;
+    unsigned char buf[HEADER_SIZE];
+    BOOL result;
     
-    NSUInteger i, len, size, total_length, v;
-    unsigned char *buf;
+    //NSLog(@"CWIMAPCacheManager: -synchronize with count = %d", _count);
     
-    //NSLog(@"expunge: rewriting cache");
+    result = [self _flushRecords];
     
-    if (lseek(_fd, 10L, SEEK_SET) < 0)
+    if (_acceptsUnorderedRecords)
     {
-        NSLog(@"fseek failed");
-        abort();
+        return ([self _flushFlags] && result);
     }
     
-    attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:[self path] error:NULL];
-    
-    buf = (unsigned char *)malloc([[attributes objectForKey: NSFileSize] integerValue]);
-    total_length = 0;
-    
-    for (i = 0; i < _count; i++)
+    if (_compaction && dispatch_group_wait(_compactionGroup, DISPATCH_TIME_NOW) == 0)
     {
-        //NSLog(@"===========");
-        len = read_unsigned_int(_fd);
-        //NSLog(@"i = %d  len = %d", i, len);
-        v = htonl(len);
-        memcpy((buf+total_length), (char *)&v, 4);
-        
-        // We write the rest of the record into the memory
-        if (read(_fd, (buf+total_length+4), len-4) < 0) { NSLog(@"read failed"); abort(); }
-        
-        NSUInteger uid = read_unsigned_int_memory(buf+total_length+12);
-        
-        if ([self messageWithUID: uid])
-        {
-            total_length += len;
-        }
-        else
-        {
-            //NSLog(@"Message not found! uid = %d  table count = %d", uid, NSCountMapTable(_table));
-        }
+        [self _finishCompaction];
     }
     
-    if (lseek(_fd, 0L, SEEK_SET) < 0)
+    // Compacting is linear in the size of the cache, we wait
+    // until it halves it.
+    if (_recordIndexes)
+    {
+        [self _compact];
+    }
+    else if (!_compaction && [_removedUIDs count]*2 > _count)
     {
-        NSLog(@"fseek failed");
-        abort();
+        [self _startCompaction];
     }
     
-    // We write our cache version, count, modification date our new size
-    _count = [_folder->allMessages count];
-    size = total_length+10;
+    result = ([self _flushFlags] && result);
     
-    write_unsigned_short(_fd, version);
-    write_unsigned_int(_fd, _count);
-    write_unsigned_int(_fd, _uidValidity);
+    if (_recordIndexes)
+    {
+        return NO;
+    }
     
-    // We write our memory cache
-    write(_fd, buf, total_length);
+    [self _getHeader: buf];
     
-    ftruncate(_fd, size);
-    free(buf);
+    if (memcmp(buf, _header, HEADER_SIZE) != 0)
+    {
+        // What the header counts must be on disk before it is.
+        if (fsync(_heapFd) < 0 || fsync(_flagsFd) < 0 || ![self _writeHeader] || fsync(_fd) < 0)
+        {
+            result = NO;
+        }
+    }
+    
+    return result;
+}
+
+
+//
+//
+//
+- (void) updateFlagsOfMessage: (CWIMAPMessage *) theMessage
+{
+    NSUInteger i, flags, page;
+    
+    i = [self _recordIndexOfUID: [theMessage uid]  hint: [theMessage messageNumber]-1];
+    
+    if (i == NSNotFound)
+    {
+        return;
+    }
+    
+    flags = theMessage.flags.flags;
+    
+    if (read_unsigned_int_memory(_flags+i*FLAGS_ENTRY_SIZE+4) != flags)
+    {
+        write_unsigned_int_memory(_flags+i*FLAGS_ENTRY_SIZE+4, flags);
+        page = (i*FLAGS_ENTRY_SIZE+4)/page_size();
+        
+        if (!(_dirtyPages[page/8] & (1 << (page%8))))
+        {
+            _dirtyPages[page/8] |= (1 << (page%8));
+            _dirtyPageCount++;
+        }
+    }
+}
+
+
+//
+// The cached headers, the flags and the record are added to the batch
+// being written, which is flushed once it's large enough or when the
+// records are needed. The header is updated by -synchronize.
+//
+- (void) writeRecord: (CWCacheRecord *) theRecord  message: (id) theMessage
+{
+    unsigned char record[RECORD_SIZE], entry[FLAGS_ENTRY_SIZE];
+    unsigned short lengths[FIELD_COUNT];
+    NSData *allFields[FIELD_COUNT];
+    NSUInteger i, len;
+    
+    allFields[0] = theRecord.from;
+    allFields[1] = theRecord.in_reply_to;
+    allFields[2] = theRecord.message_id;
+    allFields[3] = theRecord.references;
+    allFields[4] = theRecord.subject;
+    allFields[5] = theRecord.to;
+    allFields[6] = theRecord.cc;
+    
+    if (!_indexWriter)
+    {
+        _heapWriter = [[CWCacheWriter alloc] initWithFileDescriptor: _heapFd  offset: _heapLength];
+        _flagsWriter = [[CWCacheWriter alloc] initWithFileDescriptor: _flagsFd  offset: _count*FLAGS_ENTRY_SIZE];
+        _indexWriter = [[CWCacheWriter alloc] initWithFileDescriptor: _fd  offset: HEADER_SIZE+_count*RECORD_SIZE];
+    }
+    
+    // Like before, a header can't be longer than 65535 bytes.
+    for (len = 0, i = 0; i < FIELD_COUNT; i++)
+    {
+        lengths[i] = MIN([allFields[i] length], 65535);
+        [_heapWriter appendBytes: [allFields[i] bytes]  length: lengths[i]];
+        len += lengths[i];
+    }
+    
+    write_record_memory(record, theRecord.flags, theRecord.date, theRecord.imap_uid, theRecord.size, _heapLength, lengths);
+    write_unsigned_int_memory(entry, theRecord.imap_uid);
+    write_unsigned_int_memory(entry+4, theRecord.flags);
+    
+    [_flagsWriter appendBytes: entry  length: FLAGS_ENTRY_SIZE];
+    [_indexWriter appendBytes: record  length: RECORD_SIZE];
+    [_messageTable setObject: theMessage  forUID: theRecord.imap_uid];
+    [_recordIndexes setObject: [NSNumber numberWithUnsignedInteger: _count]  forUID: theRecord.imap_uid];
+    
+    _heapLength += len;
+    _count++;
+    
+    if ([_heapWriter isFull] || [_indexWriter isFull])
+    {
+        [self _flushRecords];
+    }
+}
+
+
+//
+// The UIDs of the messages removed since the last call are appended
+// to the journal, their records are left alone until -synchronize
+// compacts the cache.
+//
+- (void) expunge
+{
+    __block NSUInteger count;
+    unsigned char *buf;
+    
+    if (![_expungedUIDs count])
+    {
+        return;
+    }
+    
+    buf = (unsigned char *)malloc([_expungedUIDs count]*JOURNAL_ENTRY_SIZE);
+    count = 0;
+    
+    [_expungedUIDs enumerateIndexesUsingBlock: ^(NSUInteger theUID, BOOL *stop) {
+        write_unsigned_int_memory(buf+count*JOURNAL_ENTRY_SIZE, theUID);
+        count++;
+    }];
+    
+    if (lseek(_journalFd, _journalLength, SEEK_SET) < 0 || write_block(_journalFd, buf, count*JOURNAL_ENTRY_SIZE) < 0 || fsync(_journalFd) < 0)
+    {
+        NSLog(@"UNABLE TO WRITE THE CACHE JOURNAL");
+        ftruncate(_journalFd, _journalLength);
+        free(buf);
+        return;
+    }
+    
+    free(buf);
+    
+    _journalLength += count*JOURNAL_ENTRY_SIZE;
+    [_removedUIDs addIndexes: _expungedUIDs];
+    [_expungedUIDs removeAllIndexes];
+}
+
+
+//
+// The compaction running in the background is stopped and dropped.
+//
+- (void) _cancelCompaction
+{
+    if (!_compaction)
+    {
+        return;
+    }
+    
+    __atomic_store_n(&_compaction->cancelled, 1, __ATOMIC_RELAXED);
+    dispatch_group_wait(_compactionGroup, DISPATCH_TIME_FOREVER);
+    [self _discardCompaction];
+}
+
+
+//
+// The records of the messages that weren't removed are written to
+// new files with their current flags, their headers to a new string
+// heap. The old files are left untouched until the new records replace
+// them, see -_recoverCompaction. Unordered records are sorted by UID.
+//
+- (BOOL) _compact
+{
+    NSString *aPath, *aHeapPath, *aFlagsPath, *aNewPath, *aNewHeapPath, *aNewFlagsPath;
+    unsigned char buf[HEADER_SIZE], record[RECORD_SIZE], *index, *heap, *r;
+    unsigned long long offset, len;
+    NSMutableData *records, *strings, *entries;
+    struct record_entry *order;
+    NSInteger fd, heap_fd, flags_fd;
+    NSUInteger count, i, j;
+    size_t index_length;
+    BOOL result;
+    
+    [self _cancelCompaction];
+    
+    aPath = [self path];
+    aHeapPath = [aPath stringByAppendingPathExtension: @"heap"];
+    aFlagsPath = [aPath stringByAppendingPathExtension: @"flags"];
+    aNewPath = [aPath stringByAppendingPathExtension: @"new"];
+    aNewHeapPath = [aHeapPath stringByAppendingPathExtension: @"new"];
+    aNewFlagsPath = [aFlagsPath stringByAppendingPathExtension: @"new"];
+    
+    index_length = HEADER_SIZE+_count*RECORD_SIZE;
+    index = heap = NULL;
+    
+    if ((_count*FLAGS_ENTRY_SIZE > _flagsLength && ![self _mapFlags]) || ![self _flushFlags] ||
+        !(index = map_file(_fd, index_length, PROT_READ)) || (_heapLength && !(heap = map_file(_heapFd, _heapLength, PROT_READ))))
+    {
+        NSLog(@"mmap failed in _compact");
+        if (index) munmap(index, index_length);
+        return NO;
+    }
+    
+    // The new records are created first, their presence tells the compaction isn't complete.
+    fd = open([aNewPath UTF8String], O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+    heap_fd = (fd < 0 ? -1 : open([aNewHeapPath UTF8String], O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR));
+    flags_fd = (heap_fd < 0 ? -1 : open([aNewFlagsPath UTF8String], O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR));
+    
+    records = [NSMutableData dataWithCapacity: BUFFER_SIZE];
+    strings = [NSMutableData dataWithCapacity: BUFFER_SIZE];
+    entries = [NSMutableData dataWithCapacity: BUFFER_SIZE];
+    result = (flags_fd >= 0 && lseek(fd, HEADER_SIZE, SEEK_SET) >= 0);
+    order = NULL;
+    
+    if (_recordIndexes && _count)
+    {
+        order = (struct record_entry *)malloc(_count*sizeof(struct record_entry));
+        
+        for (i = 0; i < _count; i++)
+        {
+            order[i].uid = read_unsigned_int_memory(_flags+i*FLAGS_ENTRY_SIZE);
+            order[i].index = i;
+        }
+        
+        qsort(order, _count, sizeof(struct record_entry), compare_record_entries);
+    }
+    
+    for (count = 0, offset = 0, j = 0; result && j < _count; j++)
+    {
+        i = (order ? order[j].index : j);
+        r = index + HEADER_SIZE + i*RECORD_SIZE;
+        
+        if ([_removedUIDs containsIndex: read_unsigned_int_memory(r+8)])
+        {
+            continue;
+        }
+        
+        memcpy(record, r, RECORD_SIZE);
+        memcpy(record, _flags+i*FLAGS_ENTRY_SIZE+4, 4);
+        len = record_heap_length(r);
+        
+        // We don't keep headers we don't have.
+        if (len && read_unsigned_long_long_memory(r+16) + len <= _heapLength)
+        {
+            result = append_block(heap_fd, strings, heap+read_unsigned_long_long_memory(r+16), len);
+            write_unsigned_long_long_memory(record+16, offset);
+            offset += len;
+        }
+        else
+        {
+            write_unsigned_long_long_memory(record+16, offset);
+            memset(record+24, 0, FIELD_COUNT*2);
+        }
+        
+        result = (result && append_block(fd, records, record, RECORD_SIZE) &&
+                  append_block(flags_fd, entries, _flags+i*FLAGS_ENTRY_SIZE, FLAGS_ENTRY_SIZE));
+        count++;
+    }
+    
+    munmap(index, index_length);
+    if (heap) munmap(heap, _heapLength);
+    free(order);
+    
+    [self _getHeader: buf];
+    write_unsigned_int_memory(buf+4, count);
+    write_unsigned_long_long_memory(buf+24, offset);
+    
+    result = (result &&
+              write_block(heap_fd, [strings bytes], [strings length]) >= 0 &&
+              write_block(flags_fd, [entries bytes], [entries length]) >= 0 &&
+              write_block(fd, [records bytes], [records length]) >= 0 &&
+              lseek(fd, 0L, SEEK_SET) >= 0 && write_block(fd, buf, HEADER_SIZE) >= 0 &&
+              fsync(heap_fd) == 0 && fsync(flags_fd) == 0 && fsync(fd) == 0 &&
+              rename([aNewPath UTF8String], [aPath UTF8String]) == 0);
+    
+    if (!result)
+    {
+        NSLog(@"UNABLE TO COMPACT THE CACHE");
+        
+        // The new records go last, the other files could otherwise be taken for complete ones.
+        if (flags_fd >= 0) close(flags_fd);
+        if (heap_fd >= 0) close(heap_fd);
+        if (fd >= 0) close(fd);
+        unlink([aNewFlagsPath UTF8String]);
+        unlink([aNewHeapPath UTF8String]);
+        unlink([aNewPath UTF8String]);
+        return NO;
+    }
+    
+    // The compaction is complete, it is otherwise completed when the cache is opened again.
+    if (rename([aNewHeapPath UTF8String], [aHeapPath UTF8String]) < 0 ||
+        rename([aNewFlagsPath UTF8String], [aFlagsPath UTF8String]) < 0)
+    {
+        NSLog(@"UNABLE TO RENAME THE COMPACTED CACHE");
+    }
+    
+    // The flags were written back above.
+    if (_flags)
+    {
+        munmap(_flags, _flagsLength);
+        _flags = NULL;
+        _flagsLength = _dirtyPageCount = 0;
+    }
+    
+    close(_fd);
+    close(_heapFd);
+    close(_flagsFd);
+    _fd = fd;
+    _heapFd = heap_fd;
+    _flagsFd = flags_fd;
+    
+    _count = count;
+    _heapLength = offset;
+    memcpy(_header, buf, HEADER_SIZE);
+    [self _mapFlags];
+    
+    // The removed records are gone, so is the need for the journal.
+    [_removedUIDs removeAllIndexes];
+    _recordIndexes = nil;
+    
+    if (ftruncate(_journalFd, 0) == 0)
+    {
+        fsync(_journalFd);
+        _journalLength = 0;
+    }
+    
+    return YES;
+}
+
+
+//
+// The new files of the compaction are closed and removed, the new
+// records last like when it fails in -_compact. Those of a completed
+// compaction are ours, -_recoverCompaction renames them if we couldn't.
+//
+- (void) _discardCompaction
+{
+    NSString *aPath;
+    
+    aPath = [self path];
+    
+    if (_compaction->index) munmap(_compaction->index, _compaction->index_length);
+    if (_compaction->heap) munmap(_compaction->heap, _compaction->heap_length);
+    if (_compaction->flags_fd >= 0) close(_compaction->flags_fd);
+    if (_compaction->heap_fd >= 0) close(_compaction->heap_fd);
+    
+    if (_compaction->fd >= 0)
+    {
+        close(_compaction->fd);
+        unlink([[[aPath stringByAppendingPathExtension: @"flags"] stringByAppendingPathExtension: @"new"] UTF8String]);
+        unlink([[[aPath stringByAppendingPathExtension: @"heap"] stringByAppendingPathExtension: @"new"] UTF8String]);
+        unlink([[aPath stringByAppendingPathExtension: @"new"] UTF8String]);
+    }
+    
+    free(_compaction->flags);
+    free(_compaction->kept);
+    free(_compaction);
+    _compaction = NULL;
+    _compactionGroup = nil;
+    _compactedUIDs = nil;
+}
+
+
+//
+// The records written in the background are completed with their
+// current flags and followed by those appended meanwhile, with their
+// headers. The new files then replace the old ones like in -_compact.
+// The messages removed meanwhile are logged in the journal again.
+//
+- (BOOL) _finishCompaction
+{
+    NSString *aPath, *aHeapPath, *aFlagsPath;
+    unsigned long long len, offset, heap_length;
+    unsigned char buf[HEADER_SIZE], *records, *r;
+    NSMutableData *entries;
+    __block NSUInteger n;
+    NSUInteger count, i;
+    ssize_t size;
+    BOOL result;
+    
+    aPath = [self path];
+    aHeapPath = [aPath stringByAppendingPathExtension: @"heap"];
+    aFlagsPath = [aPath stringByAppendingPathExtension: @"flags"];
+    
+    [self _flushRecords];
+    
+    if (!_compaction->result || _count < _compaction->count || _heapLength < _compaction->heap_length ||
+        (_count*FLAGS_ENTRY_SIZE > _flagsLength && ![self _mapFlags]))
+    {
+        NSLog(@"UNABLE TO COMPACT THE CACHE");
+        [self _discardCompaction];
+        return NO;
+    }
+    
+    count = _count - _compaction->count;
+    heap_length = _compaction->offset + (_heapLength - _compaction->heap_length);
+    entries = [NSMutableData dataWithCapacity: BUFFER_SIZE];
+    records = (unsigned char *)malloc(MAX(count, 1)*RECORD_SIZE);
+    result = (lseek(_compaction->flags_fd, 0L, SEEK_SET) >= 0);
+    
+    for (i = 0; result && i < _compaction->kept_count; i++)
+    {
+        result = append_block(_compaction->flags_fd, entries, _flags+_compaction->kept[i]*FLAGS_ENTRY_SIZE, FLAGS_ENTRY_SIZE);
+    }
+    
+    // The headers of the records appended meanwhile follow those of the snapshot.
+    result = (result && records && pread(_fd, records, count*RECORD_SIZE, HEADER_SIZE+_compaction->count*RECORD_SIZE) == (ssize_t)(count*RECORD_SIZE));
+    
+    for (i = 0; result && i < count; i++)
+    {
+        r = records + i*RECORD_SIZE;
+        offset = read_unsigned_long_long_memory(r+16);
+        memcpy(r, _flags+(_compaction->count+i)*FLAGS_ENTRY_SIZE+4, 4);
+        
+        if (offset >= _compaction->heap_length && offset + record_heap_length(r) <= _heapLength)
+        {
+            write_unsigned_long_long_memory(r+16, offset - _compaction->heap_length + _compaction->offset);
+        }
+        else
+        {
+            write_unsigned_long_long_memory(r+16, _compaction->offset);
+            memset(r+24, 0, FIELD_COUNT*2);
+        }
+        
+        result = append_block(_compaction->flags_fd, entries, _flags+(_compaction->count+i)*FLAGS_ENTRY_SIZE, FLAGS_ENTRY_SIZE);
+    }
+    
+    result = (result && write_block(_compaction->flags_fd, [entries bytes], [entries length]) >= 0 &&
+              lseek(_compaction->heap_fd, _compaction->offset, SEEK_SET) >= 0);
+    [entries setLength: BUFFER_SIZE];
+    
+    for (offset = _compaction->heap_length; result && offset < _heapLength; offset += size)
+    {
+        len = MIN(_heapLength - offset, BUFFER_SIZE);
+        size = pread(_heapFd, [entries mutableBytes], len, offset);
+        result = (size == (ssize_t)len && write_block(_compaction->heap_fd, [entries bytes], len) >= 0);
+    }
+    
+    [self _getHeader: buf];
+    write_unsigned_int_memory(buf+4, _compaction->kept_count+count);
+    write_unsigned_long_long_memory(buf+24, heap_length);
+    
+    result = (result &&
+              lseek(_compaction->fd, HEADER_SIZE+_compaction->kept_count*RECORD_SIZE, SEEK_SET) >= 0 &&
+              write_block(_compaction->fd, records, count*RECORD_SIZE) >= 0 &&
+              lseek(_compaction->fd, 0L, SEEK_SET) >= 0 && write_block(_compaction->fd, buf, HEADER_SIZE) >= 0 &&
+              fsync(_compaction->heap_fd) == 0 && fsync(_compaction->flags_fd) == 0 && fsync(_compaction->fd) == 0 &&
+              rename([[aPath stringByAppendingPathExtension: @"new"] UTF8String], [aPath UTF8String]) == 0);
+    free(records);
+    
+    if (!result)
+    {
+        NSLog(@"UNABLE TO COMPACT THE CACHE");
+        [self _discardCompaction];
+        return NO;
+    }
+    
+    // The compaction is complete, it is otherwise completed when the cache is opened again.
+    if (rename([[aHeapPath stringByAppendingPathExtension: @"new"] UTF8String], [aHeapPath UTF8String]) < 0 ||
+        rename([[aFlagsPath stringByAppendingPathExtension: @"new"] UTF8String], [aFlagsPath UTF8String]) < 0)
+    {
+        NSLog(@"UNABLE TO RENAME THE COMPACTED CACHE");
+    }
+    
+    // The flags were copied above.
+    if (_flags)
+    {
+        munmap(_flags, _flagsLength);
+        _flags = NULL;
+        _flagsLength = _dirtyPageCount = 0;
+    }
+    
+    close(_fd);
+    close(_heapFd);
+    close(_flagsFd);
+    _fd = _compaction->fd;
+    _heapFd = _compaction->heap_fd;
+    _flagsFd = _compaction->flags_fd;
+    _compaction->fd = _compaction->heap_fd = _compaction->flags_fd = -1;
+    
+    _count = _compaction->kept_count+count;
+    _heapLength = heap_length;
+    memcpy(_header, buf, HEADER_SIZE);
+    [self _mapFlags];
+    
+    // The compacted records are gone, those removed meanwhile are still there.
+    [_removedUIDs removeIndexes: _compactedUIDs];
+    [self _discardCompaction];
+    
+    records = (unsigned char *)malloc(MAX([_removedUIDs count], 1)*JOURNAL_ENTRY_SIZE);
+    n = 0;
+    
+    [_removedUIDs enumerateIndexesUsingBlock: ^(NSUInteger theUID, BOOL *stop) {
+        write_unsigned_int_memory(records+n*JOURNAL_ENTRY_SIZE, theUID);
+        n++;
+    }];
+    
+    if (ftruncate(_journalFd, 0) == 0 && lseek(_journalFd, 0L, SEEK_SET) >= 0 &&
+        write_block(_journalFd, records, n*JOURNAL_ENTRY_SIZE) >= 0 && fsync(_journalFd) == 0)
+    {
+        _journalLength = n*JOURNAL_ENTRY_SIZE;
+    }
+    else
+    {
+        // The journal must not hold fewer UIDs than were removed.
+        NSLog(@"UNABLE TO WRITE THE CACHE JOURNAL");
+    }
+    
+    free(records);
+    
+    return YES;
+}
+
+
+//
+// The dirty pages of the flags file are written back, each run
+// of consecutive ones with a single msync().
+//
+- (BOOL) _flushFlags
+{
+    NSUInteger first, i, pages;
+    size_t size;
+    BOOL result;
+    
+    if (!_dirtyPageCount)
+    {
+        return YES;
+    }
+    
+    size = page_size();
+    pages = (_flagsLength+size-1)/size;
+    result = YES;
+    
+    for (i = 0; i < pages; i++)
+    {
+        if (!(_dirtyPages[i/8] & (1 << (i%8))))
+        {
+            continue;
+        }
+        
+        for (first = i; i < pages && (_dirtyPages[i/8] & (1 << (i%8))); i++)
+        {
+            _dirtyPages[i/8] &= ~(1 << (i%8));
+        }
+        
+        if (msync(_flags+first*size, MIN(i*size, _flagsLength)-first*size, MS_SYNC) < 0)
+        {
+            NSLog(@"msync failed in _flushFlags");
+            result = NO;
+        }
+    }
+    
+    _dirtyPageCount = 0;
+    
+    return result;
+}
+
+
+//
+// The batch of records is written, the headers first so that a record
+// never refers to headers that aren't there. If we fail, the files are
+// truncated back to the records written before and those of the batch
+// are dropped.
+//
+- (BOOL) _flushRecords
+{
+    unsigned long long heap_length;
+    NSUInteger count;
+    BOOL result;
+    
+    if (!_indexWriter)
+    {
+        return YES;
+    }
+    
+    heap_length = [_heapWriter offset];
+    count = ([_indexWriter offset]-HEADER_SIZE)/RECORD_SIZE;
+    result = ([_heapWriter flush] && [_flagsWriter flush] && [_indexWriter flush]);
+    
+    _heapWriter = _flagsWriter = _indexWriter = nil;
+    
+    if (!result)
+    {
+        NSLog(@"UNABLE TO WRITE THE CACHE RECORDS");
+        ftruncate(_fd, HEADER_SIZE+count*RECORD_SIZE);
+        ftruncate(_flagsFd, count*FLAGS_ENTRY_SIZE);
+        ftruncate(_heapFd, heap_length);
+        _heapLength = heap_length;
+        _count = count;
+    }
+    
+    return result;
+}
+
+
+//
+//
+//
+- (void) _getHeader: (unsigned char *) theBuffer
+{
+    memset(theBuffer, 0, HEADER_SIZE);
+    write_unsigned_short_memory(theBuffer, version);
+    write_unsigned_short_memory(theBuffer+2, RECORD_SIZE);
+    write_unsigned_int_memory(theBuffer+4, _count);
+    write_unsigned_int_memory(theBuffer+8, _uidValidity);
+    write_unsigned_int_memory(theBuffer+12, (_acceptsUnorderedRecords ? UNORDERED_RECORDS : 0));
+    write_unsigned_long_long_memory(theBuffer+16, _highestModSeq);
+    write_unsigned_long_long_memory(theBuffer+24, _heapLength);
+}
+
+
+//
+// The flags file is mapped again to cover all the records, after
+// writing the pending ones and back the dirty pages of the previous
+// mapping.
+//
+- (BOOL) _mapFlags
+{
+    size_t length, size;
+    
+    // The entries we map must be on disk.
+    [self _flushRecords];
+    [self _flushFlags];
+    
+    if (_flags)
+    {
+        munmap(_flags, _flagsLength);
+        _flags = NULL;
+        _flagsLength = 0;
+    }
+    
+    length = _count*FLAGS_ENTRY_SIZE;
+    
+    if (!length)
+    {
+        return YES;
+    }
+    
+    if (!(_flags = map_file(_flagsFd, length, PROT_READ|PROT_WRITE)))
+    {
+        NSLog(@"mmap failed in _mapFlags");
+        return NO;
+    }
+    
+    size = page_size();
+    _flagsLength = length;
+    _dirtyPages = (unsigned char *)realloc(_dirtyPages, ((length+size-1)/size+7)/8);
+    memset(_dirtyPages, 0, ((length+size-1)/size+7)/8);
+    
+    return YES;
+}
+
+
+//
+// The records of version 1 and 2 caches are converted and their
+// headers copied to the string heap, so nothing is downloaded again.
+//
+- (void) _migrateFromVersion: (unsigned short) theVersion
+{
+    NSMutableData *allRecords, *allStrings;
+    unsigned char record[RECORD_SIZE], *bytes, *end, *r, *p;
+    unsigned short lengths[FIELD_COUNT];
+    NSUInteger count, len, i, j;
+    unsigned long long offset;
+    NSData *aData;
+    NSUInteger header_size;
+    
+    aData = [NSData dataWithContentsOfFile: [self path]  options: NSDataReadingMappedIfSafe  error: NULL];
+    header_size = (theVersion == 1 ? HEADER_SIZE_V1 : HEADER_SIZE_V2);
+    
+    allRecords = [NSMutableData data];
+    allStrings = [NSMutableData data];
+    
+    if ([aData length] >= header_size)
+    {
+        bytes = (unsigned char *)[aData bytes];
+        end = bytes + [aData length];
+        
+        count = read_unsigned_int_memory(bytes+2);
+        _uidValidity = read_unsigned_int_memory(bytes+6);
+        _highestModSeq = (theVersion == 2 ? read_unsigned_long_long_memory(bytes+10) : 0);
+        
+        // A record is its length, the flags, date, UID and size followed by
+        // the headers, each prefixed by its length. We stop at the first
+        // one that doesn't fit in the file.
+        for (r = bytes + header_size, i = 0; i < count && r + 20 <= end; i++)
+        {
+            len = read_unsigned_int_memory(r);
+            
+            if (len < 20 || r + len > end)
+            {
+                break;
+            }
+            
+            offset = [allStrings length];
+            
+            for (p = r + 20, j = 0; j < FIELD_COUNT && p + 2 <= r + len; j++)
+            {
+                lengths[j] = read_unsigned_short_memory(p);
+                
+                if (p + 2 + lengths[j] > r + len)
+                {
+                    break;
+                }
+                
+                [allStrings appendBytes: p+2  length: lengths[j]];
+                p += 2 + lengths[j];
+            }
+            
+            if (j < FIELD_COUNT)
+            {
+                [allStrings setLength: offset];
+                break;
+            }
+            
+            write_record_memory(record, read_unsigned_int_memory(r+4), read_unsigned_int_memory(r+8),
+                                read_unsigned_int_memory(r+12), read_unsigned_int_memory(r+16), offset, lengths);
+            [allRecords appendData: [NSData dataWithBytes: record  length: RECORD_SIZE]];
+            r += len;
+        }
+    }
+    
+    _count = [allRecords length]/RECORD_SIZE;
+    _heapLength = [allStrings length];
+    
+    // The header goes last, the cache stays a version 1 or 2 one until then.
+    if (ftruncate(_heapFd, 0) < 0 || lseek(_heapFd, 0L, SEEK_SET) < 0 || write_block(_heapFd, [allStrings bytes], _heapLength) < 0 ||
+        lseek(_fd, HEADER_SIZE, SEEK_SET) < 0 || write_block(_fd, [allRecords bytes], [allRecords length]) < 0 ||
+        ftruncate(_fd, HEADER_SIZE+[allRecords length]) < 0 || ftruncate(_journalFd, 0) < 0 ||
+        ![self _rebuildFlags] || ![self _writeHeader])
+    {
+        NSLog(@"UNABLE TO MIGRATE THE CACHE");
+        [self _truncate];
+        [self _writeHeader];
+    }
+    
+    fsync(_heapFd);
+    fsync(_flagsFd);
+    fsync(_fd);
+    
+    [self _mapFlags];
+}
+
+
+//
+// The journal lists the UIDs of the removed messages. A partly
+// written entry, at its end, is dropped.
+//
+- (void) _readJournal
+{
+    unsigned char *journal;
+    NSUInteger count, i;
+    struct stat st;
+    
+    if (fstat(_journalFd, &st) < 0)
+    {
+        return;
+    }
+    
+    count = st.st_size/JOURNAL_ENTRY_SIZE;
+    _journalLength = count*JOURNAL_ENTRY_SIZE;
+    
+    if ((unsigned long long)st.st_size != _journalLength)
+    {
+        ftruncate(_journalFd, _journalLength);
+    }
+    
+    if (!count)
+    {
+        return;
+    }
+    
+    if (!(journal = map_file(_journalFd, _journalLength, PROT_READ)))
+    {
+        NSLog(@"mmap failed in _readJournal");
+        return;
+    }
+    
+    for (i = 0; i < count; i++)
+    {
+        [_removedUIDs addIndex: read_unsigned_int_memory(journal+i*JOURNAL_ENTRY_SIZE)];
+    }
+    
+    munmap(journal, _journalLength);
+}
+
+
+//
+// The flags file is written from the UIDs and flags of the records.
+//
+- (BOOL) _rebuildFlags
+{
+    unsigned char *index, *entries, *r;
+    size_t index_length;
+    NSUInteger i;
+    BOOL result;
+    
+    if (!_count)
+    {
+        return (ftruncate(_flagsFd, 0) == 0);
+    }
+    
+    index_length = HEADER_SIZE+_count*RECORD_SIZE;
+    
+    if (!(index = map_file(_fd, index_length, PROT_READ)))
+    {
+        NSLog(@"mmap failed in _rebuildFlags");
+        return NO;
+    }
+    
+    entries = (unsigned char *)malloc(_count*FLAGS_ENTRY_SIZE);
+    
+    for (i = 0; i < _count; i++)
+    {
+        r = index + HEADER_SIZE + i*RECORD_SIZE;
+        write_unsigned_int_memory(entries+i*FLAGS_ENTRY_SIZE, read_unsigned_int_memory(r+8));
+        memcpy(entries+i*FLAGS_ENTRY_SIZE+4, r, 4);
+    }
+    
+    munmap(index, index_length);
+    
+    result = (lseek(_flagsFd, 0L, SEEK_SET) >= 0 && write_block(_flagsFd, entries, _count*FLAGS_ENTRY_SIZE) >= 0 &&
+              ftruncate(_flagsFd, _count*FLAGS_ENTRY_SIZE) == 0);
+    free(entries);
+    
+    return result;
+}
+
+
+//
+// The number of complete records the cache file holds.
+//
+- (NSUInteger) _recordCount
+{
+    struct stat st;
+    
+    if (fstat(_fd, &st) < 0 || st.st_size < HEADER_SIZE)
+    {
+        return 0;
+    }
+    
+    return (st.st_size-HEADER_SIZE)/RECORD_SIZE;
+}
+
+
+//
+// Records are appended in the order of their UIDs, so we look for
+// theUID by bisection in the flags file unless the entry at theIndex,
+// usually the message's, is the right one. Unordered records, those
+// following the first _sortedCount ones, are found in _recordIndexes.
+//
+- (NSUInteger) _recordIndexOfUID: (NSUInteger) theUID  hint: (NSUInteger) theIndex
+{
+    NSUInteger low, high, mid, uid;
+    NSNumber *aNumber;
+    
+    if (!theUID || (_count*FLAGS_ENTRY_SIZE > _flagsLength && ![self _mapFlags]))
+    {
+        return NSNotFound;
+    }
+    
+    if (theIndex < _count && read_unsigned_int_memory(_flags+theIndex*FLAGS_ENTRY_SIZE) == theUID)
+    {
+        return theIndex;
+    }
+    
+    if (_recordIndexes && (aNumber = [_recordIndexes objectForUID: theUID]))
+    {
+        mid = [aNumber unsignedIntegerValue];
+        
+        // The records of a failed batch are gone.
+        if (mid < _count && read_unsigned_int_memory(_flags+mid*FLAGS_ENTRY_SIZE) == theUID)
+        {
+            return mid;
+        }
+    }
+    
+    low = 0;
+    high = (_recordIndexes ? MIN(_sortedCount, _count) : _count);
+    
+    while (low < high)
+    {
+        mid = low + (high-low)/2;
+        uid = read_unsigned_int_memory(_flags+mid*FLAGS_ENTRY_SIZE);
+        
+        if (uid == theUID)
+        {
+            return mid;
+        }
+        
+        if (uid < theUID)
+        {
+            low = mid+1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    
+    return NSNotFound;
+}
+
+
+//
+// A compaction is complete once the new records replaced the old
+// ones. Until then, the new files are dropped. After, the new string
+// heap and flags replace the old ones if they haven't yet.
+//
+- (void) _recoverCompaction
+{
+    NSString *aPath, *aHeapPath, *aFlagsPath;
+    
+    aPath = [self path];
+    aHeapPath = [aPath stringByAppendingPathExtension: @"heap"];
+    aFlagsPath = [aPath stringByAppendingPathExtension: @"flags"];
+    
+    if (access([[aPath stringByAppendingPathExtension: @"new"] UTF8String], F_OK) == 0)
+    {
+        unlink([[aFlagsPath stringByAppendingPathExtension: @"new"] UTF8String]);
+        unlink([[aHeapPath stringByAppendingPathExtension: @"new"] UTF8String]);
+        unlink([[aPath stringByAppendingPathExtension: @"new"] UTF8String]);
+        return;
+    }
+    
+    // Nothing to do unless they exist.
+    rename([[aHeapPath stringByAppendingPathExtension: @"new"] UTF8String], [aHeapPath UTF8String]);
+    rename([[aFlagsPath stringByAppendingPathExtension: @"new"] UTF8String], [aFlagsPath UTF8String]);
+}
+
+
+//
+// Records are written before the header counting them. We keep those
+// written after it was last updated if they follow the previous ones,
+// UIDs and headers in the string heap included.
+//
+- (void) _recoverRecords
+{
+    unsigned long long end;
+    unsigned char *index, *r;
+    NSUInteger count, i, uid;
+    size_t index_length;
+    struct stat st;
+    
+    count = [self _recordCount];
+    
+    if (count <= _count || fstat(_heapFd, &st) < 0)
+    {
+        return;
+    }
+    
+    index_length = HEADER_SIZE+count*RECORD_SIZE;
+    
+    if (!(index = map_file(_fd, index_length, PROT_READ)))
+    {
+        NSLog(@"mmap failed in _recoverRecords");
+        return;
+    }
+    
+    uid = (_count ? read_unsigned_int_memory(index+HEADER_SIZE+(_count-1)*RECORD_SIZE+8) : 0);
+    
+    for (i = _count; i < count; i++)
+    {
+        r = index + HEADER_SIZE + i*RECORD_SIZE;
+        end = read_unsigned_long_long_memory(r+16) + record_heap_length(r);
+        
+        if (read_unsigned_int_memory(r+8) <= uid || read_unsigned_long_long_memory(r+16) < _heapLength ||
+            end > (unsigned long long)st.st_size)
+        {
+            break;
+        }
+        
+        uid = read_unsigned_int_memory(r+8);
+        _heapLength = end;
+    }
+    
+    munmap(index, index_length);
+    
+    //NSLog(@"Recovered %d records", i-_count);
+    _count = i;
+}
+
+
+//
+// The records of the messages that weren't removed are copied to new
+// files in the background, see compact_records(), from a snapshot of
+// the records, the string heap and the flags. The records appended
+// after it are left for -_finishCompaction, as are the flags.
+//
+- (void) _startCompaction
+{
+    static dispatch_queue_t queue;
+    static dispatch_once_t onceToken;
+    NSString *aPath, *aHeapPath, *aFlagsPath;
+    struct compaction *aCompaction;
+    NSIndexSet *allUIDs;
+    
+    dispatch_once(&onceToken, ^{
+        queue = dispatch_queue_create("org.pantomime.IMAPCacheCompaction", DISPATCH_QUEUE_SERIAL);
+    });
+    
+    if (!_count || (_count*FLAGS_ENTRY_SIZE > _flagsLength && ![self _mapFlags]))
+    {
+        return;
+    }
+    
+    aPath = [self path];
+    aHeapPath = [aPath stringByAppendingPathExtension: @"heap"];
+    aFlagsPath = [aPath stringByAppendingPathExtension: @"flags"];
+    
+    _compaction = aCompaction = (struct compaction *)calloc(1, sizeof(struct compaction));
+    aCompaction->count = _count;
+    aCompaction->index_length = HEADER_SIZE+_count*RECORD_SIZE;
+    aCompaction->heap_length = _heapLength;
+    
+    // The new records are created first, their presence tells the compaction isn't complete.
+    aCompaction->fd = open([[aPath stringByAppendingPathExtension: @"new"] UTF8String], O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+    aCompaction->heap_fd = (aCompaction->fd < 0 ? -1 : open([[aHeapPath stringByAppendingPathExtension: @"new"] UTF8String], O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR));
+    aCompaction->flags_fd = (aCompaction->heap_fd < 0 ? -1 : open([[aFlagsPath stringByAppendingPathExtension: @"new"] UTF8String], O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR));
+    
+    // The records of the snapshot are never written again, the heap only appended to.
+    aCompaction->index = map_file(_fd, aCompaction->index_length, PROT_READ);
+    aCompaction->heap = map_file(_heapFd, _heapLength, PROT_READ);
+    aCompaction->flags = (unsigned char *)malloc(_count*FLAGS_ENTRY_SIZE);
+    
+    if (aCompaction->flags_fd < 0 || !aCompaction->index || (_heapLength && !aCompaction->heap) || !aCompaction->flags)
+    {
+        NSLog(@"UNABLE TO COMPACT THE CACHE");
+        [self _discardCompaction];
+        return;
+    }
+    
+    memcpy(aCompaction->flags, _flags, _count*FLAGS_ENTRY_SIZE);
+    allUIDs = [_removedUIDs copy];
+    _compactedUIDs = allUIDs;
+    _compactionGroup = dispatch_group_create();
+    
+    // The block doesn't retain us, -dealloc cancels it.
+    dispatch_group_async(_compactionGroup, queue, ^{
+        @autoreleasepool
+        {
+            compact_records(aCompaction, allUIDs);
+        }
+    });
+}
+
+
+//
+// All the records are dropped, -synchronize writes the header again.
+//
+- (void) _truncate
+{
+    // It reads the files we truncate.
+    [self _cancelCompaction];
+    _heapWriter = _flagsWriter = _indexWriter = nil;
+    
+    if (_flags)
+    {
+        munmap(_flags, _flagsLength);
+        _flags = NULL;
+        _flagsLength = _dirtyPageCount = 0;
+    }
+    
+    ftruncate(_fd, 0);
+    ftruncate(_heapFd, 0);
+    ftruncate(_flagsFd, 0);
+    ftruncate(_journalFd, 0);
+    
+    _count = _uidValidity = _sortedCount = 0;
+    _highestModSeq = _heapLength = _journalLength = 0;
+    memset(_header, 0, HEADER_SIZE);
+    _recordIndexes = (_acceptsUnorderedRecords ? [[CWIMAPUIDIndex alloc] init] : nil);
+    
+    [_messageTable removeAllObjects];
+    [_removedUIDs removeAllIndexes];
+    [_expungedUIDs removeAllIndexes];
+}
+
+
+//
+//
+//
+- (BOOL) _writeHeader
+{
+    unsigned char buf[HEADER_SIZE];
+    
+    [self _getHeader: buf];
+    
+    if (lseek(_fd, 0L, SEEK_SET) < 0 || write_block(_fd, buf, HEADER_SIZE) < 0)
+    {
+        NSLog(@"UNABLE TO WRITE THE CACHE HEADER");
+        return NO;
+    }
+    
+    memcpy(_header, buf, HEADER_SIZE);
     
-    //NSLog(@"Done! New size = %d", size);
+    return YES;
 }
 
 @end
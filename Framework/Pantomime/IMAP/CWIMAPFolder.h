@@ -39,11 +39,30 @@ extern NSString* PantomimeMessagesCopyCompleted;
 */
 extern NSString* PantomimeMessagesCopyFailed;
 
+/*!
+  @const PantomimeMessagesMoveCompleted
+  @discussion This notification is posted when CWIMAPFolder: -moveMessages:
+              toFolder: has successfully completed. -messagesMoveCompleted:
+	      is also called on the delegate, if any. The messages were
+	      removed from the receiver by then.
+*/
+extern NSString* PantomimeMessagesMoveCompleted;
+
+/*!
+  @const PantomimeMessagesMoveFailed
+  @discussion This notification is posted when CWIMAPFolder: -moveMessages:
+              toFolder: has failed to complete. -messagesMoveFailed:
+	      is also called on the delegate, if any.
+*/
+extern NSString* PantomimeMessagesMoveFailed;
+
 /*!
   @const PantomimeMessageStoreCompleted
   @discussion This notification is posted when CWIMAPFolder: -setFlags:
               messages: has successfully completed. -messageStoreCompleted:
-	      is also called on the delegate, if any.
+	      is also called on the delegate, if any. Setting the flags
+	      of many messages with sparse UIDs is done with more than one
+	      command, each one posting it for the messages it updated.
 */
 extern NSString* PantomimeMessageStoreCompleted;
 
@@ -55,6 +74,51 @@ extern NSString* PantomimeMessageStoreCompleted;
 */
 extern NSString* PantomimeMessageStoreFailed;
 
+/*!
+  @const PantomimeFolderSortCompleted
+  @discussion This notification is posted when CWIMAPFolder: -sortByKey:
+              reverse: has successfully completed. -folderSortCompleted:
+	      is also called on the delegate, if any. The "UIDs" key of
+	      its user info holds the sorted UIDs.
+*/
+extern NSString* PantomimeFolderSortCompleted;
+
+/*!
+  @const PantomimeFolderSortFailed
+  @discussion This notification is posted when CWIMAPFolder: -sortByKey:
+              reverse: has failed to complete. -folderSortFailed:
+	      is also called on the delegate, if any.
+*/
+extern NSString* PantomimeFolderSortFailed;
+
+/*!
+  @const PantomimeFolderThreadCompleted
+  @discussion This notification is posted when CWIMAPFolder: -threadWithAlgorithm:
+              has successfully completed. -folderThreadCompleted: is also
+	      called on the delegate, if any.
+*/
+extern NSString* PantomimeFolderThreadCompleted;
+
+/*!
+  @const PantomimeFolderThreadFailed
+  @discussion This notification is posted when CWIMAPFolder: -threadWithAlgorithm:
+              has failed to complete. -folderThreadFailed: is also called
+	      on the delegate, if any.
+*/
+extern NSString* PantomimeFolderThreadFailed;
+
+/*!
+  @const PantomimeFolderPrefetchWindowCompleted
+  @discussion This notification is posted when CWIMAPFolder: -prefetch fetches
+              the headers of a folder in windows and one of them has been
+	      fetched. -folderPrefetchWindowCompleted: is also called on the
+	      delegate, if any. The "Range" key of its user info holds the
+	      range of the messages fetched, as indexes in -allMessages, in
+	      a NSValue. PantomimeFolderPrefetchCompleted is posted after
+	      the last one.
+*/
+extern NSString* PantomimeFolderPrefetchWindowCompleted;
+
 
 /*!
   @class CWIMAPFolder
@@ -73,6 +137,16 @@ extern NSString* PantomimeMessageStoreFailed;
 */
 @property (nonatomic) NSUInteger uidValidity;
 
+/*!
+  @method highestModSeq
+  @discussion This method is used to obtain the highest mod-sequence
+              of an IMAP folder, as the IMAP server gave it when the folder
+	      was selected. Refer to "3.1.1. HIGHESTMODSEQ Response Code" of
+	      RFC 7162 for a detailed description of this parameter.
+  @result The highest mod-sequence, 0 if the folder doesn't support them.
+*/
+@property unsigned long long highestModSeq;
+
 /*!
   @method selected
   @discussion This method is used to verify if the folder is in
@@ -81,6 +155,44 @@ extern NSString* PantomimeMessageStoreFailed;
 */
 @property BOOL selected;
 
+/*!
+  @method flagUpdateDelay
+  @discussion This method is used to obtain the number of seconds flag
+              changes made with -setFlags:messages: are held back before
+	      being sent to the IMAP server. During that time, changes are
+	      merged: a message is stored with the last flags it was given
+	      and messages given the same flags are stored with a single
+	      UID STORE command. The flags of the messages are updated right
+	      away. The delay is 0 by default, changes are then sent at once.
+
+	      The delay is measured with the run loop. Pending changes are
+	      also sent when a change comes after the delay expired, and
+	      before copying messages, expunging or closing the folder.
+  @result The delay in seconds.
+*/
+@property NSTimeInterval flagUpdateDelay;
+
+/*!
+  @method prefetchWindow
+  @discussion This method is used to obtain the number of messages whose
+              headers -prefetch fetches per command when the folder has
+	      no cache, or an empty one. The newest messages are fetched
+	      first, so that they can be shown without waiting for the
+	      whole folder. 0 fetches all of them with a single command.
+	      The default is 500.
+  @result The number of messages.
+*/
+@property NSUInteger prefetchWindow;
+
+/*!
+  @method existsCount
+  @discussion This method is used to obtain the number of messages of the
+              folder, as the last EXISTS response of the IMAP server gave it.
+	      It is set by CWIMAPStore, NSNotFound until the folder is selected.
+  @result The number of messages.
+*/
+@property (nonatomic) NSUInteger existsCount;
+
 /*!
   @method initWithName: mode:
   @discussion This method is used to initialize the receiver
@@ -113,6 +225,37 @@ extern NSString* PantomimeMessageStoreFailed;
                               flags:(CWFlags*)theFlags
                        internalDate:(NSDate*)theDate;
 
+/*!
+  @method appendMessagesFromRawSources: flags:
+  @discussion This method is used to append many messages, for example
+              when migrating a mailbox to the IMAP server. It is fully
+	      asynchronous.
+
+	      If the server supports the MULTIAPPEND extension (RFC 3502),
+	      the messages are appended with as few APPEND commands as
+	      possible, each one holding about 32 MB of them. If it supports
+	      non-synchronizing literals (LITERAL+ or LITERAL-, RFC 7888),
+	      the messages are sent without waiting for the server to
+	      accept each one of them.
+
+	      Sources in memory have their invalid headers removed, like
+	      with -appendMessageFromRawSource:flags:internalDate:. Files
+	      are read from disk as they are sent, see CWIMAPAppendStream,
+	      only the mbox separator they might start with is skipped.
+	      The line breaks of both are converted to CRLF.
+	      PantomimeFolderAppendCompleted (or
+	      PantomimeFolderAppendFailed) is posted once per APPEND
+	      command, the "Sources" key of its user info holding the
+	      sources it appended. A file that can't be read is not
+	      appended, PantomimeFolderAppendFailed is posted for it alone.
+  @param theSources The raw sources of the messages, as NSData instances,
+                    or the paths of the files holding them.
+  @param theFlags The flags of each message, as CWFlags instances (NSNull
+                  for none), nil if no flags need to be kept.
+*/
+- (void) appendMessagesFromRawSources: (NSArray *) theSources
+                                flags: (NSArray *) theFlags;
+
 /*!
   @method copyMessages: toFolder:
   @discussion This method copies the messages in <i>theMessages</i> array from
@@ -121,7 +264,9 @@ extern NSString* PantomimeMessageStoreFailed;
 	      (and calls -messagesCopyCompleted: on the delegate, if any). On failure,
 	      it posts a PantomimeMessagesCopyFailed notification (and calls
 	      -messagesCopyFailed: on the delegate, if any). This method is
-	      fully asynchronous.
+	      fully asynchronous. Copying many messages with sparse UIDs
+	      is done with more than one command, each one posting its
+	      own notification with the messages it copied.
   @param theMessages The messages to copy.
   @param theFolder The name of the target folder. The name must include
                    hierarchy separators if the target folder is a subfolder.
@@ -129,13 +274,141 @@ extern NSString* PantomimeMessageStoreFailed;
 - (void) copyMessages:(NSArray*)theMessages
              toFolder:(NSString*)theFolder;
 
+/*!
+  @method moveMessages: toFolder:
+  @discussion This method moves the messages in <i>theMessages</i> array from
+              the receiver to the destination folder's name, <i>theFolder</i>.
+	      If the server supports the MOVE extension (RFC 6851), the
+	      messages are moved with UID MOVE. Otherwise, they are copied,
+	      marked as \Deleted once copied and expunged, with UID EXPUNGE
+	      if the server supports UIDPLUS (RFC 4315). Without it, other
+	      messages marked as \Deleted in the receiver are expunged too.
+
+	      The expunge responses of a command are applied to -allMessages
+	      and to the cache at once, when it completes, and the messages
+	      are threaded again only then. PantomimeMessageExpunged isn't
+	      posted for them. On success, this method posts a
+	      PantomimeMessagesMoveCompleted notification (and calls
+	      -messagesMoveCompleted: on the delegate, if any). On failure,
+	      it posts a PantomimeMessagesMoveFailed notification (and calls
+	      -messagesMoveFailed: on the delegate, if any). This method is
+	      fully asynchronous. Like with -copyMessages:toFolder:, many
+	      messages with sparse UIDs are moved with more than one command.
+  @param theMessages The messages to move.
+  @param theFolder The name of the target folder. The name must include
+                   hierarchy separators if the target folder is a subfolder.
+*/
+- (void) moveMessages: (NSArray *) theMessages
+             toFolder: (NSString *) theFolder;
+
 /*!
   @method prefetch
   @discussion This method is used to cache part of the message headers
               from the IMAP server. On completion, it posts the PantomimeFolderPrefetchCompleted
 	      notification (and calls -folderPrefetchCompleted: on the delegate, if any).
 	      This method is fully asynchronous.
+
+	      If QRESYNC is enabled on the store and the cache knows its highest
+	      mod-sequence, only the messages that changed or vanished since
+	      are fetched, along with the new ones. With pipelining enabled (see
+	      -setPipelineWindow: in CWIMAPStore), both are sent at once.
+
+	      Without a cache, or with an empty one, the headers of the newest
+	      messages are fetched first, -prefetchWindow messages at a time. The
+	      folder then holds a message for each one the server has, its
+	      UID being 0 until it is fetched. PantomimeFolderPrefetchWindowCompleted
+	      is posted as each window completes. If one fails, the prefetch
+	      stops there and PantomimeFolderPrefetchFailed is posted instead
+	      of PantomimeFolderPrefetchCompleted.
 */
 - (void) prefetch;
 
+/*!
+  @method prefetchWindowBeforeIndex:
+  @discussion This method is used to fetch the headers of the -prefetchWindow
+              messages preceding the one at <i>theIndex</i> in -allMessages.
+	      Normally, you should not invoke this method directly. It is
+	      invoked by -prefetch and by CWIMAPStore once a window has been
+	      fetched, until the first message is reached.
+  @param theIndex The index following the last message to fetch.
+*/
+- (void) prefetchWindowBeforeIndex: (NSUInteger) theIndex;
+
+/*!
+  @method flushFlagUpdates
+  @discussion This method is used to send the flag changes held back
+              because of -flagUpdateDelay right away, without waiting
+	      for the delay to expire.
+*/
+- (void) flushFlagUpdates;
+
+/*!
+  @method indexOfMessageWithUID:
+  @discussion This method is used to obtain the index, in -allMessages,
+              of the message whose UID is <i>theUID</i>. Its message
+	      sequence number is the index plus one. Since UIDs grow with
+	      message sequence numbers, the messages are searched by
+	      bisection, without going through them all. Messages whose
+	      UID isn't known yet are skipped over, wherever they are.
+  @param theUID The UID.
+  @result The index, NSNotFound if there's no such message.
+*/
+- (NSUInteger) indexOfMessageWithUID: (NSUInteger) theUID;
+
+/*!
+  @method canSort
+  @discussion This method is used to verify if the IMAP server can sort
+              the messages of the receiver, that is if it advertises the
+	      SORT capability (RFC 5256).
+  @result YES if it can, NO otherwise.
+*/
+- (BOOL) canSort;
+
+/*!
+  @method sortByKey: reverse:
+  @discussion This method is used to have the IMAP server sort all the
+              messages of the receiver. The headers of the messages don't
+	      need to be prefetched: the server only sends their UIDs, in
+	      order. A client showing a page of a large folder can thus
+	      obtain its messages from the first UIDs. On completion, it posts
+	      a PantomimeFolderSortCompleted notification (and calls
+	      -folderSortCompleted: on the delegate, if any). On failure, it
+	      posts a PantomimeFolderSortFailed notification (and calls
+	      -folderSortFailed: on the delegate, if any). This method is
+	      fully asynchronous and must only be invoked if -canSort
+	      returns YES.
+  @param theKey The key to sort on.
+  @param theBOOL YES to sort in reverse order, NO otherwise.
+*/
+- (void) sortByKey: (PantomimeSortKey) theKey
+           reverse: (BOOL) theBOOL;
+
+/*!
+  @method canThreadWithAlgorithm:
+  @discussion This method is used to verify if the IMAP server can thread
+              the messages of the receiver using <i>theAlgorithm</i>, that
+	      is if it advertises the corresponding THREAD capability (RFC 5256).
+  @param theAlgorithm The threading algorithm.
+  @result YES if it can, NO otherwise.
+*/
+- (BOOL) canThreadWithAlgorithm: (PantomimeThreadAlgorithm) theAlgorithm;
+
+/*!
+  @method threadWithAlgorithm:
+  @discussion This method is used to have the IMAP server thread all the
+              messages of the receiver, instead of doing it locally with
+	      -thread which needs the headers of all the messages. Once
+	      completed, -allContainers returns the root CWContainer instances.
+	      Containers of messages that aren't in the cache have a
+	      CWIMAPMessage holding only their UID, which isn't part of
+	      -allMessages. On completion, it posts a PantomimeFolderThreadCompleted
+	      notification (and calls -folderThreadCompleted: on the delegate,
+	      if any). On failure, it posts a PantomimeFolderThreadFailed
+	      notification (and calls -folderThreadFailed: on the delegate, if any).
+	      This method is fully asynchronous and must only be invoked if
+	      -canThreadWithAlgorithm: returns YES.
+  @param theAlgorithm The threading algorithm.
+*/
+- (void) threadWithAlgorithm: (PantomimeThreadAlgorithm) theAlgorithm;
+
 @end
@@ -25,20 +25,39 @@
 #import "CWConnection.h"
 #import "CWConstants.h"
 #import "CWFlags.h"
+#import "CWIMAPAppendStream.h"
+#import "CWIMAPBodyStore.h"
 #import "CWIMAPCacheManager.h"
 #import "CWIMAPStore.h"
 #import "CWIMAPMessage.h"
+#import "CWIMAPSequenceSet.h"
 #import "CWTCPConnection.h"
 #import "NSData+CWExtensions.h"
 #import "NSString+CWExtensions.h"
 
+#include "io.h"
+
+//
+// The number of bytes of messages we append with a
+// single APPEND command, when MULTIAPPEND is supported.
+//
+#define APPEND_BATCH_SIZE 33554432
+
 //
 // Private methods
 //
 @interface CWIMAPFolder ()
 
+@property NSMutableDictionary *pendingFlags;
+@property NSMutableDictionary *pendingMessages;
+@property NSTimeInterval pendingSince;
+@property BOOL prefetchPending;
+
+- (void) _discardFlagUpdates;
 - (NSString *) _flagsAsStringFromFlags: (CWFlags *) theFlags;
+- (BOOL) _hasCapability: (NSString *) theCapability;
 - (NSData *) _removeInvalidHeadersFromMessage: (NSData *) theMessage;
+- (void) _storeFlags: (CWFlags *) theFlags  messages: (NSArray *) theMessages;
 
 @end
 
@@ -52,6 +71,13 @@
 {
   self = [super initWithName: theName];
   [self setSelected: NO];
+  _pendingFlags = [[NSMutableDictionary alloc] init];
+  _pendingMessages = [[NSMutableDictionary alloc] init];
+  _pendingSince = 0;
+  _flagUpdateDelay = 0;
+  _prefetchWindow = 500;
+  _existsCount = NSNotFound;
+  _prefetchPending = NO;
   return self;
 }
 
@@ -146,36 +172,177 @@
 }
 
 //
+// A batch ends once it holds APPEND_BATCH_SIZE bytes, so that a
+// message the server refuses doesn't make it refuse all the others.
 //
+// Sources in memory have their invalid headers removed, like with
+// -appendMessageFromRawSource:flags:internalDate:, before the stream
+// computes the length of their literal. Files are only mapped as they
+// are sent so we leave them alone, but for the mbox separator they
+// might start with. The notifications hold the sources we were given.
 //
-- (void) copyMessages:(NSArray*)theMessages
-             toFolder:(NSString*)theFolder
+- (void) appendMessagesFromRawSources: (NSArray *) theSources
+                                flags: (NSArray *) theFlags
 {
-    NSMutableString *aMutableString;
-    NSInteger i, count;
+    NSMutableArray *allSources, *allData, *allFlags;
+    CWIMAPAppendStream *aStream;
+    NSUInteger i, count, limit;
+    unsigned long long size;
+    BOOL multiappend;
+    id aSource, o;
     
-    // We create our message's UID set
-    aMutableString = [[NSMutableString alloc] init];
-    count = [theMessages count];
+    multiappend = [self _hasCapability: @"MULTIAPPEND"];
+    
+    if ([self _hasCapability: @"LITERAL+"])
+    {
+        limit = NSUIntegerMax;
+    }
+    else
+    {
+        // LITERAL- only allows them up to 4096 bytes.
+        limit = ([self _hasCapability: @"LITERAL-"] ? 4096 : 0);
+    }
+    
+    allSources = [NSMutableArray array];
+    allData = [NSMutableArray array];
+    allFlags = [NSMutableArray array];
+    count = [theSources count];
+    size = 0;
     
     for (i = 0; i < count; i++)
     {
-        if (i == count-1)
+        aSource = [theSources objectAtIndex: i];
+        o = (theFlags ? [theFlags objectAtIndex: i] : nil);
+        
+        //
+        // A file we can't read would be appended as an empty message,
+        // we report it right away and append the other ones.
+        //
+        if (![aSource isKindOfClass: [NSData class]] && ![[NSFileManager defaultManager] isReadableFileAtPath: aSource])
         {
-            [aMutableString appendFormat: @"%lu", (unsigned long)[[theMessages objectAtIndex: i] uid]];
+            NSDictionary *info;
+            
+            info = [NSDictionary dictionaryWithObjectsAndKeys: self, @"Folder", [NSArray arrayWithObject: aSource], @"Sources", nil];
+            POST_NOTIFICATION(PantomimeFolderAppendFailed, _store, info);
+            PERFORM_SELECTOR_3([_store delegate], @selector(folderAppendFailed:), PantomimeFolderAppendFailed, info);
         }
         else
         {
-            [aMutableString appendFormat: @"%lu,", (unsigned long)[[theMessages objectAtIndex: i] uid]];
+            [allSources addObject: aSource];
+            [allFlags addObject: ([o isKindOfClass: [CWFlags class]] ? [self _flagsAsStringFromFlags: o] : @"")];
+            
+            if ([aSource isKindOfClass: [NSData class]])
+            {
+                aSource = [self _removeInvalidHeadersFromMessage: aSource];
+                size += [aSource length];
+            }
+            else
+            {
+                size += [[[NSFileManager defaultManager] attributesOfItemAtPath: aSource  error: NULL] fileSize];
+            }
+            
+            [allData addObject: aSource];
+        }
+        
+        if ([allData count] && (!multiappend || size >= APPEND_BATCH_SIZE || i == count-1))
+        {
+            aStream = [[CWIMAPAppendStream alloc] initWithSources: allData  flags: allFlags  nonSynchronizingLimit: limit];
+            
+            [_store sendCommand: IMAP_APPEND
+                           info: [NSDictionary dictionaryWithObjectsAndKeys: self, @"Folder", allSources, @"Sources", aStream, @"Stream", nil]
+                      arguments: @"APPEND \"%@\" %@", self.name, [aStream arguments]];
+            
+            allSources = [NSMutableArray array];
+            allData = [NSMutableArray array];
+            allFlags = [NSMutableArray array];
+            size = 0;
         }
     }
+}
+
+//
+//
+//
+- (void) copyMessages:(NSArray*)theMessages
+             toFolder:(NSString*)theFolder
+{
+    CWIMAPSequenceSet *aSequenceSet;
+    NSArray *allSubsets;
+    NSUInteger i, count;
+    
+    // The flags of the messages are copied with them.
+    [self flushFlagUpdates];
+    
+    //
+    // We send one command per subset of our message's UID set so
+    // that copying many messages doesn't give a too long command.
+    //
+    allSubsets = [[CWIMAPSequenceSet sequenceSetWithMessages: theMessages] subsets];
+    count = [allSubsets count];
     
-    // We send our IMAP command
-    [_store sendCommand: IMAP_UID_COPY
-                   info: [NSDictionary dictionaryWithObjectsAndKeys: theMessages, @"Messages", theFolder, @"Name", self, @"Folder", nil]
-              arguments: @"UID COPY %@ \"%@\"",
-     aMutableString,
-     theFolder];
+    for (i = 0; i < count; i++)
+    {
+        aSequenceSet = [allSubsets objectAtIndex: i];
+        
+        // We send our IMAP command
+        [_store sendCommand: IMAP_UID_COPY
+                       info: [NSDictionary dictionaryWithObjectsAndKeys: (count > 1 ? [aSequenceSet messagesFromArray: theMessages] : theMessages), @"Messages",
+                              theFolder, @"Name", self, @"Folder", nil]
+                  arguments: @"UID COPY %@ \"%@\"",
+         [aSequenceSet stringValue],
+         theFolder];
+    }
+}
+
+
+//
+// Without MOVE, each subset is copied first. Once its copy completes,
+// CWIMAPStore marks its messages as \Deleted and then sends the
+// command line we leave under "Expunge" in the info, so that nothing
+// is removed from the receiver if the copy failed.
+//
+- (void) moveMessages: (NSArray *) theMessages
+             toFolder: (NSString *) theFolder
+{
+    CWIMAPSequenceSet *aSequenceSet;
+    NSArray *allSubsets, *someMessages;
+    NSString *aString;
+    NSUInteger i, count;
+    BOOL move, uidplus;
+
+    // The flags of the messages are moved with them.
+    [self flushFlagUpdates];
+
+    move = [self _hasCapability: @"MOVE"];
+    uidplus = [self _hasCapability: @"UIDPLUS"];
+
+    allSubsets = [[CWIMAPSequenceSet sequenceSetWithMessages: theMessages] subsets];
+    count = [allSubsets count];
+
+    for (i = 0; i < count; i++)
+    {
+        aSequenceSet = [allSubsets objectAtIndex: i];
+        someMessages = (count > 1 ? [aSequenceSet messagesFromArray: theMessages] : theMessages);
+
+        if (move)
+        {
+            [_store sendCommand: IMAP_UID_MOVE
+                           info: [NSDictionary dictionaryWithObjectsAndKeys: someMessages, @"Messages", theFolder, @"Name", self, @"Folder", nil]
+                      arguments: @"UID MOVE %@ \"%@\"",
+             [aSequenceSet stringValue],
+             theFolder];
+            continue;
+        }
+
+        aString = (uidplus ? [NSString stringWithFormat: @"UID EXPUNGE %@", [aSequenceSet stringValue]] : @"EXPUNGE");
+
+        [_store sendCommand: IMAP_UID_COPY
+                       info: [NSDictionary dictionaryWithObjectsAndKeys: someMessages, @"Messages", theFolder, @"Name", self, @"Folder",
+                              aString, @"Expunge", nil]
+                  arguments: @"UID COPY %@ \"%@\"",
+         [aSequenceSet stringValue],
+         theFolder];
+    }
 }
 
 
@@ -184,19 +351,105 @@
 //
 - (void) prefetch
 {
+  CWIMAPCacheManager *aCacheManager;
+  CWIMAPMessage *aMessage;
+  NSDictionary *theInfo;
+  NSUInteger uid, i;
+
+  aCacheManager = (CWIMAPCacheManager *)self.cacheManager;
+
+  //
+  // Once our cache is synchronized, it is with the mod-sequence the
+  // folder had when we selected it. See -_parseOK in CWIMAPStore.
+  //
+  theInfo = nil;
+
+  if ([_store isQRESYNCEnabled] && _highestModSeq)
+    {
+      theInfo = [NSDictionary dictionaryWithObject: [NSNumber numberWithUnsignedLongLong: _highestModSeq]  forKey: @"HighestModSeq"];
+    }
+
+  //
+  // If our cache was synchronized with a mod-sequence of this folder (RFC 7162),
+  // the server tells us which messages changed or vanished since. We then
+  // fetch the new ones, without waiting if commands are pipelined.
+  //
+  if (aCacheManager && [self count] && theInfo && aCacheManager.highestModSeq &&
+      aCacheManager.uidValidity == _uidValidity)
+    {
+      uid = [[allMessages lastObject] uid];
+
+      [_store sendCommand: IMAP_UID_FETCH_FLAGS_CHANGEDSINCE  info: nil  arguments: @"UID FETCH 1:%lu (UID FLAGS) (CHANGEDSINCE %llu VANISHED)",
+	      (unsigned long)uid, aCacheManager.highestModSeq];
+      [_store sendCommand: IMAP_UID_FETCH_HEADER_FIELDS  info: theInfo  arguments: @"UID FETCH %lu:* (UID FLAGS RFC822.SIZE BODY.PEEK[HEADER.FIELDS (From To Cc Subject Date Message-ID References In-Reply-To)])",
+	      (unsigned long)(uid+1)];
+    }
   // We first update the messages in our cache, if we need to.
-  if (self.cacheManager && [self count])
+  else if (aCacheManager && [self count])
     {
       [_store sendCommand: IMAP_UID_SEARCH  info: nil  arguments: @"UID SEARCH 1:*"];
     }
+  //
+  // The windows are counted from the last message, we wait for the
+  // EXISTS response telling how many there are. See -setExistsCount:.
+  //
+  else if (_prefetchWindow && ![self count] && _existsCount == NSNotFound)
+    {
+      _prefetchPending = YES;
+    }
+  //
+  // We fetch the newest messages first. Their MSNs are the only thing we
+  // know, so we add a message for each one the folder has and fill them
+  // as their window is fetched. Their records are then written newest
+  // first, the cache sorts them once the last window is fetched.
+  //
+  else if (_prefetchWindow && ![self count] && _existsCount > _prefetchWindow)
+    {
+      for (i = 0; i < _existsCount; i++)
+	{
+	  aMessage = [[CWIMAPMessage alloc] init];
+	  [aMessage setInitialized: NO];
+	  [aMessage setFolder: self];
+	  [aMessage setMessageNumber: i+1];
+	  [self appendMessage: aMessage];
+	}
+
+      aCacheManager.acceptsUnorderedRecords = YES;
+      [self prefetchWindowBeforeIndex: _existsCount];
+    }
   else
     {
       //
       // We must send this command since our IMAP cache might be empty (or have been removed).
       // In that case, we much fetch again all messages, starting at UID 1.
       //
-      [_store sendCommand: IMAP_UID_FETCH_HEADER_FIELDS  info: nil  arguments: @"UID FETCH %u:* (UID FLAGS RFC822.SIZE BODY.PEEK[HEADER.FIELDS (From To Cc Subject Date Message-ID References In-Reply-To)])", 1];
+      [_store sendCommand: IMAP_UID_FETCH_HEADER_FIELDS  info: theInfo  arguments: @"UID FETCH %u:* (UID FLAGS RFC822.SIZE BODY.PEEK[HEADER.FIELDS (From To Cc Subject Date Message-ID References In-Reply-To)])", 1];
+    }
+}
+
+
+//
+// We don't know the UIDs of the messages yet, we fetch them from
+// their MSNs. The window that completes gives the next one, see
+// -_parseOK in CWIMAPStore.
+//
+- (void) prefetchWindowBeforeIndex: (NSUInteger) theIndex
+{
+  NSMutableDictionary *theInfo;
+  NSUInteger first;
+
+  first = (_prefetchWindow && theIndex > _prefetchWindow ? theIndex-_prefetchWindow : 0);
+
+  theInfo = [NSMutableDictionary dictionaryWithObjectsAndKeys: self, @"Folder",
+				 [NSValue valueWithRange: NSMakeRange(first, theIndex-first)], @"Range", nil];
+
+  if ([_store isQRESYNCEnabled] && _highestModSeq)
+    {
+      [theInfo setObject: [NSNumber numberWithUnsignedLongLong: _highestModSeq]  forKey: @"HighestModSeq"];
     }
+
+  [_store sendCommand: IMAP_UID_FETCH_HEADER_FIELDS  info: theInfo  arguments: @"FETCH %lu:%lu (UID FLAGS RFC822.SIZE BODY.PEEK[HEADER.FIELDS (From To Cc Subject Date Message-ID References In-Reply-To)])",
+	  (unsigned long)(first+1), (unsigned long)theIndex];
 }
 
 
@@ -218,14 +471,20 @@
   theCommand = [[self store] lastCommand];
 
   if (theCommand == IMAP_SELECT || theCommand == IMAP_UID_SEARCH || theCommand == IMAP_UID_SEARCH_ANSWERED ||
-      theCommand == IMAP_UID_SEARCH_FLAGGED || theCommand == IMAP_UID_SEARCH_UNSEEN)
+      theCommand == IMAP_UID_SEARCH_FLAGGED || theCommand == IMAP_UID_SEARCH_UNSEEN ||
+      theCommand == IMAP_UID_FETCH_FLAGS_CHANGEDSINCE)
     {
+      // The mailbox won't be selected anymore, the held back changes can't be sent.
+      [self _discardFlagUpdates];
       [_store removeFolderFromOpenFolders: self];
       [[self store] cancelRequest];
       [[self store] reconnect];
       return;
     }
 
+  // Flag changes we were holding back must reach the server before CLOSE expunges messages.
+  [self flushFlagUpdates];
+
   if (self.cacheManager)
     {
       NSLog(@"Synching cache...");
@@ -233,6 +492,8 @@
       NSLog(@"Done synching cache.");
     }
 
+  [[_store bodyStore] synchronize];
+
   // We set the _folder ivar to nil for all messages. This is required in case
   // an IMAPMessage instance was retained and we invoke -setFlags: on it, which
   // will try to access the _folder ivar in order to communicate with the IMAP server.
@@ -263,6 +524,9 @@
 //
 - (void) expunge
 {
+  // Messages marked as \Deleted must be known as such by the server.
+  [self flushFlagUpdates];
+
   //
   // We send our EXPUNGE command. The responses will be processed in IMAPStore and
   // the MSN will be updated in IMAPStore: -_parseExpunge.
@@ -289,74 +553,179 @@
     }
 }
 
+
+//
+// -prefetch might be waiting for the first EXISTS response.
+//
+- (void) setExistsCount: (NSUInteger) theCount
+{
+  _existsCount = theCount;
+
+  if (_prefetchPending)
+    {
+      _prefetchPending = NO;
+      [self prefetch];
+    }
+}
+
 //
 //
 //
 - (void) setFlags: (CWFlags *) theFlags
          messages: (NSArray *) theMessages
 {
-    NSMutableString *aMutableString, *aSequenceSet;
     CWIMAPMessage *aMessage;
+    NSNumber *aNumber;
+    NSUInteger i, count;
     
-    if ([theMessages count] == 1)
+    // We set the flags right away, just in case someone asks for them
+    // just after invoking this method. Nevertheless, they WILL be set
+    // in IMAPStore: -_parseOK:.
+    count = [theMessages count];
+    
+    for (i = 0; i < count; i++)
     {
-        aMessage = [theMessages lastObject];
-        // We set the flags right away, just in case someone asks for them
-        // just after invoking this method. Nevertheless, they WILL be set
-        // in IMAPStore: -_parseOK:.
-        // We do the same below, when the count > 1
-        [[aMessage flags] replaceWithFlags: theFlags];
-        aSequenceSet = [NSMutableString stringWithFormat: @"%lu:%lu", (unsigned long)[aMessage uid], (unsigned long)[aMessage uid]];
+        [[(CWMessage *)[theMessages objectAtIndex: i] flags] replaceWithFlags: theFlags];
+        [(CWIMAPCacheManager *)self.cacheManager updateFlagsOfMessage: [theMessages objectAtIndex: i]];
     }
-    else
+    
+    if (_flagUpdateDelay <= 0)
     {
-        NSInteger i, count;
-        
-        aSequenceSet = [[NSMutableString alloc] init];
-        count = [theMessages count];
-        
-        for (i = 0; i < count; i++)
-        {
-            aMessage = [theMessages objectAtIndex: i];
-            [[aMessage flags] replaceWithFlags: theFlags];
-            
-            if (aMessage == [theMessages lastObject])
-            {
-                [aSequenceSet appendFormat: @"%lu", (unsigned long)[aMessage uid]];
-            }
-            else
-            {
-                [aSequenceSet appendFormat: @"%lu,", (unsigned long)[aMessage uid]];
-            }
-        }
+        [self _storeFlags: theFlags  messages: theMessages];
+        return;
     }
     
-    aMutableString = [[NSMutableString alloc] init];
+    //
+    // We hold the change back. The last flags set on a message win, the
+    // ones we were holding for it are never sent.
+    //
+    theFlags = [theFlags copy];
+    
+    for (i = 0; i < count; i++)
+    {
+        aMessage = [theMessages objectAtIndex: i];
+        aNumber = [NSNumber numberWithUnsignedInteger: [aMessage uid]];
+        [_pendingFlags setObject: theFlags  forKey: aNumber];
+        [_pendingMessages setObject: aMessage  forKey: aNumber];
+    }
     
     //
-    // If we're removing all flags, we rather send a STORE -FLAGS (<current flags>)
-    // than a STORE FLAGS (<new flags>) since some broken servers might not
-    // support it (like Cyrus v1.5.19 and v1.6.24).
+    // We flush the changes once the delay expired. If nothing runs the
+    // run loop, like with CWReactor, we also flush when a change comes
+    // after the delay expired.
     //
-    if (theFlags.flags == 0)
+    if (!_pendingSince)
     {
-        [aMutableString appendFormat: @"UID STORE %@ -FLAGS.SILENT (", aSequenceSet];
-        [aMutableString appendString: [self _flagsAsStringFromFlags: theFlags]];
-        [aMutableString appendString: @")"];
+        _pendingSince = monotonic_time();
+        [self performSelector: @selector(flushFlagUpdates)  withObject: nil  afterDelay: _flagUpdateDelay];
     }
-    else
+    else if (monotonic_time() - _pendingSince >= _flagUpdateDelay)
     {
-        [aMutableString appendFormat: @"UID STORE %@ FLAGS.SILENT (", aSequenceSet];
-        [aMutableString appendString: [self _flagsAsStringFromFlags: theFlags]];
-        [aMutableString appendString: @")"];
+        [self flushFlagUpdates];
     }
+}
+
+
+//
+// We send one STORE per distinct set of flags.
+//
+- (void) flushFlagUpdates
+{
+    NSMutableDictionary *allFlags, *allGroups;
+    NSMutableArray *theMessages;
+    NSEnumerator *theEnumerator;
+    NSNumber *aNumber, *aKey;
+    CWFlags *theFlags;
     
-    [_store sendCommand: IMAP_UID_STORE
-                   info: [NSDictionary dictionaryWithObjectsAndKeys: theMessages, @"Messages", theFlags, @"Flags", nil]
-              arguments: aMutableString];
+    if (!_pendingSince)
+    {
+        return;
+    }
+    
+    [NSObject cancelPreviousPerformRequestsWithTarget: self  selector: @selector(flushFlagUpdates)  object: nil];
+    _pendingSince = 0;
+    
+    allFlags = [NSMutableDictionary dictionary];
+    allGroups = [NSMutableDictionary dictionary];
+    theEnumerator = [_pendingFlags keyEnumerator];
+    
+    while ((aNumber = [theEnumerator nextObject]))
+    {
+        theFlags = [_pendingFlags objectForKey: aNumber];
+        aKey = [NSNumber numberWithUnsignedInteger: theFlags.flags];
+        theMessages = [allGroups objectForKey: aKey];
+        
+        if (!theMessages)
+        {
+            theMessages = [NSMutableArray array];
+            [allGroups setObject: theMessages  forKey: aKey];
+            [allFlags setObject: theFlags  forKey: aKey];
+        }
+        
+        [theMessages addObject: [_pendingMessages objectForKey: aNumber]];
+    }
+    
+    [_pendingFlags removeAllObjects];
+    [_pendingMessages removeAllObjects];
+    theEnumerator = [allGroups keyEnumerator];
+    
+    while ((aKey = [theEnumerator nextObject]))
+    {
+        [self _storeFlags: [allFlags objectForKey: aKey]  messages: [allGroups objectForKey: aKey]];
+    }
 }
 
 
+//
+// The messages we don't know the UID of yet, the new ones or those
+// a prefetch window didn't reach, have 0 for UID. They can be the
+// last ones as well as the first ones, with the newest messages
+// prefetched first, so we skip over those we land on: the ones
+// following them tell us on which side the UID is.
+//
+- (NSUInteger) indexOfMessageWithUID: (NSUInteger) theUID
+{
+    NSUInteger low, high, mid, i, uid;
+    
+    if (!theUID)
+    {
+        return NSNotFound;
+    }
+    
+    low = 0;
+    high = [allMessages count];
+    
+    while (low < high)
+    {
+        mid = low + (high-low)/2;
+        
+        for (i = mid; i < high && !(uid = [(CWIMAPMessage *)[allMessages objectAtIndex: i] uid]); i++);
+        
+        // There's no known UID left from mid on.
+        if (i == high)
+        {
+            high = mid;
+            continue;
+        }
+        
+        if (uid == theUID)
+        {
+            return i;
+        }
+        
+        if (uid < theUID)
+        {
+            low = i+1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    
+    return NSNotFound;
+}
+
 
 //
 // Using IMAP, we ignore most parameters.
@@ -390,6 +759,89 @@
   [_store sendCommand: IMAP_UID_SEARCH_ALL  info: [NSDictionary dictionaryWithObject: self  forKey: @"Folder"]  arguments: aString];
 }
 
+
+//
+//
+//
+- (BOOL) canSort
+{
+  return [self _hasCapability: @"SORT"];
+}
+
+
+//
+// We always sort all the messages, using UTF-8 which RFC 5256
+// requires servers to support.
+//
+- (void) sortByKey: (PantomimeSortKey) theKey
+           reverse: (BOOL) theBOOL
+{
+  NSString *aString;
+
+  switch (theKey)
+    {
+    case PantomimeSortArrival:
+      aString = @"ARRIVAL";
+      break;
+
+    case PantomimeSortCc:
+      aString = @"CC";
+      break;
+
+    case PantomimeSortFrom:
+      aString = @"FROM";
+      break;
+
+    case PantomimeSortSize:
+      aString = @"SIZE";
+      break;
+
+    case PantomimeSortSubject:
+      aString = @"SUBJECT";
+      break;
+
+    case PantomimeSortTo:
+      aString = @"TO";
+      break;
+
+    case PantomimeSortDate:
+    default:
+      aString = @"DATE";
+    }
+
+  [_store sendCommand: IMAP_UID_SORT
+		 info: [NSDictionary dictionaryWithObject: self  forKey: @"Folder"]
+	    arguments: @"UID SORT (%@%@) UTF-8 ALL", (theBOOL ? @"REVERSE " : @""), aString];
+}
+
+
+//
+//
+//
+- (BOOL) canThreadWithAlgorithm: (PantomimeThreadAlgorithm) theAlgorithm
+{
+  return [self _hasCapability: (theAlgorithm == PantomimeThreadOrderedSubject ? @"THREAD=ORDEREDSUBJECT" : @"THREAD=REFERENCES")];
+}
+
+
+//
+//
+//
+- (void) threadWithAlgorithm: (PantomimeThreadAlgorithm) theAlgorithm
+{
+  [_store sendCommand: IMAP_UID_THREAD
+		 info: [NSDictionary dictionaryWithObject: self  forKey: @"Folder"]
+	    arguments: @"UID THREAD %@ UTF-8 ALL", (theAlgorithm == PantomimeThreadOrderedSubject ? @"ORDEREDSUBJECT" : @"REFERENCES")];
+}
+
+- (void) _discardFlagUpdates
+{
+    [NSObject cancelPreviousPerformRequestsWithTarget: self  selector: @selector(flushFlagUpdates)  object: nil];
+    _pendingSince = 0;
+    [_pendingFlags removeAllObjects];
+    [_pendingMessages removeAllObjects];
+}
+
 - (NSString *) _flagsAsStringFromFlags: (CWFlags *) theFlags
 {
   NSMutableString *aMutableString;
@@ -425,6 +877,28 @@
 }
 
 
+//
+//
+//
+- (BOOL) _hasCapability: (NSString *) theCapability
+{
+  NSArray *allCapabilities;
+  NSUInteger i;
+
+  allCapabilities = [_store capabilities];
+
+  for (i = 0; i < [allCapabilities count]; i++)
+    {
+      if ([[allCapabilities objectAtIndex: i] caseInsensitiveCompare: theCapability] == NSOrderedSame)
+	{
+	  return YES;
+	}
+    }
+
+  return NO;
+}
+
+
 //
 //
 //
@@ -461,5 +935,53 @@
   return aMutableData;
 }
 
+
+//
+//
+//
+- (void) _storeFlags: (CWFlags *) theFlags  messages: (NSArray *) theMessages
+{
+    NSMutableString *aMutableString;
+    CWIMAPSequenceSet *aSequenceSet;
+    NSArray *allSubsets;
+    NSUInteger i, count;
+    
+    //
+    // Consecutive UIDs are sent as ranges and we send one command
+    // per subset of the set so that none of them is too long.
+    //
+    allSubsets = [[CWIMAPSequenceSet sequenceSetWithMessages: theMessages] subsets];
+    count = [allSubsets count];
+    
+    for (i = 0; i < count; i++)
+    {
+        aSequenceSet = [allSubsets objectAtIndex: i];
+        aMutableString = [[NSMutableString alloc] init];
+        
+        //
+        // If we're removing all flags, we rather send a STORE -FLAGS (<current flags>)
+        // than a STORE FLAGS (<new flags>) since some broken servers might not
+        // support it (like Cyrus v1.5.19 and v1.6.24).
+        //
+        if (theFlags.flags == 0)
+        {
+            [aMutableString appendFormat: @"UID STORE %@ -FLAGS.SILENT (", [aSequenceSet stringValue]];
+            [aMutableString appendString: [self _flagsAsStringFromFlags: theFlags]];
+            [aMutableString appendString: @")"];
+        }
+        else
+        {
+            [aMutableString appendFormat: @"UID STORE %@ FLAGS.SILENT (", [aSequenceSet stringValue]];
+            [aMutableString appendString: [self _flagsAsStringFromFlags: theFlags]];
+            [aMutableString appendString: @")"];
+        }
+        
+        [_store sendCommand: IMAP_UID_STORE
+                       info: [NSDictionary dictionaryWithObjectsAndKeys: (count > 1 ? [aSequenceSet messagesFromArray: theMessages] : theMessages), @"Messages",
+                              theFlags, @"Flags", nil]
+                  arguments: aMutableString];
+    }
+}
+
 @end
 
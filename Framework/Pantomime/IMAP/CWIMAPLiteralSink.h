@@ -0,0 +1,99 @@
+/*
+**  CWIMAPLiteralSink.h
+**
+**  Copyright (c) 2001-2007
+**
+**  This library is free software; you can redistribute it and/or
+**  modify it under the terms of the GNU Lesser General Public
+**  License as published by the Free Software Foundation; either
+**  version 2.1 of the License, or (at your option) any later version.
+**
+**  This library is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+**  Lesser General Public License for more details.
+**
+**  You should have received a copy of the GNU Lesser General Public
+**  License along with this library; if not, write to the Free Software
+**  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef _Pantomime_H_CWIMAPLiteralSink
+#define _Pantomime_H_CWIMAPLiteralSink
+
+#import <Foundation/Foundation.h>
+
+/*!
+  @class CWIMAPLiteralSink
+  @discussion This class collects the data of a literal sent by the
+              IMAP server. The literal is received line by line and its
+	      line breaks are stored as LF, so it doesn't have to be
+	      converted once it has been fully received.
+
+	      Small literals are kept in memory. Literals bigger than the
+	      threshold given at initialization time are written to a
+	      temporary file, through a small buffer, and the data
+	      obtained once the literal is complete maps that file. This
+	      way, receiving a very big message doesn't require holding
+	      it in memory, twice.
+*/
+@interface CWIMAPLiteralSink : NSObject
+
+/*!
+  @method initWithCapacity: threshold:
+  @discussion This method is used to initialize a sink for a literal
+              of <i>theCapacity</i> bytes, as announced by the server.
+  @param theCapacity The size of the literal.
+  @param theThreshold The size above which the literal is written to
+                      a temporary file, 0 to always keep it in memory.
+  @result The instance.
+*/
+- (id) initWithCapacity: (NSUInteger) theCapacity
+              threshold: (NSUInteger) theThreshold;
+
+/*!
+  @method isFileBacked
+  @discussion This method is used to verify if the receiver
+              writes the literal to a temporary file.
+  @result YES if it does, NO if the literal is kept in memory.
+*/
+- (BOOL) isFileBacked;
+
+/*!
+  @method appendBytes: length:
+  @discussion This method is used to append bytes of a line
+              of the literal, without its line break.
+  @param theBytes The bytes to append.
+  @param theLength The number of bytes to append.
+*/
+- (void) appendBytes: (const char *) theBytes  length: (NSUInteger) theLength;
+
+/*!
+  @method appendLineBreak
+  @discussion This method is used to end the current line of the literal.
+              A LF is appended in place of the CRLF that was received.
+*/
+- (void) appendLineBreak;
+
+/*!
+  @method length
+  @discussion This method is used to obtain the number of bytes
+              appended to the receiver so far.
+  @result The number of bytes.
+*/
+- (NSUInteger) length;
+
+/*!
+  @method data
+  @discussion This method is used to obtain the literal. Once this method
+              has been called, nothing can be appended to the receiver.
+	      If the literal was written to a temporary file, the data maps
+	      that file, which is unlinked right away.
+  @result The literal, with LF line breaks. nil if it was written to
+          a temporary file that could not be read back.
+*/
+- (NSData *) data;
+
+@end
+
+#endif // _Pantomime_H_CWIMAPLiteralSink
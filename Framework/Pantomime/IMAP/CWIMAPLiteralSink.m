@@ -0,0 +1,261 @@
+/*
+**  CWIMAPLiteralSink.m
+**
+**  Copyright (c) 2001-2007
+**
+**  This library is free software; you can redistribute it and/or
+**  modify it under the terms of the GNU Lesser General Public
+**  License as published by the Free Software Foundation; either
+**  version 2.1 of the License, or (at your option) any later version.
+**
+**  This library is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+**  Lesser General Public License for more details.
+**
+**  You should have received a copy of the GNU Lesser General Public
+**  License along with this library; if not, write to the Free Software
+**  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#import "CWIMAPLiteralSink.h"
+
+#include "io.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+//
+// Bytes written to the temporary file are first collected in
+// a buffer of that size, to avoid a write() per line.
+//
+#define FLUSH_SIZE 65536
+
+@interface CWIMAPLiteralSink ()
+
+- (void) _flush;
+- (void) _openFile;
+- (void) _readBackFile;
+
+@end
+
+@implementation CWIMAPLiteralSink
+{
+    NSMutableData *_buffer;
+    NSString *_path;
+    NSData *_data;
+    NSUInteger _length;
+    int _fd;
+    BOOL _lost;
+}
+
+//
+//
+//
+- (id) initWithCapacity: (NSUInteger) theCapacity
+              threshold: (NSUInteger) theThreshold
+{
+    self = [super init];
+    if (self)
+    {
+        _fd = -1;
+        _length = 0;
+        _lost = NO;
+        
+        if (theThreshold && theCapacity > theThreshold)
+        {
+            [self _openFile];
+        }
+        
+        _buffer = [[NSMutableData alloc] initWithCapacity: (_fd < 0 ? theCapacity : FLUSH_SIZE)];
+    }
+    return self;
+}
+
+
+//
+//
+//
+- (void) dealloc
+{
+    if (_fd >= 0)
+    {
+        safe_close(_fd);
+        unlink([_path fileSystemRepresentation]);
+    }
+}
+
+
+//
+//
+//
+- (BOOL) isFileBacked
+{
+    return (_fd >= 0);
+}
+
+
+//
+//
+//
+- (void) appendBytes: (const char *) theBytes  length: (NSUInteger) theLength
+{
+    if (_data || _lost || !theLength) return;
+    
+    [_buffer appendBytes: theBytes  length: theLength];
+    _length += theLength;
+    
+    if (_fd >= 0 && [_buffer length] >= FLUSH_SIZE)
+    {
+        [self _flush];
+    }
+}
+
+
+//
+//
+//
+- (void) appendLineBreak
+{
+    [self appendBytes: "\n"  length: 1];
+}
+
+
+//
+//
+//
+- (NSUInteger) length
+{
+    return _length;
+}
+
+
+//
+//
+//
+- (NSData *) data
+{
+    if (_data)
+    {
+        return _data;
+    }
+    
+    if (_fd >= 0)
+    {
+        [self _flush];
+    }
+    
+    //
+    // A mapping outlives the name of the file it maps. If we could not
+    // map it, we fall back on reading it, before it goes away. If both
+    // fail, the literal is lost, we don't pass part of it for all of it.
+    //
+    if (_fd >= 0)
+    {
+        safe_close(_fd);
+        _fd = -1;
+        
+        _data = (_length ? [NSData dataWithContentsOfFile: _path  options: NSDataReadingMappedAlways  error: NULL] : [NSData data]);
+        
+        if (!_data)
+        {
+            _data = [[NSData alloc] initWithContentsOfFile: _path];
+        }
+        
+        unlink([_path fileSystemRepresentation]);
+        _buffer = nil;
+        
+        if (!_data || [_data length] != _length)
+        {
+            NSLog(@"UNABLE TO READ BACK THE LITERAL");
+            _data = nil;
+            _lost = YES;
+        }
+        
+        return _data;
+    }
+    
+    if (!_lost)
+    {
+        _data = _buffer;
+    }
+    
+    _buffer = nil;
+    
+    return _data;
+}
+
+
+//
+// If we can no longer write to our file, we continue in memory
+// with what we had written so far.
+//
+- (void) _flush
+{
+    if (![_buffer length])
+    {
+        return;
+    }
+    
+    if (write_block(_fd, [_buffer bytes], [_buffer length]) < 0)
+    {
+        [self _readBackFile];
+        return;
+    }
+    
+    [_buffer setLength: 0];
+}
+
+
+//
+//
+//
+- (void) _openFile
+{
+    NSString *aTemplate;
+    char *path;
+    
+    aTemplate = [NSTemporaryDirectory() stringByAppendingPathComponent: @"PantomimeLiteral.XXXXXX"];
+    path = strdup([aTemplate fileSystemRepresentation]);
+    
+    if (path && (_fd = mkstemp(path)) >= 0)
+    {
+        _path = [[NSFileManager defaultManager] stringWithFileSystemRepresentation: path  length: strlen(path)];
+    }
+    
+    free(path);
+}
+
+
+//
+//
+//
+- (void) _readBackFile
+{
+    NSMutableData *aMutableData;
+    
+    safe_close(_fd);
+    _fd = -1;
+    
+    aMutableData = [[NSMutableData alloc] initWithContentsOfFile: _path];
+    unlink([_path fileSystemRepresentation]);
+    
+    // What we had written is gone, so is the literal.
+    if (!aMutableData || [aMutableData length] < _length - [_buffer length])
+    {
+        NSLog(@"UNABLE TO READ BACK THE LITERAL");
+        _lost = YES;
+        return;
+    }
+    
+    // A failed write might have left part of our buffer in the file.
+    if ([aMutableData length] > _length - [_buffer length])
+    {
+        [aMutableData setLength: _length - [_buffer length]];
+    }
+    
+    [aMutableData appendData: _buffer];
+    _buffer = aMutableData;
+}
+
+@end
@@ -22,6 +22,28 @@
 
 #import "CWMessage.h"
 
+/*!
+  @const PantomimeBodyStructureFetchCompleted
+  @discussion This notification is posted when CWIMAPMessage: -fetchBodyStructure
+              has successfully completed. -bodyStructureFetchCompleted:
+	      is also called on the delegate, if any. The message is found
+	      under the "Message" key of the userInfo.
+*/
+extern NSString* PantomimeBodyStructureFetchCompleted;
+
+/*!
+  @const PantomimePartFetchCompleted
+  @discussion This notification is posted when CWIMAPPart: -fetchContent
+              or -fetchContentFromOffset:length: has successfully completed.
+	      -partFetchCompleted: is also called on the delegate, if any.
+	      The part is found under the "Part" key of the userInfo and its
+	      message under the "Message" key.
+*/
+extern NSString* PantomimePartFetchCompleted;
+
+@class CWIMAPCacheManager;
+@class CWIMAPPart;
+
 /*!
   @class CWIMAPMessage
   @discussion This class, which extends CWMessage, adds IMAP specific
@@ -40,12 +62,53 @@
 */
 @property NSUInteger uid;
 
+/*!
+  @property bodyStructure
+  @discussion The structure of the message, once fetched with
+              -fetchBodyStructure. It is a tree of CWIMAPPart instances
+	      whose content hasn't been fetched. The root is a multipart
+	      (with an empty section) for a multipart message and the
+	      only part of the message (section "1") otherwise.
+*/
+@property CWIMAPPart *bodyStructure;
+
+/*!
+  @property cacheManager
+  @discussion The cache the receiver was read from, if any. Its cached
+              headers are decoded from its record in that cache when
+	      they are first accessed, see CWMessage: -setCachedHeaders:.
+*/
+@property (weak) CWIMAPCacheManager *cacheManager;
+
+/*!
+  @method fetchBodyStructure
+  @discussion This method is used to fetch the BODYSTRUCTURE of the
+              receiver from the IMAP server, without fetching its content.
+	      The parts it describes can then be fetched one by one, see
+	      CWIMAPPart: -fetchContent. On success, the PantomimeBodyStructureFetchCompleted
+	      notification is posted (and -bodyStructureFetchCompleted: is
+	      called on the delegate, if any).
+*/
+- (void) fetchBodyStructure;
+
+/*!
+  @method partForSection:
+  @discussion This method is used to obtain the part of the receiver's
+              body structure having the section <i>theSection</i>.
+  @param theSection The section specification, like "1.2".
+  @result The part, nil if the body structure isn't known or if
+          it has no such part.
+*/
+- (CWIMAPPart *) partForSection: (NSString *) theSection;
+
 /*!
   @method rawSource
   @discussion IMAP specific implementation of the rawSource method. This method
               is always non-blocking. It might return nil if the raw source of the
 	      message hasn't yet been fetched from the IMAP server. The IMAPStore
-	      notifies the delegate when the fetch has been completed.
+	      notifies the delegate when the fetch has been completed. The
+	      source is first looked for in the body store of the IMAPStore,
+	      if any, see CWIMAPStore: -bodyStore.
   @result The raw source of the message, nil if not yet fully fetched.
 */
 - (NSData *) rawSource;
@@ -24,8 +24,14 @@
 
 #import "CWConstants.h"
 #import "CWFlags.h"
+#import "CWIMAPBodyStore.h"
+#import "CWIMAPCacheManager.h"
 #import "CWIMAPFolder.h"
+#import "CWIMAPPart.h"
 #import "CWIMAPStore.h"
+#import "CWMIMEMultipart.h"
+#import "CWMIMEUtility.h"
+#import "NSData+CWExtensions.h"
 
 
 @interface CWIMAPMessage ()
@@ -93,9 +99,27 @@
     
     if (!_content)
     {
+        NSData *aData;
+        NSRange aRange;
         id aStore;
         
         aStore = [(CWIMAPFolder *)[self folder] store];
+        aData = [[aStore bodyStore] dataForMessage: self];
+        
+        // If we kept the source, we initialize the message from it.
+        if (aData && (aRange = [aData rangeOfCString: "\r\n\r\n"]).length)
+        {
+            if (!self.headersWerePrefetched)
+            {
+                [self setHeadersFromData: [aData subdataWithRange: NSMakeRange(0, aRange.location+2)]  record: nil];
+            }
+            
+            [CWMIMEUtility setContentFromRawSource: [aData subdataWithRange: NSMakeRange(NSMaxRange(aRange), [aData length]-NSMaxRange(aRange))]
+                                            inPart: self];
+            [self setRawSource: aData];
+            self.headersWerePrefetched = YES;
+            return;
+        }
         
         if (!self.headersWerePrefetched)
         {
@@ -132,6 +156,15 @@
     
     if (!_rawSource)
     {
+        // The source might have been fetched in an earlier session.
+        NSData *aData = [[(CWIMAPStore *)[[self folder] store] bodyStore] dataForMessage: self];
+        
+        if (aData)
+        {
+            [self setRawSource: aData];
+            return _rawSource;
+        }
+        
         [(CWIMAPStore *)[[self folder] store] sendCommand: IMAP_UID_FETCH_RFC822  info: nil  arguments: @"UID FETCH %u:%u RFC822", _uid, _uid];
     }
     
@@ -139,6 +172,64 @@
 }
 
 
+//
+//
+//
+- (void) fetchBodyStructure
+{
+    if (![(CWIMAPFolder *)[self folder] selected])
+    {
+        [NSException raise:PantomimeProtocolException format:@"Unable to fetch message structure from unselected mailbox."];
+        return;
+    }
+    
+    [(CWIMAPStore *)[[self folder] store] sendCommand: IMAP_UID_FETCH_BODYSTRUCTURE  info: nil  arguments: @"UID FETCH %u:%u BODYSTRUCTURE", _uid, _uid];
+}
+
+
+//
+// The section tells us which part to pick at each level,
+// so we only walk down the branch leading to our part.
+//
+- (CWIMAPPart *) partForSection: (NSString *) theSection
+{
+    CWMIMEMultipart *aMultipart;
+    CWIMAPPart *aPart;
+    NSArray *allIndexes;
+    NSInteger index;
+    NSUInteger i;
+    
+    aPart = self.bodyStructure;
+    
+    if (!aPart || [[aPart section] isEqualToString: theSection])
+    {
+        return aPart;
+    }
+    
+    allIndexes = [theSection componentsSeparatedByString: @"."];
+    
+    for (i = 0; i < [allIndexes count]; i++)
+    {
+        if (![[aPart content] isKindOfClass: [CWMIMEMultipart class]])
+        {
+            return nil;
+        }
+        
+        aMultipart = (CWMIMEMultipart *)[aPart content];
+        index = [[allIndexes objectAtIndex: i] integerValue];
+        
+        if (index < 1 || index > [aMultipart count])
+        {
+            return nil;
+        }
+        
+        aPart = (CWIMAPPart *)[aMultipart partAtIndex: index-1];
+    }
+    
+    return ([[aPart section] isEqualToString: theSection] ? aPart : nil);
+}
+
+
 //
 //
 //
@@ -148,4 +239,13 @@
                    messages: [NSArray arrayWithObject: self]];
 }
 
+
+//
+//
+//
+- (void) readCachedHeaders: (NSUInteger) theHeaders
+{
+    [_cacheManager readHeaders: theHeaders  ofMessage: self];
+}
+
 @end
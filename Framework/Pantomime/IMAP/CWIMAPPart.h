@@ -0,0 +1,79 @@
+/*
+**  CWIMAPPart.h
+**
+**  Copyright (c) 2001-2007
+**
+**  This library is free software; you can redistribute it and/or
+**  modify it under the terms of the GNU Lesser General Public
+**  License as published by the Free Software Foundation; either
+**  version 2.1 of the License, or (at your option) any later version.
+**
+**  This library is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+**  Lesser General Public License for more details.
+**
+**  You should have received a copy of the GNU Lesser General Public
+**  License along with this library; if not, write to the Free Software
+**  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef _Pantomime_H_CWIMAPPart
+#define _Pantomime_H_CWIMAPPart
+
+#import "CWPart.h"
+
+@class CWIMAPMessage;
+
+/*!
+  @class CWIMAPPart
+  @discussion This class, which extends CWPart, describes a part of
+              an IMAP message as given by its BODYSTRUCTURE, before its
+	      content is fetched. Its MIME headers (Content-Type, charset,
+	      Content-Transfer-Encoding, filename and so on) and its size are
+	      set but its content is only fetched when asked for, using
+	      its section specification. See CWIMAPMessage: -fetchBodyStructure.
+*/
+@interface CWIMAPPart : CWPart <NSCoding>
+
+/*!
+  @property section
+  @discussion The section specification of the receiver, like "1" or
+              "2.1". See 6.4.5. FETCH Command of RFC 3501. It is empty
+	      for the multipart holding all the parts of a message.
+*/
+@property (copy) NSString *section;
+
+/*!
+  @property message
+  @discussion The message the receiver is a part of.
+*/
+@property (weak) CWIMAPMessage *message;
+
+/*!
+  @method fetchContent
+  @discussion This method is used to fetch the content of the receiver,
+              without fetching the rest of the message. Once fetched, the
+	      content is decoded and set. The PantomimePartFetchCompleted
+	      notification is then posted (and -partFetchCompleted: is
+	      called on the delegate, if any).
+*/
+- (void) fetchContent;
+
+/*!
+  @method fetchContentFromOffset: length:
+  @discussion This method is used to fetch <i>theLength</i> bytes of the
+              content of the receiver, starting at <i>theOffset</i>. Those
+	      bytes are not decoded and the content of the receiver isn't set.
+	      They are found under the "NSData" key of the userInfo of the
+	      PantomimePartFetchCompleted notification, the offset under the
+	      "Offset" key.
+  @param theOffset The offset of the first byte to fetch.
+  @param theLength The number of bytes to fetch.
+*/
+- (void) fetchContentFromOffset: (NSUInteger) theOffset
+                         length: (NSUInteger) theLength;
+
+@end
+
+#endif // _Pantomime_H_CWIMAPPart
@@ -0,0 +1,93 @@
+/*
+**  CWIMAPPart.m
+**
+**  Copyright (c) 2001-2007
+**
+**  This library is free software; you can redistribute it and/or
+**  modify it under the terms of the GNU Lesser General Public
+**  License as published by the Free Software Foundation; either
+**  version 2.1 of the License, or (at your option) any later version.
+**
+**  This library is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+**  Lesser General Public License for more details.
+**
+**  You should have received a copy of the GNU Lesser General Public
+**  License along with this library; if not, write to the Free Software
+**  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#import "CWIMAPPart.h"
+
+#import "CWConstants.h"
+#import "CWIMAPFolder.h"
+#import "CWIMAPMessage.h"
+#import "CWIMAPStore.h"
+
+@implementation CWIMAPPart
+
+//
+// NSCoding protocol
+//
+- (void) encodeWithCoder: (NSCoder *) theCoder
+{
+    [super encodeWithCoder: theCoder];
+    [theCoder encodeObject: _section];
+}
+
+
+//
+//
+//
+- (id) initWithCoder: (NSCoder *) theCoder
+{
+    self = [super initWithCoder: theCoder];
+    if (self)
+    {
+        _section = [theCoder decodeObject];
+    }
+    return self;
+}
+
+
+//
+//
+//
+- (void) fetchContent
+{
+    CWIMAPFolder *aFolder;
+    
+    aFolder = (CWIMAPFolder *)[_message folder];
+    
+    if (![aFolder selected])
+    {
+        [NSException raise: PantomimeProtocolException  format: @"Unable to fetch part content from unselected mailbox."];
+        return;
+    }
+    
+    [[aFolder store] sendCommand: IMAP_UID_FETCH_BODY_PART  info: nil  arguments: @"UID FETCH %u:%u BODY.PEEK[%@]", [_message uid], [_message uid], _section];
+}
+
+
+//
+//
+//
+- (void) fetchContentFromOffset: (NSUInteger) theOffset
+                         length: (NSUInteger) theLength
+{
+    CWIMAPFolder *aFolder;
+    
+    aFolder = (CWIMAPFolder *)[_message folder];
+    
+    if (![aFolder selected])
+    {
+        [NSException raise: PantomimeProtocolException  format: @"Unable to fetch part content from unselected mailbox."];
+        return;
+    }
+    
+    [[aFolder store] sendCommand: IMAP_UID_FETCH_BODY_PART  info: nil  arguments: @"UID FETCH %u:%u BODY.PEEK[%@]<%lu.%lu>", [_message uid], [_message uid], _section,
+                     (unsigned long)theOffset, (unsigned long)theLength];
+}
+
+@end
@@ -8,6 +8,8 @@
 
 #import "CWIMAPStore.h"
 
+@class CWIMAPLiteralSink;
+
 @interface CWIMAPQueueObject : NSObject
 
 @property IMAPCommand command;
@@ -15,6 +17,7 @@
 @property NSData *tag;
 @property NSMutableDictionary *info;
 @property NSInteger literal;
+@property CWIMAPLiteralSink *literalSink;
 
 - (id) initWithCommand:(IMAPCommand)theCommand
              arguments:(NSString *)theArguments
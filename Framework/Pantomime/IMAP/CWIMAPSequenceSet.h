@@ -0,0 +1,157 @@
+/*
+**  CWIMAPSequenceSet.h
+**
+**  Copyright (c) 2001-2007
+**
+**  This library is free software; you can redistribute it and/or
+**  modify it under the terms of the GNU Lesser General Public
+**  License as published by the Free Software Foundation; either
+**  version 2.1 of the License, or (at your option) any later version.
+**
+**  This library is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+**  Lesser General Public License for more details.
+**
+**  You should have received a copy of the GNU Lesser General Public
+**  License along with this library; if not, write to the Free Software
+**  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef _Pantomime_H_CWIMAPSequenceSet
+#define _Pantomime_H_CWIMAPSequenceSet
+
+#import <Foundation/Foundation.h>
+
+/*!
+  @const CWIMAPSequenceSetMaximumLength
+  @discussion The length, in bytes, the sequence sets returned by
+              -subsets never exceed. RFC 7162 recommends that clients
+	      limit their command lines to 8192 bytes, this leaves
+	      room for the rest of the command.
+*/
+#define CWIMAPSequenceSetMaximumLength 4000
+
+/*!
+  @class CWIMAPSequenceSet
+  @discussion This class holds a set of UIDs (or message sequence numbers)
+              and writes it as an IMAP sequence set (see 9. Formal Syntax
+	      of RFC 3501). The numbers are sorted and consecutive ones are
+	      coalesced into ranges, like 1:5000,5002:9000, whatever the
+	      order they were added in.
+
+	      Sets holding many sparse numbers are split into subsets
+	      that are short enough to be sent in a single command.
+*/
+@interface CWIMAPSequenceSet : NSObject
+
+/*!
+  @method sequenceSetWithMessages:
+  @discussion This method is used to obtain a set holding the UIDs
+              of <i>theMessages</i>.
+  @param theMessages An array of CWIMAPMessage instances.
+  @result The set.
+*/
++ (id) sequenceSetWithMessages: (NSArray *) theMessages;
+
+/*!
+  @method initWithBytes: length:
+  @discussion This method is used to initialize a set from its
+              IMAP representation, like 1:4,7,10:12. The * wildcard
+	      isn't supported since it depends on the mailbox.
+  @param theBytes The bytes, which don't have to be NUL-terminated.
+  @param theLength The number of bytes.
+  @result The instance.
+*/
+- (id) initWithBytes: (const char *) theBytes  length: (NSUInteger) theLength;
+
+/*!
+  @method addNumber:
+  @discussion This method is used to add <i>theNumber</i> to the receiver.
+              0, which is never a valid UID, is ignored.
+  @param theNumber The number to add.
+*/
+- (void) addNumber: (NSUInteger) theNumber;
+
+/*!
+  @method addNumbersInRange:
+  @discussion This method is used to add the numbers in <i>theRange</i>
+              to the receiver.
+  @param theRange The range of numbers to add.
+*/
+- (void) addNumbersInRange: (NSRange) theRange;
+
+/*!
+  @method containsNumber:
+  @discussion This method is used to verify if <i>theNumber</i>
+              is part of the receiver.
+  @param theNumber The number.
+  @result YES if it is, NO otherwise.
+*/
+- (BOOL) containsNumber: (NSUInteger) theNumber;
+
+/*!
+  @method enumerateNumbersUsingBlock:
+  @discussion This method is used to go through the numbers of the
+              receiver, in ascending order.
+  @param theBlock The block invoked with each number. Setting its
+                  second argument to YES stops the enumeration.
+*/
+- (void) enumerateNumbersUsingBlock: (void (^)(NSUInteger theNumber, BOOL *stop)) theBlock;
+
+/*!
+  @method count
+  @discussion This method is used to obtain the number of numbers
+              in the receiver.
+  @result The count.
+*/
+- (NSUInteger) count;
+
+/*!
+  @method rangeCount
+  @discussion This method is used to obtain the number of ranges
+              the receiver is written with.
+  @result The count.
+*/
+- (NSUInteger) rangeCount;
+
+/*!
+  @method stringValue
+  @discussion This method is used to obtain the IMAP representation
+              of the receiver, like 1:5000,5002,5004:9000.
+  @result The string, empty if the receiver is.
+*/
+- (NSString *) stringValue;
+
+/*!
+  @method subsetsWithMaximumLength:
+  @discussion This method is used to split the receiver into sets
+              whose IMAP representation is at most <i>theLength</i>
+	      bytes long. Ranges are never split.
+  @param theLength The maximum length of the representation of each subset.
+  @result An array of CWIMAPSequenceSet instances, in ascending order.
+          It holds a single set if the receiver is short enough and
+	  none if it is empty.
+*/
+- (NSArray *) subsetsWithMaximumLength: (NSUInteger) theLength;
+
+/*!
+  @method subsets
+  @discussion This method invokes -subsetsWithMaximumLength: with
+              CWIMAPSequenceSetMaximumLength.
+  @result An array of CWIMAPSequenceSet instances.
+*/
+- (NSArray *) subsets;
+
+/*!
+  @method messagesFromArray:
+  @discussion This method is used to obtain the messages of
+              <i>theMessages</i> whose UID is part of the receiver.
+  @param theMessages An array of CWIMAPMessage instances.
+  @result The messages, in the order of <i>theMessages</i>.
+*/
+- (NSArray *) messagesFromArray: (NSArray *) theMessages;
+
+@end
+
+#endif // _Pantomime_H_CWIMAPSequenceSet
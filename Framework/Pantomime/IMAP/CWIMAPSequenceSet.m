@@ -0,0 +1,309 @@
+/*
+**  CWIMAPSequenceSet.m
+**
+**  Copyright (c) 2001-2007
+**
+**  This library is free software; you can redistribute it and/or
+**  modify it under the terms of the GNU Lesser General Public
+**  License as published by the Free Software Foundation; either
+**  version 2.1 of the License, or (at your option) any later version.
+**
+**  This library is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+**  Lesser General Public License for more details.
+**
+**  You should have received a copy of the GNU Lesser General Public
+**  License along with this library; if not, write to the Free Software
+**  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#import "CWIMAPSequenceSet.h"
+
+#import "CWIMAPMessage.h"
+
+#include <ctype.h>
+#include <stdio.h>
+
+//
+// This C function is used to write a range as n:m, or n if it
+// holds a single number, in buf which must be at least 48 bytes
+// long. It returns the length of the string.
+//
+static inline int range_string(char *buf, NSRange theRange)
+{
+    if (theRange.length == 1)
+    {
+        return snprintf(buf, 48, "%lu", (unsigned long)theRange.location);
+    }
+
+    return snprintf(buf, 48, "%lu:%lu", (unsigned long)theRange.location, (unsigned long)NSMaxRange(theRange)-1);
+}
+
+@implementation CWIMAPSequenceSet
+{
+    NSMutableIndexSet *_numbers;
+}
+
+//
+//
+//
++ (id) sequenceSetWithMessages: (NSArray *) theMessages
+{
+    CWIMAPSequenceSet *aSet;
+    NSUInteger i, count;
+
+    aSet = [[self alloc] init];
+    count = [theMessages count];
+
+    for (i = 0; i < count; i++)
+    {
+        [aSet addNumber: [(CWIMAPMessage *)[theMessages objectAtIndex: i] uid]];
+    }
+
+    return aSet;
+}
+
+
+//
+//
+//
+- (id) init
+{
+    self = [super init];
+    if (self)
+    {
+        _numbers = [[NSMutableIndexSet alloc] init];
+    }
+    return self;
+}
+
+
+//
+//
+//
+- (id) initWithBytes: (const char *) theBytes  length: (NSUInteger) theLength
+{
+    self = [self init];
+    if (self)
+    {
+        const char *p, *end;
+        NSUInteger first, last, n;
+
+        end = theBytes + theLength;
+
+        for (p = theBytes; p < end; p++)
+        {
+            for (first = 0; p < end && isdigit(*p); p++)
+            {
+                first = first * 10 + (*p - '0');
+            }
+
+            last = first;
+
+            if (p < end && *p == ':')
+            {
+                for (last = 0, p++; p < end && isdigit(*p); p++)
+                {
+                    last = last * 10 + (*p - '0');
+                }
+            }
+
+            // n:m and m:n are the same range.
+            if (first > last)
+            {
+                n = first; first = last; last = n;
+            }
+
+            if (first)
+            {
+                [_numbers addIndexesInRange: NSMakeRange(first, last-first+1)];
+            }
+        }
+    }
+    return self;
+}
+
+
+//
+//
+//
+- (void) addNumber: (NSUInteger) theNumber
+{
+    if (theNumber)
+    {
+        [_numbers addIndex: theNumber];
+    }
+}
+
+
+//
+//
+//
+- (void) addNumbersInRange: (NSRange) theRange
+{
+    if (theRange.location == 0 && theRange.length)
+    {
+        theRange.location++;
+        theRange.length--;
+    }
+
+    if (theRange.length)
+    {
+        [_numbers addIndexesInRange: theRange];
+    }
+}
+
+
+//
+//
+//
+- (BOOL) containsNumber: (NSUInteger) theNumber
+{
+    return [_numbers containsIndex: theNumber];
+}
+
+
+//
+//
+//
+- (void) enumerateNumbersUsingBlock: (void (^)(NSUInteger theNumber, BOOL *stop)) theBlock
+{
+    [_numbers enumerateIndexesUsingBlock: theBlock];
+}
+
+
+//
+//
+//
+- (NSUInteger) count
+{
+    return [_numbers count];
+}
+
+
+//
+//
+//
+- (NSUInteger) rangeCount
+{
+    __block NSUInteger count;
+
+    count = 0;
+
+    [_numbers enumerateRangesUsingBlock: ^(NSRange theRange, BOOL *stop) {
+        count++;
+    }];
+
+    return count;
+}
+
+
+//
+//
+//
+- (NSString *) stringValue
+{
+    NSMutableString *aMutableString;
+
+    aMutableString = [NSMutableString string];
+
+    [_numbers enumerateRangesUsingBlock: ^(NSRange theRange, BOOL *stop) {
+        char buf[48];
+
+        range_string(buf, theRange);
+
+        if ([aMutableString length])
+        {
+            [aMutableString appendString: @","];
+        }
+
+        [aMutableString appendFormat: @"%s", buf];
+    }];
+
+    return aMutableString;
+}
+
+
+//
+// Ranges are added to the current subset until the next one
+// would make it too long. We count the separating comma.
+//
+- (NSArray *) subsetsWithMaximumLength: (NSUInteger) theLength
+{
+    __block CWIMAPSequenceSet *aSet;
+    __block NSUInteger length;
+    NSMutableArray *allSets;
+
+    allSets = [NSMutableArray array];
+    aSet = nil;
+    length = 0;
+
+    [_numbers enumerateRangesUsingBlock: ^(NSRange theRange, BOOL *stop) {
+        char buf[48];
+        int len;
+
+        len = range_string(buf, theRange);
+
+        if (!aSet || length + 1 + len > theLength)
+        {
+            aSet = [[CWIMAPSequenceSet alloc] init];
+            [allSets addObject: aSet];
+            length = len;
+        }
+        else
+        {
+            length += 1 + len;
+        }
+
+        [aSet addNumbersInRange: theRange];
+    }];
+
+    return allSets;
+}
+
+
+//
+//
+//
+- (NSArray *) subsets
+{
+    return [self subsetsWithMaximumLength: CWIMAPSequenceSetMaximumLength];
+}
+
+
+//
+//
+//
+- (NSArray *) messagesFromArray: (NSArray *) theMessages
+{
+    NSMutableArray *aMutableArray;
+    CWIMAPMessage *aMessage;
+    NSUInteger i, count;
+
+    count = [theMessages count];
+    aMutableArray = [NSMutableArray arrayWithCapacity: count];
+
+    for (i = 0; i < count; i++)
+    {
+        aMessage = [theMessages objectAtIndex: i];
+
+        if ([_numbers containsIndex: [aMessage uid]])
+        {
+            [aMutableArray addObject: aMessage];
+        }
+    }
+
+    return aMutableArray;
+}
+
+
+//
+//
+//
+- (NSString *) description
+{
+    return [self stringValue];
+}
+
+@end
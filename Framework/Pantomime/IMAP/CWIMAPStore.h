@@ -37,9 +37,11 @@
   @constant IMAP_CLOSE The IMAP CLOSE command - see 6.4.2. CLOSE Command of RFC 3501.
   @constant IMAP_CREATE The IMAP CREATE command - see 6.3.3. CREATE Command of RFC 3501.
   @constant IMAP_DELETE The IMAP DELETE command - see 6.3.4. DELETE Command of RFC 3501.
+  @constant IMAP_ENABLE The IMAP ENABLE command - see RFC 5161.
   @constant IMAP_EXAMINE The IMAP EXAMINE command - see 6.3.2. EXAMINE Command of RFC 3501.
   @constant IMAP_EXPUNGE The IMAP EXPUNGE command - see 6.4.3. EXPUNGE Command of RFC 3501.
   @constant IMAP_LIST The IMAP LIST command - see 6.3.8. LIST Command of RFC 3501.
+  @constant IMAP_LIST_STATUS The IMAP LIST command returning the status of the folders - see RFC 5819.
   @constant IMAP_LOGIN The IMAP LOGIN command - see 6.2.3. LOGIN Command of RFC 3501.
   @constant IMAP_LOGOUT The IMAP LOGOUT command - see 6.1.3. LOGOUT Command of RFC 3501.
   @constant IMAP_LSUB The IMAP LSUB command - see 6.3.9. LSUB Command of RFC 3501.
@@ -50,17 +52,23 @@
   @constant IMAP_STATUS The IMAP STATUS command - see 6.3.10. STATUS Command of RFC 3501.
   @constant IMAP_SUBSCRIBE The IMAP SUBSCRIBE command - see 6.3.6. SUBSCRIBE Command of RFC 3501.
   @constant IMAP_UID_COPY The IMAP COPY command - see 6.4.7. COPY Command of RFC 3501.
+  @constant IMAP_UID_FETCH_BODY_PART The IMAP FETCH command - see 6.4.5. FETCH Command of RFC 3501.
   @constant IMAP_UID_FETCH_BODY_TEXT The IMAP FETCH command - see 6.4.5. FETCH Command of RFC 3501.
+  @constant IMAP_UID_FETCH_BODYSTRUCTURE The IMAP FETCH command - see 6.4.5. FETCH Command of RFC 3501.
+  @constant IMAP_UID_FETCH_FLAGS_CHANGEDSINCE Special command used to resynchronize the IMAP Folder cache - see 3.6. CHANGEDSINCE FETCH Modifier of RFC 7162.
   @constant IMAP_UID_FETCH_HEADER_FIELDS The IMAP FETCH command - see 6.4.5. FETCH Command of RFC 3501.
   @constant IMAP_UID_FETCH_HEADER_FIELDS_NOT The IMAP FETCH command - see 6.4.5. FETCH Command of RFC 3501.
   @constant IMAP_UID_FETCH_RFC822 The IMAP FETCH command - see 6.4.5. FETCH Command of RFC 3501.
+  @constant IMAP_UID_MOVE The IMAP MOVE command - see 3.1. MOVE and UID MOVE Commands of RFC 6851.
   @constant IMAP_UID_SEARCH The IMAP SEARCH command - see 6.4.4. SEARCH Command of RFC 3501.
                             Used to update the IMAP Folder cache.
   @constant IMAP_UID_SEARCH_ALL The IMAP SEARCH command - see 6.4.4. SEARCH Command of RFC 3501.
   @constant IMAP_UID_SEARCH_ANSWERED Special command used to update the IMAP Folder cache.
   @constant IMAP_UID_SEARCH_FLAGGED Special command used to update the IMAP Folder cache.
   @constant IMAP_UID_SEARCH_UNSEEN Special command used to update the IMAP Folder cache.
+  @constant IMAP_UID_SORT The IMAP SORT command - see 3. Additional Commands of RFC 5256.
   @constant IMAP_UID_STORE The IMAP STORE command - see 6.4.6. STORE Command of RFC 3501.
+  @constant IMAP_UID_THREAD The IMAP THREAD command - see 3. Additional Commands of RFC 5256.
   @constant IMAP_UNSUBSCRIBE The IMAP UNSUBSCRIBE command - see 6.3.7. UNSUBSCRIBE Command of RFC 3501.
   @constant IMAP_EMPTY_QUEUE Special command to empty the command queue.
 */
@@ -73,9 +81,11 @@ typedef enum {
   IMAP_CLOSE,
   IMAP_CREATE,
   IMAP_DELETE,
+  IMAP_ENABLE,
   IMAP_EXAMINE,
   IMAP_EXPUNGE,
   IMAP_LIST,
+  IMAP_LIST_STATUS,
   IMAP_LOGIN,
   IMAP_LOGOUT,
   IMAP_LSUB,
@@ -86,16 +96,22 @@ typedef enum {
   IMAP_STATUS,
   IMAP_SUBSCRIBE,
   IMAP_UID_COPY,
+  IMAP_UID_FETCH_BODY_PART,
   IMAP_UID_FETCH_BODY_TEXT,
+  IMAP_UID_FETCH_BODYSTRUCTURE,
+  IMAP_UID_FETCH_FLAGS_CHANGEDSINCE,
   IMAP_UID_FETCH_HEADER_FIELDS,
   IMAP_UID_FETCH_HEADER_FIELDS_NOT,
   IMAP_UID_FETCH_RFC822,
+  IMAP_UID_MOVE,
   IMAP_UID_SEARCH,
   IMAP_UID_SEARCH_ALL,
   IMAP_UID_SEARCH_ANSWERED,
   IMAP_UID_SEARCH_FLAGGED,
   IMAP_UID_SEARCH_UNSEEN,
+  IMAP_UID_SORT,
   IMAP_UID_STORE,
+  IMAP_UID_THREAD,
   IMAP_UNSUBSCRIBE,
   IMAP_EMPTY_QUEUE,
   IMAP_IDLE,
@@ -137,6 +153,7 @@ extern NSString* PantomimeFolderNewMessageWhileIDLE;
 
 @class CWConnection;
 @class CWFlags;
+@class CWIMAPBodyStore;
 @class CWIMAPCacheManager;
 @class CWIMAPFolder;
 @class CWIMAPMessage;
@@ -197,6 +214,70 @@ extern NSString* PantomimeFolderNewMessageWhileIDLE;
 */
 - (NSData *) lastTag;
 
+/*!
+  @method pipelineWindow
+  @discussion This method is used to obtain the maximum number of
+              commands sent to the IMAP server without waiting for
+	      their completion.
+  @result The window, 1 if pipelining is disabled.
+*/
+- (NSUInteger) pipelineWindow;
+
+/*!
+  @method setPipelineWindow:
+  @discussion This method is used to set the maximum number of commands
+              sent to the IMAP server without waiting for their completion.
+	      Pipelining is disabled by default (a window of 1). When enabled,
+	      tagged responses are matched to their command by tag. Commands
+	      like STORE, COPY, FETCH, STATUS or LIST are pipelined while
+	      AUTHENTICATE, LOGIN, APPEND, IDLE, STARTTLS, SELECT, EXAMINE,
+	      CLOSE, EXPUNGE and SEARCH act as barriers: they are sent alone
+	      and nothing else is sent until they complete.
+  @param theWindow The window, 1 to disable pipelining.
+*/
+- (void) setPipelineWindow: (NSUInteger) theWindow;
+
+/*!
+  @method literalSpillThreshold
+  @discussion This method is used to obtain the size above which
+              literals received from the IMAP server are written
+	      to a temporary file instead of being kept in memory.
+  @result The size in bytes, 0 if literals are always kept in memory.
+*/
+- (NSUInteger) literalSpillThreshold;
+
+/*!
+  @method setLiteralSpillThreshold:
+  @discussion This method is used to set the size above which literals
+              received from the IMAP server, like the raw source of
+	      a message, are written to a temporary file. The data
+	      handed to the messages then maps that file. The default
+	      threshold is 1 MB.
+  @param theThreshold The size in bytes, 0 to always keep literals in memory.
+*/
+- (void) setLiteralSpillThreshold: (NSUInteger) theThreshold;
+
+/*!
+  @property bodyStore
+  @discussion The store the raw sources of the messages of the receiver's
+              folders are kept in. When set, CWIMAPMessage: -rawSource and
+	      -setInitialized: look for the source of a message in it before
+	      fetching it from the IMAP server, and the sources fetched with
+	      RFC822 are added to it. nil by default.
+*/
+@property CWIMAPBodyStore *bodyStore;
+
+/*!
+  @method isQRESYNCEnabled
+  @discussion This method is used to verify if QRESYNC (RFC 7162) was
+              enabled on the connection. It is enabled right after the
+	      authentication if the IMAP server advertises it. Folders
+	      then resynchronize their cache from its highest mod-sequence
+	      instead of searching for all their messages.
+  @result YES if it is enabled, NO otherwise.
+*/
+- (BOOL) isQRESYNCEnabled;
+
 /*!
   @method subscribeToFolderWithName:
   @discussion This method is used to subscribe to the specified folder.
@@ -230,6 +311,13 @@ extern NSString* PantomimeFolderNewMessageWhileIDLE;
 	      -folderStatusFailed: on the delegate, if any). Further calls
 	      of this method on the same set of folders will immediately return
 	      the status information.
+
+	      The notification is posted for each folder, as soon as its
+	      status is read. If the IMAP server supports LIST-STATUS (RFC 5819),
+	      the status of all its folders is obtained with a single command
+	      when more than one is wanted. Otherwise, one STATUS command is
+	      sent per folder, without waiting for the previous ones to
+	      complete even if pipelining is disabled.
   @param theArray The array of folder names.
   @result A NSDictionary instance for which the keys are the folder names (NSString instance)
           and the values are CWFolderInformation instance if the information was
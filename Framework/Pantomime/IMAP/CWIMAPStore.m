@@ -23,12 +23,16 @@
 #import "CWIMAPStore.h"
 
 #import "CWConstants.h"
+#import "CWContainer.h"
 #import "CWFlags.h"
 #import "CWFolderInformation.h"
+#import "CWIMAPBodyStore.h"
 #import "CWIMAPCacheManager.h"
 #import "CWIMAPFolder.h"
 #import "CWIMAPMessage.h"
+#import "CWIMAPPart.h"
 #import "CWMD5.h"
+#import "CWMIMEMultipart.h"
 #import "CWMIMEUtility.h"
 #import "NSData+CWExtensions.h"
 #import "NSScanner+CWExtensions.h"
@@ -36,7 +40,11 @@
 #import "CWTCPConnection.h"
 #import "CWURLName.h"
 #import "CWCacheRecord.h"
+#import "CWIMAPAppendStream.h"
+#import "CWIMAPLiteralSink.h"
 #import "CWIMAPQueueObject.h"
+#import "CWIMAPSequenceSet.h"
+#import "CWIMAPTokenizer.h"
 
 #if __LP64__
 #define CWNSIntegerFormat "ld"
@@ -51,9 +59,22 @@
 //
 static NSStringEncoding defaultCStringEncoding;
 static NSData *CRLF;
+static NSData *SPACE;
 
 #define CSIMAPTDefaultPort 143
 
+//
+// The number of STATUS commands we send without waiting for
+// their completion when pipelining is otherwise disabled.
+//
+#define STATUS_WINDOW 32
+
+//
+// The number of bytes of the messages being appended we hold
+// in the write buffer, see -updateWrite.
+//
+#define APPEND_BUFFER_SIZE 262144
+
 //
 // This C function is used to verify if a line (specified in
 // "buf", with length "c") has a literal. If it does, the
@@ -92,9 +113,139 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
     return 0;
 }
 
+//
+// This C function is used to verify if a command can be sent while
+// other commands are in flight. We only pipeline commands whose
+// untagged responses can't be mistaken for another command's. All
+// the others are barriers: they are only sent once all in-flight
+// commands completed and nothing is sent until they complete.
+//
+// This is the case for AUTHENTICATE, LOGIN and APPEND, which rely on
+// continuation requests, IDLE and STARTTLS, which change the state of
+// the connection, and SELECT, EXAMINE, CLOSE, EXPUNGE and MOVE, which
+// change the selected mailbox or its message sequence numbers.
+//
+static inline BOOL can_pipeline(IMAPCommand theCommand)
+{
+    switch (theCommand)
+    {
+        case IMAP_CREATE:
+        case IMAP_DELETE:
+        case IMAP_LIST:
+        case IMAP_LIST_STATUS:
+        case IMAP_LSUB:
+        case IMAP_NOOP:
+        case IMAP_STATUS:
+        case IMAP_SUBSCRIBE:
+        case IMAP_UID_COPY:
+        case IMAP_UID_FETCH_BODY_PART:
+        case IMAP_UID_FETCH_BODY_TEXT:
+        case IMAP_UID_FETCH_BODYSTRUCTURE:
+        case IMAP_UID_FETCH_FLAGS_CHANGEDSINCE:
+        case IMAP_UID_FETCH_RFC822:
+        case IMAP_UID_STORE:
+        case IMAP_UNSUBSCRIBE:
+            return YES;
+
+        default:
+            return NO;
+    }
+}
+
+//
+// This C function is used to obtain the value of a FETCH item, which
+// theTokenizer just read, with LF line breaks. Literals already have
+// them so they are returned as they are. NIL gives us empty data.
+//
+static inline NSData *fetch_item_data(CWIMAPTokenizer *theTokenizer)
+{
+    NSMutableData *aMutableData;
+    
+    switch ([theTokenizer tokenType])
+    {
+        case IMAPTokenLiteral:
+            return [theTokenizer tokenData];
+            
+        case IMAPTokenString:
+            aMutableData = [NSMutableData dataWithData: [theTokenizer tokenData]];
+            [aMutableData replaceCRLFWithLF];
+            return aMutableData;
+            
+        default:
+            return [NSData data];
+    }
+}
+
+//
+// This C function is used to find the UID of the message a FETCH
+// response is about without handling its other items. Servers can
+// send it anywhere in the response.
+//
+// "0" means no UID.
+//
+static inline NSUInteger fetch_response_uid(NSArray *theSegments)
+{
+    CWIMAPTokenizer *aTokenizer;
+    NSUInteger i;
+    
+    aTokenizer = [[CWIMAPTokenizer alloc] initWithSegments: theSegments];
+    
+    // We skip "*", the MSN, "FETCH" and the opening parenthesis.
+    for (i = 0; i < 4; i++)
+    {
+        [aTokenizer nextToken];
+    }
+    
+    while ([aTokenizer nextToken] != IMAPTokenEnd && [aTokenizer tokenType] != IMAPTokenListEnd)
+    {
+        if ([aTokenizer tokenIsAtom: "UID"])
+        {
+            return ([aTokenizer nextToken] == IMAPTokenNumber ? (NSUInteger)[aTokenizer tokenNumber] : 0);
+        }
+        
+        [aTokenizer nextToken];
+        [aTokenizer skipValue];
+    }
+    
+    return 0;
+}
+
+//
+// This C function is used to obtain the index, in the folder's
+// messages, of the message an EXPUNGE response is about. Its MSN
+// doesn't count the messages expunged before it, which are still
+// there until we apply the expunge responses (theIndexes).
+//
+// We walk the ranges of expunged messages once, in ascending order,
+// skipping over each one that starts at or before the index reached
+// so far. Repeated "* 1 EXPUNGE" responses give a single range, so a
+// bulk delete doesn't get slower with each response.
+//
+static inline NSUInteger index_of_msn(NSIndexSet *theIndexes, NSUInteger theMSN)
+{
+    __block NSUInteger index;
+    
+    index = theMSN-1;
+    
+    [theIndexes enumerateRangesUsingBlock: ^(NSRange theRange, BOOL *stop) {
+        if (theRange.location > index)
+        {
+            *stop = YES;
+            return;
+        }
+        
+        index += theRange.length;
+    }];
+    
+    return index;
+}
+
 @interface CWIMAPStore ()
 
 @property CWIMAPQueueObject *currentQueueObject;
+@property NSMutableDictionary *inFlight;
+@property NSUInteger maxInFlight;
+@property NSUInteger literalThreshold;
 
 @property NSMutableDictionary *folders;
 @property NSMutableDictionary *openFolders;
@@ -102,16 +253,30 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 @property NSMutableArray *subscribedFolders;
 
 @property CWIMAPFolder *selectedFolder;
+@property NSMutableIndexSet *expungedIndexes;
+@property CWIMAPAppendStream *appendStream;
 
 @property unichar folderSeparator;
 @property NSInteger tag;
 
 @property BOOL idling;
+@property BOOL readingLiteralTail;
+@property BOOL qresyncEnabled;
+
+- (void) _applyExpunges;
+- (BOOL) _enableQRESYNC;
+- (NSString *) _QRESYNCParametersForFolder: (CWIMAPFolder *) theFolder;
 
 - (NSString *) _folderNameFromString: (NSString *) theString;
-- (void) _parseFlags: (NSString *) aString
+- (void) _parseFlags: (CWIMAPTokenizer *) theTokenizer
              message: (CWIMAPMessage *) theMessage
 	      record: (CWCacheRecord *) theRecord;
+- (NSDictionary *) _parametersFromTokenizer: (CWIMAPTokenizer *) theTokenizer;
+- (CWIMAPPart *) _partFromTokenizer: (CWIMAPTokenizer *) theTokenizer
+                            section: (NSString *) theSection
+                            message: (CWIMAPMessage *) theMessage;
+- (CWContainer *) _containerFromTokenizer: (CWIMAPTokenizer *) theTokenizer;
+- (void) _authenticationCompleted;
 - (void) _renameFolder;
 - (NSArray *) _uniqueIdentifiersFromData: (NSData *) theData;
 - (void) _parseAUTHENTICATE_CRAM_MD5;
@@ -131,10 +296,17 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 - (void) _parseSEARCH;
 - (void) _parseSEARCH_CACHE;
 - (void) _parseSELECT;
+- (void) _parseSORT;
 - (void) _parseSTATUS;
 - (void) _parseSTARTTLS;
+- (void) _parseTHREAD;
 - (void) _parseUIDVALIDITY: (const char *) theString;
+- (void) _parseVANISHED;
+- (void) _removeCurrentQueueObject;
 - (void) _restoreQueue;
+- (void) _sendQueuedCommands;
+- (void) _shiftPrefetchWindow: (NSIndexSet *) theIndexes;
+- (void) _writeQueueObject: (CWIMAPQueueObject *) theQueueObject;
 
 @end
 
@@ -155,6 +327,7 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
     dispatch_once(&onceToken, ^{
         defaultCStringEncoding = [NSString defaultCStringEncoding];
         CRLF = [[NSData alloc] initWithBytes: "\r\n"  length: 2];
+        SPACE = [[NSData alloc] initWithBytes: " "  length: 1];
     });
     
     self = [super initWithName: theName  port: thePort];
@@ -171,6 +344,11 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
         
         _lastCommand = IMAP_AUTHORIZATION;
         _currentQueueObject = nil;
+        _inFlight = [[NSMutableDictionary alloc] init];
+        _maxInFlight = 1;
+        _literalThreshold = 1048576;
+        _qresyncEnabled = NO;
+        _expungedIndexes = [[NSMutableIndexSet alloc] init];
     }
     
     return self;
@@ -206,6 +384,8 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 //
 - (void) updateRead
 {
+	const char *aLine;
+	NSUInteger len;
 	id aData;
 	
 	NSInteger i, count;
@@ -213,18 +393,34 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 	
 	[super updateRead];
 	
-	// NSLog(@"_rbuf len == %lu |%@|", [_rbuf length], [_rbuf asciiString]);
+	// NSLog(@"_rbuf len == %lu", [_rbuf length]);
 	
 	if (![_rbuf length]) return;
 	
-	while ((aData = split_lines(_rbuf)))
+	//
+	// Lines are handed out by _rbuf without being copied. We only
+	// copy the ones we keep in _responsesFromServer - the lines of
+	// a literal go straight from _rbuf to the literal's data.
+	//
+	while ((aLine = [_rbuf nextLine: &len]))
     {
-		//NSLog(@"aLine = |%@|", [aData asciiString]);
-		buf = (char *)[aData bytes];
-		count = [aData length];
+		count = len;
 		
+		//
+		// We got the line following a literal that ended with its own line.
+		// Our response is now complete so we reparse it from its first line.
+		//
+		if (_readingLiteralTail)
+		{
+			_readingLiteralTail = NO;
+			[_responsesFromServer addObject: [NSData dataWithBytes: aLine  length: count]];
+			
+			aData = [_responsesFromServer objectAtIndex: 0];
+			buf = (char *)[aData bytes];
+			count = [aData length];
+		}
 		// If we are reading a literal, do so.
-		if (_currentQueueObject && _currentQueueObject.literal)
+		else if (_currentQueueObject && _currentQueueObject.literal)
 		{
 			_currentQueueObject.literal -= (count+2);
 			//NSLog(@"literal = %d, count = %d", _currentQueueObject.literal, count);
@@ -234,27 +430,19 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 				NSInteger x;
 				
 				x = -2-_currentQueueObject.literal;
-				[[_currentQueueObject.info objectForKey: @"NSData"] appendData: [aData subdataToIndex: x]];
-				[_responsesFromServer addObject: [aData subdataFromIndex: x]];
-				//NSLog(@"orig = |%@|, chooped = |%@|   |%@|", [aData asciiString], [[aData subdataToIndex: x] asciiString], [[aData subdataFromIndex: x] asciiString]);
+				[_currentQueueObject.literalSink appendBytes: aLine  length: x];
+				[_responsesFromServer addObject: [NSData dataWithBytes: aLine+x  length: count-x]];
 			}
 			else
 			{
-				[[_currentQueueObject.info objectForKey: @"NSData"] appendData: aData];
+				[_currentQueueObject.literalSink appendBytes: aLine  length: count];
 			}  
 			
 			// We are done reading a literal. Let's read again
 			// to see if we got a full response.
 			if (_currentQueueObject.literal <= 0)
 			{
-				//NSLog(@"DONE ACCUMULATING LITTERAL!\nread = |%@|", [[_currentQueueObject.info objectForKey: @"NSData"] asciiString]);
-				//
-				// Let's see, if we can, what does the next line contain. If we got
-				// something, we add this to the remaining _responsesFromServer
-				// and we are ready to parse that response (_responsesFromServer + bytes of literal).
-				//
-				// If it's nil, that's because we have nothing to read. In that case, just loop
-				// and call -updateRead in order to read the rest of the response.
+				//NSLog(@"DONE ACCUMULATING LITTERAL!\nread = %lu bytes", [_currentQueueObject.literalSink length]);
 				//
 				// We must also be careful about what we read. Microsoft Exchange sometimes send us
 				// stuff like this:
@@ -274,17 +462,15 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 				}
 				else
 				{
-					// We MUST wait until we are done reading our full
-					// FETCH response. _rbuf could end immediately at the
-					// end of our literal response and we need to call
-					// [super updateRead] to get more bytes from the socket
-					// in order to read the rest (")" or " UID 123)" for example).
-					while (!(aData = split_lines(_rbuf)))
-					{
-						//SLog(@"NOTHING TO READ! WAITING...");
-						[super updateRead];
-					}
-					[_responsesFromServer addObject: aData];
+					//
+					// The literal ended with its line, we are not done reading our
+					// FETCH response: the rest of it (")" or " UID 123)" for example)
+					// is on the next line. _rbuf might not hold it yet, so rather than
+					// waiting for it, we remember where we are and handle it in the
+					// next iteration - or on the next read event.
+					//
+					_readingLiteralTail = YES;
+					continue;
 				}
 				
 				//
@@ -301,24 +487,27 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 			{
 				//NSLog(@"Accumulating... %d remaining...", _currentQueueObject.literal);
 				//
-				// We are still accumulating bytes of the literal. Once we have appended
-				// our CRLF, we just continue the loop since there's no need to try to
+				// We are still accumulating bytes of the literal. Once we have ended
+				// the line, we just continue the loop since there's no need to try to
 				// parse anything, as we don't have the complete response yet.
 				//
-				[[_currentQueueObject.info objectForKey: @"NSData"] appendData: CRLF];
+				[_currentQueueObject.literalSink appendLineBreak];
 				continue;
 			}
 		}
 		else 
 		{
+			aData = [NSData dataWithBytes: aLine  length: count];
+			buf = (char *)[aData bytes];
+			
 			//NSLog(@"aLine = |%@|", [aData asciiString]);
 			[_responsesFromServer addObject: aData];
 			
 			if (_currentQueueObject && (_currentQueueObject.literal = has_literal(buf, count)))
 			{
 				//NSLog(@"literal = %d", _currentQueueObject.literal);
-				[_currentQueueObject.info setObject: [NSMutableData dataWithCapacity: _currentQueueObject.literal]
-				 forKey: @"NSData"];
+				_currentQueueObject.literalSink = [[CWIMAPLiteralSink alloc] initWithCapacity: _currentQueueObject.literal
+													    threshold: _literalThreshold];
 			}
 		}
 		
@@ -350,10 +539,18 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 			//
 			if (*(buf-i) == '+')
 			{
-				if (_lastCommand == IMAP_APPEND)
+				if (_lastCommand == IMAP_APPEND && _appendStream)
+				{
+					// The next literal was waiting for us, see -updateWrite.
+					[_appendStream resume];
+					[self updateWrite];
+					break;
+				}
+				else if (_lastCommand == IMAP_APPEND)
 				{
+					// The message is queued by reference, not copied.
 					if (nil != _currentQueueObject)
-						[self writeData: [_currentQueueObject.info objectForKey: @"NSData"]];
+						[_wbuf appendData: [_currentQueueObject.info objectForKey: @"NSData"]];
 					
 					[self writeData: CRLF];
 					break;
@@ -555,6 +752,17 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 				}
 			}
 			//
+			// The SORT and THREAD responses of RFC 5256.
+			//
+			else if (len && strncasecmp("SORT", buf, 4) == 0)
+			{
+				[self _parseSORT];
+			}
+			else if (len && strncasecmp("THREAD", buf, 6) == 0)
+			{
+				[self _parseTHREAD];
+			}
+			//
 			//
 			//
 			else if (len && strncasecmp("STATUS", buf, 6) == 0)
@@ -569,6 +777,13 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 				[self _parseEXPUNGE];
 			}
 			//
+			// With QRESYNC enabled, we get these instead of EXPUNGE responses.
+			//
+			else if (len && strncasecmp("VANISHED", buf, 8) == 0)
+			{
+				[self _parseVANISHED];
+			}
+			//
 			//
 			//
 			else if (len && strncasecmp("CAPABILITY", buf, 10) == 0)
@@ -581,6 +796,7 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 		//
 		else
 		{
+			CWIMAPQueueObject *aQueueObject;
 			NSInteger j;
 			
 			//NSData *foo;
@@ -601,6 +817,21 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 			//NSLog(@"OK/NO/BAD response = |%@|", [[NSData dataWithBytes: buf-j+i+1  length: j-i-1] asciiString]);
 			buf = buf-j+i+1;
 			
+			//
+			// The tag tells us which command completed. With pipelining,
+			// it isn't necessarily the oldest one we sent.
+			//
+			aQueueObject = [_inFlight objectForKey: [NSData dataWithBytes: buf-i-1  length: i]];
+			
+			if (aQueueObject)
+			{
+				_currentQueueObject = aQueueObject;
+				_lastCommand = aQueueObject.command;
+			}
+			
+			// The expunge responses we got are applied before the command completes.
+			[self _applyExpunges];
+			
 			// From RFC3501:
 			//
 			// The server completion result response indicates the success or
@@ -634,7 +865,7 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 				[self _parseBAD];
 			}
 		}
-    } // while ((aData = split_lines...
+    } // while ((aLine = [_rbuf nextLine: &len]))
 	
 	//NSLog(@"While loop broken!");
 }
@@ -892,11 +1123,36 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 
   [_folderStatus removeAllObjects];
 
+  //
+  // With LIST-STATUS (RFC 5819), a single LIST command gives us the status
+  // of all the folders, each STATUS response following the LIST response
+  // of its folder. Since all folders are listed, we only use it when we
+  // want the status of more than one.
+  //
+  // C: A043 LIST "" "*" RETURN (STATUS (MESSAGES UNSEEN))
+  // S: * LIST () "." "INBOX"
+  // S: * STATUS "INBOX" (MESSAGES 17 UNSEEN 16)
+  // S: A043 OK List completed
+  //
+  if ([theArray count] > 1)
+    {
+      for (i = 0; i < [_capabilities count]; i++)
+	{
+	  if ([[_capabilities objectAtIndex: i] caseInsensitiveCompare: @"LIST-STATUS"] == NSOrderedSame)
+	    {
+	      [self sendCommand: IMAP_LIST_STATUS
+		    info: [NSDictionary dictionaryWithObject: theArray  forKey: @"Names"]
+		    arguments: @"LIST \"\" \"*\" RETURN (STATUS (MESSAGES UNSEEN))"];
+	      return _folderStatus;
+	    }
+	}
+    }
+
   // C: A042 STATUS blurdybloop (UIDNEXT MESSAGES)
   // S: * STATUS blurdybloop (MESSAGES 231 UIDNEXT 44292)
   // S: A042 OK STATUS completed
   //
-  // We send: MESSAGES UNSEEN
+  // We send: MESSAGES UNSEEN. The commands are pipelined, see _sendQueuedCommands.
   for (i = 0; i < [theArray count]; i++)
     {
       // RFC3501 says we SHOULD NOT call STATUS on the selected mailbox - so we won't do it.
@@ -920,25 +1176,12 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 //
 // It then sets the last command (w/o the tag) that has been sent.
 //
-// If the server is already processing a query, it queues it in _queue.
+// If the server is already processing as many queries as we allow,
+// or a query that can't be pipelined, it queues it in _queue.
 //
 - (void) sendCommand: (IMAPCommand) theCommand  info: (NSDictionary *) theInfo  arguments: (NSString *) theFormat, ...
 {
-	if (theCommand == IMAP_EMPTY_QUEUE)
-    {
-		if ([_queue count])
-		{
-			// We dequeue the first inserted command from the queue.
-			_currentQueueObject = [_queue lastObject];
-		}
-		else
-		{
-			// The queue is empty, we have nothing more to do...
-			_currentQueueObject = nil;
-			return;
-		}
-    }
-	else
+	if (theCommand != IMAP_EMPTY_QUEUE)
     {
 		CWIMAPQueueObject *aQueueObject;
 		NSString *aString;
@@ -957,58 +1200,45 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 		//
 		// We skip this verification for the IMAP_APPEND command as a messages with the same size
 		// could be quickly appended to the folder and we do NOT want to skip the second one.
+		// Nor do we skip the EXPUNGE command ending a move, which must report its own messages.
 		//
 		count = [_queue count];
 		
 		for (i = 0; i < count; i++)
 		{
 			aQueueObject = [_queue objectAtIndex: i];
-			if (aQueueObject.command == theCommand && theCommand != IMAP_APPEND && [aQueueObject.arguments isEqualToString: aString])
+			if (aQueueObject.command == theCommand && theCommand != IMAP_APPEND && ![theInfo objectForKey: @"Expunge"] &&
+				[aQueueObject.arguments isEqualToString: aString])
 			{
 				//NSLog(@"A COMMAND ALREADY EXIST!!!!");
 				return;
 			}   
 		}
 		
-		if ((IMAP_DONE == theCommand) && (IMAP_IDLE == _lastCommand) && (0 < [_queue count]))
-		{
-			// remove the last object if we terminate an idle command
-			aQueueObject = [[CWIMAPQueueObject alloc] initWithCommand:theCommand  arguments:aString  tag:[self lastTag]  info:theInfo];
-			[_queue removeLastObject];
-		}
-		else
+		//
+		// DONE terminates the IDLE command in flight. Since IDLE is a barrier,
+		// it is the only command in flight. DONE takes its place and its tag,
+		// and is sent right away, ahead of the commands queued while idling.
+		//
+		if ((IMAP_DONE == theCommand) && (IMAP_IDLE == _lastCommand) && _currentQueueObject &&
+			(IMAP_IDLE == _currentQueueObject.command) && [_inFlight objectForKey: _currentQueueObject.tag])
 		{
-			aQueueObject = [[CWIMAPQueueObject alloc] initWithCommand: theCommand  arguments: aString  tag: [self nextTag]  info: theInfo];
+			aQueueObject = [[CWIMAPQueueObject alloc] initWithCommand: theCommand  arguments: aString  tag: _currentQueueObject.tag  info: theInfo];
+			[_queue replaceObjectAtIndex: [_queue indexOfObjectIdenticalTo: _currentQueueObject]  withObject: aQueueObject];
+			[_inFlight setObject: aQueueObject  forKey: aQueueObject.tag];
+			_currentQueueObject = aQueueObject;
+			_lastCommand = IMAP_DONE;
+			[self _writeQueueObject: aQueueObject];
+			return;
 		}
 		
+		aQueueObject = [[CWIMAPQueueObject alloc] initWithCommand: theCommand  arguments: aString  tag: [self nextTag]  info: theInfo];
 		[_queue insertObject: aQueueObject  atIndex: 0];
 		
 		//NSLog(@"queue size = %d", [_queue count]);
-		
-		// If we had queued commands, we return since we'll eventually
-		// dequeue them one by one. Otherwise, we run it immediately.
-		if ([_queue count] > 1)
-		{
-			//NSLog(@"QUEUED |%@|", aString);
-			return;
-		}
-		
-		_currentQueueObject = aQueueObject;
     }
 	
-	// NSLog(@"Sending |%@|", _currentQueueObject.arguments);
-	_lastCommand = _currentQueueObject.command;
-	
-	if (IMAP_DONE != _lastCommand)
-	{
-		[self writeData: _currentQueueObject.tag];
-		[self writeData: [NSData dataWithBytes: " "  length: 1]];
-	}
-	[self writeData: [_currentQueueObject.arguments dataUsingEncoding: defaultCStringEncoding]];
-	[self writeData: CRLF];
-	
-	POST_NOTIFICATION(@"PantomimeCommandSent", self, _currentQueueObject.info);
-	PERFORM_SELECTOR_2(_delegate, @selector(commandSent:), @"PantomimeCommandSent", [NSNumber numberWithInteger:_lastCommand], @"Command");
+	[self _sendQueuedCommands];
 }
 
 //
@@ -1087,6 +1317,73 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 }
 
 
+//
+//
+//
+- (NSUInteger) pipelineWindow
+{
+  return _maxInFlight;
+}
+
+- (void) setPipelineWindow: (NSUInteger) theWindow
+{
+  _maxInFlight = (theWindow > 0 ? theWindow : 1);
+  [self _sendQueuedCommands];
+}
+
+
+//
+// The messages of an APPEND command sent by CWIMAPFolder:
+// -appendMessagesFromRawSources:flags: are read as the socket drains,
+// we only hold APPEND_BUFFER_SIZE bytes of them. We stop when a
+// literal waits for a continuation request, see -updateRead.
+//
+- (void) updateWrite
+{
+  NSData *aData;
+
+  [super updateWrite];
+
+  while (_appendStream && [_wbuf length] < APPEND_BUFFER_SIZE)
+    {
+      if (!(aData = [_appendStream nextData]))
+	{
+	  if ([_appendStream isComplete])
+	    {
+	      _appendStream = nil;
+	    }
+	  break;
+	}
+
+      [_wbuf appendData: aData];
+      [super updateWrite];
+    }
+}
+
+
+//
+//
+//
+- (NSUInteger) literalSpillThreshold
+{
+  return _literalThreshold;
+}
+
+- (void) setLiteralSpillThreshold: (NSUInteger) theThreshold
+{
+  _literalThreshold = theThreshold;
+}
+
+
+//
+//
+//
+- (BOOL) isQRESYNCEnabled
+{
+  return _qresyncEnabled;
+}
+
+
 //
 //
 //
@@ -1200,6 +1497,17 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 }
 
 
+//
+//
+//
+- (void) cancelRequest
+{
+  [_inFlight removeAllObjects];
+  _currentQueueObject = nil;
+  [super cancelRequest];
+}
+
+
 //
 // This method NOOPs the IMAP store.
 //
@@ -1220,8 +1528,9 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
   reconnecting = YES;
   
   // We flush our read/write buffers.
-  [_rbuf setLength: 0];
-  [_wbuf setLength: 0];
+  [_rbuf reset];
+  [_wbuf reset];
+  _appendStream = nil;
 
   //
   // We first empty our queue and set again our _lastCommand ivar to
@@ -1230,8 +1539,12 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
   //NSLog(@"queue count = %d", [_queue count]);
   //NSLog(@"%@", [_queue description]);
   [_queue removeAllObjects];
+  [_inFlight removeAllObjects];
   _lastCommand = IMAP_AUTHORIZATION;
   _currentQueueObject = nil;
+  _readingLiteralTail = NO;
+  _qresyncEnabled = NO;
+  [_expungedIndexes removeAllIndexes];
 
   [super close];
   [super connectInBackgroundAndNotify];
@@ -1249,131 +1562,331 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 }
 
 //
-// This method is used to parse the name of a mailbox.
-//
-// If the string was encoded using mUTF-7, it'll also
-// decode it.
+// We remove the expunged messages in a single pass and renumber the
+// ones following the first of them once. As it was done for each
+// untagged EXPUNGE response, the delegate is informed of every
+// message expunged unless we sent the EXPUNGE command ourself.
 //
-- (NSString *) _folderNameFromString: (NSString *) theString
+- (void) _applyExpunges
 {
-    NSString *aString;
-    NSRange aRange;
-    
-    aRange = [theString rangeOfString: @"\""];
-    
-    if (aRange.length)
-    {
-        NSInteger mark;
-        
-        mark = aRange.location + 1;
-        
-        aRange = [theString rangeOfString: @"\""
-                                  options: 0
-                                    range: NSMakeRange(mark, [theString length] - mark)];
-        
-        aString = [theString substringWithRange: NSMakeRange(mark, aRange.location - mark)];
-        
-        // Check if we got "NIL" or a real separator.
-        if ([aString length] == 1)
-        {
-            _folderSeparator = [aString characterAtIndex:0];
-        }
-        else
-        {
-            _folderSeparator = 0;
-        }
-        
-        mark = aRange.location + 2;
-        aString = [theString substringFromIndex: mark];
-    }
-    else
+  NSIndexSet *theIndexes;
+  NSArray *theMessages;
+  NSUInteger i, count;
+
+  if (![_expungedIndexes count])
     {
-        aRange = [theString rangeOfString: @"NIL"  options: NSCaseInsensitiveSearch];
-        
-        if (aRange.length)
-        {
-            aString = [theString substringFromIndex: aRange.location + aRange.length + 1];
-        }
-        else
-        {
-            return theString;
-        }
+      return;
     }
-    
-    aString = [aString stringFromQuotedString];
-    
-    return aString;
-}
 
+  theIndexes = [_expungedIndexes copy];
+  [_expungedIndexes removeAllIndexes];
 
-//
-// This method parses the flags received in theString and builds
-// a corresponding Flags object for them.
-//
-- (void) _parseFlags: (NSString *) theString
-	     message: (CWIMAPMessage *) theMessage
-	      record: (CWCacheRecord *) theRecord
-{
-    CWFlags *theFlags;
-    NSRange aRange;
-    
-    theFlags = [[CWFlags alloc] init];
-    
-    // We check if the message has the Seen flag
-    aRange = [theString rangeOfString: @"\\Seen"
-                              options: NSCaseInsensitiveSearch];
-    
-    if (aRange.length > 0)
+  if (!_selectedFolder || [theIndexes lastIndex] >= [_selectedFolder->allMessages count])
     {
-        [theFlags add: PantomimeSeen];
+      return;
     }
-    
-    // We check if the message has the Recent flag
-    aRange = [theString rangeOfString: @"\\Recent"
-                              options: NSCaseInsensitiveSearch];
-    
-    if (aRange.length > 0)
+
+  // We do NOT use [_selectedFolder removeMessage: aMessage] since it'll thread the messages.
+  theMessages = [_selectedFolder->allMessages objectsAtIndexes: theIndexes];
+  [_selectedFolder->allMessages removeObjectsAtIndexes: theIndexes];
+  [_selectedFolder updateCache];
+  [self _shiftPrefetchWindow: theIndexes];
+
+  // We remove their entries in our cache
+  if (_selectedFolder.cacheManager)
     {
-        [theFlags add: PantomimeRecent];
+      for (i = 0; i < [theMessages count]; i++)
+	{
+	  [(CWIMAPCacheManager *)_selectedFolder.cacheManager removeMessageWithUID: [[theMessages objectAtIndex: i] uid]];
+	}
     }
-    
-    // We check if the message has the Deleted flag
-    aRange = [theString rangeOfString: @"\\Deleted"
-                              options: NSCaseInsensitiveSearch];
-    
-    if (aRange.length > 0)
+
+  // We update all MSNs starting from the first message that has been expunged.
+  count = [_selectedFolder->allMessages count];
+
+  for (i = [theIndexes firstIndex]; i < count; i++)
     {
-        [theFlags add: PantomimeDeleted];
+      [[_selectedFolder->allMessages objectAtIndex: i] setMessageNumber: (i+1)];
     }
-    
-    // We check if the message has the Answered flag
-    aRange = [theString rangeOfString: @"\\Answered"
-                              options: NSCaseInsensitiveSearch];
-    
-    if (aRange.length > 0)
+
+  //
+  // If our previous command is NOT the EXPUNGE command, we must inform our
+  // delegate that messages have been expunged. The delegate SHOULD refresh
+  // its view and does NOT have to issue any command to update the state
+  // of the messages (since it has been done). Otherwise, we'll do the threading
+  // of the messages in _parseOK:. So do we when moving messages.
+  //
+  if (_lastCommand != IMAP_EXPUNGE && _lastCommand != IMAP_UID_MOVE)
     {
-        [theFlags add: PantomimeAnswered];
+      if ([_selectedFolder allContainers])
+	{
+	  [_selectedFolder thread];
+	}
+
+      if (_selectedFolder.cacheManager)
+	{
+	  [(CWIMAPCacheManager*)_selectedFolder.cacheManager expunge];
+	}
+
+      for (i = 0; i < [theMessages count]; i++)
+	{
+	  POST_NOTIFICATION(PantomimeMessageExpunged, self, [NSDictionary dictionaryWithObject: [theMessages objectAtIndex: i]  forKey: @"Message"]);
+	  (void)PERFORM_SELECTOR_1(_delegate, @selector(messageExpunged:), PantomimeMessageExpunged);
+	}
     }
+}
+
+
+//
+// The prefetch windows are ranges of MSNs, see -prefetchWindowBeforeIndex:
+// in CWIMAPFolder. The window being fetched must not count the messages
+// expunged before it, so that the next one starts where it really does.
+// If it wasn't sent yet, its MSNs are updated too and it covers a full
+// window again if it got empty, NOOP standing for it once none is left.
+//
+- (void) _shiftPrefetchWindow: (NSIndexSet *) theIndexes
+{
+  CWIMAPQueueObject *aQueueObject;
+  NSUInteger i, end, window;
+  NSValue *aValue;
+  NSRange aRange;
+
+  for (i = 0; i < [_queue count]; i++)
+    {
+      aQueueObject = [_queue objectAtIndex: i];
+      aValue = [aQueueObject.info objectForKey: @"Range"];
+
+      if (aQueueObject.command != IMAP_UID_FETCH_HEADER_FIELDS || !aValue || [aQueueObject.info objectForKey: @"Folder"] != _selectedFolder)
+	{
+	  continue;
+	}
+
+      aRange = [aValue rangeValue];
+      aRange.length -= [theIndexes countOfIndexesInRange: aRange];
+      aRange.location -= [theIndexes countOfIndexesInRange: NSMakeRange(0, aRange.location)];
+
+      if (![_inFlight objectForKey: aQueueObject.tag])
+	{
+	  if (!aRange.length)
+	    {
+	      end = aRange.location;
+	      window = [_selectedFolder prefetchWindow];
+	      aRange.location = (window && end > window ? end-window : 0);
+	      aRange.length = end - aRange.location;
+	    }
+
+	  aQueueObject.arguments = (aRange.length ?
+				    [NSString stringWithFormat: @"FETCH %lu:%lu (UID FLAGS RFC822.SIZE BODY.PEEK[HEADER.FIELDS (From To Cc Subject Date Message-ID References In-Reply-To)])",
+					      (unsigned long)(aRange.location+1), (unsigned long)NSMaxRange(aRange)] :
+				    @"NOOP");
+	}
+
+      [aQueueObject.info setObject: [NSValue valueWithRange: aRange]  forKey: @"Range"];
+    }
+}
+
+
+//
+// Once authenticated, we reselect the mailbox we had selected
+// before reconnecting, if any.
+//
+- (void) _authenticationCompleted
+{
+  NSString *aString;
+
+  if (!reconnecting)
+    {
+      AUTHENTICATION_COMPLETED(_delegate, _mechanism);
+      return;
+    }
+
+  if (!_selectedFolder)
+    {
+      [self _restoreQueue];
+      return;
+    }
+
+  aString = [self _QRESYNCParametersForFolder: _selectedFolder];
+
+  if ([_selectedFolder mode] == PantomimeReadOnlyMode)
+    {
+      [self sendCommand: IMAP_EXAMINE  info: [NSDictionary dictionaryWithObject: [NSNumber numberWithBool: ([aString length] > 0)]  forKey: @"QRESYNC"]
+	      arguments: @"EXAMINE \"%@\"%@", [_selectedFolder name], aString];
+    }
+  else
+    {
+      [self sendCommand: IMAP_SELECT  info: [NSDictionary dictionaryWithObject: [NSNumber numberWithBool: ([aString length] > 0)]  forKey: @"QRESYNC"]
+	      arguments: @"SELECT \"%@\"%@", [_selectedFolder name], aString];
+    }
+
+  if (opening_mailbox) [_selectedFolder prefetch];
+}
+
+
+//
+// QRESYNC (RFC 7162) must be enabled before we can use it. Servers
+// often only advertise it once we are authenticated, in the tagged
+// response of the authentication: 0002 OK [CAPABILITY IMAP4rev1 ...]
+//
+- (BOOL) _enableQRESYNC
+{
+  NSString *aString;
+  NSData *aData;
+  NSRange r1, r2;
+  NSUInteger i;
+
+  aData = [_responsesFromServer lastObject];
+  r1 = [aData rangeOfCString: "[CAPABILITY "];
+
+  if (r1.length)
+    {
+      r2 = [aData rangeOfCString: "]"  options: 0  range: NSMakeRange(NSMaxRange(r1), [aData length]-NSMaxRange(r1))];
+
+      if (r2.length)
+	{
+	  aString = [[NSString alloc] initWithData: [aData subdataWithRange: NSMakeRange(NSMaxRange(r1), r2.location-NSMaxRange(r1))]
+					  encoding: defaultCStringEncoding];
+	  [_capabilities removeAllObjects];
+	  [_capabilities addObjectsFromArray: [aString componentsSeparatedByString: @" "]];
+	}
+    }
+
+  for (i = 0; i < [_capabilities count]; i++)
+    {
+      if ([[_capabilities objectAtIndex: i] caseInsensitiveCompare: @"QRESYNC"] == NSOrderedSame)
+	{
+	  _qresyncEnabled = YES;
+	  [self sendCommand: IMAP_ENABLE  info: nil  arguments: @"ENABLE QRESYNC"];
+	  return YES;
+	}
+    }
+
+  return NO;
+}
+
+
+//
+// When we reselect a mailbox after reconnecting, we ask the server
+// for what changed since our cache was last synchronized. When
+// opening a mailbox, -prefetch in CWIMAPFolder takes care of that.
+//
+- (NSString *) _QRESYNCParametersForFolder: (CWIMAPFolder *) theFolder
+{
+  CWIMAPCacheManager *aCacheManager;
+
+  aCacheManager = (CWIMAPCacheManager *)theFolder.cacheManager;
+
+  if (!_qresyncEnabled || opening_mailbox || !aCacheManager.highestModSeq || !aCacheManager.uidValidity || ![theFolder count])
+    {
+      return @"";
+    }
+
+  return [NSString stringWithFormat: @" (QRESYNC (%lu %llu))", (unsigned long)aCacheManager.uidValidity, aCacheManager.highestModSeq];
+}
+
+
+//
+// This method is used to parse the name of a mailbox.
+//
+// If the string was encoded using mUTF-7, it'll also
+// decode it.
+//
+- (NSString *) _folderNameFromString: (NSString *) theString
+{
+    NSString *aString;
+    NSRange aRange;
     
-    // We check if the message has the Flagged flag
-    aRange = [theString rangeOfString: @"\\Flagged"
-                              options: NSCaseInsensitiveSearch];
+    aRange = [theString rangeOfString: @"\""];
     
-    if (aRange.length > 0)
+    if (aRange.length)
+    {
+        NSInteger mark;
+        
+        mark = aRange.location + 1;
+        
+        aRange = [theString rangeOfString: @"\""
+                                  options: 0
+                                    range: NSMakeRange(mark, [theString length] - mark)];
+        
+        aString = [theString substringWithRange: NSMakeRange(mark, aRange.location - mark)];
+        
+        // Check if we got "NIL" or a real separator.
+        if ([aString length] == 1)
+        {
+            _folderSeparator = [aString characterAtIndex:0];
+        }
+        else
+        {
+            _folderSeparator = 0;
+        }
+        
+        mark = aRange.location + 2;
+        aString = [theString substringFromIndex: mark];
+    }
+    else
     {
-        [theFlags add: PantomimeFlagged];
+        aRange = [theString rangeOfString: @"NIL"  options: NSCaseInsensitiveSearch];
+        
+        if (aRange.length)
+        {
+            aString = [theString substringFromIndex: aRange.location + aRange.length + 1];
+        }
+        else
+        {
+            return theString;
+        }
     }
     
-    // We check if the message has the Draft flag
-    aRange = [theString rangeOfString: @"\\Draft"
-                              options: NSCaseInsensitiveSearch];
+    aString = [aString stringFromQuotedString];
     
-    if (aRange.length > 0)
+    return aString;
+}
+
+
+//
+// This method parses the list of flags theTokenizer is positioned
+// on and builds a corresponding Flags object for them.
+//
+- (void) _parseFlags: (CWIMAPTokenizer *) theTokenizer
+	     message: (CWIMAPMessage *) theMessage
+	      record: (CWCacheRecord *) theRecord
+{
+    CWFlags *theFlags;
+    
+    theFlags = [[CWFlags alloc] init];
+    
+    while ([theTokenizer tokenType] == IMAPTokenListStart || [theTokenizer tokenType] == IMAPTokenAtom)
     {
-        [theFlags add: PantomimeDraft];
+        if ([theTokenizer tokenIsAtom: "\\Seen"])
+        {
+            [theFlags add: PantomimeSeen];
+        }
+        else if ([theTokenizer tokenIsAtom: "\\Recent"])
+        {
+            [theFlags add: PantomimeRecent];
+        }
+        else if ([theTokenizer tokenIsAtom: "\\Deleted"])
+        {
+            [theFlags add: PantomimeDeleted];
+        }
+        else if ([theTokenizer tokenIsAtom: "\\Answered"])
+        {
+            [theFlags add: PantomimeAnswered];
+        }
+        else if ([theTokenizer tokenIsAtom: "\\Flagged"])
+        {
+            [theFlags add: PantomimeFlagged];
+        }
+        else if ([theTokenizer tokenIsAtom: "\\Draft"])
+        {
+            [theFlags add: PantomimeDraft];
+        }
+        
+        [theTokenizer nextToken];
     }
     
     [[theMessage flags] replaceWithFlags: theFlags];
+    [(CWIMAPCacheManager *)_selectedFolder.cacheManager updateFlagsOfMessage: theMessage];
     theRecord.flags = theFlags.flags;
     
     //
@@ -1383,7 +1896,9 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
     // of the messages (since it has been done).
     //
     if (_lastCommand != IMAP_UID_FETCH_BODY_TEXT && _lastCommand != IMAP_UID_FETCH_HEADER_FIELDS &&
-        _lastCommand != IMAP_UID_FETCH_HEADER_FIELDS_NOT && _lastCommand != IMAP_UID_FETCH_RFC822)
+        _lastCommand != IMAP_UID_FETCH_HEADER_FIELDS_NOT && _lastCommand != IMAP_UID_FETCH_RFC822 &&
+        _lastCommand != IMAP_UID_FETCH_BODY_PART && _lastCommand != IMAP_UID_FETCH_BODYSTRUCTURE &&
+        _lastCommand != IMAP_UID_FETCH_FLAGS_CHANGEDSINCE)
     {
         NSDictionary *userInfo = [NSDictionary dictionaryWithObjectsAndKeys:theMessage, @"Message", nil];
         POST_NOTIFICATION(PantomimeMessageChanged, self, userInfo);
@@ -1558,17 +2073,22 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
       AUTHENTICATION_FAILED(_delegate, _mechanism);
       break;
 
+    case IMAP_ENABLE:
+      _qresyncEnabled = NO;
+      [self _authenticationCompleted];
+      break;
+
     default:
       // We got a BAD response that we could not handle. Raise an exception for now
       // and remove the command that caused this from the queue.
-      [_queue removeLastObject];
+      [self _removeCurrentQueueObject];
       [_responsesFromServer removeAllObjects];
       [NSException raise:PantomimeProtocolException format:@"Unable to handle IMAP response (%@).", [aData asciiString]];
     }
 
   if (![aData hasCPrefix: "*"])
     {
-      [_queue removeLastObject];
+      [self _removeCurrentQueueObject];
       [self sendCommand: IMAP_EMPTY_QUEUE  info: nil  arguments: @""];
     }
 
@@ -1651,11 +2171,16 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 	NSData *aData;
 	NSInteger n = 0;
 	
+	// The count doesn't include the messages expunged before.
+	[self _applyExpunges];
+	
 	aData = [_responsesFromServer lastObject];
 
     [self scanFromData:aData withFormat:"* %" CWNSIntegerFormat " EXISTS", &n];
 	
 	// NSLog(@"_parseEXISTS: %ld", n);
+	_selectedFolder.existsCount = n;
+	
 	if (self.idling &&
         (nil != _currentQueueObject) &&
 		(IMAP_IDLE == _currentQueueObject.command) &&
@@ -1666,6 +2191,7 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 	}
 	else if ((nil != _currentQueueObject) &&
              (_currentQueueObject.command != IMAP_SELECT) &&
+             (_currentQueueObject.command != IMAP_EXAMINE) &&
              ([[_selectedFolder allMessages] count] < n))
     {
 		NSUInteger uid;
@@ -1686,11 +2212,16 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 //
 // Example: * 44 EXPUNGE
 //
+// Servers send one response per expunged message, each one renumbering
+// the messages following it. Instead of removing the messages one at a
+// time, we remember which ones were expunged and remove them at once
+// in -_applyExpunges, before the command completes or before we get
+// a response that relies on the new MSNs.
+//
 - (void) _parseEXPUNGE
 {
-  CWIMAPMessage *aMessage;
-  NSData *aData;
-  NSInteger i, msn = 0;
+  NSInteger msn = 0;
+  NSUInteger index;
 
   // It looks like some servers send untagged expunge reponses
   // _after_ the selected folder has been closed.
@@ -1699,9 +2230,12 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
       return;
     }
 
-  aData = [_responsesFromServer lastObject];
+  [self scanFromData: [_responsesFromServer lastObject]  withFormat: "* %" CWNSIntegerFormat " EXPUNGE", &msn];
 
-    [self scanFromData:aData withFormat:"* %" CWNSIntegerFormat " EXPUNGE", &msn];
+  if (msn <= 0)
+    {
+      return;
+    }
 
   //
   // Messages CAN be expunged before we really had time to FETCH them.
@@ -1709,53 +2243,19 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
   // we have so far. It should be safe since the view hasn't even
   // had the chance to display them.
   //
-  if (msn > [_selectedFolder->allMessages count]) return;
+  index = index_of_msn(_expungedIndexes, msn);
 
-  aMessage = [_selectedFolder->allMessages objectAtIndex: (msn-1)];
-  
-  // We do NOT use  [_selectedFolder removeMessage: aMessage] since it'll
-  // thread the messages everytime we invoke it. We rather thread messages
-  // if:
-  // * We got an untagged EXPUNGE response but the last command was NOT
-  //   an EXPUNGE one (see below, near the end of the method)
-  // * We sent an EXPUNGE command - we'll do the threading of the
-  //   messages in _parseOK:
-  //
-  [_selectedFolder->allMessages removeObject: aMessage];
-  [_selectedFolder updateCache];
-  
-  // We remove its entry in our cache
-  if (_selectedFolder.cacheManager)
-    {
-      [(CWIMAPCacheManager *)(CWIMAPCacheManager*)_selectedFolder.cacheManager removeMessageWithUID: [aMessage uid]];
-    }
-  
-  // We update all MSNs starting from the message that has been expunged.
-  for (i = (msn-1); i < [_selectedFolder->allMessages count]; i++)
+  if (index >= [_selectedFolder->allMessages count])
     {
-      [[_selectedFolder->allMessages objectAtIndex: i] setMessageNumber: (i+1)];
+      return;
     }
-  
-  //
-  // If our previous command is NOT the EXPUNGE command, we must inform our
-  // delegate that messages have been expunged. The delegate SHOULD refresh
-  // its view and does NOT have to issue any command to update the state
-  // of the messages (since it has been done).
-  //
-  if (_lastCommand != IMAP_EXPUNGE)
-    {
-      if ([_selectedFolder allContainers])
-	{
-	  [_selectedFolder thread];
-	}
 
-      if (_selectedFolder.cacheManager)
-	{
-	  [(CWIMAPCacheManager*)_selectedFolder.cacheManager expunge];
-	}
+  [_expungedIndexes addIndex: index];
 
-      POST_NOTIFICATION(PantomimeMessageExpunged, self, [NSDictionary dictionaryWithObject: aMessage  forKey: @"Message"]);
-      (void)PERFORM_SELECTOR_1(_delegate, @selector(messageExpunged:), PantomimeMessageExpunged);
+  // While idling, there's no command completion to wait for.
+  if (_lastCommand == IMAP_IDLE)
+    {
+      [self _applyExpunges];
     }
 }
 
@@ -1833,18 +2333,19 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 //
 - (void) _parseFETCH: (NSInteger) theMSN
 {
-	NSMutableString *aMutableString;
-	NSCharacterSet *aCharacterSet;
+	CWIMAPTokenizer *aTokenizer;
+	CWCacheRecord *cacheRecord;
 	CWIMAPMessage *aMessage;
-	NSScanner *aScanner;
+	NSMutableArray *theSegments;
+	NSData *aData, *theLiteral, *theValue;
 	
-	NSMutableArray *aMutableArray;
-	NSString *aWord, *aString;
-	NSRange aRange;
+	NSUInteger i, first, count;
+	BOOL must_flush_record;
+	char prefix[32];
+	int len;
 	
-	BOOL done, seen_fetch, must_flush_record;
-	NSInteger i, j, count, len;
-	CWCacheRecord *cacheRecord = [[CWCacheRecord alloc] init];
+	// Its MSN doesn't count the messages expunged before it.
+	[self _applyExpunges];
 	
 	//
 	// The folder might have been closed so we must not try to
@@ -1852,13 +2353,6 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 	//
 	if (!_selectedFolder) return;
 	
-	count = [_responsesFromServer count]-1;
-	
-	//NSLog(@"RESPONSES FROM SERVER: %d", count);
-	
-	aMutableString = [[NSMutableString alloc] init];
-	aMutableArray = [[NSMutableArray alloc] init];
-	
 	//
 	// Note:
 	//
@@ -1869,153 +2363,161 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 	// * 1 FETCH (FLAGS (\Recent \Seen) UID 1)
 	// 1 OK UID SEARCH completed
 	//
-	// In such response, we must NOT consider the "* SEARCH" response.
+	// In such response, we must NOT consider the "* SEARCH" response. Our response starts
+	// with the first "* <msn> FETCH" line and we compare it byte by byte.
 	//
-	must_flush_record = seen_fetch = NO;
+	len = snprintf(prefix, sizeof(prefix), "* %ld FETCH", (long)theMSN);
+	count = [_responsesFromServer count];
 	
-	for (i = 0; i <= count; i++)
-    {
-		aString = [[_responsesFromServer objectAtIndex: i] asciiString];
-		//NSLog(@"%i: %@", i, aString);
-		if (!seen_fetch && [aString hasCaseInsensitivePrefix: [NSString stringWithFormat: @"* %ld FETCH", (long)theMSN]])
+	for (first = 0; first < count; first++)
+	{
+		aData = [_responsesFromServer objectAtIndex: first];
+		
+		if ([aData length] >= len && strncasecmp([aData bytes], prefix, len) == 0)
 		{
-			seen_fetch = YES;
+			break;
 		}
+	}
+	
+	if (first == count) return;
+	
+	//
+	// The lines of our response are handed to the tokenizer as they are. The
+	// literal, which we accumulated separately, follows the line announcing it.
+	//
+	theSegments = [NSMutableArray arrayWithCapacity: count-first+1];
+	theLiteral = [_currentQueueObject.literalSink data];
+	
+	for (i = first; i < count; i++)
+	{
+		aData = [_responsesFromServer objectAtIndex: i];
+		[theSegments addObject: aData];
 		
-		if (seen_fetch)
+		if (theLiteral && [aData length] && ((const char *)[aData bytes])[[aData length]-1] == '}')
 		{
-			[aMutableArray addObject: [_responsesFromServer objectAtIndex: i]];
-			[aMutableString appendString: aString];
-			if (i < count-1)
-			{
-				[aMutableString appendString: @" "];
-			}
+			[theSegments addObject: theLiteral];
+			theLiteral = nil;
 		}
-    }
-	
-	//NSLog(@"GOT TO PARSE: |%@|", aMutableString);
+	}
 	
-	aCharacterSet = [NSCharacterSet whitespaceAndNewlineCharacterSet];
-	len = [aMutableString length];
-	aMessage = nil;
-	i = 0;
+	aTokenizer = [[CWIMAPTokenizer alloc] initWithSegments: theSegments];
 	
-	aScanner = [[NSScanner alloc] initWithString: aMutableString];
-	[aScanner setScanLocation: i];
+	// We skip "*", the MSN, "FETCH" and the opening parenthesis.
+	for (i = 0; i < 4; i++)
+	{
+		[aTokenizer nextToken];
+	}
 	
-	done = ![aScanner scanUpToCharactersFromSet: aCharacterSet  intoString: NULL];
+	cacheRecord = [[CWCacheRecord alloc] init];
+	must_flush_record = NO;
 	
 	//
-	// We tokenize our string into words
+	// We are resynchronizing our cache from its mod-sequence (RFC 7162), the
+	// server tells us about the messages that changed since. Their MSNs might
+	// not match our cache yet so we rather find them from their UID. Messages
+	// we don't have are new ones, we fetch them afterward in -prefetch.
 	//
-	while (!done)
-    {
-		j = [aScanner scanLocation];
-		aWord = [[aMutableString substringWithRange: NSMakeRange(i,j-i)] stringByTrimmingWhiteSpaces];
+	if (_lastCommand == IMAP_UID_FETCH_FLAGS_CHANGEDSINCE || _lastCommand == IMAP_SELECT || _lastCommand == IMAP_EXAMINE)
+	{
+		NSUInteger index;
+		
+		// Without a cache, our messages are still ordered by UID.
+		if (_selectedFolder.cacheManager)
+		{
+			aMessage = [(CWIMAPCacheManager *)_selectedFolder.cacheManager messageWithUID: fetch_response_uid(theSegments)];
+		}
+		else
+		{
+			index = [_selectedFolder indexOfMessageWithUID: fetch_response_uid(theSegments)];
+			aMessage = (index != NSNotFound ? [_selectedFolder->allMessages objectAtIndex: index] : nil);
+		}
 		
-		//NSLog(@"WORD |%@|", aWord);
+		if (!aMessage)
+		{
+			[_responsesFromServer removeObjectsInRange: NSMakeRange(first, count-first)];
+			_currentQueueObject.literalSink = nil;
+			return;
+		}
 		
-		if ([aWord characterAtIndex: 0] == '(')
+		[aMessage setMessageNumber: theMSN];
+	}
+	//
+	// If the MSN is > then the folder's count, that means it's
+	// a new message.
+	//
+	// We can safely assume this since what we have in _selectedFolder->allMessages
+	// is really the messages in our IMAP folder. That is true since we
+	// synchronized our cache when opening the folder, in IMAPFolder: -prefetch.
+	//
+	else if (theMSN > [_selectedFolder->allMessages count])
+	{
+		//NSLog(@"============ NEW MESSAGE ======================");
+		aMessage = [[CWIMAPMessage alloc] init];
+		
+		// We set some initial properties to our message;
+		[aMessage setInitialized: NO];
+		[aMessage setFolder: _selectedFolder];
+		[aMessage setMessageNumber: theMSN];
+		[_selectedFolder appendMessage: aMessage];
+		
+		// We add the new message to our cache.
+		if (_selectedFolder.cacheManager)
 		{
-			aWord = [aWord substringFromIndex: 1];
+			CLEAR_CACHE_RECORD(cacheRecord);
+			must_flush_record = YES;
 		}
+	}
+	else
+	{
+		aMessage = [_selectedFolder->allMessages objectAtIndex: (theMSN-1)];
+		[aMessage setMessageNumber: theMSN];
+		[aMessage setFolder: _selectedFolder];
 		
-		//
-		// We read the MSN
-		//
-		if ([aWord characterAtIndex: 0] == '*')
+		// Messages prefetched in windows are added to our cache once we know their UID.
+		if (aMessage.uid == 0 && _selectedFolder.cacheManager)
 		{
-			NSInteger msn;
-			
-			[aScanner scanInteger:&msn];
-			//NSLog(@"msn = %d", msn);
-			
-			//
-			// If the MSN is > then the folder's count, that means it's
-			// a new message.
-			//
-			// We can safely assume this since what we have in _selectedFolder->allMessages
-			// is really the messages in our IMAP folder. That is true since we
-			// synchronized our cache when opening the folder, in IMAPFolder: -prefetch.
-			//
-			if (msn > [_selectedFolder->allMessages count])
-			{
-				//NSLog(@"============ NEW MESSAGE ======================");
-				aMessage = [[CWIMAPMessage alloc] init];
-				
-				// We set some initial properties to our message;
-				[aMessage setInitialized: NO];
-				[aMessage setFolder: _selectedFolder];
-				[aMessage setMessageNumber: msn];
-				[_selectedFolder appendMessage: aMessage];
-				
-				// We add the new message to our cache.
-				if (_selectedFolder.cacheManager)
-				{
-					if (must_flush_record)
-					{
-						[(CWIMAPCacheManager*)_selectedFolder.cacheManager writeRecord:cacheRecord  message:aMessage];
-					}
-					
-					CLEAR_CACHE_RECORD(cacheRecord);
-					must_flush_record = YES;
-					
-					//[(CWIMAPCacheManager*)_selectedFolder.cacheManager addObject: aMessage];
-				}
-			}
-			else
-			{
-				aMessage = [_selectedFolder->allMessages objectAtIndex: (msn-1)];
-				[aMessage setMessageNumber: msn];
-				[aMessage setFolder: _selectedFolder];
-			}
+			CLEAR_CACHE_RECORD(cacheRecord);
+			must_flush_record = YES;
 		}
+	}
+	
+	//
+	// We handle each item as soon as we have read it. Items we
+	// don't know about are skipped, whatever their value is.
+	//
+	while ([aTokenizer nextToken] != IMAPTokenEnd && [aTokenizer tokenType] != IMAPTokenListEnd)
+	{
 		//
 		// We read our UID
 		//
-		if ([aWord caseInsensitiveCompare: @"UID"] == NSOrderedSame)
+		if ([aTokenizer tokenIsAtom: "UID"])
 		{
-			NSUInteger uid;
-			
-			[aScanner scanUnsignedInt: &uid];
-			//NSLog(@"uid %d j = %d, scanLoc = %d", uid, j, [aScanner scanLocation]);
-			
-			if (aMessage.uid == 0)
+			if ([aTokenizer nextToken] == IMAPTokenNumber && aMessage.uid == 0)
 			{
-				aMessage.uid = uid;
-				cacheRecord.imap_uid = uid;
+				aMessage.uid = (NSUInteger)[aTokenizer tokenNumber];
+				cacheRecord.imap_uid = (NSUInteger)[aTokenizer tokenNumber];
 			}
-			
-			j = [aScanner scanLocation];
 		}
 		//
 		// We read our flags. We usually get something like FLAGS (\Seen)
 		//
-		else if ([aWord caseInsensitiveCompare: @"FLAGS"] == NSOrderedSame)
+		else if ([aTokenizer tokenIsAtom: "FLAGS"])
 		{
-			// We get the substring inside our ( )
-			aRange = [aMutableString rangeOfString: @")"  options: 0  range: NSMakeRange(j,len-j)]; 
-			//NSLog(@"Flags = |%@|", [aMutableString substringWithRange: NSMakeRange(j+2, aRange.location-j-2)]);
-			[self _parseFlags: [aMutableString substringWithRange: NSMakeRange(j+2, aRange.location-j-2)]
-					  message: aMessage
-					   record: cacheRecord];
-			
-			j = aRange.location + 1;
-			[aScanner setScanLocation: j];
+			[aTokenizer nextToken];
+			[self _parseFlags: aTokenizer
+				  message: aMessage
+				   record: cacheRecord];
 		}
 		//
 		// We read the RFC822 message size
 		//
-		else if ([aWord caseInsensitiveCompare: @"RFC822.SIZE"] == NSOrderedSame)
+		else if ([aTokenizer tokenIsAtom: "RFC822.SIZE"])
 		{
-			NSInteger size;
-			
-			[aScanner scanInteger:&size];
-			//NSLog(@"size = %d", size);
-			[aMessage setSize: size];
-			cacheRecord.size = size;
-			
-			j = [aScanner scanLocation];
+			if ([aTokenizer nextToken] == IMAPTokenNumber)
+			{
+				[aMessage setSize: (NSInteger)[aTokenizer tokenNumber]];
+				cacheRecord.size = (NSUInteger)[aTokenizer tokenNumber];
+			}
 		}
 		//
 		// Note:
@@ -2025,91 +2527,372 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 		// 000b UID FETCH 3071053:3071053 BODY.PEEK[HEADER.FIELDS.NOT (From To Cc Subject Date Message-ID References In-Reply-To MIME-Version)]
 		// * 1 FETCH (UID 3071053 BODY[HEADER.FIELDS ("From" "To" "Cc" "Subject" "Date" "Message-ID" "References" "In-Reply-To" "MIME-Version")] {1030}
 		//
-		else if ([aWord caseInsensitiveCompare: @"BODY[HEADER.FIELDS.NOT"] == NSOrderedSame ||
-				 _lastCommand == IMAP_UID_FETCH_HEADER_FIELDS_NOT)
+		else if ([aTokenizer tokenHasPrefix: "BODY[HEADER.FIELDS.NOT"] ||
+				 ([aTokenizer tokenHasPrefix: "BODY[HEADER.FIELDS"] && _lastCommand == IMAP_UID_FETCH_HEADER_FIELDS_NOT))
 		{
-			[[_currentQueueObject.info objectForKey: @"NSData"] replaceCRLFWithLF];
-			[aMessage addHeadersFromData:  [_currentQueueObject.info objectForKey: @"NSData"] record: NULL];
-			break;
+			[aTokenizer nextToken];
+			theValue = fetch_item_data(aTokenizer);
+			[aMessage addHeadersFromData: theValue  record: NULL];
 		}
 		//
-		// We must not break immediately after parsing this information. It's very important
+		// We must not stop immediately after parsing this information. It's very important
 		// since servers like Exchange might send us responses like:
 		//
 		// * 1 FETCH (FLAGS (\Seen) RFC822.SIZE 4491 BODY[HEADER.FIELDS (From To Cc Subject Date Message-ID References In-Reply-To Content-Type)] {337} UID 614348)
 		//
-		// If we break right away, we'll skip the size and more importantly, the UID.
+		// If we stopped right away, we'd skip the size and more importantly, the UID.
 		//
-		else if ([aWord caseInsensitiveCompare: @"BODY[HEADER.FIELDS"] == NSOrderedSame)
+		else if ([aTokenizer tokenHasPrefix: "BODY[HEADER.FIELDS"])
 		{
-			[[_currentQueueObject.info objectForKey: @"NSData"] replaceCRLFWithLF];
-			[aMessage setHeadersFromData: [_currentQueueObject.info objectForKey: @"NSData"]  record:cacheRecord];
+			[aTokenizer nextToken];
+			theValue = fetch_item_data(aTokenizer);
+			[aMessage setHeadersFromData: theValue  record: cacheRecord];
 		}
 		//
 		//
 		//
-		else if ([aWord caseInsensitiveCompare: @"BODY[TEXT]"] == NSOrderedSame)
+		else if ([aTokenizer tokenIsAtom: "BODY[TEXT]"])
 		{
-			[[_currentQueueObject.info objectForKey: @"NSData"] replaceCRLFWithLF];
+			[aTokenizer nextToken];
+			
 			if (![aMessage content])
 			{
-				NSData *aData;
-				
 				//
-				// We do an initial check for the message body. If we haven't read a literal,
-				// [_currentQueueObject.info objectForKey: @"NSData"] returns nil. This can
-				// happen with messages having a totally emtpy body. For those messages,
-				// we simply set a default content, being an empty NSData instance.
+				// Messages having a totally empty body give us an empty or a NIL
+				// value, for which we simply set an empty content.
 				//
-				aData = [_currentQueueObject.info objectForKey: @"NSData"];
+				theValue = fetch_item_data(aTokenizer);
 				
-				if (!aData) aData = [NSData data];
-				
-				[CWMIMEUtility setContentFromRawSource: aData  inPart: aMessage];
+				[CWMIMEUtility setContentFromRawSource: theValue  inPart: aMessage];
 				[aMessage setInitialized: YES];
 				
 				// LUDO
-                if (nil != aMessage)
-                {
-                    [_currentQueueObject.info setObject: aMessage  forKey: @"Message"];
-                }
+				if (nil != aMessage)
+				{
+					[_currentQueueObject.info setObject: aMessage  forKey: @"Message"];
+				}
 				
-                NSDictionary *userInfo = [NSDictionary dictionaryWithObjectsAndKeys:aMessage, @"Message", nil];
+				NSDictionary *userInfo = [NSDictionary dictionaryWithObjectsAndKeys:aMessage, @"Message", nil];
 				POST_NOTIFICATION(PantomimeMessagePrefetchCompleted, self, userInfo);
 				PERFORM_SELECTOR_2(_delegate, @selector(messagePrefetchCompleted:), PantomimeMessagePrefetchCompleted, aMessage, @"Message");
 			}
-			break;
 		}
 		//
+		// The structure of the message, see -fetchBodyStructure in CWIMAPMessage.
 		//
+		else if ([aTokenizer tokenIsAtom: "BODYSTRUCTURE"])
+		{
+			if ([aTokenizer nextToken] == IMAPTokenListStart)
+			{
+				aMessage.bodyStructure = [self _partFromTokenizer: aTokenizer  section: @""  message: aMessage];
+				
+				// A single part message has no multipart holding its part.
+				if (![aMessage.bodyStructure isMIMEType: @"multipart"  subType: @"*"])
+				{
+					[aMessage.bodyStructure setSection: @"1"];
+				}
+				
+				NSDictionary *userInfo = [NSDictionary dictionaryWithObjectsAndKeys:aMessage, @"Message", nil];
+				POST_NOTIFICATION(PantomimeBodyStructureFetchCompleted, self, userInfo);
+				PERFORM_SELECTOR_2(_delegate, @selector(bodyStructureFetchCompleted:), PantomimeBodyStructureFetchCompleted, aMessage, @"Message");
+			}
+			else
+			{
+				[aTokenizer skipValue];
+			}
+		}
+		//
+		// The content of a part, see CWIMAPPart. Only complete contents
+		// are decoded, partial ones are handed out as they are.
 		//
-		else if ([aWord caseInsensitiveCompare: @"RFC822"] == NSOrderedSame)
+		else if ([aTokenizer tokenHasPrefix: "BODY["])
 		{
-			[[_currentQueueObject.info objectForKey: @"NSData"] replaceCRLFWithLF];
-			[aMessage setRawSource: [_currentQueueObject.info objectForKey: @"NSData"]];
-            NSDictionary *userInfo = [NSDictionary dictionaryWithObjectsAndKeys:aMessage, @"Message", nil];
+			const char *bytes, *end;
+			CWIMAPPart *aPart;
+			NSString *aSection;
+			NSUInteger offset;
+			BOOL partial;
+			
+			bytes = [aTokenizer tokenBytes] + 5;
+			end = memchr(bytes, ']', [aTokenizer tokenLength] - 5);
+			aSection = (end ? [[NSString alloc] initWithBytes: bytes  length: end-bytes  encoding: NSASCIIStringEncoding] : nil);
+			partial = (end && end+1 < [aTokenizer tokenBytes]+[aTokenizer tokenLength] && end[1] == '<');
+			offset = (partial ? strtoul(end+2, NULL, 10) : 0);
+			
+			[aTokenizer nextToken];
+			theValue = fetch_item_data(aTokenizer);
+			aPart = ([aSection length] ? [aMessage partForSection: aSection] : nil);
+			
+			if (aPart)
+			{
+				NSDictionary *userInfo;
+				
+				if (partial)
+				{
+					userInfo = [NSDictionary dictionaryWithObjectsAndKeys: aPart, @"Part", aMessage, @"Message",
+							theValue, @"NSData", [NSNumber numberWithUnsignedInteger: offset], @"Offset", nil];
+				}
+				else
+				{
+					[CWMIMEUtility setContentFromRawSource: theValue  inPart: aPart];
+					userInfo = [NSDictionary dictionaryWithObjectsAndKeys: aPart, @"Part", aMessage, @"Message", nil];
+				}
+				
+				POST_NOTIFICATION(PantomimePartFetchCompleted, self, userInfo);
+				PERFORM_SELECTOR_3(_delegate, @selector(partFetchCompleted:), PantomimePartFetchCompleted, userInfo);
+			}
+		}
+		//
+		//
+		//
+		else if ([aTokenizer tokenIsAtom: "RFC822"])
+		{
+			[aTokenizer nextToken];
+			theValue = fetch_item_data(aTokenizer);
+			[aMessage setRawSource: theValue];
+			[self.bodyStore setData: theValue  forMessage: aMessage];
+			NSDictionary *userInfo = [NSDictionary dictionaryWithObjectsAndKeys:aMessage, @"Message", nil];
 			POST_NOTIFICATION(PantomimeMessageFetchCompleted, self, userInfo);
 			PERFORM_SELECTOR_2(_delegate, @selector(messageFetchCompleted:), PantomimeMessageFetchCompleted, aMessage, @"Message");
-			break;
 		}
-		
-		i = j;
-		done = ![aScanner scanUpToCharactersFromSet: aCharacterSet  intoString: NULL];
-		
-		if (done && must_flush_record)
+		else
 		{
-			[(CWIMAPCacheManager*)_selectedFolder.cacheManager writeRecord:cacheRecord  message: aMessage];
+			[aTokenizer nextToken];
+			[aTokenizer skipValue];
 		}
-    }
+	}
 	
+	// A message can't have two records, even if a window overlapped the previous one.
+	if (must_flush_record && cacheRecord.imap_uid &&
+	    ![(CWIMAPCacheManager *)_selectedFolder.cacheManager messageWithUID: cacheRecord.imap_uid])
+	{
+		[(CWIMAPCacheManager*)_selectedFolder.cacheManager writeRecord: cacheRecord  message: aMessage];
+	}
 	
 	//
 	// It is important that we remove the responses we have processed. This is particularly
 	// useful if we are caching an IMAP mailbox. We could receive thousands of untagged
 	// FETCH responses and we don't want to go over them again and again everytime
-	// this method is invoked.
+	// this method is invoked. They are all at the end of _responsesFromServer.
+	//
+	[_responsesFromServer removeObjectsInRange: NSMakeRange(first, count-first)];
+	_currentQueueObject.literalSink = nil;
+}
+
+
+//
+// This method parses a body parameter list, like ("CHARSET" "us-ascii"),
+// theTokenizer is positioned on. The keys are lowercase.
+//
+- (NSDictionary *) _parametersFromTokenizer: (CWIMAPTokenizer *) theTokenizer
+{
+	NSMutableDictionary *allParameters;
+	NSString *aKey;
+	
+	if ([theTokenizer tokenType] != IMAPTokenListStart)
+	{
+		return nil;
+	}
+	
+	allParameters = [NSMutableDictionary dictionary];
+	
+	while ([theTokenizer nextToken] != IMAPTokenListEnd && [theTokenizer tokenType] != IMAPTokenEnd)
+	{
+		aKey = [[theTokenizer tokenString] lowercaseString];
+		
+		if ([theTokenizer nextToken] == IMAPTokenListEnd || [theTokenizer tokenType] == IMAPTokenEnd)
+		{
+			break;
+		}
+		
+		if (aKey && [theTokenizer tokenType] != IMAPTokenAtom)
+		{
+			[allParameters setObject: [theTokenizer tokenString]  forKey: aKey];
+		}
+	}
+	
+	return allParameters;
+}
+
+
+//
+// This method builds the part described by the body structure theTokenizer
+// is positioned on - its opening parenthesis. See 7.4.2. FETCH Response
+// of RFC 3501. When it returns, theTokenizer is on the closing parenthesis.
+//
+// We don't go inside message/rfc822 parts, they are fetched as a whole.
+//
+- (CWIMAPPart *) _partFromTokenizer: (CWIMAPTokenizer *) theTokenizer
+                            section: (NSString *) theSection
+                            message: (CWIMAPMessage *) theMessage
+{
+	NSDictionary *allParameters;
+	CWIMAPPart *aPart;
+	NSString *aString;
+	NSUInteger i, disposition;
+	
+	aPart = [[CWIMAPPart alloc] init];
+	[aPart setSection: theSection];
+	[aPart setMessage: theMessage];
+	
+	if ([theTokenizer nextToken] == IMAPTokenListStart)
+	{
+		CWMIMEMultipart *aMultipart;
+		
+		aMultipart = [[CWMIMEMultipart alloc] init];
+		
+		for (i = 1; [theTokenizer tokenType] == IMAPTokenListStart; i++)
+		{
+			[aMultipart addPart: [self _partFromTokenizer: theTokenizer
+							      section: ([theSection length] ? [NSString stringWithFormat: @"%@.%lu", theSection, (unsigned long)i] :
+									[NSString stringWithFormat: @"%lu", (unsigned long)i])
+							      message: theMessage]];
+			[theTokenizer nextToken];
+		}
+		
+		[aPart setContentType: [[NSString stringWithFormat: @"multipart/%@", [theTokenizer tokenString]] lowercaseString]];
+		[aPart setContent: aMultipart];
+		
+		//
+		// The extension data starts with the parameters, then comes
+		// the disposition. Servers might not send extension data.
+		//
+		disposition = 0;
+		
+		switch ([theTokenizer nextToken])
+		{
+			case IMAPTokenListEnd:
+			case IMAPTokenEnd:
+				return aPart;
+				
+			case IMAPTokenListStart:
+				allParameters = [self _parametersFromTokenizer: theTokenizer];
+				
+				if ((aString = [allParameters objectForKey: @"boundary"]))
+				{
+					[aPart setBoundary: [aString dataUsingEncoding: NSASCIIStringEncoding]];
+				}
+				
+			default:
+				[theTokenizer nextToken];
+		}
+	}
+	else
+	{
+		[aPart setContentType: [[NSString stringWithFormat: @"%@/%@", [theTokenizer tokenString],
+						  ([theTokenizer nextToken] != IMAPTokenEnd ? [theTokenizer tokenString] : @"")] lowercaseString]];
+		
+		[theTokenizer nextToken];
+		allParameters = [self _parametersFromTokenizer: theTokenizer];
+		
+		if ((aString = [allParameters objectForKey: @"charset"]))
+		{
+			[aPart setCharset: aString];
+		}
+		
+		if ((aString = [allParameters objectForKey: @"name"]))
+		{
+			[aPart setFilename: [CWMIMEUtility decodeHeader: [aString dataUsingEncoding: NSISOLatin1StringEncoding]  charset: [aPart defaultCharset]]];
+		}
+		
+		if ([theTokenizer nextToken] == IMAPTokenString)
+		{
+			[aPart setContentID: [theTokenizer tokenString]];
+		}
+		
+		if ([theTokenizer nextToken] == IMAPTokenString)
+		{
+			[aPart setContentDescription: [theTokenizer tokenString]];
+		}
+		
+		[theTokenizer nextToken];
+		aString = [theTokenizer tokenString];
+		
+		if ([aString caseInsensitiveCompare: @"quoted-printable"] == NSOrderedSame)
+		{
+			[aPart setContentTransferEncoding: PantomimeEncodingQuotedPrintable];
+		}
+		else if ([aString caseInsensitiveCompare: @"base64"] == NSOrderedSame)
+		{
+			[aPart setContentTransferEncoding: PantomimeEncodingBase64];
+		}
+		else if ([aString caseInsensitiveCompare: @"8bit"] == NSOrderedSame)
+		{
+			[aPart setContentTransferEncoding: PantomimeEncoding8bit];
+		}
+		else if ([aString caseInsensitiveCompare: @"binary"] == NSOrderedSame)
+		{
+			[aPart setContentTransferEncoding: PantomimeEncodingBinary];
+		}
+		else
+		{
+			[aPart setContentTransferEncoding: PantomimeEncodingNone];
+		}
+		
+		if ([theTokenizer nextToken] == IMAPTokenNumber)
+		{
+			[aPart setSize: (long)[theTokenizer tokenNumber]];
+		}
+		
+		//
+		// Text parts have their number of lines, message/rfc822 parts their
+		// envelope, body structure and number of lines. Then comes the
+		// extension data: MD5 and disposition.
+		//
+		if ([aPart isMIMEType: @"text"  subType: @"*"])
+		{
+			disposition = 2;
+		}
+		else if ([aPart isMIMEType: @"message"  subType: @"rfc822"])
+		{
+			disposition = 4;
+		}
+		else
+		{
+			disposition = 1;
+		}
+		
+		[theTokenizer nextToken];
+	}
+	
 	//
-	[_responsesFromServer removeObjectsInArray: aMutableArray];
+	// We are on the first field we haven't read yet, we read
+	// the disposition and skip everything else.
+	//
+	for (i = 0; [theTokenizer tokenType] != IMAPTokenListEnd && [theTokenizer tokenType] != IMAPTokenEnd; i++)
+	{
+		if (i == disposition && [theTokenizer tokenType] == IMAPTokenListStart)
+		{
+			[theTokenizer nextToken];
+			
+			if ([theTokenizer tokenType] == IMAPTokenString)
+			{
+				[aPart setContentDisposition: ([[theTokenizer tokenString] caseInsensitiveCompare: @"inline"] == NSOrderedSame ? PantomimeInlineDisposition : PantomimeAttachmentDisposition)];
+			}
+			
+			[theTokenizer nextToken];
+			allParameters = [self _parametersFromTokenizer: theTokenizer];
+			
+			if ((aString = [allParameters objectForKey: @"filename"]))
+			{
+				[aPart setFilename: [CWMIMEUtility decodeHeader: [aString dataUsingEncoding: NSISOLatin1StringEncoding]  charset: [aPart defaultCharset]]];
+			}
+			
+			// We go to the end of the disposition.
+			while ([theTokenizer nextToken] != IMAPTokenListEnd && [theTokenizer tokenType] != IMAPTokenEnd)
+			{
+				[theTokenizer skipValue];
+			}
+		}
+		else
+		{
+			[theTokenizer skipValue];
+		}
+		
+		[theTokenizer nextToken];
+	}
+	
+	return aPart;
 }
 
 
@@ -2296,6 +3079,11 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
       AUTHENTICATION_FAILED(_delegate, _mechanism);
       break;
 
+    case IMAP_ENABLE:
+      _qresyncEnabled = NO;
+      [self _authenticationCompleted];
+      break;
+
     case IMAP_CREATE:
       POST_NOTIFICATION(PantomimeFolderCreateFailed, self, _currentQueueObject.info);
       (void)PERFORM_SELECTOR_1(_delegate, @selector(folderCreateFailed:), PantomimeFolderCreateFailed);
@@ -2307,6 +3095,13 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
       break;
 
     case IMAP_EXPUNGE:
+      if ([_currentQueueObject.info objectForKey: @"Expunge"])
+	{
+	  POST_NOTIFICATION(PantomimeMessagesMoveFailed, self, _currentQueueObject.info);
+	  PERFORM_SELECTOR_3(_delegate, @selector(messagesMoveFailed:), PantomimeMessagesMoveFailed, _currentQueueObject.info);
+	  break;
+	}
+
       POST_NOTIFICATION(PantomimeFolderExpungeFailed, self, _currentQueueObject.info);
       PERFORM_SELECTOR_2(_delegate, @selector(folderExpungeFailed:), PantomimeFolderExpungeFailed, _selectedFolder, @"Folder");
       break;
@@ -2330,21 +3125,80 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
       break;
       
     case IMAP_UID_COPY:
+      if ([_currentQueueObject.info objectForKey: @"Expunge"])
+	{
+	  POST_NOTIFICATION(PantomimeMessagesMoveFailed, self, _currentQueueObject.info);
+	  PERFORM_SELECTOR_3(_delegate, @selector(messagesMoveFailed:), PantomimeMessagesMoveFailed, _currentQueueObject.info);
+	  break;
+	}
+
       POST_NOTIFICATION(PantomimeMessagesCopyFailed, self, _currentQueueObject.info);
       PERFORM_SELECTOR_3(_delegate, @selector(messagesCopyFailed:), PantomimeMessagesCopyFailed, _currentQueueObject.info);
       break;
 
+    case IMAP_UID_MOVE:
+      POST_NOTIFICATION(PantomimeMessagesMoveFailed, self, _currentQueueObject.info);
+      PERFORM_SELECTOR_3(_delegate, @selector(messagesMoveFailed:), PantomimeMessagesMoveFailed, _currentQueueObject.info);
+      break;
+
+    //
+    // A window of the prefetch failed, we don't go on with the next
+    // one. The records written so far are sorted, like once the last
+    // window is fetched, but our cache keeps its mod-sequence.
+    //
+    case IMAP_UID_FETCH_HEADER_FIELDS:
+      if (![aData hasCPrefix: "*"] && [_currentQueueObject.info objectForKey: @"Range"] &&
+	  [_currentQueueObject.info objectForKey: @"Folder"] == _selectedFolder)
+	{
+	  CWIMAPCacheManager *aCacheManager;
+
+	  opening_mailbox = NO;
+	  aCacheManager = (CWIMAPCacheManager *)_selectedFolder.cacheManager;
+
+	  if (aCacheManager)
+	    {
+	      aCacheManager.acceptsUnorderedRecords = NO;
+	      [aCacheManager synchronize];
+	    }
+
+	  POST_NOTIFICATION(PantomimeFolderPrefetchFailed, self, _currentQueueObject.info);
+	  PERFORM_SELECTOR_3(_delegate, @selector(folderPrefetchFailed:), PantomimeFolderPrefetchFailed, _currentQueueObject.info);
+	}
+      break;
+
     case IMAP_UID_SEARCH_ALL:
       POST_NOTIFICATION(PantomimeFolderSearchFailed, self, _currentQueueObject.info);
       (void)PERFORM_SELECTOR_1(_delegate, @selector(folderSearchFailed:), PantomimeFolderSearchFailed);
       break;
 
+    case IMAP_UID_SORT:
+      POST_NOTIFICATION(PantomimeFolderSortFailed, self, _currentQueueObject.info);
+      PERFORM_SELECTOR_3(_delegate, @selector(folderSortFailed:), PantomimeFolderSortFailed, _currentQueueObject.info);
+      break;
+
+    case IMAP_UID_THREAD:
+      POST_NOTIFICATION(PantomimeFolderThreadFailed, self, _currentQueueObject.info);
+      PERFORM_SELECTOR_3(_delegate, @selector(folderThreadFailed:), PantomimeFolderThreadFailed, _currentQueueObject.info);
+      break;
+
+    case IMAP_LIST_STATUS:
+      POST_NOTIFICATION(PantomimeFolderStatusFailed, self, _currentQueueObject.info);
+      PERFORM_SELECTOR_3(_delegate, @selector(folderStatusFailed:), PantomimeFolderStatusFailed, _currentQueueObject.info);
+      break;
+
     case IMAP_STATUS:
       POST_NOTIFICATION(PantomimeFolderStatusFailed, self, _currentQueueObject.info);
       PERFORM_SELECTOR_2(_delegate, @selector(folderStatusFailed:), PantomimeFolderStatusFailed, [_currentQueueObject.info objectForKey: @"Name"], @"Name");
       break;
 
-    case IMAP_UID_STORE:
+    case IMAP_UID_STORE:
+      if ([_currentQueueObject.info objectForKey: @"Expunge"])
+	{
+	  POST_NOTIFICATION(PantomimeMessagesMoveFailed, self, _currentQueueObject.info);
+	  PERFORM_SELECTOR_3(_delegate, @selector(messagesMoveFailed:), PantomimeMessagesMoveFailed, _currentQueueObject.info);
+	  break;
+	}
+
       POST_NOTIFICATION(PantomimeMessageStoreFailed, self, _currentQueueObject.info);
       PERFORM_SELECTOR_3(_delegate, @selector(messageStoreFailed:), PantomimeMessageStoreFailed, _currentQueueObject.info);
       break;
@@ -2370,7 +3224,7 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
       POST_NOTIFICATION(@"PantomimeCommandCompleted", self, _currentQueueObject.info);
       PERFORM_SELECTOR_3(_delegate, @selector(commandCompleted:), @"PantomimeCommandCompleted", _currentQueueObject.info);
       
-      [_queue removeLastObject];
+      [self _removeCurrentQueueObject];
       [self sendCommand: IMAP_EMPTY_QUEUE  info: nil  arguments: @""];
     }
 
@@ -2421,29 +3275,10 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 		case IMAP_AUTHENTICATE_CRAM_MD5:
 		case IMAP_AUTHENTICATE_LOGIN:
 		case IMAP_LOGIN:
-			if (reconnecting)
-			{
-				if (_selectedFolder)
-				{
-					if ([_selectedFolder mode] == PantomimeReadOnlyMode)
-					{
-						[self sendCommand: IMAP_EXAMINE  info: nil  arguments: @"EXAMINE \"%@\"", [_selectedFolder name]];
-					}
-					else
-					{
-						[self sendCommand: IMAP_SELECT  info: nil  arguments: @"SELECT \"%@\"", [_selectedFolder name]];
-					}
-					
-					if (opening_mailbox) [_selectedFolder prefetch];
-				}
-				else
-				{
-					[self _restoreQueue];
-				}
-			}
-			else
+			// We complete the authentication once QRESYNC is enabled, if we can enable it.
+			if (![self _enableQRESYNC])
 			{
-				AUTHENTICATION_COMPLETED(_delegate, _mechanism);
+				[self _authenticationCompleted];
 			}
 			break;
 			
@@ -2476,7 +3311,12 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 			(void)PERFORM_SELECTOR_1(_delegate, @selector(folderDeleteCompleted:), PantomimeFolderDeleteCompleted);
 			break;
 			
+		case IMAP_ENABLE:
+			[self _authenticationCompleted];
+			break;
+			
 		case IMAP_EXPUNGE:
+		case IMAP_UID_MOVE:
 			//
 			// No need to synchronize our IMAP cache here since, at worst, the
 			// expunged messages will get removed once we reopen the mailbox.
@@ -2490,6 +3330,15 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 			{
 				[(CWIMAPCacheManager*)_selectedFolder.cacheManager expunge];
 			}
+			
+			// The messages moved were removed along with the others expunged, if any.
+			if (_lastCommand == IMAP_UID_MOVE || [_currentQueueObject.info objectForKey: @"Expunge"])
+			{
+				POST_NOTIFICATION(PantomimeMessagesMoveCompleted, self, _currentQueueObject.info);
+				PERFORM_SELECTOR_3(_delegate, @selector(messagesMoveCompleted:), PantomimeMessagesMoveCompleted, _currentQueueObject.info);
+				break;
+			}
+			
 			POST_NOTIFICATION(PantomimeFolderExpungeCompleted, self, _currentQueueObject.info);
 			PERFORM_SELECTOR_2(_delegate, @selector(folderExpungeCompleted:), PantomimeFolderExpungeCompleted, _selectedFolder, @"Folder");
 			break;
@@ -2531,17 +3380,76 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 			break;
 			
 		case IMAP_UID_COPY:
+			//
+			// When moving messages without MOVE, we can now mark the copied
+			// messages as \Deleted. They are expunged once that completed.
+			//
+			if ([_currentQueueObject.info objectForKey: @"Expunge"])
+			{
+				[self sendCommand: IMAP_UID_STORE  info: _currentQueueObject.info  arguments: @"UID STORE %@ +FLAGS.SILENT (\\Deleted)",
+				      [[CWIMAPSequenceSet sequenceSetWithMessages: [_currentQueueObject.info objectForKey: @"Messages"]] stringValue]];
+				break;
+			}
+			
 			POST_NOTIFICATION(PantomimeMessagesCopyCompleted, self, _currentQueueObject.info);
 			PERFORM_SELECTOR_3(_delegate, @selector(messagesCopyCompleted:), PantomimeMessagesCopyCompleted, _currentQueueObject.info);
 			break;
 			
+		case IMAP_UID_FETCH_FLAGS_CHANGEDSINCE:
+			// Messages that vanished were removed, the others are now numbered like on the server.
+			[_selectedFolder updateCache];
+			break;
+			
 		case IMAP_UID_FETCH_HEADER_FIELDS:
 		{
+			CWIMAPCacheManager *aCacheManager;
+			NSDictionary *userInfo;
+			NSValue *aValue;
+			
+			aValue = [_currentQueueObject.info objectForKey: @"Range"];
+			
+			//
+			// The folder is prefetched in windows, the newest messages first. We
+			// go on with the preceding window unless this one reached the first
+			// message, see -prefetchWindowBeforeIndex: in CWIMAPFolder.
+			//
+			if (aValue)
+			{
+				if ([aData hasCPrefix: "*"] || [_currentQueueObject.info objectForKey: @"Folder"] != _selectedFolder)
+				{
+					break;
+				}
+				
+				userInfo = [NSDictionary dictionaryWithObjectsAndKeys: _selectedFolder, @"Folder", aValue, @"Range", nil];
+				POST_NOTIFICATION(PantomimeFolderPrefetchWindowCompleted, self, userInfo);
+				PERFORM_SELECTOR_3(_delegate, @selector(folderPrefetchWindowCompleted:), PantomimeFolderPrefetchWindowCompleted, userInfo);
+				
+				if ([aValue rangeValue].location > 0)
+				{
+					[_selectedFolder prefetchWindowBeforeIndex: [aValue rangeValue].location];
+					break;
+				}
+			}
+			
 			opening_mailbox = NO;
+			aCacheManager = (CWIMAPCacheManager *)_selectedFolder.cacheManager;
 			
-			if (_selectedFolder.cacheManager)
+			if (aCacheManager)
 			{
-				[(CWIMAPCacheManager*)_selectedFolder.cacheManager synchronize];
+				// The records written by the windows are sorted by -synchronize.
+				aCacheManager.acceptsUnorderedRecords = NO;
+				
+				//
+				// Our cache is now synchronized with the mod-sequence the folder had
+				// when we selected it, see -prefetch in CWIMAPFolder.
+				//
+				if ([_currentQueueObject.info objectForKey: @"HighestModSeq"])
+				{
+					aCacheManager.highestModSeq = [[_currentQueueObject.info objectForKey: @"HighestModSeq"] unsignedLongLongValue];
+					aCacheManager.uidValidity = _selectedFolder.uidValidity;
+				}
+				
+				[aCacheManager synchronize];
 			}
 			
 			//NSLog(@"DONE PREFETCHING FOLDER");
@@ -2571,6 +3479,20 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 			}
 			break;
 			
+		case IMAP_UID_SORT:
+			// An untagged OK, like one carrying a HIGHESTMODSEQ, must not complete the command.
+			if (![aData hasCPrefix: "*"])
+			{
+				NSDictionary *userInfo;
+				NSArray *allUIDs;
+				
+				allUIDs = [_currentQueueObject.info objectForKey: @"UIDs"];
+				userInfo = [NSDictionary dictionaryWithObjectsAndKeys: _selectedFolder, @"Folder", (allUIDs ? allUIDs : [NSArray array]), @"UIDs", nil];
+				POST_NOTIFICATION(PantomimeFolderSortCompleted, self, userInfo);
+				PERFORM_SELECTOR_3(_delegate, @selector(folderSortCompleted:), PantomimeFolderSortCompleted, userInfo);
+			}
+			break;
+			
 		case IMAP_UID_STORE:
 		{
 			// Once the STORE has completed, we update the messages.
@@ -2582,9 +3504,23 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 			theFlags = [_currentQueueObject.info objectForKey: @"Flags"];
 			count = [theMessages count];
 			
+			// Messages being moved only got \Deleted added to their flags.
+			if ([_currentQueueObject.info objectForKey: @"Expunge"])
+			{
+				for (i = 0; i < count; i++)
+				{
+					[[(CWMessage*)[theMessages objectAtIndex: i] flags] add: PantomimeDeleted];
+					[(CWIMAPCacheManager *)_selectedFolder.cacheManager updateFlagsOfMessage: [theMessages objectAtIndex: i]];
+				}
+				
+				[self sendCommand: IMAP_EXPUNGE  info: _currentQueueObject.info  arguments: @"%@", [_currentQueueObject.info objectForKey: @"Expunge"]];
+				break;
+			}
+			
 			for (i = 0; i < count; i++)
 			{
 				[[(CWMessage*)[theMessages objectAtIndex: i] flags] replaceWithFlags: theFlags];
+				[(CWIMAPCacheManager *)_selectedFolder.cacheManager updateFlagsOfMessage: [theMessages objectAtIndex: i]];
 			}
 			
 			POST_NOTIFICATION(PantomimeMessageStoreCompleted, self, _currentQueueObject.info);
@@ -2592,6 +3528,18 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 		}
 			break;
 			
+		case IMAP_UID_THREAD:
+			if (![aData hasCPrefix: "*"])
+			{
+				NSArray *allContainers;
+				
+				allContainers = [_currentQueueObject.info objectForKey: @"Containers"];
+				[_selectedFolder setAllContainers: (allContainers ? allContainers : [NSArray array])];
+				POST_NOTIFICATION(PantomimeFolderThreadCompleted, self, [NSDictionary dictionaryWithObject: _selectedFolder  forKey: @"Folder"]);
+				PERFORM_SELECTOR_2(_delegate, @selector(folderThreadCompleted:), PantomimeFolderThreadCompleted, _selectedFolder, @"Folder");
+			}
+			break;
+			
 		case IMAP_UNSUBSCRIBE:
 			// We must remove the folder from our list of subscribed folders.
 			[_subscribedFolders removeObject: [_currentQueueObject.info objectForKey: @"Name"]];
@@ -2619,7 +3567,7 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 		POST_NOTIFICATION(@"PantomimeCommandCompleted", self, _currentQueueObject.info);
 		PERFORM_SELECTOR_3(_delegate, @selector(commandCompleted:), @"PantomimeCommandCompleted", _currentQueueObject.info);
 		
-		[_queue removeLastObject];
+		[self _removeCurrentQueueObject];
 		[self sendCommand: IMAP_EMPTY_QUEUE  info: nil  arguments: @""];
     }
 	
@@ -2685,6 +3633,7 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 - (void) _parseSEARCH_CACHE
 {
   CWIMAPMessage *aMessage;
+  NSDictionary *theInfo;
   NSArray *allResults;
   NSInteger i, count;
   BOOL b;
@@ -2754,7 +3703,9 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
       //     
       for (i = 0; i < count; i++)
 	{
-	  [[[(CWIMAPCacheManager*)_selectedFolder.cacheManager messageWithUID:[[allResults objectAtIndex:i] unsignedIntegerValue]] flags] add:PantomimeAnswered];
+	  aMessage = [(CWIMAPCacheManager*)_selectedFolder.cacheManager messageWithUID: [[allResults objectAtIndex: i] unsignedIntegerValue]];
+	  [[aMessage flags] add: PantomimeAnswered];
+	  [(CWIMAPCacheManager*)_selectedFolder.cacheManager updateFlagsOfMessage: aMessage];
 	}
       [self sendCommand: IMAP_UID_SEARCH_FLAGGED  info: nil  arguments: @"UID SEARCH FLAGGED"];
       break;
@@ -2765,7 +3716,9 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
       //     
       for (i = 0; i < count; i++)
 	{
-	  [[[(CWIMAPCacheManager*)_selectedFolder.cacheManager messageWithUID: [[allResults objectAtIndex: i] unsignedIntegerValue]] flags] add: PantomimeFlagged];
+	  aMessage = [(CWIMAPCacheManager*)_selectedFolder.cacheManager messageWithUID: [[allResults objectAtIndex: i] unsignedIntegerValue]];
+	  [[aMessage flags] add: PantomimeFlagged];
+	  [(CWIMAPCacheManager*)_selectedFolder.cacheManager updateFlagsOfMessage: aMessage];
 	}
       [self sendCommand: IMAP_UID_SEARCH_UNSEEN  info: nil  arguments: @"UID SEARCH UNSEEN"];
       break;
@@ -2777,15 +3730,27 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
       for (i = 0; i < count; i++)
 	{
 	  //NSLog(@"removing for UID %d", [[allResults objectAtIndex: i] unsignedIntValue]);
-	  [[[(CWIMAPCacheManager*)_selectedFolder.cacheManager messageWithUID: [[allResults objectAtIndex: i] unsignedIntegerValue]] flags] remove: PantomimeSeen];
+	  aMessage = [(CWIMAPCacheManager*)_selectedFolder.cacheManager messageWithUID: [[allResults objectAtIndex: i] unsignedIntegerValue]];
+	  [[aMessage flags] remove: PantomimeSeen];
+	  [(CWIMAPCacheManager*)_selectedFolder.cacheManager updateFlagsOfMessage: aMessage];
 	}
       
       //
       // We obtain the last UID of our cache.
       // Messages will be fetched starting from that UID + 1.
       //
+      // Like in -prefetch, our cache gets the mod-sequence of the folder once it
+      // completed, so that it can be resynchronized with CHANGEDSINCE next time.
+      //
       //NSLog(@"LAST UID IN CACHE: %u", [[_selectedFolder->allMessages lastObject] UID]);
-      [self sendCommand: IMAP_UID_FETCH_HEADER_FIELDS  info: nil  arguments: @"UID FETCH %u:* (UID FLAGS RFC822.SIZE BODY.PEEK[HEADER.FIELDS (From To Cc Subject Date Message-ID References In-Reply-To)])", ([[_selectedFolder->allMessages lastObject] uid]+1)];
+      theInfo = nil;
+
+      if (_qresyncEnabled && _selectedFolder.highestModSeq)
+	{
+	  theInfo = [NSDictionary dictionaryWithObject: [NSNumber numberWithUnsignedLongLong: _selectedFolder.highestModSeq]  forKey: @"HighestModSeq"];
+	}
+
+      [self sendCommand: IMAP_UID_FETCH_HEADER_FIELDS  info: theInfo  arguments: @"UID FETCH %u:* (UID FLAGS RFC822.SIZE BODY.PEEK[HEADER.FIELDS (From To Cc Subject Date Message-ID References In-Reply-To)])", ([[_selectedFolder->allMessages lastObject] uid]+1)];
       break;
 
     default:
@@ -2806,6 +3771,7 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
   // The last object in _responsesFromServer is a tagged OK response.
   // We need to parse it here.
   count = [_responsesFromServer count];
+  _selectedFolder.highestModSeq = 0;
 
   for (i = 0; i < count; i++)
     {
@@ -2817,6 +3783,23 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 	{
 	  [self _parseUIDVALIDITY: [aData cString]];
 	}
+
+      // * OK [HIGHESTMODSEQ 715194045007] Highest - we get * OK [NOMODSEQ] if the mailbox doesn't support them.
+      // Like for any response code, some text can follow it.
+      if ([aData hasCPrefix: "* OK [HIGHESTMODSEQ "])
+	{
+	  unsigned long long modseq;
+	  const char *bytes;
+	  char *end;
+
+	  bytes = [aData cString]+20;
+	  modseq = strtoull(bytes, &end, 10);
+
+	  if (end != bytes && *end == ']')
+	    {
+	      _selectedFolder.highestModSeq = modseq;
+	    }
+	}
       
       // 3c4d OK [READ-ONLY] Completed
       if ([aData rangeOfCString: "OK [READ-ONLY]"].length)
@@ -2833,6 +3816,18 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 
   if (reconnecting)
     {
+      //
+      // We gave the server the mod-sequence of our cache so it already sent us
+      // what changed since, see -_QRESYNCParametersForFolder:.
+      //
+      if ([[_currentQueueObject.info objectForKey: @"QRESYNC"] boolValue] && _selectedFolder.highestModSeq &&
+	  ((CWIMAPCacheManager *)_selectedFolder.cacheManager).uidValidity == _selectedFolder.uidValidity)
+	{
+	  [_selectedFolder updateCache];
+	  ((CWIMAPCacheManager *)_selectedFolder.cacheManager).highestModSeq = _selectedFolder.highestModSeq;
+	  [_selectedFolder.cacheManager synchronize];
+	}
+
       [self _restoreQueue];
     }
   else
@@ -2844,6 +3839,31 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 }
 
 
+//
+// This method parses a SORT response, like "* SORT 2 84 882". We
+// keep the UIDs, in order, in the current queue object.
+//
+- (void) _parseSORT
+{
+  CWIMAPTokenizer *aTokenizer;
+  NSMutableArray *allUIDs;
+
+  aTokenizer = [[CWIMAPTokenizer alloc] initWithSegments: [NSArray arrayWithObject: [_responsesFromServer lastObject]]];
+  allUIDs = [NSMutableArray array];
+
+  // We skip "*" and "SORT".
+  [aTokenizer nextToken];
+  [aTokenizer nextToken];
+
+  while ([aTokenizer nextToken] == IMAPTokenNumber)
+    {
+      [allUIDs addObject: [NSNumber numberWithUnsignedInteger: (NSUInteger)[aTokenizer tokenNumber]]];
+    }
+
+  [_currentQueueObject.info setObject: allUIDs  forKey: @"UIDs"];
+}
+
+
 //
 //
 //
@@ -2900,6 +3920,125 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 }
 
 
+//
+// This method parses a thread of a THREAD response, from the token
+// following its opening parenthesis to its closing one. The messages
+// listed first are each the child of the one before them. The nested
+// threads that follow, if any, are the children of the last message.
+// A thread starting with nested threads has no message at its root.
+//
+// For example, "(3 6 (4 23)(44 7 96))" gives us 3, whose child is
+// 6, whose children are 4, whose child is 23, and 44, whose child
+// is 7, whose child is 96.
+//
+- (CWContainer *) _containerFromTokenizer: (CWIMAPTokenizer *) theTokenizer
+{
+  CWContainer *aContainer, *firstContainer, *lastContainer, *lastChild;
+  CWIMAPMessage *aMessage;
+  NSUInteger uid;
+
+  firstContainer = lastContainer = lastChild = nil;
+
+  while ([theTokenizer nextToken] != IMAPTokenEnd && [theTokenizer tokenType] != IMAPTokenListEnd)
+    {
+      if ([theTokenizer tokenType] == IMAPTokenNumber)
+	{
+	  uid = (NSUInteger)[theTokenizer tokenNumber];
+	  aMessage = [(CWIMAPCacheManager *)_selectedFolder.cacheManager messageWithUID: uid];
+
+	  //
+	  // The headers of the message might not have been prefetched. We give
+	  // its container a message holding only its UID, which the folder
+	  // doesn't know about.
+	  //
+	  if (!aMessage)
+	    {
+	      aMessage = [[CWIMAPMessage alloc] init];
+	      [aMessage setFolder: _selectedFolder];
+	      [aMessage setUid: uid];
+	    }
+
+	  aContainer = [[CWContainer alloc] init];
+	  aContainer.message = aMessage;
+	  [aMessage setProperty: aContainer  forKey: @"Container"];
+
+	  if (lastContainer)
+	    {
+	      aContainer.parent = lastContainer;
+	      lastContainer.child = aContainer;
+	    }
+	  else
+	    {
+	      firstContainer = aContainer;
+	    }
+
+	  lastContainer = aContainer;
+	}
+      else if ([theTokenizer tokenType] == IMAPTokenListStart)
+	{
+	  if (!lastContainer)
+	    {
+	      firstContainer = lastContainer = [[CWContainer alloc] init];
+	    }
+
+	  aContainer = [self _containerFromTokenizer: theTokenizer];
+
+	  if (!aContainer)
+	    {
+	      continue;
+	    }
+
+	  aContainer.parent = lastContainer;
+
+	  if (lastChild)
+	    {
+	      lastChild.next = aContainer;
+	    }
+	  else
+	    {
+	      lastContainer.child = aContainer;
+	    }
+
+	  lastChild = aContainer;
+	}
+    }
+
+  return firstContainer;
+}
+
+
+//
+// This method parses a THREAD response, like "* THREAD (2)(3 6 (4 23)(44 7 96))".
+// Each thread of the response gives us a root container, which we keep in the
+// current queue object until the command completes.
+//
+- (void) _parseTHREAD
+{
+  CWIMAPTokenizer *aTokenizer;
+  NSMutableArray *allContainers;
+  CWContainer *aContainer;
+
+  aTokenizer = [[CWIMAPTokenizer alloc] initWithSegments: [NSArray arrayWithObject: [_responsesFromServer lastObject]]];
+  allContainers = [NSMutableArray array];
+
+  // We skip "*" and "THREAD".
+  [aTokenizer nextToken];
+  [aTokenizer nextToken];
+
+  while ([aTokenizer nextToken] == IMAPTokenListStart)
+    {
+      aContainer = [self _containerFromTokenizer: aTokenizer];
+
+      if (aContainer)
+	{
+	  [allContainers addObject: aContainer];
+	}
+    }
+
+  [_currentQueueObject.info setObject: allContainers  forKey: @"Containers"];
+}
+
+
 //
 // Example: * OK [UIDVALIDITY 948394385]
 //
@@ -2911,6 +4050,141 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
 }
 
 
+//
+// Examples: * VANISHED 405,407,410:425
+//           * VANISHED (EARLIER) 300:310,405,411
+//
+// With QRESYNC enabled (RFC 7162), the server tells us about expunged
+// messages by UID. We get the EARLIER ones while resynchronizing our
+// cache and the others instead of untagged EXPUNGE responses. They
+// are applied right away, like many EXPUNGE responses would be.
+//
+- (void) _parseVANISHED
+{
+  NSUInteger i, count, expunged, low, high, mid;
+  CWIMAPSequenceSet *theUIDs;
+  CWIMAPTokenizer *aTokenizer;
+  BOOL earlier;
+
+  aTokenizer = [[CWIMAPTokenizer alloc] initWithSegments: [NSArray arrayWithObject: [_responsesFromServer lastObject]]];
+  [_responsesFromServer removeLastObject];
+
+  // Like in _parseEXPUNGE, the folder might have been closed.
+  if (!_selectedFolder || !aTokenizer)
+    {
+      return;
+    }
+
+  // We skip "*", "VANISHED" and the (EARLIER) tag, if any.
+  [aTokenizer nextToken];
+  [aTokenizer nextToken];
+
+  earlier = NO;
+
+  if ([aTokenizer nextToken] == IMAPTokenListStart)
+    {
+      earlier = YES;
+      [aTokenizer skipValue];
+      [aTokenizer nextToken];
+    }
+
+  theUIDs = [[CWIMAPSequenceSet alloc] initWithBytes: [aTokenizer tokenBytes]  length: [aTokenizer tokenLength]];
+
+  count = [_selectedFolder->allMessages count];
+  expunged = [_expungedIndexes count];
+
+  //
+  // We usually get a few UIDs, whose messages are found by bisection.
+  // A VANISHED (EARLIER) response can cover many UIDs we never had,
+  // we then rather go through our messages once.
+  //
+  if ([theUIDs count] < count)
+    {
+      [theUIDs enumerateNumbersUsingBlock: ^(NSUInteger theUID, BOOL *stop) {
+	  NSUInteger index;
+
+	  index = [_selectedFolder indexOfMessageWithUID: theUID];
+
+	  if (index != NSNotFound)
+	    {
+	      [_expungedIndexes addIndex: index];
+	    }
+	}];
+    }
+  else
+    {
+      for (i = 0; i < count; i++)
+	{
+	  if ([theUIDs containsNumber: [[_selectedFolder->allMessages objectAtIndex: i] uid]])
+	    {
+	      [_expungedIndexes addIndex: i];
+	    }
+	}
+    }
+
+  //
+  // Without EARLIER, the server only tells about messages we were told
+  // exist. Those we didn't find are among the ones a windowed prefetch
+  // didn't reach yet, whose UID is still 0. They precede the others and
+  // are alike, so we remove as many of them as we didn't find, the last
+  // ones, like we would from an EXPUNGE response. See -prefetch in CWIMAPFolder.
+  //
+  expunged = [_expungedIndexes count] - expunged;
+
+  if (!earlier && count && expunged < [theUIDs count] && [[_selectedFolder->allMessages objectAtIndex: 0] uid] == 0)
+    {
+      for (low = 0, high = count; low < high; )
+	{
+	  mid = low + (high-low)/2;
+
+	  if ([[_selectedFolder->allMessages objectAtIndex: mid] uid])
+	    {
+	      high = mid;
+	    }
+	  else
+	    {
+	      low = mid+1;
+	    }
+	}
+
+      expunged = MIN([theUIDs count] - expunged, low);
+      [_expungedIndexes addIndexesInRange: NSMakeRange(low - expunged, expunged)];
+    }
+
+  [self _applyExpunges];
+}
+
+
+//
+// This method removes the command that just completed from the
+// queue and from the table of commands in flight. The oldest
+// command still in flight, if any, becomes the current one again.
+//
+- (void) _removeCurrentQueueObject
+{
+  if (!_currentQueueObject)
+    {
+      return;
+    }
+
+  // What's left of its messages, if it was refused, isn't sent.
+  if (_appendStream && [_currentQueueObject.info objectForKey: @"Stream"] == _appendStream)
+    {
+      _appendStream = nil;
+    }
+
+  [_inFlight removeObjectForKey: _currentQueueObject.tag];
+  [_queue removeObjectIdenticalTo: _currentQueueObject];
+
+  _currentQueueObject = ([_inFlight count] ? [_queue lastObject] : nil);
+
+  if (_currentQueueObject)
+    {
+      _lastCommand = _currentQueueObject.command;
+    }
+}
+
+
 //
 //
 //
@@ -2927,4 +4201,84 @@ static inline NSInteger has_literal(char *buf, NSInteger c)
   (void)PERFORM_SELECTOR_1(_delegate, @selector(serviceReconnected:), PantomimeServiceReconnected);
 }
 
+
+//
+// The commands in flight are always the oldest ones of _queue, at
+// its end. We send the oldest queued commands that weren't sent yet
+// for as long as the window allows it and no barrier is in the way.
+//
+// The oldest command in flight is the current one, the untagged
+// responses we receive are attributed to it.
+//
+- (void) _sendQueuedCommands
+{
+  CWIMAPQueueObject *aQueueObject;
+  NSUInteger count, n;
+
+  while ((count = [_queue count]) > (n = [_inFlight count]))
+    {
+      aQueueObject = [_queue objectAtIndex: count-n-1];
+
+      if (n && (!can_pipeline(aQueueObject.command) || !can_pipeline(((CWIMAPQueueObject *)[_queue lastObject]).command)))
+	{
+	  break;
+	}
+
+      //
+      // A STATUS response names its mailbox so it can't be mistaken for
+      // another one. Even with pipelining disabled, we send STATUS commands
+      // following a STATUS command without waiting for their completion.
+      //
+      if (n >= _maxInFlight && (n >= STATUS_WINDOW || aQueueObject.command != IMAP_STATUS ||
+				((CWIMAPQueueObject *)[_queue lastObject]).command != IMAP_STATUS))
+	{
+	  break;
+	}
+
+      [_inFlight setObject: aQueueObject  forKey: aQueueObject.tag];
+
+      if (!n)
+	{
+	  _currentQueueObject = aQueueObject;
+	  _lastCommand = aQueueObject.command;
+	}
+
+      [self _writeQueueObject: aQueueObject];
+    }
+
+  if (![_inFlight count])
+    {
+      _currentQueueObject = nil;
+    }
+}
+
+
+//
+// We queue the tag, the arguments and the CRLF as separate segments
+// and only flush them with the last one, so the whole command line
+// goes out in a single gather write.
+//
+- (void) _writeQueueObject: (CWIMAPQueueObject *) theQueueObject
+{
+  // NSLog(@"Sending |%@|", theQueueObject.arguments);
+  if (IMAP_DONE != theQueueObject.command)
+    {
+      [_wbuf appendData: theQueueObject.tag];
+      [_wbuf appendData: SPACE];
+    }
+  [_wbuf appendData: [theQueueObject.arguments dataUsingEncoding: defaultCStringEncoding]];
+
+  // The messages appended follow the command line, see -updateWrite.
+  if (IMAP_APPEND == theQueueObject.command)
+    {
+      _appendStream = [theQueueObject.info objectForKey: @"Stream"];
+      [_appendStream rewind];
+    }
+
+  [self writeData: CRLF];
+
+  POST_NOTIFICATION(@"PantomimeCommandSent", self, theQueueObject.info);
+  PERFORM_SELECTOR_2(_delegate, @selector(commandSent:), @"PantomimeCommandSent", [NSNumber numberWithInteger: theQueueObject.command], @"Command");
+}
+
 @end
@@ -0,0 +1,163 @@
+/*
+**  CWIMAPTokenizer.h
+**
+**  Copyright (c) 2001-2007
+**
+**  This library is free software; you can redistribute it and/or
+**  modify it under the terms of the GNU Lesser General Public
+**  License as published by the Free Software Foundation; either
+**  version 2.1 of the License, or (at your option) any later version.
+**
+**  This library is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+**  Lesser General Public License for more details.
+**
+**  You should have received a copy of the GNU Lesser General Public
+**  License along with this library; if not, write to the Free Software
+**  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef _Pantomime_H_CWIMAPTokenizer
+#define _Pantomime_H_CWIMAPTokenizer
+
+#import <Foundation/Foundation.h>
+
+/*!
+  @typedef IMAPTokenType
+  @abstract The kind of tokens found in IMAP responses.
+  @constant IMAPTokenEnd There are no more bytes to tokenize.
+  @constant IMAPTokenAtom An atom, like FETCH, NIL or \Seen. A section
+                          and a partial specifier are part of the atom,
+			  like in BODY[HEADER.FIELDS (From To)]<0>.
+  @constant IMAPTokenNumber An atom made only of digits.
+  @constant IMAPTokenString A quoted string. The token bytes exclude the quotes.
+  @constant IMAPTokenLiteral A literal. The token bytes are the literal's data.
+  @constant IMAPTokenListStart The opening parenthesis of a list.
+  @constant IMAPTokenListEnd The closing parenthesis of a list.
+*/
+typedef enum {
+  IMAPTokenEnd = 0,
+  IMAPTokenAtom,
+  IMAPTokenNumber,
+  IMAPTokenString,
+  IMAPTokenLiteral,
+  IMAPTokenListStart,
+  IMAPTokenListEnd
+} IMAPTokenType;
+
+/*!
+  @class CWIMAPTokenizer
+  @discussion This class splits an IMAP response into tokens, working
+              directly on the bytes of the response. Nothing is copied:
+	      the token bytes point inside the NSData instances given
+	      to the tokenizer, which are retained.
+
+	      A response is given as segments: its lines, without their
+	      CRLF, each line ending with a literal specification ({123})
+	      being followed by the literal's data. The end of a line
+	      separates tokens like a space does.
+*/
+@interface CWIMAPTokenizer : NSObject
+
+/*!
+  @method initWithSegments:
+  @discussion This method is used to initialize a tokenizer for the
+              response made of <i>theSegments</i>.
+  @param theSegments An array of NSData instances.
+  @result The instance, nil on error.
+*/
+- (id) initWithSegments: (NSArray *) theSegments;
+
+/*!
+  @method nextToken
+  @discussion This method is used to read the next token.
+  @result The type of the token read.
+*/
+- (IMAPTokenType) nextToken;
+
+/*!
+  @method tokenType
+  @discussion This method is used to obtain the type of the last token read.
+  @result The type of the token.
+*/
+- (IMAPTokenType) tokenType;
+
+/*!
+  @method tokenBytes
+  @discussion This method is used to obtain the bytes of the last token read.
+  @result The bytes, which are not NUL-terminated.
+*/
+- (const char *) tokenBytes;
+
+/*!
+  @method tokenLength
+  @discussion This method is used to obtain the length of the last token read.
+  @result The number of bytes.
+*/
+- (NSUInteger) tokenLength;
+
+/*!
+  @method tokenNumber
+  @discussion This method is used to obtain the value of the last token read
+              if it is a number, or the announced size if it is a literal.
+  @result The value, 0 for other tokens.
+*/
+- (unsigned long long) tokenNumber;
+
+/*!
+  @method tokenString
+  @discussion This method is used to obtain the last token read as a string.
+              Quoted strings are unescaped.
+  @result The string, nil if the token is not an atom, a number, a quoted
+          string or a literal.
+*/
+- (NSString *) tokenString;
+
+/*!
+  @method tokenData
+  @discussion This method is used to obtain the last token read as data.
+              The data of a literal is returned without being copied.
+  @result The data, nil if the token is not an atom, a number, a quoted
+          string or a literal.
+*/
+- (NSData *) tokenData;
+
+/*!
+  @method tokenIsAtom:
+  @discussion This method is used to verify if the last token read is the atom
+              <i>theAtom</i>, ignoring case.
+  @param theAtom The NUL-terminated atom.
+  @result YES if it is, NO otherwise.
+*/
+- (BOOL) tokenIsAtom: (const char *) theAtom;
+
+/*!
+  @method tokenHasPrefix:
+  @discussion This method is used to verify if the last token read is an atom
+              starting with <i>thePrefix</i>, ignoring case.
+  @param thePrefix The NUL-terminated prefix.
+  @result YES if it does, NO otherwise.
+*/
+- (BOOL) tokenHasPrefix: (const char *) thePrefix;
+
+/*!
+  @method skipValue
+  @discussion This method is used to skip the value starting with the last
+              token read. If it is the opening parenthesis of a list, the
+	      whole list is skipped, including nested lists and literals.
+  @result YES on success, NO if the response ended before the value.
+*/
+- (BOOL) skipValue;
+
+/*!
+  @method segmentIndex
+  @discussion This method is used to obtain the index of the segment
+              the tokenizer is reading.
+  @result The index.
+*/
+- (NSUInteger) segmentIndex;
+
+@end
+
+#endif // _Pantomime_H_CWIMAPTokenizer
@@ -0,0 +1,457 @@
+/*
+**  CWIMAPTokenizer.m
+**
+**  Copyright (c) 2001-2007
+**
+**  This library is free software; you can redistribute it and/or
+**  modify it under the terms of the GNU Lesser General Public
+**  License as published by the Free Software Foundation; either
+**  version 2.1 of the License, or (at your option) any later version.
+**
+**  This library is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+**  Lesser General Public License for more details.
+**
+**  You should have received a copy of the GNU Lesser General Public
+**  License along with this library; if not, write to the Free Software
+**  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#import "CWIMAPTokenizer.h"
+
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+
+//
+// We try UTF-8 first since that's what most servers send in
+// quoted strings nowadays, falling back to ISO-8859-1.
+//
+static inline NSString *string_from_bytes(const char *theBytes, NSUInteger theLength)
+{
+  NSString *aString;
+
+  aString = [[NSString alloc] initWithBytes: theBytes  length: theLength  encoding: NSUTF8StringEncoding];
+
+  if (!aString)
+    {
+      aString = [[NSString alloc] initWithBytes: theBytes  length: theLength  encoding: NSISOLatin1StringEncoding];
+    }
+
+  return aString;
+}
+
+//
+// RFC3501 atom-specials, minus the resp-specials ']' since we read
+// sections as part of their atom.
+//
+static inline BOOL is_atom_char(char c)
+{
+  return (c > 0x20 && c < 0x7f && c != '(' && c != ')' && c != '{' && c != '"');
+}
+
+@interface CWIMAPTokenizer ()
+
+- (BOOL) _nextSegment;
+
+@end
+
+@implementation CWIMAPTokenizer
+{
+    NSArray *_segments;
+    NSUInteger _segment;
+    NSData *_data;
+    NSData *_literal;
+
+    const char *_bytes;
+    NSUInteger _length;
+    NSUInteger _position;
+
+    IMAPTokenType _type;
+    const char *_token;
+    NSUInteger _tokenLength;
+    unsigned long long _number;
+}
+
+//
+//
+//
+- (id) initWithSegments: (NSArray *) theSegments
+{
+    self = [super init];
+    if (self)
+    {
+        if (![theSegments count])
+        {
+            return nil;
+        }
+
+        _segments = theSegments;
+        _segment = 0;
+        _data = [_segments objectAtIndex: 0];
+        _bytes = [_data bytes];
+        _length = [_data length];
+        _position = 0;
+        _type = IMAPTokenEnd;
+    }
+    return self;
+}
+
+
+//
+//
+//
+- (IMAPTokenType) nextToken
+{
+    const char *p, *end;
+
+    p = _bytes + _position;
+    end = _bytes + _length;
+
+    while (p < end && *p == ' ')
+    {
+        p++;
+    }
+
+    // Lines are separated like words are.
+    while (p == end && [self _nextSegment])
+    {
+        p = _bytes;
+        end = _bytes + _length;
+
+        while (p < end && *p == ' ')
+        {
+            p++;
+        }
+    }
+
+    _token = p;
+    _tokenLength = 0;
+    _number = 0;
+
+    if (p == end)
+    {
+        _position = _length;
+        return (_type = IMAPTokenEnd);
+    }
+
+    switch (*p)
+    {
+        case '(':
+            _type = IMAPTokenListStart;
+            _tokenLength = 1;
+            p++;
+            break;
+
+        case ')':
+            _type = IMAPTokenListEnd;
+            _tokenLength = 1;
+            p++;
+            break;
+
+        case '"':
+            // We keep the escaped characters as they are, -tokenString unescapes them.
+            _type = IMAPTokenString;
+            _token = ++p;
+
+            while (p < end && *p != '"')
+            {
+                if (*p == '\\' && p+1 < end) p++;
+                p++;
+            }
+
+            _tokenLength = p - _token;
+            if (p < end) p++;
+            break;
+
+        case '{':
+            //
+            // A literal. Its data is the next segment and we continue
+            // with the segment following it.
+            //
+            p++;
+
+            while (p < end && isdigit(*p))
+            {
+                _number = _number * 10 + (*p - '0');
+                p++;
+            }
+
+            _type = IMAPTokenLiteral;
+            _position = _length;
+
+            if ([self _nextSegment])
+            {
+                _literal = _data;
+                _token = _bytes;
+                _tokenLength = _length;
+
+                if (![self _nextSegment])
+                {
+                    _position = _length;
+                }
+            }
+            else
+            {
+                _literal = nil;
+                _token = NULL;
+            }
+
+            return _type;
+
+        default:
+            _type = IMAPTokenNumber;
+
+            while (p < end && is_atom_char(*p))
+            {
+                // A section like [HEADER.FIELDS (From To)] may contain spaces and
+                // parentheses. It can be followed by a partial specifier, <0.100>.
+                if (*p == '[')
+                {
+                    while (p < end && *p != ']') p++;
+                    if (p < end) p++;
+
+                    if (p < end && *p == '<')
+                    {
+                        while (p < end && *p != '>') p++;
+                        if (p < end) p++;
+                    }
+
+                    _type = IMAPTokenAtom;
+                    continue;
+                }
+
+                if (_type == IMAPTokenNumber && isdigit(*p))
+                {
+                    _number = _number * 10 + (*p - '0');
+                }
+                else
+                {
+                    _type = IMAPTokenAtom;
+                }
+
+                p++;
+            }
+
+            _tokenLength = p - _token;
+
+            if (_type == IMAPTokenAtom)
+            {
+                _number = 0;
+            }
+
+            // We got an invalid character, we skip it.
+            if (!_tokenLength)
+            {
+                _type = IMAPTokenAtom;
+                _tokenLength = 1;
+                p++;
+            }
+    }
+
+    _position = p - _bytes;
+
+    return _type;
+}
+
+
+//
+//
+//
+- (IMAPTokenType) tokenType
+{
+    return _type;
+}
+
+
+//
+//
+//
+- (const char *) tokenBytes
+{
+    return _token;
+}
+
+
+//
+//
+//
+- (NSUInteger) tokenLength
+{
+    return _tokenLength;
+}
+
+
+//
+//
+//
+- (unsigned long long) tokenNumber
+{
+    return _number;
+}
+
+
+//
+//
+//
+- (NSString *) tokenString
+{
+    NSMutableString *aMutableString;
+    NSUInteger i, start;
+
+    switch (_type)
+    {
+        case IMAPTokenAtom:
+        case IMAPTokenNumber:
+        case IMAPTokenLiteral:
+            if (!_token) return @"";
+            return string_from_bytes(_token, _tokenLength);
+
+        case IMAPTokenString:
+            if (!memchr(_token, '\\', _tokenLength))
+            {
+                return string_from_bytes(_token, _tokenLength);
+            }
+
+            aMutableString = [NSMutableString stringWithCapacity: _tokenLength];
+
+            for (i = start = 0; i < _tokenLength; i++)
+            {
+                if (_token[i] == '\\' && i+1 < _tokenLength)
+                {
+                    [aMutableString appendString: string_from_bytes(_token+start, i-start)];
+                    start = ++i;
+                }
+            }
+
+            [aMutableString appendString: string_from_bytes(_token+start, _tokenLength-start)];
+            return aMutableString;
+
+        default:
+            return nil;
+    }
+}
+
+
+//
+//
+//
+- (NSData *) tokenData
+{
+    switch (_type)
+    {
+        case IMAPTokenLiteral:
+            return (_literal ? _literal : [NSData data]);
+
+        case IMAPTokenAtom:
+        case IMAPTokenNumber:
+        case IMAPTokenString:
+            return [NSData dataWithBytes: _token  length: _tokenLength];
+
+        default:
+            return nil;
+    }
+}
+
+
+//
+//
+//
+- (BOOL) tokenIsAtom: (const char *) theAtom
+{
+    size_t len;
+
+    len = strlen(theAtom);
+
+    return ((_type == IMAPTokenAtom || _type == IMAPTokenNumber) &&
+            _tokenLength == len && strncasecmp(_token, theAtom, len) == 0);
+}
+
+
+//
+//
+//
+- (BOOL) tokenHasPrefix: (const char *) thePrefix
+{
+    size_t len;
+
+    len = strlen(thePrefix);
+
+    return ((_type == IMAPTokenAtom || _type == IMAPTokenNumber) &&
+            _tokenLength >= len && strncasecmp(_token, thePrefix, len) == 0);
+}
+
+
+//
+//
+//
+- (BOOL) skipValue
+{
+    NSUInteger depth;
+
+    if (_type == IMAPTokenEnd)
+    {
+        return NO;
+    }
+
+    if (_type != IMAPTokenListStart)
+    {
+        return YES;
+    }
+
+    depth = 1;
+
+    while (depth)
+    {
+        switch ([self nextToken])
+        {
+            case IMAPTokenEnd:
+                return NO;
+
+            case IMAPTokenListStart:
+                depth++;
+                break;
+
+            case IMAPTokenListEnd:
+                depth--;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    return YES;
+}
+
+
+//
+//
+//
+- (NSUInteger) segmentIndex
+{
+    return _segment;
+}
+
+
+//
+//
+//
+- (BOOL) _nextSegment
+{
+    if (_segment+1 >= [_segments count])
+    {
+        return NO;
+    }
+
+    _segment++;
+    _data = [_segments objectAtIndex: _segment];
+    _bytes = [_data bytes];
+    _length = [_data length];
+    _position = 0;
+
+    return YES;
+}
+
+@end
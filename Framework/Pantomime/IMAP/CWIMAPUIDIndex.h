@@ -0,0 +1,87 @@
+/*
+**  CWIMAPUIDIndex.h
+**
+**  Copyright (c) 2001-2007
+**
+**  This library is free software; you can redistribute it and/or
+**  modify it under the terms of the GNU Lesser General Public
+**  License as published by the Free Software Foundation; either
+**  version 2.1 of the License, or (at your option) any later version.
+**
+**  This library is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+**  Lesser General Public License for more details.
+**
+**  You should have received a copy of the GNU Lesser General Public
+**  License along with this library; if not, write to the Free Software
+**  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef _Pantomime_H_CWIMAPUIDIndex
+#define _Pantomime_H_CWIMAPUIDIndex
+
+#import <Foundation/Foundation.h>
+
+/*!
+  @class CWIMAPUIDIndex
+  @discussion This class maps UIDs to objects, usually CWIMAPMessage
+              instances. It is an open addressing hash table keyed
+	      directly by the UIDs, so looking up a message neither
+	      allocates nor hashes a key object. The objects are retained.
+	      UID 0, which is never a valid UID, can't be used as a key.
+*/
+@interface CWIMAPUIDIndex : NSObject
+
+/*!
+  @method initWithCapacity:
+  @discussion This method is used to initialize an index able to
+              hold <i>theCapacity</i> objects without growing.
+  @param theCapacity The number of objects.
+  @result The instance.
+*/
+- (id) initWithCapacity: (NSUInteger) theCapacity;
+
+/*!
+  @method count
+  @discussion This method is used to obtain the number of objects
+              in the receiver.
+  @result The count.
+*/
+- (NSUInteger) count;
+
+/*!
+  @method objectForUID:
+  @discussion This method is used to obtain the object associated
+              with <i>theUID</i>.
+  @param theUID The UID.
+  @result The object, nil if there's none.
+*/
+- (id) objectForUID: (NSUInteger) theUID;
+
+/*!
+  @method setObject: forUID:
+  @discussion This method is used to associate <i>theObject</i> with
+              <i>theUID</i>, replacing the object it was associated with.
+  @param theObject The object, nil to remove the association.
+  @param theUID The UID.
+*/
+- (void) setObject: (id) theObject  forUID: (NSUInteger) theUID;
+
+/*!
+  @method removeObjectForUID:
+  @discussion This method is used to remove the object associated
+              with <i>theUID</i>, if any.
+  @param theUID The UID.
+*/
+- (void) removeObjectForUID: (NSUInteger) theUID;
+
+/*!
+  @method removeAllObjects
+  @discussion This method is used to empty the receiver.
+*/
+- (void) removeAllObjects;
+
+@end
+
+#endif // _Pantomime_H_CWIMAPUIDIndex
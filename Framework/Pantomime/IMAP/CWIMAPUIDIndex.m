@@ -0,0 +1,268 @@
+/*
+**  CWIMAPUIDIndex.m
+**
+**  Copyright (c) 2001-2007
+**
+**  This library is free software; you can redistribute it and/or
+**  modify it under the terms of the GNU Lesser General Public
+**  License as published by the Free Software Foundation; either
+**  version 2.1 of the License, or (at your option) any later version.
+**
+**  This library is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+**  Lesser General Public License for more details.
+**
+**  You should have received a copy of the GNU Lesser General Public
+**  License along with this library; if not, write to the Free Software
+**  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#import "CWIMAPUIDIndex.h"
+
+#include <stdlib.h>
+
+//
+// The table is kept at most half full so that probe sequences
+// stay short. Its size is always a power of two.
+//
+#define MIN_SIZE 64
+
+//
+// This C function is used to obtain the slot a UID hashes to. UIDs
+// are mostly consecutive, Fibonacci hashing spreads them evenly.
+//
+static inline NSUInteger slot_for_uid(NSUInteger theUID, NSUInteger theMask)
+{
+    return (NSUInteger)(((unsigned long long)theUID * 11400714819323198485ULL) >> 32) & theMask;
+}
+
+@interface CWIMAPUIDIndex ()
+
+- (void) _resize: (NSUInteger) theSize;
+
+@end
+
+@implementation CWIMAPUIDIndex
+{
+    NSUInteger *_keys;
+    __strong id *_objects;
+    NSUInteger _size;
+    NSUInteger _count;
+}
+
+//
+//
+//
+- (id) init
+{
+    return [self initWithCapacity: 0];
+}
+
+
+//
+//
+//
+- (id) initWithCapacity: (NSUInteger) theCapacity
+{
+    self = [super init];
+    if (self)
+    {
+        NSUInteger size;
+
+        for (size = MIN_SIZE; size < theCapacity*2; size *= 2);
+
+        _count = 0;
+        _size = 0;
+        [self _resize: size];
+    }
+    return self;
+}
+
+
+//
+//
+//
+- (void) dealloc
+{
+    NSUInteger i;
+
+    // The objects must be released before their memory is freed.
+    for (i = 0; i < _size; i++)
+    {
+        _objects[i] = nil;
+    }
+
+    free(_objects);
+    free(_keys);
+}
+
+
+//
+//
+//
+- (NSUInteger) count
+{
+    return _count;
+}
+
+
+//
+//
+//
+- (id) objectForUID: (NSUInteger) theUID
+{
+    NSUInteger i, mask;
+
+    if (!theUID)
+    {
+        return nil;
+    }
+
+    mask = _size-1;
+
+    for (i = slot_for_uid(theUID, mask); _keys[i]; i = (i+1) & mask)
+    {
+        if (_keys[i] == theUID)
+        {
+            return _objects[i];
+        }
+    }
+
+    return nil;
+}
+
+
+//
+//
+//
+- (void) setObject: (id) theObject  forUID: (NSUInteger) theUID
+{
+    NSUInteger i, mask;
+
+    if (!theUID)
+    {
+        return;
+    }
+
+    if (!theObject)
+    {
+        [self removeObjectForUID: theUID];
+        return;
+    }
+
+    if ((_count+1)*2 > _size)
+    {
+        [self _resize: _size*2];
+    }
+
+    mask = _size-1;
+
+    for (i = slot_for_uid(theUID, mask); _keys[i]; i = (i+1) & mask)
+    {
+        if (_keys[i] == theUID)
+        {
+            _objects[i] = theObject;
+            return;
+        }
+    }
+
+    _keys[i] = theUID;
+    _objects[i] = theObject;
+    _count++;
+}
+
+
+//
+// We don't leave tombstones behind: the entries following the removed
+// one in its probe sequence are moved back if it's where they belong.
+//
+- (void) removeObjectForUID: (NSUInteger) theUID
+{
+    NSUInteger i, j, k, mask;
+
+    if (!theUID)
+    {
+        return;
+    }
+
+    mask = _size-1;
+
+    for (i = slot_for_uid(theUID, mask); _keys[i] != theUID; i = (i+1) & mask)
+    {
+        if (!_keys[i])
+        {
+            return;
+        }
+    }
+
+    for (j = (i+1) & mask; _keys[j]; j = (j+1) & mask)
+    {
+        k = slot_for_uid(_keys[j], mask);
+
+        // The entry at j can fill the hole at i if its slot k isn't in (i, j].
+        if ((i <= j) ? (k <= i || k > j) : (k <= i && k > j))
+        {
+            _keys[i] = _keys[j];
+            _objects[i] = _objects[j];
+            i = j;
+        }
+    }
+
+    _keys[i] = 0;
+    _objects[i] = nil;
+    _count--;
+}
+
+
+//
+//
+//
+- (void) removeAllObjects
+{
+    NSUInteger i;
+
+    for (i = 0; i < _size; i++)
+    {
+        _keys[i] = 0;
+        _objects[i] = nil;
+    }
+
+    _count = 0;
+}
+
+
+//
+//
+//
+- (void) _resize: (NSUInteger) theSize
+{
+    NSUInteger *oldKeys, oldSize, i, j, mask;
+    __strong id *oldObjects;
+
+    oldKeys = _keys;
+    oldObjects = _objects;
+    oldSize = _size;
+
+    _keys = (NSUInteger *)calloc(theSize, sizeof(NSUInteger));
+    _objects = (__strong id *)calloc(theSize, sizeof(id));
+    _size = theSize;
+    mask = _size-1;
+
+    for (i = 0; i < oldSize; i++)
+    {
+        if (oldKeys[i])
+        {
+            for (j = slot_for_uid(oldKeys[i], mask); _keys[j]; j = (j+1) & mask);
+
+            _keys[j] = oldKeys[i];
+            _objects[j] = oldObjects[i];
+            oldObjects[i] = nil;
+        }
+    }
+
+    free(oldObjects);
+    free(oldKeys);
+}
+
+@end
@@ -22,6 +22,7 @@
 
 #import "CWCacheManager.h"
 
+@class CWCacheWriter;
 @class CWFolder;
 @class CWLocalMessage;
 @class NSDate;
@@ -41,6 +42,7 @@
     NSUInteger _modification_date;
     NSUInteger _size;
     NSInteger _fd;
+    CWCacheWriter *_writer;
 }
 
 @property (readonly) NSUInteger count;
@@ -86,6 +88,8 @@
 /*!
   @method writeRecord:
   @discussion This method is used to write a cache record to disk.
+              Records are written in batches, see CWCacheWriter. A
+	      batch is written once it's large enough or by -synchronize.
   @param theRecord The record to write.
 */
 - (void) writeRecord: (CWCacheRecord *) theRecord;
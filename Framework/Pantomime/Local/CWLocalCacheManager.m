@@ -30,8 +30,13 @@
 #import "CWLocalMessage.h"
 #import "CWParser.h"
 #import "CWCacheRecord.h"
+#import "CWCacheWriter.h"
 #import "NSData+CWExtensions.h"
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 static unsigned short version = 1;
 
 //
@@ -53,6 +58,12 @@ static unsigned short version = 1;
 // 16+     4      Size
 //
 //
+@interface CWLocalCacheManager ()
+
+- (BOOL) _flushRecords;
+
+@end
+
 @implementation CWLocalCacheManager
 
 //
@@ -65,6 +76,7 @@ static unsigned short version = 1;
     {
         NSDictionary *attributes;
         NSUInteger d, s, c;
+        unsigned int header[3];
         unsigned short int v;
         BOOL broken;
         
@@ -103,10 +115,8 @@ static unsigned short version = 1;
         {
             NSUInteger i;
             
-            v = read_unsigned_short(_fd);
-            
-            // HACK: We IGNORE all the previous cache.
-            if (v != version)
+            // HACK: We IGNORE all the previous cache, like a damaged one.
+            if (read_unsigned_short(_fd, &v) < 0 || v != version)
             {
                 //NSLog(@"Ignoring the old cache format.");
                 ftruncate(_fd, 0);
@@ -114,12 +124,21 @@ static unsigned short version = 1;
                 return self;
             }
             
-            _count = read_unsigned_int(_fd);
-            _modification_date = read_unsigned_int(_fd);
+            // A header we can't read is that of a broken cache.
+            memset(header, 0, sizeof(header));
+            
+            if (read_unsigned_int(_fd, &header[0]) < 0 || read_unsigned_int(_fd, &header[1]) < 0 ||
+                ([(CWLocalFolder *)_folder type] == PantomimeFormatMbox && read_unsigned_int(_fd, &header[2]) < 0))
+            {
+                broken = YES;
+            }
+            
+            _count = header[0];
+            _modification_date = header[1];
             
             if ([(CWLocalFolder *)_folder type] == PantomimeFormatMbox)
             {
-                _size = read_unsigned_int(_fd);
+                _size = header[2];
                 
                 if (s != _size || d != _modification_date) broken = YES;
             }
@@ -163,6 +182,8 @@ static unsigned short version = 1;
 {
   //NSLog(@"CWLocalCacheManager: -dealloc");
   
+  [self _flushRecords];
+  
   if (_fd >= 0) close(_fd);
 
 }
@@ -179,6 +200,7 @@ static unsigned short version = 1;
   CWFlags *theFlags;
   
   unsigned short int len, tot = 0;
+  unsigned int record_length;
   unsigned char *r, *s;
   NSInteger begin, end, i;
   BOOL b;
@@ -186,10 +208,10 @@ static unsigned short version = 1;
   begin = (NSNotFound != theRange.location) ? theRange.location : 0;
   end = (NSMaxRange(theRange) <= _count ? NSMaxRange(theRange) : _count);
 
-  if (lseek(_fd, ([(CWLocalFolder *)_folder type] == PantomimeFormatMbox) ? 14L : 10L, SEEK_SET) < 0)
+  if (![self _flushRecords] || lseek(_fd, ([(CWLocalFolder *)_folder type] == PantomimeFormatMbox) ? 14L : 10L, SEEK_SET) < 0)
     {
       NSLog(@"lseek failed in initInRange:");
-      abort();
+      return;
     }
   
   //NSLog(@"init from %d to %d, count = %d, size of char %d", begin, end, _count, sizeof(char));
@@ -212,11 +234,21 @@ static unsigned short version = 1;
       // With 'static' buffer: .839 (not worth it)
 
       // We parse the record length, date, flags, position in file and the size.
-      len = read_unsigned_int(_fd);
+      if (read_unsigned_int(_fd, &record_length) < 0 || record_length < 4)
+	{
+	  NSLog(@"read failed in initInRange:");
+	  break;
+	}
 
-      r = (unsigned char *)malloc(len-4);
+      record_length -= 4;
+      r = (unsigned char *)malloc(record_length);
       
-      if (read(_fd, r, len-4) < 0) { NSLog(@"read failed"); abort(); }
+      if (read_block(_fd, r, record_length) != (ssize_t)record_length)
+	{
+	  NSLog(@"read failed in initInRange:");
+	  free(r);
+	  break;
+	}
 
       theFlags = [[CWFlags alloc] initWithFlags: read_unsigned_int_memory(r)];
       [aMessage setReceivedDate: [NSCalendarDate dateWithTimeIntervalSince1970: read_unsigned_int_memory(r+4)]];
@@ -253,47 +285,11 @@ static unsigned short version = 1;
       // changed since the last time this method was called.
       [aMessage setFlags: theFlags];
 
-      // .209ms
-      read_string_memory(r+tot, s, &len);
-      [CWParser parseFrom: [NSData dataWithBytes: s  length: len]  inMessage: aMessage  quick: YES];
-      tot += len+2;
-     
-      // .462ms (+253ms), .217ms
-      read_string_memory(r+tot, s, &len);
-      [CWParser parseInReplyTo: [NSData dataWithBytes: s  length: len]  inMessage: aMessage  quick: YES];
-      tot += len+2;
-      
-      // .468ms (+4ms)
-      read_string_memory(r+tot, s, &len);
-      [CWParser parseMessageID: [NSData dataWithBytes: s  length: len]  inMessage: aMessage  quick: YES];
-      tot += len+2;
-
-      // .560ms (+92ms)
-      read_string_memory(r+tot, s, &len);
-      [CWParser parseReferences: [NSData dataWithBytes: s  length: len]  inMessage: aMessage  quick: YES];
-      tot += len+2;
-
-      // .731ms (+171ms), .135ms
-      read_string_memory(r+tot, s, &len);
-      [CWParser parseSubject:  [NSData dataWithBytes: s  length: len]  inMessage: aMessage  quick: YES];
-      tot += len+2;
-      
-      // .823ms (+92ms), .80ms
-      read_string_memory(r+tot, s, &len);
-      [CWParser parseDestination: [NSData dataWithBytes: s  length: len]
-		forType: PantomimeToRecipient
-		inMessage: aMessage
-		quick: YES];
-      tot += len+2;
-      
-      // .948ms (+125 to +163ms)
-      read_string_memory(r+tot, s, &len);
-      [CWParser parseDestination: [NSData dataWithBytes: s  length: len]
-		forType: PantomimeCcRecipient
-		inMessage: aMessage
-		quick: YES];
-
-      free(r);
+      // The headers are parsed from the record when they are first
+      // accessed, the message keeps it without copying it.
+      [aMessage setCachedRecord: [NSData dataWithBytesNoCopy: r  length: record_length  freeWhenDone: YES]
+		offset: tot];
+      [aMessage setCachedHeaders: PantomimeCachedAllHeaders];
     }
 
   free(s);
@@ -326,78 +322,124 @@ static unsigned short version = 1;
 }
 
 //
-//
+// The flags of the records are updated in place, through mmap(), so
+// that the pages holding them are the only ones written back. If the
+// records don't match the header, the cache is dropped and it's
+// rebuilt from the mailbox when opened.
 //
 - (BOOL) synchronize
 {
     NSDictionary *attributes;
     CWLocalMessage *aMessage;
-    NSUInteger len, flags;
+    unsigned char header[14], *m, *r, *end;
+    NSUInteger len, header_size;
+    struct stat st;
     NSInteger i;
+    BOOL result;
+    
+    if (![self _flushRecords])
+    {
+        return NO;
+    }
     
     if ([(CWLocalFolder *)_folder type] == PantomimeFormatMbox)
     {
         attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:[(CWLocalFolder *)_folder path] error:NULL];
+        header_size = 14;
     }
     else
     {
         attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:[NSString stringWithFormat: @"%@/cur", [(CWLocalFolder *)_folder path]] error:NULL];
+        header_size = 10;
     }
     
     _modification_date = [[attributes objectForKey: NSFileModificationDate] timeIntervalSince1970];
     _count = [_folder->allMessages count];
     
-    if (lseek(_fd, 0L, SEEK_SET) < 0)
-    {
-        NSLog(@"fseek failed");
-    }
-    
     // We write our cache version, count, modification date and size.
-    write_unsigned_short(_fd, version);
-    write_unsigned_int(_fd, _count);
-    write_unsigned_int(_fd, _modification_date);
+    write_unsigned_short_memory(header, version);
+    write_unsigned_int_memory(header+2, _count);
+    write_unsigned_int_memory(header+6, _modification_date);
     
     if ([(CWLocalFolder *)_folder type] == PantomimeFormatMbox)
     {
         _size = [[attributes objectForKey: NSFileSize] integerValue];
-        write_unsigned_int(_fd, _size);
+        write_unsigned_int_memory(header+10, _size);
+    }
+    
+    if (pwrite(_fd, header, header_size, 0) != (ssize_t)header_size || fstat(_fd, &st) < 0)
+    {
+        NSLog(@"UNABLE TO WRITE THE CACHE HEADER");
+        return NO;
     }
     
     // We now update the message flags
     //NSLog(@"Synching flags for mailbox %@, count = %d", [(CWLocalFolder *)_folder path], _count);
-    for (i = 0; i < _count; i++)
+    result = YES;
+    
+    if (_count)
     {
-        len = read_unsigned_int(_fd);
-        //NSLog(@"len = %d", len);
+        m = (unsigned char *)mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, _fd, 0);
         
-        if ((NSNull *)(aMessage = [_folder->allMessages objectAtIndex: i]) != [NSNull null])
+        if (m == MAP_FAILED)
         {
-            flags = aMessage.flags.flags;
-            write_unsigned_int(_fd, flags);
-            lseek(_fd, (len-8), SEEK_CUR);
-            //NSLog(@"wrote = %d", flags);
+            NSLog(@"mmap failed in synchronize");
+            return NO;
         }
-        else
+        
+        end = m + st.st_size;
+        
+        for (r = m + header_size, i = 0; i < _count; i++, r += len)
         {
-            lseek(_fd, (len-4), SEEK_CUR);
+            len = (r + 8 <= end ? read_unsigned_int_memory(r) : 0);
+            
+            if (len < 8 || len > (NSUInteger)(end - r))
+            {
+                result = NO;
+                break;
+            }
+            
+            // Only the pages holding flags that changed get dirty.
+            if ((NSNull *)(aMessage = [_folder->allMessages objectAtIndex: i]) != [NSNull null] &&
+                read_unsigned_int_memory(r+4) != (unsigned int)aMessage.flags.flags)
+            {
+                write_unsigned_int_memory(r+4, aMessage.flags.flags);
+            }
         }
+        
+        result = (result && msync(m, st.st_size, MS_SYNC) == 0);
+        munmap(m, st.st_size);
     }
     //NSLog(@"Done!");
     
+    if (!result)
+    {
+        NSLog(@"UNABLE TO UPDATE THE CACHE RECORDS");
+        ftruncate(_fd, 0);
+        return NO;
+    }
+    
     return (fsync(_fd) == 0);
 }
 
 //
-//
+// The record is added to the batch being written, which is
+// flushed once it's large enough or by -synchronize.
 //
 - (void) writeRecord: (CWCacheRecord *) theRecord
 {
     NSUInteger len;
+    off_t offset;
     
-    if (lseek(_fd, 0L, SEEK_END) < 0)
+    if (!_writer)
     {
-        NSLog(@"COULD NOT LSEEK TO END OF FILE");
-        abort();
+        if ((offset = lseek(_fd, 0L, SEEK_END)) < 0)
+        {
+            NSLog(@"COULD NOT LSEEK TO END OF FILE");
+            return;
+        }
+        
+        _writer = [[CWCacheWriter alloc] initWithFileDescriptor: _fd  offset: offset];
     }
     
     // We calculate the length of this record (including the
@@ -423,33 +465,38 @@ static unsigned short version = 1;
     }
     
     // We write the length of our entry
-    write_unsigned_int(_fd, len);
+    [_writer appendUnsignedInt: len];
     
     // We write the flags, date, position and the size of the message.
-    write_unsigned_int(_fd, theRecord.flags);
-    write_unsigned_int(_fd, theRecord.date);
+    [_writer appendUnsignedInt: theRecord.flags];
+    [_writer appendUnsignedInt: theRecord.date];
     
     if ([(CWLocalFolder *)_folder type] == PantomimeFormatMbox)
     {
-        write_unsigned_int(_fd, theRecord.position);
+        [_writer appendUnsignedInt: theRecord.position];
     }
     else
     {
-        write_string(_fd, (unsigned char *)theRecord.filename, strlen(theRecord.filename));
+        [_writer appendString: theRecord.filename  length: strlen(theRecord.filename)];
     }
     
-    write_unsigned_int(_fd, theRecord.size);
+    [_writer appendUnsignedInt: theRecord.size];
     
     // We write the read of our cached headers (From, In-Reply-To, Message-ID, References, Subject and To)
-    write_string(_fd, (unsigned char *)[theRecord.from bytes], [theRecord.from length]);
-    write_string(_fd, (unsigned char *)[theRecord.in_reply_to bytes], [theRecord.in_reply_to length]);
-    write_string(_fd, (unsigned char *)[theRecord.message_id bytes], [theRecord.message_id length]);
-    write_string(_fd, (unsigned char *)[theRecord.references bytes], [theRecord.references length]);
-    write_string(_fd, (unsigned char *)[theRecord.subject bytes], [theRecord.subject length]);
-    write_string(_fd, (unsigned char *)[theRecord.to bytes], [theRecord.to length]);
-    write_string(_fd, (unsigned char *)[theRecord.cc bytes], [theRecord.cc length]);
+    [_writer appendString: [theRecord.from bytes]  length: [theRecord.from length]];
+    [_writer appendString: [theRecord.in_reply_to bytes]  length: [theRecord.in_reply_to length]];
+    [_writer appendString: [theRecord.message_id bytes]  length: [theRecord.message_id length]];
+    [_writer appendString: [theRecord.references bytes]  length: [theRecord.references length]];
+    [_writer appendString: [theRecord.subject bytes]  length: [theRecord.subject length]];
+    [_writer appendString: [theRecord.to bytes]  length: [theRecord.to length]];
+    [_writer appendString: [theRecord.cc bytes]  length: [theRecord.cc length]];
     
     _count++;
+    
+    if ([_writer isFull])
+    {
+        [self _flushRecords];
+    }
 }
 
 
@@ -460,161 +507,171 @@ static unsigned short version = 1;
 // on disk but BEFORE we actually removed the deleted
 // messages from the allMessages ivar.
 //
+// The records that are kept are written to a new file, a record at
+// a time, which replaces the cache once complete. If we fail, the old
+// cache no longer matches the mailbox and is dropped when opened.
 //
 - (void) expunge
 {
     NSDictionary *attributes;
     CWLocalMessage *aMessage;
+    NSString *aPath;
     
-    NSUInteger cache_size, flags, i, len, total_deleted, total_length, type, v;
-    short delta;
-    char *buf;
+    unsigned char header[14], *buf;
+    NSUInteger count, header_size, i, len, old_len, s_len, size, type;
+    unsigned int record_length;
+    const char *filename;
+    NSInteger fd;
+    BOOL result;
     
     //NSLog(@"rewriting cache");
     
-    // We get the current cache size
-    cache_size = lseek(_fd, 0L, SEEK_END);
+    type = [(CWLocalFolder *)_folder type];
+    header_size = (type == PantomimeFormatMbox ? 14 : 10);
+    aPath = [[self path] stringByAppendingPathExtension: @"new"];
     
-    if (lseek(_fd, ([(CWLocalFolder *)_folder type] == PantomimeFormatMbox) ? 14L : 10L, SEEK_SET) < 0)
+    if (![self _flushRecords] || lseek(_fd, header_size, SEEK_SET) < 0 ||
+        (fd = open([aPath UTF8String], O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR)) < 0)
     {
-        NSLog(@"fseek failed");
-        abort();
+        NSLog(@"UNABLE TO CREATE THE NEW CACHE");
+        return;
     }
     
-    total_deleted = total_length = 0;
-    type = [(CWLocalFolder *)_folder type];
+    // The header is written last, once we know the count.
+    result = (lseek(fd, header_size, SEEK_SET) >= 0);
+    buf = NULL;
+    size = 0;
     
-    //
-    // We alloc a little bit more memory that we really need in
-    // case we have to rewrite the filename for a maildir cache
-    // and the filename length is greater than the previous one.
-    //
-    buf = (char *)malloc(cache_size+[_folder count]*10);
-    _count = [_folder->allMessages count];
-    
-    for (i = 0; i < _count; i++)
+    for (count = 0, i = 0; result && i < [_folder->allMessages count]; i++)
     {
-        len = read_unsigned_int(_fd);
+        // A damaged record ends the rewriting, the new cache is then dropped.
+        if (read_unsigned_int(_fd, &record_length) < 0 || record_length < 4)
+        {
+            result = NO;
+            break;
+        }
+        
+        len = record_length;
         aMessage = [_folder->allMessages objectAtIndex: i];
-        flags = aMessage.flags.flags;
-        delta = 0;
         
-        if ((flags&PantomimeDeleted) == PantomimeDeleted)
+        if ((aMessage.flags.flags&PantomimeDeleted) == PantomimeDeleted)
         {
             // We skip over that record
-            lseek(_fd, len-4, SEEK_CUR);
-            total_deleted++;
-            //NSLog(@"Skip %d bytes, index %d!", len, i);
+            result = (lseek(_fd, len-4, SEEK_CUR) >= 0);
+            continue;
+        }
+        
+        //
+        // For maildir-based caches, we must update the filename of our
+        // cache entries in case flags were flushed to the disk. We make
+        // room for the longest one.
+        //
+        filename = (type == PantomimeFormatMbox ? NULL : [[aMessage mailFilename] UTF8String]);
+        s_len = (filename ? strlen(filename) : 0);
+        
+        if (len+s_len > size)
+        {
+            size = len+s_len;
+            buf = (unsigned char *)realloc(buf, size);
+        }
+        
+        //
+        // For mbox-based caches, we must update the file position of
+        // our cache entries and also the size of the message in the cache.
+        //
+        if (type == PantomimeFormatMbox)
+        {
+            // We read the rest of the record into memory and
+            // overwrite the position and size it holds.
+            result = (read_block(_fd, buf+4, len-4) == (ssize_t)(len-4));
+            write_unsigned_int_memory(buf+12, [aMessage filePosition]);
+            write_unsigned_int_memory(buf+16, [aMessage size]);
         }
         else
         {
-            //
-            // For mbox-based caches, we must update the file position of
-            // our cache entries and also the size of the message in the cache.
-            //
-            if (type == PantomimeFormatMbox)
-            {
-                // We write the rest of the record into the memory
-                if (read(_fd, (buf+total_length+4), len-4) < 0) { NSLog(@"read failed"); abort(); }
-                
-                // We update the position in the mailbox file by
-                // overwriting the current value in memory
-                v = htonl([aMessage filePosition]);
-                memcpy((buf+total_length+12), (char *)&v, 4);
-                //NSLog(@"Wrote file position %d", ntohl(v));
-                
-                // We update the size of the message by overwriting
-                // the current value in memory
-                v = htonl([aMessage size]);
-                memcpy((buf+total_length+16), (char *)&v, 4);
-                //NSLog(@"Wrote message size %d", ntohl(v));
-            }
-            //
-            // For maildir-based caches, we must update the filename of our
-            // cache entries in case flags were flushed to the disk.
-            //
-            else
-            {
-                unsigned short c0, c1, old_len, r;
-                char *filename;
-                NSInteger s_len;
-                
-                // We read our Flags, Date, and the first two bytes
-                // of our filename into memory.
-                if (read(_fd, (buf+total_length+4), 10) < 0) { NSLog(@"read failed"); abort(); }
-                
-                // We read the length of our previous string
-                c0 = *(buf+total_length+12);
-                c1 = *(buf+total_length+13);
-                old_len = ntohs((c1<<8)|c0);
-                
-                //NSLog(@"Previous length = %d  Filename = |%@|", old_len, [aMessage mailFilename]);
-                filename = (char *)[[aMessage mailFilename] UTF8String];
-                s_len = strlen(filename);
-                delta = s_len-old_len;
-                
-                //if (delta != 0) NSLog(@"i = %d  delta = %d |%@| s_len = %d", i, delta, [aMessage mailFilename], s_len);
-                
-                // We write back our filename
-                r = htons(s_len);
-                memcpy((buf+total_length+12), (char *)&r, 2);
-                memcpy((buf+total_length+14), filename, s_len);
-                
-                // We read the rest in our memory. We first skip or old filename string.
-                if (lseek(_fd, old_len, SEEK_CUR) < 0) { NSLog(@"lseek failed"); abort(); }
-                //NSLog(@"must read back into memory %d bytes", len-old_len-14);
-                if (read(_fd, (buf+total_length+s_len+14), len-old_len-14) < 0) { NSLog(@"read failed"); abort(); }
-                //NSLog(@"current file pos after full read %d", lseek(_fd, 0L, SEEK_CUR));
-            }
+            // We read our Flags, Date, and the length of our previous filename.
+            result = (read_block(_fd, buf+4, 10) == 10);
+            old_len = read_unsigned_short_memory(buf+12);
             
-            // We write back our record length, adjusting its size if we need
-            // to, in the case we are handling a maildir-based cache.
-            len += delta;
-            v = htonl(len);
-            memcpy((buf+total_length), (char *)&v, 4);
+            //NSLog(@"Previous length = %d  Filename = |%@|", old_len, [aMessage mailFilename]);
+            write_unsigned_short_memory(buf+12, s_len);
+            memcpy(buf+14, filename, s_len);
             
-            total_length += len;
-            //NSLog(@"_size = %d  total_length = %d", _size, total_length);
+            // We read the rest in our memory, skipping our old filename string.
+            result = (result && lseek(_fd, old_len, SEEK_CUR) >= 0 &&
+                      read_block(_fd, buf+14+s_len, len-old_len-14) == (ssize_t)(len-old_len-14));
+            len = len-old_len+s_len;
         }
+        
+        // We write back our record length, adjusting its size if we need
+        // to, in the case we are handling a maildir-based cache.
+        write_unsigned_int_memory(buf, len);
+        result = (result && write_block(fd, buf, len) >= 0);
+        count++;
     }
     
-    if (lseek(_fd, 0L, SEEK_SET) < 0)
-    {
-        NSLog(@"fseek failed");
-    }
+    free(buf);
     
     // We write our cache version, count, modification date our new size
-    cache_size = total_length+([(CWLocalFolder *)_folder type] == PantomimeFormatMbox ? 14 : 10);
-    _count -= total_deleted;
-    
-    write_unsigned_short(_fd, version);
-    write_unsigned_int(_fd, _count);
-    
-    if ([(CWLocalFolder *)_folder type] == PantomimeFormatMbox)
+    if (type == PantomimeFormatMbox)
     {
         attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:[(CWLocalFolder *)_folder path] error:NULL];
-        
-        _modification_date = [[attributes objectForKey: NSFileModificationDate] timeIntervalSince1970];
-        _size = [[attributes objectForKey: NSFileSize] integerValue];
-        write_unsigned_int(_fd, _modification_date);
-        write_unsigned_int(_fd, _size);
     }
     else
     {
         attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:[NSString stringWithFormat: @"%@/cur", [(CWLocalFolder *)_folder path]] error:NULL];
-        _modification_date = [[attributes objectForKey: NSFileModificationDate] timeIntervalSince1970];
-        _size = 0;
-        write_unsigned_int(_fd, _modification_date);
     }
     
-    // We write our memory cache
-    write(_fd, buf, total_length);
+    write_unsigned_short_memory(header, version);
+    write_unsigned_int_memory(header+2, count);
+    write_unsigned_int_memory(header+6, [[attributes objectForKey: NSFileModificationDate] timeIntervalSince1970]);
+    write_unsigned_int_memory(header+10, (type == PantomimeFormatMbox ? [[attributes objectForKey: NSFileSize] integerValue] : 0));
     
-    //ftruncate(_fd, _size);
-    ftruncate(_fd, cache_size);
-    free(buf);
+    result = (result && lseek(fd, 0L, SEEK_SET) >= 0 && write_block(fd, header, header_size) >= 0 &&
+              fsync(fd) == 0 && rename([aPath UTF8String], [[self path] UTF8String]) == 0);
+    
+    if (!result)
+    {
+        NSLog(@"UNABLE TO REWRITE THE CACHE");
+        close(fd);
+        unlink([aPath UTF8String]);
+        return;
+    }
+    
+    close(_fd);
+    _fd = fd;
+    _count = count;
+    _modification_date = read_unsigned_int_memory(header+6);
+    _size = read_unsigned_int_memory(header+10);
     
     //NSLog(@"Done!");
 }
 
+
+//
+// If we fail, the header would count records we don't have: the
+// cache is dropped, it's rebuilt from the mailbox when opened.
+//
+- (BOOL) _flushRecords
+{
+    BOOL result;
+    
+    if (!_writer)
+    {
+        return YES;
+    }
+    
+    result = [_writer flush];
+    _writer = nil;
+    
+    if (!result)
+    {
+        NSLog(@"UNABLE TO WRITE THE CACHE RECORDS");
+        ftruncate(_fd, 0);
+        _count = 0;
+    }
+    
+    return result;
+}
+
 @end
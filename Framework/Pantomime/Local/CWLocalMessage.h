@@ -35,6 +35,8 @@
     NSString *_mailFilename;     // Name of file in which the message is stored (if using maildir)
     NSInteger _type;	                 // PantomimeFormatMbox or PantomimeFormatMaildir
     NSUInteger _file_position;
+    NSData *_cachedRecord;       // Cache record holding the headers not decoded yet
+    NSUInteger _cachedRecordOffset;
 }
 
 /*!
@@ -89,5 +91,17 @@
 */
 - (void) setMailFilename: (NSString *) theFilename;
 
+/*!
+  @method setCachedRecord: offset:
+  @discussion This method is used by CWLocalCacheManager to keep the cache
+              record of the receiver, whose headers are decoded when they
+	      are first accessed. See CWMessage: -setCachedHeaders:.
+  @param theRecord The record, nil to forget it.
+  @param theOffset The position of the first cached header in the record.
+                   The headers follow each other in the order of the
+		   PantomimeCachedHeader values, each prefixed by its length.
+*/
+- (void) setCachedRecord: (NSData *) theRecord  offset: (NSUInteger) theOffset;
+
 @end
 
@@ -27,6 +27,7 @@
 #import "CWLocalFolder.h"
 #import "CWLocalStore.h"
 #import "CWMIMEUtility.h"
+#import "CWParser.h"
 #import "NSData+CWExtensions.h"
 
 
@@ -44,6 +45,8 @@ static NSInteger currentLocalMessageVersion = 1;
 
   _mailFilename = nil;
   _file_position = 0;
+  _cachedRecord = nil;
+  _cachedRecordOffset = 0;
 
   return self;
 }
@@ -127,6 +130,60 @@ static NSInteger currentLocalMessageVersion = 1;
   ASSIGN(_mailFilename, theFilename);
 }
 
+
+//
+//
+//
+- (void) setCachedRecord: (NSData *) theRecord  offset: (NSUInteger) theOffset
+{
+  _cachedRecord = theRecord;
+  _cachedRecordOffset = theOffset;
+}
+
+
+//
+// We walk the headers of our cache record, parsing the requested
+// ones. The record is released once they are all decoded.
+//
+- (void) readCachedHeaders: (NSUInteger) theHeaders
+{
+  unsigned char *bytes, *p, *end;
+  unsigned short len;
+  NSUInteger aHeader;
+
+  if (!_cachedRecord)
+    {
+      return;
+    }
+
+  bytes = (unsigned char *)[_cachedRecord bytes];
+  end = bytes + [_cachedRecord length];
+
+  for (p = bytes + _cachedRecordOffset, aHeader = PantomimeCachedFrom; aHeader <= PantomimeCachedCc && p + 2 <= end; aHeader <<= 1)
+    {
+      len = read_unsigned_short_memory(p);
+      
+      if (p + 2 + len > end)
+	{
+	  break;
+	}
+      
+      if (theHeaders & aHeader)
+	{
+	  [CWParser parseCachedHeader: aHeader
+		    data: [NSData dataWithBytesNoCopy: p+2  length: len  freeWhenDone: NO]
+		    inMessage: self];
+	}
+      
+      p += 2 + len;
+    }
+
+  if (![self cachedHeaders])
+    {
+      _cachedRecord = nil;
+    }
+}
+
 //
 //
 //
@@ -22,6 +22,7 @@
 
 #import "CWCacheManager.h"
 
+@class CWCacheWriter;
 @class CWPOP3CacheObject;
 @class CWCacheRecord;
 
@@ -39,6 +40,8 @@
     NSMutableDictionary *_messageTable;
     NSUInteger _count;
     NSInteger _fd;
+    CWCacheWriter *_writer;
+    NSUInteger _pendingCount;
 }
 
 /*!
@@ -56,6 +59,8 @@
 /*!
   @method writeRecord:
   @discussion This method is used to write a cache record to disk.
+              Records are written in batches, see CWCacheWriter. A
+	      batch is written once it's large enough or by -synchronize.
   @param theRecord The record to write.
 */
 - (void) writeRecord:(CWCacheRecord *)theRecord;
@@ -23,6 +23,7 @@
 #import "CWPOP3CacheManager.h"
 
 #import "CWCacheRecord.h"
+#import "CWCacheWriter.h"
 #import "CWConstants.h"
 #import "CWPOP3CacheObject.h"
 
@@ -43,6 +44,7 @@ static unsigned short version = 1;
 //
 @interface CWPOP3CacheManager (Private)
 - (void) _convertOldCacheFromFile: (NSString *) theFile;
+- (BOOL) _flushRecords;
 @end
 
 @implementation CWPOP3CacheManager (Private)
@@ -78,6 +80,35 @@ static unsigned short version = 1;
     }
 }
 
+
+//
+// If we fail, the records of the batch are dropped. The header
+// is written by -synchronize and only counts those we have.
+//
+- (BOOL) _flushRecords
+{
+    BOOL result;
+    
+    if (!_writer)
+    {
+        return YES;
+    }
+    
+    result = [_writer flush];
+    
+    if (!result)
+    {
+        NSLog(@"UNABLE TO WRITE THE CACHE RECORDS");
+        ftruncate(_fd, [_writer offset]);
+        _count -= _pendingCount;
+    }
+    
+    _writer = nil;
+    _pendingCount = 0;
+    
+    return result;
+}
+
 @end
 
 
@@ -95,18 +126,19 @@ static unsigned short version = 1;
         unsigned short int v;
         
         _messageTable = [[NSMutableDictionary alloc] init];
-        _count = 0;
+        _count = _pendingCount = 0;
         
+        // Without its file, the folder is used without a cache.
         if ((_fd = open([thePath UTF8String], O_RDWR|O_CREAT, S_IRUSR|S_IWUSR)) < 0)
         {
             NSLog(@"CANNOT CREATE OR OPEN THE CACHE!)");
-            abort();
+            return nil;
         }
         
         if (lseek(_fd, 0L, SEEK_SET) < 0)
         {
             NSLog(@"UNABLE TO LSEEK INITIAL");
-            abort();
+            return nil;
         }
         
         attributes = [[NSFileManager defaultManager] fileAttributesAtPath: thePath  traverseLink: NO];
@@ -117,11 +149,18 @@ static unsigned short version = 1;
             NSString *aUID;
             NSDate *aDate;
             
+            unsigned int count, date;
             unsigned short len;
             char *s;
             NSInteger i;
             
-            v = read_unsigned_short(_fd);
+            // A cache too short for its header is dropped.
+            if (read_unsigned_short(_fd, &v) < 0 || (v == version && read_unsigned_int(_fd, &count) < 0))
+            {
+                ftruncate(_fd, 0);
+                [self synchronize];
+                return self;
+            }
             
             // HACK: We CONVERT all the previous cache.
             if (v != version)
@@ -131,23 +170,36 @@ static unsigned short version = 1;
                 return self;
             }
             
-            _count = read_unsigned_int(_fd);
+            //NSLog(@"Init with count = %d  version = %d", count, v);
             
-            //NSLog(@"Init with count = %d  version = %d", _count, v);
+            // A string is at most 65535 bytes long.
+            s = (char *)malloc(65536);
             
-            s = (char *)malloc(4096);
-            
-            for (i = 0; i < _count; i++)
+            for (i = 0; i < count; i++)
             {
-                aDate = [NSCalendarDate dateWithTimeIntervalSince1970: read_unsigned_int(_fd)];
-                read_string(_fd, s, &len);	  
+                if (read_unsigned_int(_fd, &date) < 0 || read_string(_fd, s, &len) < 0)
+                {
+                    break;
+                }
                 
+                aDate = [NSCalendarDate dateWithTimeIntervalSince1970: date];
                 aUID = [[NSString alloc] initWithData: [NSData dataWithBytes: s  length: len]
                                              encoding: NSASCIIStringEncoding];
                 [_messageTable setObject:aDate forKey:aUID];
             }
             
             free(s);
+            
+            // The records we can't read are dropped, with the header counting them.
+            if (i < count)
+            {
+                [_messageTable removeAllObjects];
+                ftruncate(_fd, 0);
+                [self synchronize];
+                return self;
+            }
+            
+            _count = count;
         }
         else
         {
@@ -165,6 +217,7 @@ static unsigned short version = 1;
 {
   if (_fd >= 0)
   {
+      [self _flushRecords];
       close(_fd);
   }
 }
@@ -205,18 +258,22 @@ static unsigned short version = 1;
 //
 - (BOOL) synchronize
 {
-    if (lseek(_fd, 0L, SEEK_SET) < 0)
+    unsigned char header[6];
+    BOOL result;
+    
+    result = [self _flushRecords];
+    
+    // We write our cache version, count and UID validity.
+    write_unsigned_short_memory(header, version);
+    write_unsigned_int_memory(header+2, _count);
+    
+    if (pwrite(_fd, header, 6, 0) != 6)
     {
-        NSLog(@"fseek failed");
-        abort();
+        NSLog(@"UNABLE TO WRITE THE CACHE HEADER");
         return NO;
     }
     
-    // We write our cache version, count and UID validity.
-    write_unsigned_short(_fd, version);
-    write_unsigned_int(_fd, _count);
-    
-    return (fsync(_fd) == 0);
+    return (fsync(_fd) == 0 && result);
 }
 
 //
@@ -225,6 +282,7 @@ static unsigned short version = 1;
 - (void) writeRecord: (CWCacheRecord *) theRecord
 {
     NSData *aData;
+    off_t offset;
     
     // We do NOT write a record we already have in our cache.
     // Some POP3 servers, like popa3d, might return the same UID
@@ -235,20 +293,31 @@ static unsigned short version = 1;
         return;
     }
     
-    if (lseek(_fd, 0L, SEEK_END) < 0)
+    if (!_writer)
     {
-        NSLog(@"COULD NOT LSEEK TO END OF FILE");
-        abort();
+        if ((offset = lseek(_fd, 0L, SEEK_END)) < 0)
+        {
+            NSLog(@"COULD NOT LSEEK TO END OF FILE");
+            return;
+        }
+        
+        _writer = [[CWCacheWriter alloc] initWithFileDescriptor: _fd  offset: offset];
     }
     
-    write_unsigned_int(_fd, theRecord.date);
+    [_writer appendUnsignedInt: theRecord.date];
     
     aData = [theRecord.pop3_uid dataUsingEncoding: NSASCIIStringEncoding];
-    write_string(_fd, (unsigned char *)[aData bytes], [aData length]);
+    [_writer appendString: [aData bytes]  length: [aData length]];
     
     
     [_messageTable setObject:[NSCalendarDate dateWithTimeIntervalSince1970:theRecord.date] forKey:theRecord.pop3_uid];
     _count++;
+    _pendingCount++;
+    
+    if ([_writer isFull])
+    {
+        [self _flushRecords];
+    }
 }
 
 @end
@@ -379,7 +379,7 @@ static NSData *CRLF;
 
   [super updateRead];
 
-  while ((aData = split_lines(_rbuf)))
+  while ((aData = [_rbuf nextLineData]))
     {
       buf = (char *)[aData bytes];
       count = [aData length];
@@ -517,7 +517,7 @@ static NSData *CRLF;
     }
     
     // We send the command to the POP3 server.
-    [self writeData: [aQueueObject->arguments dataUsingEncoding: defaultCStringEncoding]];
+    [_wbuf appendData: [aQueueObject->arguments dataUsingEncoding: defaultCStringEncoding]];
     [self writeData: CRLF];
 }
 
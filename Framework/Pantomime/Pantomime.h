@@ -26,6 +26,7 @@
 #import <Foundation/Foundation.h>
 
 #include "CWCacheManager.h"
+#include "CWCacheWriter.h"
 #include "CWCharset.h"
 #include "CWConstants.h"
 #include "CWContainer.h"
@@ -34,10 +35,17 @@
 #include "CWFlags.h"
 #include "CWFolder.h"
 #include "CWFolderInformation.h"
+#include "CWIMAPAppendStream.h"
+#include "CWIMAPBodyStore.h"
 #include "CWIMAPCacheManager.h"
 #include "CWIMAPFolder.h"
+#include "CWIMAPLiteralSink.h"
 #include "CWIMAPMessage.h"
+#include "CWIMAPPart.h"
+#include "CWIMAPSequenceSet.h"
 #include "CWIMAPStore.h"
+#include "CWIMAPTokenizer.h"
+#include "CWIMAPUIDIndex.h"
 #include "CWInternetAddress.h"
 #include "CWISO8859_1.h"
 #include "CWISO8859_10.h"
@@ -78,9 +86,12 @@
 #include "CWPOP3Folder.h"
 #include "CWPOP3Message.h"
 #include "CWPOP3Store.h"
+#include "CWReactor.h"
+#include "CWReadBuffer.h"
 #include "CWSendmail.h"
 #include "CWService.h"
 #include "CWSMTP.h"
+#include "CWSocketConnection.h"
 #include "CWStore.h"
 #include "CWTCPConnection.h"
 #include "CWTransport.h"
@@ -91,5 +102,6 @@
 #include "CWWINDOWS_1252.h"
 #include "CWWINDOWS_1253.h"
 #include "CWWINDOWS_1254.h"
+#include "CWWriteQueue.h"
 
 #endif // _Pantomime_H_Pantomime
@@ -34,6 +34,7 @@
 
 #include <sys/uio.h>	// For read() and write() on OS X
 #include <stdlib.h>
+#include <time.h>	// For clock_gettime()
 
 
 //
@@ -52,6 +53,37 @@ ssize_t read_block(int fd, void *buf, size_t count)
                 return -1;
             }
         }
+        else if (bytes == 0)
+        {
+            // The end of the file, we return what we have.
+            break;
+        }
+        else
+        {
+            tot += bytes;
+        }
+    }
+    
+    return tot;
+}
+
+
+//
+//
+//
+ssize_t write_block(int fd, const void *buf, size_t count)
+{
+    ssize_t tot = 0, bytes = 0;
+    
+    while (tot < count)
+    {
+        if ((bytes = write(fd, buf+tot, count-tot)) == -1)
+        {
+            if (errno != EINTR)
+            {
+                return -1;
+            }
+        }
         else
         {
             tot += bytes;
@@ -142,13 +174,63 @@ unsigned int read_unsigned_int_memory(unsigned char *m)
 //
 //
 //
-unsigned short read_unsigned_short(int fd)
+unsigned short read_unsigned_short_memory(unsigned char *m)
+{
+  return (unsigned short)((m[0] << 8) | m[1]);
+}
+
+//
+//
+//
+unsigned long long read_unsigned_long_long_memory(unsigned char *m)
+{
+  return (((unsigned long long)read_unsigned_int_memory(m)) << 32) | read_unsigned_int_memory(m+4);
+}
+
+//
+//
+//
+void write_unsigned_short_memory(unsigned char *m, unsigned short value)
+{
+  m[0] = (unsigned char)(value >> 8);
+  m[1] = (unsigned char)value;
+}
+
+//
+//
+//
+void write_unsigned_int_memory(unsigned char *m, unsigned int value)
+{
+  m[0] = (unsigned char)(value >> 24);
+  m[1] = (unsigned char)(value >> 16);
+  m[2] = (unsigned char)(value >> 8);
+  m[3] = (unsigned char)value;
+}
+
+//
+//
+//
+void write_unsigned_long_long_memory(unsigned char *m, unsigned long long value)
+{
+  write_unsigned_int_memory(m, (unsigned int)(value >> 32));
+  write_unsigned_int_memory(m+4, (unsigned int)(value & 0xffffffff));
+}
+
+//
+//
+//
+int read_unsigned_short(int fd, unsigned short *value)
 {
   unsigned short v;
   
-  if (read(fd, &v, 2) != 2) abort();
+  if (read_block(fd, &v, 2) != 2)
+    {
+      return -1;
+    }
+
+  *value = ntohs(v);
 
-  return ntohs(v);
+  return 0;
 }
 
 //
@@ -170,14 +252,21 @@ void write_unsigned_short(int fd, unsigned short value)
 //
 //
 //
-void read_string(int fd, char *buf, unsigned short int *count)
+int read_string(int fd, char *buf, unsigned short int *count)
 {
-  *count = read_unsigned_short(fd);
+  if (read_unsigned_short(fd, count) < 0)
+    {
+      *count = 0;
+      return -1;
+    }
   
-  if (*count)
+  if (*count && read_block(fd, buf, *count) != *count)
     {
-      read(fd, buf, *count);
+      *count = 0;
+      return -1;
     }
+
+  return 0;
 }
 
 //
@@ -203,15 +292,18 @@ void write_string(int fd, unsigned char *s, unsigned short len)
 //
 //
 //
-unsigned int read_unsigned_int(int fd)
+int read_unsigned_int(int fd, unsigned int *value)
 {
   unsigned int v;
-  //int v;
-  int c;
   
-  if ((c = read(fd, &v, 4)) != 4) { printf("read = %d\n", c); }
+  if (read_block(fd, &v, 4) != 4)
+    {
+      return -1;
+    }
+
+  *value = ntohl(v);
 
-  return ntohl(v);
+  return 0;
 }
 
 //
@@ -231,3 +323,41 @@ void write_unsigned_int(int fd, unsigned int value)
       abort();
     }
 }
+
+//
+//
+//
+int read_unsigned_long_long(int fd, unsigned long long *value)
+{
+  unsigned int high, low;
+
+  if (read_unsigned_int(fd, &high) < 0 || read_unsigned_int(fd, &low) < 0)
+    {
+      return -1;
+    }
+
+  *value = (((unsigned long long)high) << 32) | low;
+
+  return 0;
+}
+
+//
+//
+//
+void write_unsigned_long_long(int fd, unsigned long long value)
+{
+  write_unsigned_int(fd, (unsigned int)(value >> 32));
+  write_unsigned_int(fd, (unsigned int)(value & 0xffffffff));
+}
+
+//
+//
+//
+double monotonic_time(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
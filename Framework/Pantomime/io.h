@@ -29,15 +29,29 @@
   @function read_block
   @discussion This function is used to read <i>count</i> bytes
               from <i>fd</i> and store them in <i>buf</i>. This
-	      method blocks until it read all bytes or if
-	      an error different from EINTR occurs.
+	      method blocks until it read all bytes, reaches the
+	      end of the file or an error different from EINTR occurs.
   @param fd The file descriptor to read bytes from.
   @param buf The buffer where to store the read bytes.
   @param count The number of bytes to read.
-  @result The number of bytes that have been read.
+  @result The number of bytes that have been read, fewer than
+          <i>count</i> at the end of the file, -1 on error.
 */
 ssize_t read_block(int fd, void *buf, size_t count);
 
+/*!
+  @function write_block
+  @discussion This function is used to write <i>count</i> bytes
+              from <i>buf</i> to <i>fd</i>. This method blocks
+	      until it wrote all bytes or if an error different
+	      from EINTR occurs.
+  @param fd The file descriptor to write bytes to.
+  @param buf The bytes to write.
+  @param count The number of bytes to write.
+  @result The number of bytes that have been written, -1 on error.
+*/
+ssize_t write_block(int fd, const void *buf, size_t count);
+
 /*!
   @function safe_close
   @discussion This function is used to safely close a file descriptor.
@@ -97,14 +111,64 @@ void read_string_memory(unsigned char *m, unsigned char *buf, unsigned short int
 */
 unsigned int read_unsigned_int_memory(unsigned char *m);
 
+/*!
+  @function read_unsigned_short_memory
+  @discussion This function is used to read an unsigned short from
+              the memory in network byte-order.
+  @param m The buffer to read from.
+  @result The unsigned short read from memory.
+*/
+unsigned short read_unsigned_short_memory(unsigned char *m);
+
+/*!
+  @function read_unsigned_long_long_memory
+  @discussion This function is used to read an unsigned long long,
+              written by write_unsigned_long_long_memory(), from
+	      the memory.
+  @param m The buffer to read from.
+  @result The unsigned long long read from memory.
+*/
+unsigned long long read_unsigned_long_long_memory(unsigned char *m);
+
+/*!
+  @function write_unsigned_short_memory
+  @discussion This function is used to write the specified
+              unsigned short <i>value</i> to the memory in network
+	      byte-order.
+  @param m The buffer to write to.
+  @param value The unsigned value to write.
+*/
+void write_unsigned_short_memory(unsigned char *m, unsigned short value);
+
+/*!
+  @function write_unsigned_int_memory
+  @discussion This function is used to write the specified
+              unsigned int <i>value</i> to the memory in network
+	      byte-order.
+  @param m The buffer to write to.
+  @param value The unsigned value to write.
+*/
+void write_unsigned_int_memory(unsigned char *m, unsigned int value);
+
+/*!
+  @function write_unsigned_long_long_memory
+  @discussion This function is used to write the specified
+              unsigned long long <i>value</i> to the memory, like
+	      write_unsigned_long_long() does to a file descriptor.
+  @param m The buffer to write to.
+  @param value The unsigned value to write.
+*/
+void write_unsigned_long_long_memory(unsigned char *m, unsigned long long value);
+
 /*!
   @function read_unsigned_short
   @discussion This function is used to read an unsigned short from
               the file descriptor in network byte-order.
   @param fd The file descriptor to read from.
-  @result The unsigned short read from the file descriptor.
+  @param value The unsigned short read from the file descriptor.
+  @result 0 on success, -1 on error or if the file is too short.
 */
-unsigned short read_unsigned_short(int fd);
+int read_unsigned_short(int fd, unsigned short *value);
 
 /*!
   @function write_unsigned_short
@@ -124,8 +188,9 @@ void write_unsigned_short(int fd, unsigned short value);
   @param fd The file descriptor to read from.
   @param buf The buf to write to.
   @param count The number of bytes that have been read.
+  @result 0 on success, -1 on error or if the file is too short.
 */
-void read_string(int fd, char *buf, unsigned short int *count);
+int read_string(int fd, char *buf, unsigned short int *count);
 
 /*!
   @function write_string
@@ -142,9 +207,10 @@ void write_string(int fd, unsigned char *s, unsigned short len);
   @discussion This function is used to read an unsigned int from
               the file descriptor in network byte-order.
   @param fd The file descriptor to read from.
-  @result The unsigned int read from the file descriptor.
+  @param value The unsigned int read from the file descriptor.
+  @result 0 on success, -1 on error or if the file is too short.
 */
-unsigned int read_unsigned_int(int fd);
+int read_unsigned_int(int fd, unsigned int *value);
 
 /*!
   @function write_unsigned_int
@@ -156,4 +222,35 @@ unsigned int read_unsigned_int(int fd);
 */
 void write_unsigned_int(int fd, unsigned int value);
 
+/*!
+  @function read_unsigned_long_long
+  @discussion This function is used to read an unsigned long long,
+              written by write_unsigned_long_long(), from the file
+	      descriptor.
+  @param fd The file descriptor to read from.
+  @param value The unsigned long long read from the file descriptor.
+  @result 0 on success, -1 on error or if the file is too short.
+*/
+int read_unsigned_long_long(int fd, unsigned long long *value);
+
+/*!
+  @function write_unsigned_long_long
+  @discussion This function is used to write the specified
+              unsigned long long <i>value</i> to the file descriptor
+	      </i>fd</i>, as two unsigned int in network byte-order,
+	      the most significant one first.
+  @param fd The file descriptor to write to.
+  @param value The unsigned value to write.
+*/
+void write_unsigned_long_long(int fd, unsigned long long value);
+
+/*!
+  @function monotonic_time
+  @discussion This function is used to obtain the current time from
+              a clock that is not affected by changes of the system
+	      time. It is used to compute network timeouts.
+  @result The time in seconds, with sub-second precision.
+*/
+double monotonic_time(void);
+
 #endif //  _Pantomime_H_io